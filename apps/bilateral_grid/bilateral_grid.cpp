@@ -81,12 +81,13 @@ int main(int argc, char **argv) {
     } else {
 
         // CPU schedule
+        int vector_width = target.natural_vector_size(Float(32));
         histogram.compute_at(blurz, y);
         histogram.update().reorder(c, r.x, r.y, x, y).unroll(c);
-        blurz.compute_root().reorder(c, z, x, y).parallel(y).vectorize(x, 4).unroll(c);
-        blurx.compute_root().reorder(c, x, y, z).parallel(z).vectorize(x, 4).unroll(c);
-        blury.compute_root().reorder(c, x, y, z).parallel(z).vectorize(x, 4).unroll(c);
-        bilateral_grid.compute_root().parallel(y).vectorize(x, 4);
+        blurz.compute_root().reorder(c, z, x, y).parallel(y).vectorize(x, vector_width).unroll(c);
+        blurx.compute_root().reorder(c, x, y, z).parallel(z).vectorize(x, vector_width).unroll(c);
+        blury.compute_root().reorder(c, x, y, z).parallel(z).vectorize(x, vector_width).unroll(c);
+        bilateral_grid.compute_root().parallel(y).vectorize(x, vector_width);
     }
 
     bilateral_grid.compile_to_file("bilateral_grid", r_sigma, input, target);
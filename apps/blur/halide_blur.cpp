@@ -12,10 +12,12 @@ int main(int argc, char **argv) {
     blur_y(x, y) = (blur_x(x, y) + blur_x(x, y+1) + blur_x(x, y+2))/3;
     
     // How to schedule it
-    blur_y.split(y, y, yi, 8).parallel(y).vectorize(x, 8);
-    blur_x.store_at(blur_y, y).compute_at(blur_y, yi).vectorize(x, 8);  
+    Target target = get_target_from_environment();
+    int vector_width = target.natural_vector_size(UInt(16));
+    blur_y.split(y, y, yi, 8).parallel(y).vectorize(x, vector_width);
+    blur_x.store_at(blur_y, y).compute_at(blur_y, yi).vectorize(x, vector_width);
     
-    blur_y.compile_to_file("halide_blur", input); 
+    blur_y.compile_to_file("halide_blur", input, target);
 
     return 0;
 }
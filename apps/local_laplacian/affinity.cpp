@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include "local_laplacian.h"
+#include "static_image.h"
+#include "image_io.h"
+#include <sys/time.h>
+#include "HalideRuntime.h"
+
+int main(int argc, char **argv) {
+    if (argc < 5) {
+        printf("Usage: ./affinity input.png levels alpha beta\n"
+               "e.g.: ./affinity input.png 8 1 1\n"
+               "Times local_laplacian under each thread placement policy.\n");
+        return 0;
+    }
+
+    Image<uint16_t> input = load<uint16_t>(argv[1]);
+    int levels = atoi(argv[2]);
+    float alpha = atof(argv[3]), beta = atof(argv[4]);
+    Image<uint16_t> output(input.width(), input.height(), 3);
+
+    const char *names[] = {"none", "cores", "numa"};
+    halide_thread_affinity_t policies[] = {halide_thread_affinity_none,
+                                           halide_thread_affinity_cores,
+                                           halide_thread_affinity_numa};
+    for (int p = 0; p < 3; p++) {
+        // The policy takes effect when the pool next starts up.
+        halide_shutdown_thread_pool();
+        halide_set_thread_affinity(policies[p]);
+
+        // Warm up, so that the output pages get touched by the new pool.
+        local_laplacian(levels, alpha/(levels-1), beta, input, output);
+
+        timeval t1, t2;
+        unsigned int bestT = 0xffffffff;
+        for (int i = 0; i < 10; i++) {
+            gettimeofday(&t1, NULL);
+            local_laplacian(levels, alpha/(levels-1), beta, input, output);
+            gettimeofday(&t2, NULL);
+            unsigned int t = (t2.tv_sec - t1.tv_sec) * 1000000 + (t2.tv_usec - t1.tv_usec);
+            if (t < bestT) bestT = t;
+        }
+        printf("%s: %u\n", names[p], bestT);
+    }
+
+    return 0;
+}
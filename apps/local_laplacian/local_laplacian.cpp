@@ -1,4 +1,5 @@
 #include <Halide.h>
+#include <stdlib.h>
 using namespace Halide;
 
 Var x, y;
@@ -143,6 +144,20 @@ int main(int argc, char **argv) {
             gPyramid[j].compute_root().parallel(k);
             outGPyramid[j].compute_root().parallel(y);
         }
+
+        // Optionally prefetch the rows that the strips of the large
+        // levels will read some rows from now,
+        // e.g. ./local_laplacian 2
+        int prefetch_distance = argc > 1 ? atoi(argv[1]) : 0;
+        if (prefetch_distance > 0) {
+            output.prefetch(yi, prefetch_distance);
+            gray.prefetch(yi, prefetch_distance);
+            for (int j = 0; j < 4; j++) {
+                if (j > 0) inGPyramid[j].prefetch(yi, prefetch_distance);
+                if (j > 0) gPyramid[j].prefetch(yi, prefetch_distance);
+                outGPyramid[j].prefetch(yi, prefetch_distance);
+            }
+        }
     }
 
     output.compile_to_file("local_laplacian", levels, alpha, beta, input, target);
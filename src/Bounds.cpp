@@ -834,6 +834,108 @@ private:
         scope.pop(op->name);
     }
 
+    // Narrow the bounds in a scope of the variables that a condition
+    // constrains, given that the condition takes the given value. The
+    // narrowed bounds always keep at least one point of the original
+    // ones, so that they are never empty.
+    void narrow_scope(Expr cond, bool value, Scope<Interval> &s) {
+        if (const Not *n = cond.as<Not>()) {
+            narrow_scope(n->a, !value, s);
+            return;
+        } else if (const And *a = cond.as<And>()) {
+            if (value) {
+                narrow_scope(a->a, true, s);
+                narrow_scope(a->b, true, s);
+            }
+            return;
+        } else if (const Or *o = cond.as<Or>()) {
+            if (!value) {
+                narrow_scope(o->a, false, s);
+                narrow_scope(o->b, false, s);
+            }
+            return;
+        }
+
+        // Normalize to a <= b.
+        Expr a, b;
+        if (const LT *lt = cond.as<LT>()) {
+            a = lt->a; b = lt->b - 1;
+        } else if (const LE *le = cond.as<LE>()) {
+            a = le->a; b = le->b;
+        } else if (const GT *gt = cond.as<GT>()) {
+            a = gt->b; b = gt->a - 1;
+        } else if (const GE *ge = cond.as<GE>()) {
+            a = ge->b; b = ge->a;
+        } else {
+            return;
+        }
+        if (a.type() != Int(32)) return;
+        if (!value) {
+            // The negation of a <= b is b + 1 <= a.
+            Expr t = a;
+            a = b + 1;
+            b = t;
+        }
+
+        if (const Variable *var = a.as<Variable>()) {
+            if (s.contains(var->name)) {
+                Interval i = s.get(var->name);
+                Expr limit = bounds_of_expr_in_scope(b, s).max;
+                if (limit.defined()) {
+                    if (i.max.defined()) limit = Min::make(i.max, limit);
+                    if (i.min.defined()) limit = Max::make(limit, i.min);
+                    i.max = limit;
+                    s.push(var->name, i);
+                }
+            }
+        }
+        if (const Variable *var = b.as<Variable>()) {
+            if (s.contains(var->name)) {
+                Interval i = s.get(var->name);
+                Expr limit = bounds_of_expr_in_scope(a, s).min;
+                if (limit.defined()) {
+                    if (i.min.defined()) limit = Max::make(i.min, limit);
+                    if (i.max.defined()) limit = Min::make(limit, i.max);
+                    i.min = limit;
+                    s.push(var->name, i);
+                }
+            }
+        }
+    }
+
+    void visit(const IfThenElse *op) {
+        op->condition.accept(this);
+
+        // Each case only runs for the values of the variables that
+        // make the condition go its way. Splits that guard their
+        // tails with an if rely on this to not touch anything beyond
+        // the end of the region being computed. Unlike the two sides
+        // of a Select, which are both evaluated, only one case
+        // actually runs, so this is safe. Visit the cases with their
+        // own visitors, so that a node shared with the rest of the
+        // statement also gets visited under the full bounds.
+        Scope<Interval> then_scope = scope;
+        narrow_scope(op->condition, true, then_scope);
+        BoxesTouched then_boxes(consider_calls, consider_provides, func, then_scope);
+        op->then_case.accept(&then_boxes);
+        merge_all(then_boxes.boxes);
+
+        if (op->else_case.defined()) {
+            Scope<Interval> else_scope = scope;
+            narrow_scope(op->condition, false, else_scope);
+            BoxesTouched else_boxes(consider_calls, consider_provides, func, else_scope);
+            op->else_case.accept(&else_boxes);
+            merge_all(else_boxes.boxes);
+        }
+    }
+
+    void merge_all(const map<string, Box> &other) {
+        for (map<string, Box>::const_iterator iter = other.begin();
+             iter != other.end(); ++iter) {
+            merge_boxes(boxes[iter->first], iter->second);
+        }
+    }
+
     void visit(const Provide *op) {
         if (consider_provides) {
             if (op->name == func || func.empty()) {
@@ -4,6 +4,7 @@
 #include "Substitute.h"
 #include "CSE.h"
 #include "IRPrinter.h"
+#include "IROperator.h"
 #include "Debug.h"
 #include "IREquality.h"
 #include "Scope.h"
@@ -106,48 +107,56 @@ Stmt remove_lets(Stmt s) {
     return RemoveLets().mutate(s);
 }
 
-struct ReplaceExpr : public IRMutator {
-    using IRMutator::mutate;
+// Count the number of times each node in a graph is used by the nodes
+// above it. After remove_lets, equal sub-expressions are the same node,
+// so a node used more than once is a common sub-expression.
+class CountUses : public IRGraphVisitor {
+public:
+    map<const IRNode *, int> uses;
 
-    map<Expr, Expr, ExprCompare> mutated;
+    using IRGraphVisitor::include;
 
-    Expr mutate(Expr e) {
-        map<Expr, Expr, ExprCompare>::iterator iter = mutated.find(e);
-        if (iter != mutated.end()) {
-            return iter->second;
-        } else {
-            Expr new_expr = IRMutator::mutate(e);
-            mutated[e] = new_expr;
-            return new_expr;
+    void include(const Expr &e) {
+        int &count = uses[e.ptr];
+        count++;
+        if (count == 1) {
+            e.accept(this);
         }
     }
 };
 
-Expr replace_expr(Expr e, Expr old_expr, Expr replacement) {
-    ReplaceExpr r;
-    r.mutated[old_expr] = replacement;
-    return r.mutate(e);
-}
+// Replace each node used more than once with a variable, and record
+// the lets that define them. Children are visited before their
+// parents, so each let only refers to the ones before it.
+class HoistCommonSubexpressions : public IRMutator {
+    const map<const IRNode *, int> &uses;
+    map<const IRNode *, Expr> replacements;
 
-struct FindOneCommonSubexpression : public IRGraphVisitor {
-    Expr result;
+public:
+    vector<pair<string, Expr> > lets;
 
-    using IRGraphVisitor::include;
+    HoistCommonSubexpressions(const map<const IRNode *, int> &u) : uses(u) {}
 
-    void include(const Expr &e) {
-        if (result.defined()) return;
+    using IRMutator::mutate;
 
-        set<const IRNode *>::iterator iter = visited.find(e.ptr);
+    Expr mutate(Expr e) {
+        map<const IRNode *, Expr>::iterator iter = replacements.find(e.ptr);
+        if (iter != replacements.end()) {
+            return iter->second;
+        }
 
-        if (iter != visited.end()) {
-            if (e.as<IntImm>() || e.as<FloatImm>() || e.as<Variable>() || e.as<Cast>()) {
-                return;
-            }
-            result = e;
-        } else {
-            e.accept(this);
-            visited.insert(e.ptr);
+        Expr new_expr = IRMutator::mutate(e);
+
+        map<const IRNode *, int>::const_iterator count = uses.find(e.ptr);
+        bool trivial = e.as<IntImm>() || e.as<FloatImm>() || e.as<Variable>() || e.as<Cast>();
+        if (!trivial && count != uses.end() && count->second > 1) {
+            string name = unique_name('t');
+            lets.push_back(make_pair(name, new_expr));
+            new_expr = Variable::make(new_expr.type(), name);
         }
+
+        replacements[e.ptr] = new_expr;
+        return new_expr;
     }
 };
 
@@ -159,22 +168,16 @@ Expr common_subexpression_elimination(Expr e) {
 
     // debug(0) << "Deletified letify " << e << "\n";
 
-    vector<pair<string, Expr> > lets;
-
-    while (1) {
-        FindOneCommonSubexpression finder;
-        finder.include(e);
-        if (!finder.result.defined()) break;
-
-        // debug(0) << "\nHoisting out " << finder.result << " from " << e << "\n";
-
-        string name = unique_name('t');
+    // Hoist out every common sub-expression in one pass over the
+    // graph. Finding and replacing them one at a time is quadratic in
+    // the size of the expression, which made this the most expensive
+    // part of lowering large pipelines.
+    CountUses counter;
+    counter.include(e);
 
-        lets.push_back(make_pair(name, finder.result));
-
-        e = replace_expr(e, finder.result, Variable::make(finder.result.type(), name));
-        // debug(0) << "Result: " << e << "\n";
-    }
+    HoistCommonSubexpressions hoister(counter.uses);
+    e = hoister.mutate(e);
+    const vector<pair<string, Expr> > &lets = hoister.lets;
 
     for (size_t i = lets.size(); i > 0; i--) {
         e = Let::make(lets[i-1].first, lets[i-1].second, e);
@@ -198,5 +201,66 @@ Stmt common_subexpression_elimination(Stmt s) {
     return LetifyStmt().mutate(s);
 }
 
+namespace {
+
+// Count the lets wrapped around an expression.
+int count_lets(Expr e) {
+    int n = 0;
+    while (const Let *let = e.as<Let>()) {
+        e = let->body;
+        n++;
+    }
+    return n;
+}
+
+// Make a graph in which each level uses the one below it three
+// times. As a tree it has more than 2^levels nodes.
+Expr shared_dag(int levels) {
+    Expr x = Variable::make(Int(32), "x");
+    Expr y = Variable::make(Int(32), "y");
+    Expr e = x;
+    for (int i = 0; i < levels; i++) {
+        e = e * e + (e - y);
+    }
+    return e;
+}
+
+}
+
+void cse_test() {
+    // Removing the lets again gives back the input.
+    for (int levels = 1; levels < 12; levels++) {
+        Expr e = shared_dag(levels);
+        Expr result = common_subexpression_elimination(e);
+        if (!equal(remove_lets(result), e)) {
+            std::cout << "CSE of " << e << " gave " << result
+                      << ", which is not equivalent\n";
+            assert(false);
+        }
+        // Every level but the top one and the bare variable gets a let.
+        if (count_lets(result) != levels - 1) {
+            std::cout << "CSE of " << e << " gave " << result
+                      << ", which has " << count_lets(result)
+                      << " lets instead of " << levels - 1 << "\n";
+            assert(false);
+        }
+    }
+
+    // On a graph far too large to walk as a tree, the result is
+    // linear in the number of levels.
+    const int levels = 200;
+    Expr result = common_subexpression_elimination(shared_dag(levels));
+    std::ostringstream printed;
+    printed << result;
+    if (count_lets(result) != levels - 1 || printed.str().size() > (size_t)(100 * levels)) {
+        std::cout << "CSE of a graph with " << levels << " levels gave "
+                  << count_lets(result) << " lets and "
+                  << printed.str().size() << " characters\n";
+        assert(false);
+    }
+
+    std::cout << "CSE test passed" << std::endl;
+}
+
 }
 }
@@ -35,6 +35,8 @@ Expr remove_lets(Expr);
 Stmt remove_lets(Stmt);
 // @}
 
+void cse_test();
+
 }
 }
 
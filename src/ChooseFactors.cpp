@@ -0,0 +1,230 @@
+#include "ChooseFactors.h"
+#include "IRVisitor.h"
+#include "Scope.h"
+#include "Debug.h"
+#include "Util.h"
+#include <algorithm>
+
+namespace Halide {
+namespace Internal {
+
+using std::vector;
+
+namespace {
+
+// The number of vector registers the target has to work with
+int vector_registers(const Target &t) {
+    if (t.arch == Target::ARM) {
+        return t.bits == 64 ? 32 : 16;
+    } else if (t.features & Target::AVX512) {
+        return 32;
+    } else {
+        return t.bits == 32 ? 8 : 16;
+    }
+}
+
+// The number of vector registers it takes to hold one value of the
+// given type vectorized by the given factor. Some targets only have
+// full-width registers for some types (e.g. avx only has 256-bit
+// float ops), so the width depends on the type.
+int registers(Type t, int factor, const Target &target) {
+    int element_bits = std::max(t.bits, 8);
+    int register_bits = target.natural_vector_size(t) * element_bits;
+    return std::max(1, (element_bits * factor + register_bits - 1) / register_bits);
+}
+
+// Find the narrowest and widest types computed with or loaded in an
+// expression, and whether they're all floats. Bools take up a byte.
+class FindTypes : public IRGraphVisitor {
+    using IRGraphVisitor::visit;
+
+    void include_type(Type t) {
+        if (t.is_handle()) return;
+        int bits = std::max(t.bits, 8);
+        narrowest = narrowest ? std::min(narrowest, bits) : bits;
+        widest = std::max(widest, bits);
+        all_float = all_float && t.is_float();
+    }
+
+    void visit(const Cast *op) {
+        include_type(op->type);
+        IRGraphVisitor::visit(op);
+    }
+
+    void visit(const Load *op) {
+        include_type(op->type);
+        IRGraphVisitor::visit(op);
+    }
+
+    void visit(const Call *op) {
+        include_type(op->type);
+        IRGraphVisitor::visit(op);
+    }
+
+public:
+    int narrowest, widest;
+    bool all_float;
+    FindTypes() : narrowest(0), widest(0), all_float(true) {}
+
+    // A type of the given width, of the kind found.
+    Type with_bits(int bits) const {
+        return all_float ? Float(bits) : Int(bits);
+    }
+
+    void find(Expr e) {
+        include_type(e.type());
+        e.accept(this);
+    }
+};
+
+// A generalized Sethi-Ullman number, in vector registers.
+class RegisterPressure : public IRVisitor {
+    int factor;
+    const Target &target;
+    Scope<int> in_registers;
+
+    using IRVisitor::visit;
+
+    int registers(Type t) {
+        return Halide::Internal::registers(t, factor, target);
+    }
+
+    int need(Expr e) {
+        e.accept(this);
+        return result;
+    }
+
+    // Evaluate the operands neediest first. While an operand is
+    // being evaluated, the results of the ones before it are live.
+    void operands(const vector<Expr> &args, Type t) {
+        vector<std::pair<int, int> > needs;
+        for (size_t i = 0; i < args.size(); i++) {
+            needs.push_back(std::make_pair(need(args[i]), registers(args[i].type())));
+        }
+        std::sort(needs.begin(), needs.end());
+        std::reverse(needs.begin(), needs.end());
+        int held = 0, peak = registers(t);
+        for (size_t i = 0; i < needs.size(); i++) {
+            peak = std::max(peak, held + needs[i].first);
+            held += needs[i].second;
+        }
+        result = peak;
+    }
+
+    void operands(Expr a, Type t) {
+        operands(vec(a), t);
+    }
+
+    void operands(Expr a, Expr b, Type t) {
+        operands(vec(a, b), t);
+    }
+
+    void visit(const IntImm *) {result = 0;}
+    void visit(const FloatImm *) {result = 0;}
+    void visit(const StringImm *) {result = 0;}
+
+    void visit(const Variable *op) {
+        // Values bound by lets are already counted as live.
+        result = in_registers.contains(op->name) ? 0 : registers(op->type);
+    }
+
+    void visit(const Cast *op) {operands(op->value, op->type);}
+    void visit(const Add *op) {operands(op->a, op->b, op->type);}
+    void visit(const Sub *op) {operands(op->a, op->b, op->type);}
+    void visit(const Mul *op) {operands(op->a, op->b, op->type);}
+    void visit(const Div *op) {operands(op->a, op->b, op->type);}
+    void visit(const Mod *op) {operands(op->a, op->b, op->type);}
+    void visit(const Min *op) {operands(op->a, op->b, op->type);}
+    void visit(const Max *op) {operands(op->a, op->b, op->type);}
+    void visit(const EQ *op) {operands(op->a, op->b, op->type);}
+    void visit(const NE *op) {operands(op->a, op->b, op->type);}
+    void visit(const LT *op) {operands(op->a, op->b, op->type);}
+    void visit(const LE *op) {operands(op->a, op->b, op->type);}
+    void visit(const GT *op) {operands(op->a, op->b, op->type);}
+    void visit(const GE *op) {operands(op->a, op->b, op->type);}
+    void visit(const And *op) {operands(op->a, op->b, op->type);}
+    void visit(const Or *op) {operands(op->a, op->b, op->type);}
+    void visit(const Not *op) {operands(op->a, op->type);}
+    void visit(const Ramp *op) {operands(op->base, op->stride, op->type);}
+    void visit(const Broadcast *op) {operands(op->value, op->type);}
+
+    void visit(const Select *op) {
+        operands(vec(op->condition, op->true_value, op->false_value), op->type);
+    }
+
+    void visit(const Load *op) {
+        // The index is mostly scalar address arithmetic
+        result = registers(op->type);
+    }
+
+    void visit(const Call *op) {
+        if (op->call_type == Call::Halide || op->call_type == Call::Image) {
+            // Will become a load
+            result = registers(op->type);
+        } else {
+            operands(op->args, op->type);
+        }
+    }
+
+    void visit(const Let *op) {
+        int value_need = need(op->value);
+        in_registers.push(op->name, 0);
+        int body_need = need(op->body);
+        in_registers.pop(op->name);
+        result = std::max(value_need, registers(op->value.type()) + body_need);
+    }
+
+public:
+    int result;
+    RegisterPressure(int f, const Target &t) : factor(f), target(t), result(0) {}
+};
+
+}
+
+int register_pressure(const vector<Expr> &values, int factor, const Target &t) {
+    // Tuple elements are computed one after the other, so each one
+    // holds the results of the ones before it.
+    RegisterPressure pressure(factor, t);
+    int held = 0, peak = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i].accept(&pressure);
+        peak = std::max(peak, held + pressure.result);
+        held += registers(values[i].type(), factor, t);
+    }
+    return peak;
+}
+
+int choose_vector_factor(const vector<Expr> &values, const Target &t) {
+    FindTypes types;
+    for (size_t i = 0; i < values.size(); i++) {
+        types.find(values[i]);
+    }
+
+    // Values of the widest type take up to two registers each.
+    int min_factor = t.natural_vector_size(types.with_bits(types.widest));
+    int factor = std::min(t.natural_vector_size(types.with_bits(types.narrowest)), min_factor * 2);
+    int available = vector_registers(t);
+    while (factor > min_factor && register_pressure(values, factor, t) > available / 2) {
+        factor /= 2;
+    }
+
+    debug(3) << "Narrowest type has " << types.narrowest << " bits, widest has "
+             << types.widest << " bits. Chose vector factor " << factor << "\n";
+    return factor;
+}
+
+int choose_unroll_factor(const vector<Expr> &values, int vector_factor, const Target &t) {
+    int per_copy = std::max(1, register_pressure(values, vector_factor, t));
+    int available = vector_registers(t);
+    int factor = 1;
+    while (factor < 4 && per_copy * factor * 2 <= available) {
+        factor *= 2;
+    }
+
+    debug(3) << "Body needs " << per_copy << " of " << available
+             << " registers. Chose unroll factor " << factor << "\n";
+    return factor;
+}
+
+}
+}
@@ -0,0 +1,39 @@
+#ifndef HALIDE_CHOOSE_FACTORS_H
+#define HALIDE_CHOOSE_FACTORS_H
+
+/** \file
+ * Defines the cost model used to pick the factors of splits
+ * scheduled with AutoFactor.
+ */
+
+#include "IR.h"
+#include "Target.h"
+#include <vector>
+
+namespace Halide {
+namespace Internal {
+
+/** Estimate how many vector registers it takes to compute the given
+ * values vectorized by the given factor on the given target without
+ * spilling. Operands are assumed to be evaluated neediest-first, with
+ * the results of the ones already done held in registers. */
+int register_pressure(const std::vector<Expr> &values, int factor, const Target &t);
+
+/** Pick a vectorization factor for a stage that computes the given
+ * values. This is the target's natural vector width for the narrowest
+ * type involved, but no more than two registers' worth of the widest
+ * type. It is halved while the body would need more than half the
+ * registers, leaving the rest for unrolling, but never below the
+ * natural width for the widest type. */
+int choose_vector_factor(const std::vector<Expr> &values, const Target &t);
+
+/** Pick an unroll factor for a loop around a stage that computes the
+ * given values, vectorized by the given factor. This is the largest
+ * power of two up to four for which all the copies of the body fit in
+ * registers at once. */
+int choose_unroll_factor(const std::vector<Expr> &values, int vector_factor, const Target &t);
+
+}
+}
+
+#endif
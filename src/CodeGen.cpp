@@ -10,8 +10,11 @@
 #include "JITCompiledModule.h"
 #include "CodeGen_Internal.h"
 #include "Lerp.h"
+#include "VectorReduce.h"
+#include "Workspace.h"
 
 #include <sstream>
+#include <fstream>
 
 namespace Halide {
 namespace Internal {
@@ -87,7 +90,8 @@ CodeGen::CodeGen() :
     value(NULL),
     void_t(NULL), i1(NULL), i8(NULL), i16(NULL), i32(NULL), i64(NULL),
     f16(NULL), f32(NULL), f64(NULL),
-    buffer_t_type(NULL) {
+    buffer_t_type(NULL),
+    predicate(NULL) {
     initialize_llvm();
 }
 
@@ -222,6 +226,7 @@ void CodeGen::compile(Stmt stmt, string name,
         assert(buffer.defined());
         buffer_t b = *(buffer.raw_buffer());
         assert(b.host && "Can only embed buffers that exist on the host at compile time\n");
+        embedded_images[buffer.name()] = buffer;
 
         // Figure out the offset of the last pixel.
         size_t num_elems = 1;
@@ -278,9 +283,13 @@ void CodeGen::compile(Stmt stmt, string name,
     debug(1) << "Generating llvm bitcode...\n";
     // Ok, we have a module, function, context, and a builder
     // pointing at a brand new basic block. We're good to go.
+    non_temporal_stores_emitted = false;
     stmt.accept(this);
 
     // Now we need to end the function
+    if (non_temporal_stores_emitted) {
+        builder->CreateFence(SequentiallyConsistent);
+    }
     builder->CreateRet(ConstantInt::get(i32, 0));
 
     module->setModuleIdentifier("halide_module_" + name);
@@ -317,6 +326,46 @@ void CodeGen::compile(Stmt stmt, string name,
     builder->CreateRet(result);
     verifyFunction(*wrapper);
 
+    // If the internal allocations were gathered into a workspace,
+    // make a function with the same arguments that reports how big
+    // it needs to be, so that callers can preallocate it.
+    Expr workspace_bytes = workspace_size(stmt);
+    if (workspace_bytes.defined()) {
+        string query_name = name + "_workspace_size";
+        func_t = FunctionType::get(i64, arg_types, false);
+        llvm::Function *query = llvm::Function::Create(func_t, llvm::Function::ExternalLinkage, query_name, module);
+        block = BasicBlock::Create(*context, "entry", query);
+        builder->SetInsertPoint(block);
+
+        llvm::Function *containing_function = function;
+        function = query;
+
+        size_t i = 0;
+        for (llvm::Function::arg_iterator iter = query->arg_begin();
+             iter != query->arg_end();
+             iter++) {
+            if (args[i].is_buffer) {
+                unpack_buffer(args[i].name, iter);
+            } else {
+                sym_push(args[i].name, iter);
+            }
+            i++;
+        }
+
+        for (i = 0; i < images_to_embed.size(); i++) {
+            string buffer_name = images_to_embed[i].name();
+            GlobalVariable *global = module->getNamedGlobal(buffer_name + ".buffer");
+            assert(global && "Could not find embedded image");
+            Constant *zero = ConstantInt::get(i32, 0);
+            unpack_buffer(buffer_name, ConstantExpr::getInBoundsGetElementPtr(global, vec(zero)));
+        }
+
+        builder->CreateRet(codegen(workspace_bytes));
+        verifyFunction(*query);
+
+        function = containing_function;
+    }
+
     // Finally, verify the module is ok
     verifyModule(*module);
     debug(2) << "Done generating llvm bitcode\n";
@@ -374,6 +423,42 @@ void CodeGen::optimize_module() {
     }
 }
 
+bool CodeGen::compile_from_bitcode(const string &filename, const string &name) {
+    std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    string bitcode((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    init_module();
+
+    MemoryBuffer *buffer = MemoryBuffer::getMemBuffer(StringRef(bitcode), filename, false);
+    #if LLVM_VERSION < 35
+    module = ParseBitcodeFile(buffer, *context);
+    #else
+    ErrorOr<llvm::Module *> parsed = parseBitcodeFile(buffer, *context);
+    module = parsed.getError() ? NULL : parsed.get();
+    #endif
+    delete buffer;
+
+    if (!module || !module->getFunction(name)) {
+        debug(1) << "Could not load " << filename << "\n";
+        // Nothing else refers to the module or the context yet.
+        delete builder;
+        builder = NULL;
+        delete module;
+        module = NULL;
+        delete context;
+        context = NULL;
+        return false;
+    }
+
+    owns_module = true;
+    function_name = name;
+    function = module->getFunction(name);
+    return true;
+}
+
 void CodeGen::compile_to_bitcode(const string &filename) {
     assert(module && "No module defined. Must call compile before calling compile_to_bitcode");
 
@@ -465,7 +550,10 @@ void CodeGen::compile_to_native(const string &filename, bool assembly) {
         TargetMachine::CGFT_ObjectFile;
     target_machine->addPassesToEmitFile(pass_manager, out, file_type);
 
+    PassTimer timer("native code generation for " + module->getModuleIdentifier());
+    timer.start("Generating machine code");
     pass_manager.run(*module);
+    timer.stop();
 
     delete target_machine;
 }
@@ -736,7 +824,7 @@ void CodeGen::visit(const Div *op) {
     if (op->type.is_float()) {
         value = builder->CreateFDiv(codegen(op->a), codegen(op->b));
     } else if (op->type.is_uint()) {
-        value = builder->CreateUDiv(codegen(op->a), codegen(op->b));
+        value = builder->CreateUDiv(codegen(op->a), codegen_divisor(op->b));
     } else {
         // Signed integer division sucks. It should round down (to
         // make upsampling kernels work across the zero boundary), but
@@ -766,7 +854,7 @@ void CodeGen::visit(const Div *op) {
         T result = quo + post;
         */
 
-        Value *a = codegen(op->a), *b = codegen(op->b);
+        Value *a = codegen(op->a), *b = codegen_divisor(op->b);
 
         Value *a_xor_b = builder->CreateXor(a, b);
         Value *shift = ConstantInt::get(a->getType(), op->a.type().bits-1);
@@ -799,7 +887,7 @@ void CodeGen::visit(const Mod *op) {
             Expr one = make_one(op->b.type());
             value = builder->CreateAnd(codegen(op->a), codegen(op->b - one));
         } else {
-            value = builder->CreateURem(codegen(op->a), codegen(op->b));
+            value = builder->CreateURem(codegen(op->a), codegen_divisor(op->b));
         }
     } else {
         int bits;
@@ -808,7 +896,7 @@ void CodeGen::visit(const Mod *op) {
             value = builder->CreateAnd(codegen(op->a), codegen(op->b - one));
         } else {
             Value *a = codegen(op->a);
-            Value *b = codegen(op->b);
+            Value *b = codegen_divisor(op->b);
 
             // Match this non-overflowing C code due to Len Hamey
             /*
@@ -1056,6 +1144,11 @@ void CodeGen::add_tbaa_metadata(llvm::Instruction *inst, string buffer) {
 
 void CodeGen::visit(const Load *op) {
 
+    if (predicate && op->type.is_vector()) {
+        value = codegen_predicated_load(op);
+        return;
+    }
+
     bool possibly_misaligned = (might_be_misaligned.find(op->name) != might_be_misaligned.end());
 
     // There are several cases. Different architectures may wish to override some.
@@ -1190,19 +1283,134 @@ void CodeGen::visit(const Load *op) {
             value = vec;
         } else {
             // General gathers
-            Value *index = codegen(op->index);
-            Value *vec = UndefValue::get(llvm_type_of(op->type));
-            for (int i = 0; i < op->type.width; i++) {
-                Value *idx = builder->CreateExtractElement(index, ConstantInt::get(i32, i));
-                Value *ptr = codegen_buffer_pointer(op->name, op->type.element_of(), idx);
-                LoadInst *val = builder->CreateLoad(ptr);
-                add_tbaa_metadata(val, op->name);
-                vec = builder->CreateInsertElement(vec, val, ConstantInt::get(i32, i));
-            }
-            value = vec;
+            value = codegen_gather(op);
+        }
+    }
+
+}
+
+Value *CodeGen::codegen_gather(const Load *op) {
+    Value *index = codegen(op->index);
+    Value *vec = UndefValue::get(llvm_type_of(op->type));
+    for (int i = 0; i < op->type.width; i++) {
+        Value *idx = builder->CreateExtractElement(index, ConstantInt::get(i32, i));
+        Value *ptr = codegen_buffer_pointer(op->name, op->type.element_of(), idx);
+        LoadInst *val = builder->CreateLoad(ptr);
+        add_tbaa_metadata(val, op->name);
+        vec = builder->CreateInsertElement(vec, val, ConstantInt::get(i32, i));
+    }
+    return vec;
+}
+
+bool CodeGen::get_constant_table(const Load *op, int max_bytes, vector<char> *table) {
+    map<string, Buffer>::const_iterator iter = embedded_images.find(op->name);
+    if (iter == embedded_images.end()) return false;
+
+    buffer_t b = *(iter->second.raw_buffer());
+    if (b.elem_size != op->type.bytes()) return false;
+
+    // The same extent of memory that got embedded
+    size_t num_elems = 1;
+    for (int d = 0; b.extent[d]; d++) {
+        if (b.stride[d] < 0) return false;
+        num_elems += b.stride[d] * (b.extent[d] - 1);
+    }
+    size_t bytes = num_elems * b.elem_size;
+    if (bytes > (size_t)max_bytes) return false;
+
+    table->assign(b.host, b.host + bytes);
+    return true;
+}
+
+Value *CodeGen::table_byte_indices(Value *index, int start, int bytes, int n) {
+    int lanes = index->getType()->getVectorNumElements();
+    vector<Constant *> lane_of_byte(n), byte_of_lane(n);
+    for (int i = 0; i < n; i++) {
+        int lane = start + i / bytes;
+        if (lane < lanes) {
+            lane_of_byte[i] = ConstantInt::get(i32, lane);
+        } else {
+            lane_of_byte[i] = UndefValue::get(i32);
+        }
+        byte_of_lane[i] = ConstantInt::get(i8, i % bytes);
+    }
+    Value *idx = builder->CreateShuffleVector(index, UndefValue::get(index->getType()),
+                                              ConstantVector::get(lane_of_byte));
+    idx = builder->CreateTrunc(idx, VectorType::get(i8, n));
+    if (bytes > 1) {
+        idx = builder->CreateMul(idx, ConstantVector::getSplat(n, ConstantInt::get(i8, bytes)));
+        idx = builder->CreateAdd(idx, ConstantVector::get(byte_of_lane));
+    }
+    return idx;
+}
+
+Value *CodeGen::slice_vector(Value *vec, int start, int size) {
+    int lanes = vec->getType()->getVectorNumElements();
+    if (start == 0 && size == lanes) return vec;
+
+    vector<Constant *> indices(size);
+    for (int i = 0; i < size; i++) {
+        if (start + i < lanes) {
+            indices[i] = ConstantInt::get(i32, start + i);
+        } else {
+            indices[i] = UndefValue::get(i32);
+        }
+    }
+    return builder->CreateShuffleVector(vec, UndefValue::get(vec->getType()),
+                                        ConstantVector::get(indices));
+}
+
+Value *CodeGen::concat_vectors(const vector<Value *> &vecs) {
+    assert(!vecs.empty());
+    Value *result = vecs[0];
+    for (size_t i = 1; i < vecs.size(); i++) {
+        int a = result->getType()->getVectorNumElements();
+        int b = vecs[i]->getType()->getVectorNumElements();
+        // Shuffles need both sides to be the same width
+        int w = std::max(a, b);
+        Value *lhs = slice_vector(result, 0, w);
+        Value *rhs = slice_vector(vecs[i], 0, w);
+        vector<Constant *> indices(a + b);
+        for (int j = 0; j < a; j++) {
+            indices[j] = ConstantInt::get(i32, j);
+        }
+        for (int j = 0; j < b; j++) {
+            indices[a + j] = ConstantInt::get(i32, w + j);
         }
+        result = builder->CreateShuffleVector(lhs, rhs, ConstantVector::get(indices));
     }
+    return result;
+}
+
+Value *CodeGen::codegen_predicated_load(const Load *op) {
+    // Load each lane separately. The inactive lanes load from a dummy
+    // location instead, so that they can't fault, and there's no
+    // branching.
+    Value *index = codegen(op->index);
+    Value *dummy = create_alloca_at_entry(llvm_type_of(op->type.element_of()), 1);
+    Value *vec = UndefValue::get(llvm_type_of(op->type));
+    for (int i = 0; i < op->type.width; i++) {
+        Value *lane = ConstantInt::get(i32, i);
+        Value *idx = builder->CreateExtractElement(index, lane);
+        Value *ptr = codegen_buffer_pointer(op->name, op->type.element_of(), idx);
+        Value *active = builder->CreateExtractElement(predicate, lane);
+        ptr = builder->CreateSelect(active, ptr, dummy);
+        LoadInst *val = builder->CreateLoad(ptr);
+        add_tbaa_metadata(val, op->name);
+        vec = builder->CreateInsertElement(vec, val, lane);
+    }
+    return vec;
+}
 
+Value *CodeGen::codegen_divisor(Expr b) {
+    Value *divisor = codegen(b);
+    // Everything in a predicated block has the width of the mask.
+    if (predicate && b.type().is_vector() && !is_const(b) &&
+        b.type().width == (int)predicate->getType()->getVectorNumElements()) {
+        Value *one = ConstantInt::get(llvm_type_of(b.type()), 1);
+        divisor = builder->CreateSelect(predicate, divisor, one);
+    }
+    return divisor;
 }
 
 void CodeGen::visit(const Ramp *op) {
@@ -1278,6 +1486,8 @@ bool function_takes_user_context(const string &name) {
         "halide_init_kernels",
         "halide_malloc",
         "halide_printf",
+        "halide_profiler_pipeline_start",
+        "halide_profiler_set_stage",
         "halide_profiling_timer",
         "halide_release",
         "halide_start_clock",
@@ -1313,7 +1523,12 @@ void CodeGen::visit(const Call *op) {
                 indices[i] = ConstantInt::get(i32, idx->value);
             }
             Value *arg = codegen(op->args[0]);
-            value = builder->CreateShuffleVector(arg, arg, ConstantVector::get(indices));
+            if (op->type.is_scalar()) {
+                // Shuffling out a single lane is an extract.
+                value = builder->CreateExtractElement(arg, indices[0]);
+            } else {
+                value = builder->CreateShuffleVector(arg, arg, ConstantVector::get(indices));
+            }
 
         } else if (op->name == Call::interleave_vectors) {
             assert(op->args.size() == 2);
@@ -1495,6 +1710,29 @@ void CodeGen::visit(const Call *op) {
 
             value = codegen_buffer_pointer(load->name, load->type, load->index);
 
+        } else if (op->name == Call::non_temporal) {
+            // Only changes how the value is stored. See visit(const Store *).
+            assert(op->args.size() == 1 && "non_temporal takes one argument");
+            value = codegen(op->args[0]);
+        } else if (op->name == Call::prefetch) {
+            assert(op->args.size() == 1 && "prefetch takes one argument");
+            const Load *load = op->args[0].as<Load>();
+            assert(load && "The sole argument to prefetch must be a Load node");
+            assert(load->index.type().is_scalar() && "Can't prefetch a vector load");
+
+            // llvm.prefetch becomes prefetcht0 on x86, and pld or prfm on arm.
+            llvm::Value *ptr = codegen_buffer_pointer(load->name, load->type, load->index);
+            ptr = builder->CreatePointerCast(ptr, i8->getPointerTo());
+            llvm::Function *fn = Intrinsic::getDeclaration(module, Intrinsic::prefetch);
+            llvm::Value *args[4] = {
+                ptr,
+                ConstantInt::get(i32, 0), // read
+                ConstantInt::get(i32, 3), // keep in all levels of cache
+                ConstantInt::get(i32, 1)  // data cache
+            };
+            builder->CreateCall(fn, args);
+            value = ConstantInt::get(i32, 0);
+
         } else if (op->name == Call::trace || op->name == Call::trace_expr) {
 
             int int_args = (int)(op->args.size()) - 5;
@@ -1564,6 +1802,11 @@ void CodeGen::visit(const Call *op) {
         } else if (op->name == Call::lerp) {
             assert(op->args.size() == 3);
             value = codegen(lower_lerp(op->args[0], op->args[1], op->args[2]));
+        } else if (op->name == Call::vector_reduce) {
+            assert(op->args.size() == 2);
+            const StringImm *reduce_op = op->args[0].as<StringImm>();
+            assert(reduce_op && "Malformed vector_reduce node");
+            value = codegen(lower_vector_reduce(reduce_op->value, op->args[1]));
         } else if (op->name == Call::popcount) {
             assert(op->args.size() == 1);
             std::vector<llvm::Type*> arg_type(1);
@@ -1634,9 +1877,12 @@ void CodeGen::visit(const Call *op) {
             // correctly (they just get called "Handle()"), so we may
             // need to pointer cast to the appropriate type.
             FunctionType *func_t = fn->getFunctionType();
+            // The user_context, if any, is inserted as the first
+            // parameter below.
+            size_t first_arg = function_takes_user_context(op->name) ? 1 : 0;
             for (size_t i = 0; i < args.size(); i++) {
                 if (op->args[i].type().is_handle()) {
-                    llvm::Type *t = func_t->getParamType(i);
+                    llvm::Type *t = func_t->getParamType(i + first_arg);
                     if (t != args[i]->getType()) {
                         debug(4) << "Pointer casting argument to extern call: "
                                  << op->args[i] << "\n";
@@ -1646,8 +1892,10 @@ void CodeGen::visit(const Call *op) {
             }
         }
 
-        // If any of the args are handles, assume it might access memory
-        bool pure = true;
+        // If any of the args are handles, assume it might access
+        // memory. The runtime functions that take a user_context all
+        // have side effects.
+        bool pure = !function_takes_user_context(op->name);
         for (size_t i = 0; i < op->args.size(); i++) {
             if (op->args[i].type().is_handle()) {
                 pure = false;
@@ -1930,9 +2178,15 @@ void CodeGen::visit(const For *op) {
         closure.unpack_struct(symbol_table, closure_handle, builder);
 
         // Generate the new function body
+        bool outer_non_temporal_stores_emitted = non_temporal_stores_emitted;
+        non_temporal_stores_emitted = false;
         codegen(op->body);
 
         // Return success
+        if (non_temporal_stores_emitted) {
+            builder->CreateFence(SequentiallyConsistent);
+        }
+        non_temporal_stores_emitted = outer_non_temporal_stores_emitted;
         builder->CreateRet(ConstantInt::get(i32, 0));
 
         // Move the builder back to the main function and call do_par_for
@@ -1962,9 +2216,17 @@ void CodeGen::visit(const For *op) {
 }
 
 void CodeGen::visit(const Store *op) {
+    if (predicate && op->value.type().is_vector()) {
+        codegen_predicated_store(op);
+        return;
+    }
+
     Value *val = codegen(op->value);
     Halide::Type value_type = op->value.type();
     bool possibly_misaligned = (might_be_misaligned.find(op->name) != might_be_misaligned.end());
+    const Call *call = op->value.as<Call>();
+    bool non_temporal = (call && call->call_type == Call::Intrinsic &&
+                         call->name == Call::non_temporal);
     // Scalar
     if (value_type.is_scalar()) {
         Value *ptr = codegen_buffer_pointer(op->name, value_type, op->index);
@@ -1990,8 +2252,12 @@ void CodeGen::visit(const Store *op) {
             if (possibly_misaligned) {
                 alignment = op->value.type().element_of().bytes();
             }
-            StoreInst *store = builder->CreateAlignedStore(val, ptr2, alignment);
-            add_tbaa_metadata(store, op->name);
+            if (non_temporal) {
+                codegen_non_temporal_store(val, ptr2, alignment, op->name);
+            } else {
+                StoreInst *store = builder->CreateAlignedStore(val, ptr2, alignment);
+                add_tbaa_metadata(store, op->name);
+            }
         } else if (ramp) {
             Value *ptr = codegen_buffer_pointer(op->name, value_type.element_of(), ramp->base);
             const IntImm *const_stride = ramp->stride.as<IntImm>();
@@ -2028,6 +2294,65 @@ void CodeGen::visit(const Store *op) {
 
 }
 
+void CodeGen::codegen_non_temporal_store(Value *val, Value *ptr, int alignment, const string &buffer) {
+    int bytes = (int)(val->getType()->getPrimitiveSizeInBits() / 8);
+    if (bytes < 16 || (bytes & (bytes - 1))) {
+        // Not a whole number of vector registers.
+        StoreInst *store = builder->CreateAlignedStore(val, ptr, alignment);
+        add_tbaa_metadata(store, buffer);
+        return;
+    }
+
+    MDNode *non_temporal = MDNode::get(*context, vec<Value *>(ConstantInt::get(i32, 1)));
+    non_temporal_stores_emitted = true;
+
+    if (alignment >= bytes) {
+        StoreInst *store = builder->CreateAlignedStore(val, ptr, bytes);
+        store->setMetadata("nontemporal", non_temporal);
+        add_tbaa_metadata(store, buffer);
+        return;
+    }
+
+    Value *address = builder->CreatePtrToInt(ptr, i64);
+    Value *aligned = builder->CreateIsNull(builder->CreateAnd(address, bytes - 1));
+
+    BasicBlock *non_temporal_bb = BasicBlock::Create(*context, "non_temporal_store", function);
+    BasicBlock *regular_bb = BasicBlock::Create(*context, "regular_store", function);
+    BasicBlock *after_bb = BasicBlock::Create(*context, "after_store", function);
+    builder->CreateCondBr(aligned, non_temporal_bb, regular_bb);
+
+    builder->SetInsertPoint(non_temporal_bb);
+    StoreInst *store = builder->CreateAlignedStore(val, ptr, bytes);
+    store->setMetadata("nontemporal", non_temporal);
+    add_tbaa_metadata(store, buffer);
+    builder->CreateBr(after_bb);
+
+    builder->SetInsertPoint(regular_bb);
+    store = builder->CreateAlignedStore(val, ptr, alignment);
+    add_tbaa_metadata(store, buffer);
+    builder->CreateBr(after_bb);
+
+    builder->SetInsertPoint(after_bb);
+}
+
+void CodeGen::codegen_predicated_store(const Store *op) {
+    // Store each lane separately, sending the inactive lanes to a
+    // dummy location.
+    Value *val = codegen(op->value);
+    Value *index = codegen(op->index);
+    Halide::Type value_type = op->value.type();
+    Value *dummy = create_alloca_at_entry(llvm_type_of(value_type.element_of()), 1);
+    for (int i = 0; i < value_type.width; i++) {
+        Value *lane = ConstantInt::get(i32, i);
+        Value *idx = builder->CreateExtractElement(index, lane);
+        Value *v = builder->CreateExtractElement(val, lane);
+        Value *ptr = codegen_buffer_pointer(op->name, value_type.element_of(), idx);
+        Value *active = builder->CreateExtractElement(predicate, lane);
+        ptr = builder->CreateSelect(active, ptr, dummy);
+        StoreInst *store = builder->CreateStore(v, ptr);
+        add_tbaa_metadata(store, op->name);
+    }
+}
 
 void CodeGen::visit(const Block *op) {
     codegen(op->first);
@@ -2042,7 +2367,59 @@ void CodeGen::visit(const Provide *op) {
     assert(false && "Provide encountered during codegen");
 }
 
+void CodeGen::codegen_predicated(Stmt s, Value *mask) {
+    // Test all the lanes of the mask at once by sign-extending it to
+    // bytes and treating those as one big integer.
+    int width = mask->getType()->getVectorNumElements();
+    Value *bytes = builder->CreateSExt(mask, VectorType::get(i8, width));
+    llvm::Type *bits_t = llvm::IntegerType::get(*context, width * 8);
+    Value *bits = builder->CreateBitCast(bytes, bits_t);
+
+    BasicBlock *all_bb = BasicBlock::Create(*context, "all_lanes_bb", function);
+    BasicBlock *check_bb = BasicBlock::Create(*context, "check_lanes_bb", function);
+    BasicBlock *some_bb = BasicBlock::Create(*context, "some_lanes_bb", function);
+    BasicBlock *after_bb = BasicBlock::Create(*context, "after_bb", function);
+
+    Value *all = builder->CreateICmpEQ(bits, ConstantInt::getAllOnesValue(bits_t));
+    builder->CreateCondBr(all, all_bb, check_bb);
+
+    builder->SetInsertPoint(check_bb);
+    Value *none = builder->CreateICmpEQ(bits, ConstantInt::get(bits_t, 0));
+    builder->CreateCondBr(none, after_bb, some_bb);
+
+    Value *old_predicate = predicate;
+
+    builder->SetInsertPoint(all_bb);
+    predicate = NULL;
+    codegen(s);
+    builder->CreateBr(after_bb);
+
+    builder->SetInsertPoint(some_bb);
+    predicate = mask;
+    codegen(s);
+    builder->CreateBr(after_bb);
+
+    predicate = old_predicate;
+    builder->SetInsertPoint(after_bb);
+}
+
 void CodeGen::visit(const IfThenElse *op) {
+    if (op->condition.type().is_vector()) {
+        // An if statement with a vector condition, made by
+        // vectorize_loops. The body runs once for the whole vector,
+        // with the loads and stores of the lanes for which the
+        // condition is false masked off.
+        Value *cond = codegen(op->condition);
+        Value *mask = predicate ? builder->CreateAnd(cond, predicate) : cond;
+        codegen_predicated(op->then_case, mask);
+        if (op->else_case.defined()) {
+            mask = builder->CreateNot(cond);
+            if (predicate) mask = builder->CreateAnd(mask, predicate);
+            codegen_predicated(op->else_case, mask);
+        }
+        return;
+    }
+
     BasicBlock *true_bb = BasicBlock::Create(*context, "true_bb", function);
     BasicBlock *false_bb = BasicBlock::Create(*context, "false_bb", function);
     BasicBlock *after_bb = BasicBlock::Create(*context, "after_bb", function);
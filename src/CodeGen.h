@@ -59,6 +59,11 @@ public:
                          const std::vector<Argument> &args,
                          const std::vector<Buffer> &images_to_embed);
 
+    /** Load a module previously written by compile_to_bitcode, in
+     * place of calling compile. The name must be the one passed to
+     * compile. Returns false if the file can't be read. */
+    bool compile_from_bitcode(const std::string &filename, const std::string &name);
+
     /** Emit a compiled halide statement as llvm bitcode. Call this
      * after calling compile. */
     void compile_to_bitcode(const std::string &filename);
@@ -212,6 +217,32 @@ protected:
      * different buffers */
     void add_tbaa_metadata(llvm::Instruction *inst, std::string buffer);
 
+    /** While generating the body of an if statement with a vector
+     * condition, this is a vector of i1 saying which lanes are
+     * active. Vector loads and stores must leave the inactive lanes
+     * alone. NULL when all lanes are active. */
+    llvm::Value *predicate;
+
+    /** Generate a statement with only the lanes in the mask active,
+     * branching around it if no lanes are active, and generating it
+     * without a predicate if all of them are. */
+    void codegen_predicated(Stmt s, llvm::Value *mask);
+
+    /** Generate a vector load or store under the current
+     * predicate. The default implementations do each active lane as
+     * a scalar load or store, and send the inactive lanes to a dummy
+     * location on the stack. Architectures with masked vector loads
+     * and stores should override these. */
+    // @{
+    virtual llvm::Value *codegen_predicated_load(const Load *op);
+    virtual void codegen_predicated_store(const Store *op);
+    // @}
+
+    /** Generate the divisor of an integer division or modulus. Under
+     * a predicate, the inactive lanes may hold anything, so they
+     * divide by one instead, which can't trap. */
+    llvm::Value *codegen_divisor(Expr b);
+
     using IRVisitor::visit;
 
     /** Generate code for various IR nodes. These can be overridden by
@@ -255,8 +286,30 @@ protected:
     virtual void visit(const Evaluate *);
     // @}
 
-    /** Recursive code for generating a gather using a binary tree. */
-    llvm::Value *codegen_gather(llvm::Value *indices, const Load *op);
+    /** Generate a vector load whose index is not a ramp. The default
+     * implementation loads each lane separately. Architectures with
+     * gather instructions or in-register table lookups should
+     * override this. */
+    virtual llvm::Value *codegen_gather(const Load *op);
+
+    /** If a load is from an image embedded in the module that is no
+     * larger than max_bytes, get the contents of that image. Lookups
+     * into such tables can be done with byte shuffles instead of
+     * memory accesses. */
+    bool get_constant_table(const Load *op, int max_bytes, std::vector<char> *table);
+
+    /** Make n byte indices into a table for a byte shuffle, for the
+     * lanes of the vector of element indices starting at the given
+     * lane. Byte j of element i comes from byte index[i]*bytes + j of
+     * the table. */
+    llvm::Value *table_byte_indices(llvm::Value *index, int start, int bytes, int n);
+
+    /** Take a slice of the lanes of a vector, padding with undefs
+     * past the end, or concatenate vectors end-to-end. */
+    // @{
+    llvm::Value *slice_vector(llvm::Value *vec, int start, int size);
+    llvm::Value *concat_vectors(const std::vector<llvm::Value *> &vecs);
+    // @}
 
     /** Generate code for an allocate node. It has no default
      * implementation - it must be handled in an architecture-specific
@@ -298,6 +351,19 @@ protected:
      * guarantee their alignment) */
     std::set<std::string> might_be_misaligned;
 
+    /** Have we emitted non-temporal stores since the start of the
+     * current function? If so, it ends with a fence, so that the
+     * stores are visible to whoever runs next. */
+    bool non_temporal_stores_emitted;
+
+    /** Store a dense vector with a non-temporal store, which bypasses
+     * the cache. These must be aligned to the size of the vector, so
+     * unless the alignment is already known to be sufficient, this
+     * checks the address at runtime and does a regular store when it
+     * isn't aligned (e.g. at the edges of an image). */
+    void codegen_non_temporal_store(llvm::Value *val, llvm::Value *ptr,
+                                    int alignment, const std::string &buffer);
+
     llvm::Value *get_user_context() const;
 
 
@@ -314,6 +380,10 @@ private:
     /** String constants already emitted to the module. Tracked to
      * prevent emitting the same string many times. */
     std::map<std::string, llvm::Constant *> string_constants;
+
+    /** The images embedded in the module, by name. Their contents
+     * can't change after compilation. */
+    std::map<std::string, Buffer> embedded_images;
 };
 
 }}
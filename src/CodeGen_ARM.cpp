@@ -11,6 +11,9 @@
 #include "Param.h"
 #include "Simplify.h"
 #include "integer_division_table.h"
+#include "Workspace.h"
+#include "Profiling.h"
+#include "VectorReduce.h"
 #include "LLVM_Headers.h"
 
 // Native client llvm relies on global flags to control sandboxing on
@@ -401,10 +404,22 @@ void CodeGen_ARM::compile(Stmt stmt, string name,
     module->setTargetTriple(triple.str());
     debug(1) << "Target triple of initial module: " << module->getTargetTriple() << "\n";
 
+    if (target.features & Target::Workspace) {
+        stmt = inject_workspace(stmt);
+    }
+
+    if (target.features & Target::Profile) {
+        stmt = inject_sampling_profiler(stmt, name);
+    }
+
+    PassTimer timer("code generation for " + name);
+
     // Pass to the generic codegen
+    timer.start("Generating llvm bitcode");
     CodeGen::compile(stmt, name, args, images_to_embed);
 
     // Optimize
+    timer.start("Optimizing llvm bitcode");
     CodeGen::optimize_module();
 }
 
@@ -1040,8 +1055,8 @@ void CodeGen_ARM::visit(const Store *op) {
     // A dense store of an interleaving can be done using a vst2 intrinsic
     const Ramp *ramp = op->index.as<Ramp>();
 
-    // We only deal with ramps here
-    if (!ramp) {
+    // We only deal with ramps here, and neon has no masked stores
+    if (!ramp || predicate) {
         CodeGen::visit(op);
         return;
     }
@@ -1140,11 +1155,50 @@ void CodeGen_ARM::visit(const Store *op) {
 
 }
 
+Value *CodeGen_ARM::codegen_gather(const Load *op) {
+    Type t = op->type;
+    int bytes = t.bytes();
+
+    vector<char> table;
+    if (target.bits == 32 && t.bits >= 8 && bytes <= 4 &&
+        get_constant_table(op, 32, &table)) {
+        // vtbl1 through vtbl4 look up each byte of a d register in a
+        // table of one to four d registers.
+        int regs = ((int)table.size() + 7) / 8;
+        table.resize(regs * 8, 0);
+        vector<Value *> args;
+        for (int r = 0; r < regs; r++) {
+            vector<Constant *> table_bytes(8);
+            for (int i = 0; i < 8; i++) {
+                table_bytes[i] = ConstantInt::get(i8, (uint8_t)table[r*8 + i]);
+            }
+            args.push_back(ConstantVector::get(table_bytes));
+        }
+        args.push_back(NULL);
+
+        ostringstream intrin;
+        intrin << "vtbl" << regs;
+
+        Value *index = codegen(op->index);
+        int lanes = 8 / bytes;
+        llvm::Type *result_t = VectorType::get(llvm_type_of(t.element_of()), lanes);
+        vector<Value *> results;
+        for (int i = 0; i < t.width; i += lanes) {
+            args[regs] = table_byte_indices(index, i, bytes, 8);
+            Value *result = call_intrin(args[0]->getType(), intrin.str(), args);
+            results.push_back(builder->CreateBitCast(result, result_t));
+        }
+        return slice_vector(concat_vectors(results), 0, t.width);
+    }
+
+    return CodeGen_Posix::codegen_gather(op);
+}
+
 void CodeGen_ARM::visit(const Load *op) {
     const Ramp *ramp = op->index.as<Ramp>();
 
-    // We only deal with ramps here
-    if (!ramp) {
+    // We only deal with ramps here, and neon has no masked loads
+    if (!ramp || predicate) {
         CodeGen::visit(op);
         return;
     }
@@ -1257,6 +1311,44 @@ void CodeGen_ARM::visit(const Call *op) {
         e.accept(this);
         return;
     }
+
+    if (op->call_type == Call::Intrinsic &&
+        op->name == Call::vector_reduce &&
+        target.bits == 32) {
+        assert(op->args.size() == 2);
+        const StringImm *reduce_op = op->args[0].as<StringImm>();
+        assert(reduce_op && "Malformed vector_reduce node");
+        Type t = op->args[1].type();
+
+        // Combine halves with vertical ops down to a d register, then
+        // finish with the pairwise ops.
+        string intrin;
+        if (reduce_op->value == "add") {
+            intrin = "vpadd";
+        } else if (reduce_op->value == "max") {
+            intrin = t.is_uint() ? "vpmaxu" : "vpmaxs";
+        } else if (reduce_op->value == "min") {
+            intrin = t.is_uint() ? "vpminu" : "vpmins";
+        }
+
+        int lanes = 64 / t.bits;
+        if (!intrin.empty() && t.bits >= 8 && t.bits <= 32 && t.width % lanes == 0) {
+            if (t.is_float()) {
+                intrin += ".v2f32";
+            } else {
+                intrin += ".v" + int_to_string(lanes) + "i" + int_to_string(t.bits);
+            }
+
+            Expr v = lower_vector_reduce(reduce_op->value, op->args[1], lanes);
+            Value *x = codegen(v);
+            for (int w = lanes; w > 1; w /= 2) {
+                x = call_intrin(x->getType(), intrin, vec(x, x));
+            }
+            value = builder->CreateExtractElement(x, ConstantInt::get(i32, 0));
+            return;
+        }
+    }
+
     CodeGen::visit(op);
 }
 
@@ -61,6 +61,9 @@ protected:
     void visit(const Call *);
     // @}
 
+    /** Use vtbl for lookups into constant tables of up to 32 bytes */
+    llvm::Value *codegen_gather(const Load *);
+
     /** Various patterns to peephole match against */
     struct Pattern {
         std::string intrin;
@@ -218,26 +218,36 @@ string CodeGen_C::print_name(const string &name) {
     return oss.str();
 }
 
-void CodeGen_C::compile_header(const string &name, const vector<Argument> &args) {
+void CodeGen_C::compile_header(const string &name, const vector<Argument> &args,
+                               bool workspace_query) {
     stream << "#ifndef HALIDE_" << name << '\n'
            << "#define HALIDE_" << name << '\n';
 
     // Throw in a definition of a buffer_t
     stream << buffer_t_definition;
 
-    // Now the function prototype
-    stream << "extern \"C\" int " << name << "(";
-    for (size_t i = 0; i < args.size(); i++) {
-        if (i > 0) stream << ", ";
-        if (args[i].is_buffer) {
-            stream << "buffer_t *" << print_name(args[i].name);
-        } else {
-            stream << "const "
-                   << print_type(args[i].type)
-                   << " " << print_name(args[i].name);
+    // Now the function prototype, and the prototype of the workspace
+    // size query if there is one. They take the same arguments.
+    vector<string> names = vec<string>(name);
+    if (workspace_query) {
+        names.push_back(name + "_workspace_size");
+    }
+    for (size_t j = 0; j < names.size(); j++) {
+        // The size query returns a count of bytes, which may not fit
+        // in an int.
+        stream << "extern \"C\" " << (j == 0 ? "int " : "int64_t ") << names[j] << "(";
+        for (size_t i = 0; i < args.size(); i++) {
+            if (i > 0) stream << ", ";
+            if (args[i].is_buffer) {
+                stream << "buffer_t *" << print_name(args[i].name);
+            } else {
+                stream << "const "
+                       << print_type(args[i].type)
+                       << " " << print_name(args[i].name);
+            }
         }
+        stream << ");\n";
     }
-    stream << ");\n";
 
     stream << "#endif\n";
 }
@@ -647,6 +657,17 @@ void CodeGen_C::visit(const Call *op) {
             assert(op->args.size() == 1 && op->args[0].as<Load>());
             string arg = print_expr(op->args[0]);
             rhs << "&(" << arg << ")";
+        } else if (op->name == Call::non_temporal) {
+            assert(op->args.size() == 1);
+            rhs << print_expr(op->args[0]);
+        } else if (op->name == Call::prefetch) {
+            const Load *load = op->args[0].as<Load>();
+            assert(op->args.size() == 1 && load);
+            string index = print_expr(load->index);
+            do_indent();
+            stream << "__builtin_prefetch(((" << print_type(load->type) << " *)"
+                   << print_name(load->name) << ") + " << index << ");\n";
+            rhs << "0";
         } else {
           // TODO: other intrinsics
           std::cerr << "Unhandled intrinsic: " << op->name << std::endl;
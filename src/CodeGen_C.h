@@ -36,7 +36,8 @@ public:
 
     /** Emit a header file defining a halide pipeline with the given
      * type signature */
-    void compile_header(const std::string &name, const std::vector<Argument> &args);
+    void compile_header(const std::string &name, const std::vector<Argument> &args,
+                        bool workspace_query = false);
 
     static void test();
 
@@ -16,6 +16,7 @@
 #include "Bounds.h"
 #include "Simplify.h"
 #include "Tracing.h"
+#include "Workspace.h"
 
 #ifdef _MSC_VER
 // TODO: This is untested
@@ -358,6 +359,12 @@ void CodeGen_GPU_Host::compile(Stmt stmt, string name,
     // between different x86 operating systems
     // module->setTargetTriple( ... );
 
+    // Host allocations aren't gathered into a workspace yet, but the
+    // header still declares the size query, so it reports zero.
+    if (target.features & Target::Workspace) {
+        stmt = inject_empty_workspace(stmt);
+    }
+
     // Pass to the generic codegen
     CodeGen::compile(stmt, name, args, images_to_embed);
 
@@ -651,7 +658,7 @@ void CodeGen_GPU_Host::visit(const Allocate *alloc) {
     WhereIsBufferUsed usage(alloc->name);
     alloc->accept(&usage);
 
-    Allocation host_allocation = {NULL, 0};
+    Allocation host_allocation = {NULL, 0, false};
 
     if (usage.used_on_host) {
         debug(2) << alloc->name << " is used on the host\n";
@@ -75,6 +75,16 @@ CodeGen_Posix::CodeGen_Posix() :
     wild_u32x8(Variable::make(UInt(32, 8), "*")),
     wild_u64x4(Variable::make(UInt(64, 4), "*")),
 
+    wild_i8x64(Variable::make(Int(8, 64), "*")),
+    wild_i16x32(Variable::make(Int(16, 32), "*")),
+    wild_i32x16(Variable::make(Int(32, 16), "*")),
+    wild_i64x8(Variable::make(Int(64, 8), "*")),
+
+    wild_u8x64(Variable::make(UInt(8, 64), "*")),
+    wild_u16x32(Variable::make(UInt(16, 32), "*")),
+    wild_u32x16(Variable::make(UInt(32, 16), "*")),
+    wild_u64x8(Variable::make(UInt(64, 8), "*")),
+
     wild_f32x2(Variable::make(Float(32, 2), "*")),
 
     wild_f32x4(Variable::make(Float(32, 4), "*")),
@@ -132,8 +142,17 @@ void CodeGen_Posix::init_module() {
 CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &name, Type type, Expr size) {
 
     Allocation allocation;
+    allocation.in_workspace = false;
+
+    // The workspace itself has its own entry points in the runtime,
+    // so that callers can supply it.
+    bool is_workspace = (name == "__workspace");
+    const char *malloc_name = is_workspace ? "halide_workspace_malloc" : "halide_malloc";
 
-    if (const IntImm *int_size = size.as<IntImm>()) {
+    if (sym_exists(name + ".workspace")) {
+        allocation.stack_size = 0;
+        allocation.in_workspace = true;
+    } else if (const IntImm *int_size = size.as<IntImm>()) {
         int stack_elems = int_size->value;
 
         allocation.stack_size = stack_elems * type.bytes();
@@ -151,7 +170,13 @@ CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &na
 
     llvm::Type *llvm_type = llvm_type_of(type);
 
-    if (allocation.stack_size) {
+    if (allocation.in_workspace) {
+
+        // inject_workspace has already worked out where it goes.
+        Value *ptr = sym_get(name + ".workspace");
+        allocation.ptr = builder->CreatePointerCast(ptr, llvm_type->getPointerTo());
+
+    } else if (allocation.stack_size) {
 
         // We used to do the alloca locally and save and restore the
         // stack pointer, but this makes llvm generate streams of
@@ -163,15 +188,15 @@ CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &na
         Value *llvm_size = codegen(size * type.bytes());
 
         // call malloc
-        llvm::Function *malloc_fn = module->getFunction("halide_malloc");
-        malloc_fn->setDoesNotAlias(0);
+        llvm::Function *malloc_fn = module->getFunction(malloc_name);
         assert(malloc_fn && "Could not find halide_malloc in module");
+        malloc_fn->setDoesNotAlias(0);
 
         llvm::Function::arg_iterator arg_iter = malloc_fn->arg_begin();
         ++arg_iter;  // skip the user context *
         llvm_size = builder->CreateIntCast(llvm_size, arg_iter->getType(), false);
 
-        debug(4) << "Creating call to halide_malloc\n";
+        debug(4) << "Creating call to " << malloc_name << "\n";
         Value *args[2] = { get_user_context(), llvm_size };
 
         CallInst *call = builder->CreateCall(malloc_fn, args);
@@ -199,13 +224,15 @@ void CodeGen_Posix::free_allocation(const std::string &name) {
     llvm::Function *allocated_in = call_inst ? call_inst->getParent()->getParent() : NULL;
     llvm::Function *current_func = builder->GetInsertBlock()->getParent();
 
-    if (alloc.stack_size) {
-        // Free is a no-op for stack allocations
+    if (alloc.stack_size || alloc.in_workspace) {
+        // Free is a no-op for stack allocations and allocations
+        // within the workspace
     } else if (allocated_in == current_func) { // Skip over allocations from outside this function.
         // Call free
-        llvm::Function *free_fn = module->getFunction("halide_free");
+        const char *free_name = (name == "__workspace") ? "halide_workspace_free" : "halide_free";
+        llvm::Function *free_fn = module->getFunction(free_name);
         assert(free_fn && "Could not find halide_free in module");
-        debug(4) << "Creating call to halide_free\n";
+        debug(4) << "Creating call to " << free_name << "\n";
         Value *args[2] = { get_user_context(), alloc.ptr };
         builder->CreateCall(free_fn, args);
     }
@@ -39,6 +39,8 @@ protected:
     Expr wild_u8x16, wild_u16x8, wild_u32x4, wild_u64x2; // 128-bit unsigned ints
     Expr wild_i8x32, wild_i16x16, wild_i32x8, wild_i64x4; // 256-bit signed ints
     Expr wild_u8x32, wild_u16x16, wild_u32x8, wild_u64x4; // 256-bit unsigned ints
+    Expr wild_i8x64, wild_i16x32, wild_i32x16, wild_i64x8; // 512-bit signed ints
+    Expr wild_u8x64, wild_u16x32, wild_u32x16, wild_u64x8; // 512-bit unsigned ints
     Expr wild_f32x2; // 64-bit floats
     Expr wild_f32x4, wild_f64x2; // 128-bit floats
     Expr wild_f32x8, wild_f64x4; // 256-bit floats
@@ -66,6 +68,11 @@ protected:
         /** How many bytes of stack space used. 0 implies it was a
          * heap allocation. */
         int stack_size;
+
+        /** Whether this allocation was carved out of the pipeline's
+         * workspace (see inject_workspace), in which case there is
+         * nothing to free. */
+        bool in_workspace;
     };
 
     /** The allocations currently in scope. The stack gets pushed when
@@ -74,7 +81,10 @@ protected:
 
     /** Allocates some memory on either the stack or the heap, and
      * returns an Allocation object describing it. For heap
-     * allocations this calls halide_malloc in the runtime, and for
+     * allocations this calls halide_malloc in the runtime (or
+     * halide_workspace_malloc for the workspace itself), for
+     * allocations with a name.workspace entry in the symbol table it
+     * uses that pointer, and for
      * stack allocations it either reuses an existing block from the
      * free_stack_blocks list, or it saves the stack pointer and calls
      * alloca.
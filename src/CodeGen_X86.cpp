@@ -11,6 +11,9 @@
 #include "Param.h"
 #include "integer_division_table.h"
 #include "IRPrinter.h"
+#include "Workspace.h"
+#include "Profiling.h"
+#include "VectorReduce.h"
 #include "LLVM_Headers.h"
 
 namespace Halide {
@@ -88,10 +91,22 @@ void CodeGen_X86::compile(Stmt stmt, string name,
 
     debug(1) << "Target triple of initial module: " << module->getTargetTriple() << "\n";
 
+    if (target.features & Target::Workspace) {
+        stmt = inject_workspace(stmt);
+    }
+
+    if (target.features & Target::Profile) {
+        stmt = inject_sampling_profiler(stmt, name);
+    }
+
+    PassTimer timer("code generation for " + name);
+
     // Pass to the generic codegen
+    timer.start("Generating llvm bitcode");
     CodeGen::compile(stmt, name, args, images_to_embed);
 
     // Optimize
+    timer.start("Optimizing llvm bitcode");
     CodeGen::optimize_module();
 }
 
@@ -211,7 +226,8 @@ void CodeGen_X86::visit(const Cast *op) {
     vector<Expr> matches;
 
     struct Pattern {
-        bool needs_sse_41;
+        // The target features needed to use the pattern
+        uint64_t features;
         bool extern_call;
         bool wide_op;
         Type type;
@@ -220,43 +236,77 @@ void CodeGen_X86::visit(const Cast *op) {
     };
 
     Pattern patterns[] = {
-        {false, false, true, Int(8, 16), "sse2.padds.b",
+        {0, false, true, Int(8, 16), "sse2.padds.b",
          _i8(clamp(wild_i16x16 + wild_i16x16, -128, 127))},
-        {false, false, true, Int(8, 16), "sse2.psubs.b",
+        {0, false, true, Int(8, 16), "sse2.psubs.b",
          _i8(clamp(wild_i16x16 - wild_i16x16, -128, 127))},
-        {false, false, true, UInt(8, 16), "sse2.paddus.b",
+        {0, false, true, UInt(8, 16), "sse2.paddus.b",
          _u8(min(wild_u16x16 + wild_u16x16, 255))},
-        {false, false, true, UInt(8, 16), "sse2.psubus.b",
+        {0, false, true, UInt(8, 16), "sse2.psubus.b",
          _u8(max(wild_i16x16 - wild_i16x16, 0))},
-        {false, false, true, Int(16, 8), "sse2.padds.w",
+        {0, false, true, Int(16, 8), "sse2.padds.w",
          _i16(clamp(wild_i32x8 + wild_i32x8, -32768, 32767))},
-        {false, false, true, Int(16, 8), "sse2.psubs.w",
+        {0, false, true, Int(16, 8), "sse2.psubs.w",
          _i16(clamp(wild_i32x8 - wild_i32x8, -32768, 32767))},
-        {false, false, true, UInt(16, 8), "sse2.paddus.w",
+        {0, false, true, UInt(16, 8), "sse2.paddus.w",
          _u16(min(wild_u32x8 + wild_u32x8, 65535))},
-        {false, false, true, UInt(16, 8), "sse2.psubus.w",
+        {0, false, true, UInt(16, 8), "sse2.psubus.w",
          _u16(max(wild_i32x8 - wild_i32x8, 0))},
-        {false, false, true, Int(16, 8), "sse2.pmulh.w",
+        {0, false, true, Int(16, 8), "sse2.pmulh.w",
          _i16((wild_i32x8 * wild_i32x8) / 65536)},
-        {false, false, true, UInt(16, 8), "sse2.pmulhu.w",
+        {0, false, true, UInt(16, 8), "sse2.pmulhu.w",
          _u16((wild_u32x8 * wild_u32x8) / 65536)},
-        {false, false, true, UInt(8, 16), "sse2.pavg.b",
+        {0, false, true, UInt(8, 16), "sse2.pavg.b",
          _u8(((wild_u16x16 + wild_u16x16) + 1) / 2)},
-        {false, false, true, UInt(16, 8), "sse2.pavg.w",
+        {0, false, true, UInt(16, 8), "sse2.pavg.w",
          _u16(((wild_u32x8 + wild_u32x8) + 1) / 2)},
-        {false, true, false, Int(16, 8), "packssdw",
+        {0, true, false, Int(16, 8), "packssdw",
          _i16(clamp(wild_i32x8, -32768, 32767))},
-        {false, true, false, Int(8, 16), "packsswb",
+        {0, true, false, Int(8, 16), "packsswb",
          _i8(clamp(wild_i16x16, -128, 127))},
-        {false, true, false, UInt(8, 16), "packuswb",
+        {0, true, false, UInt(8, 16), "packuswb",
          _u8(clamp(wild_i16x16, 0, 255))},
-        {true, true, false, UInt(16, 8), "packusdw",
-         _u16(clamp(wild_i32x8, 0, 65535))}
+        {Target::SSE41, true, false, UInt(16, 8), "packusdw",
+         _u16(clamp(wild_i32x8, 0, 65535))},
+
+        // The same again on 256-bit vectors
+        {Target::AVX2, false, true, Int(8, 32), "avx2.padds.b",
+         _i8(clamp(wild_i16x32 + wild_i16x32, -128, 127))},
+        {Target::AVX2, false, true, Int(8, 32), "avx2.psubs.b",
+         _i8(clamp(wild_i16x32 - wild_i16x32, -128, 127))},
+        {Target::AVX2, false, true, UInt(8, 32), "avx2.paddus.b",
+         _u8(min(wild_u16x32 + wild_u16x32, 255))},
+        {Target::AVX2, false, true, UInt(8, 32), "avx2.psubus.b",
+         _u8(max(wild_i16x32 - wild_i16x32, 0))},
+        {Target::AVX2, false, true, Int(16, 16), "avx2.padds.w",
+         _i16(clamp(wild_i32x16 + wild_i32x16, -32768, 32767))},
+        {Target::AVX2, false, true, Int(16, 16), "avx2.psubs.w",
+         _i16(clamp(wild_i32x16 - wild_i32x16, -32768, 32767))},
+        {Target::AVX2, false, true, UInt(16, 16), "avx2.paddus.w",
+         _u16(min(wild_u32x16 + wild_u32x16, 65535))},
+        {Target::AVX2, false, true, UInt(16, 16), "avx2.psubus.w",
+         _u16(max(wild_i32x16 - wild_i32x16, 0))},
+        {Target::AVX2, false, true, Int(16, 16), "avx2.pmulh.w",
+         _i16((wild_i32x16 * wild_i32x16) / 65536)},
+        {Target::AVX2, false, true, UInt(16, 16), "avx2.pmulhu.w",
+         _u16((wild_u32x16 * wild_u32x16) / 65536)},
+        {Target::AVX2, false, true, UInt(8, 32), "avx2.pavg.b",
+         _u8(((wild_u16x32 + wild_u16x32) + 1) / 2)},
+        {Target::AVX2, false, true, UInt(16, 16), "avx2.pavg.w",
+         _u16(((wild_u32x16 + wild_u32x16) + 1) / 2)},
+        {Target::AVX2, true, false, Int(16, 16), "packssdw",
+         _i16(clamp(wild_i32x16, -32768, 32767))},
+        {Target::AVX2, true, false, Int(8, 32), "packsswb",
+         _i8(clamp(wild_i16x32, -128, 127))},
+        {Target::AVX2, true, false, UInt(8, 32), "packuswb",
+         _u8(clamp(wild_i16x32, 0, 255))},
+        {Target::AVX2, true, false, UInt(16, 16), "packusdw",
+         _u16(clamp(wild_i32x16, 0, 65535))}
     };
 
     for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); i++) {
         const Pattern &pattern = patterns[i];
-        if (!(target.features | Target::SSE41) && pattern.needs_sse_41) continue;
+        if ((target.features & pattern.features) != pattern.features) continue;
         if (expr_match(pattern.pattern, op, matches)) {
             bool ok = true;
             if (pattern.wide_op) {
@@ -481,6 +531,7 @@ void CodeGen_X86::visit(const Div *op) {
 
 void CodeGen_X86::visit(const Min *op) {
     bool use_sse_41 = target.features & Target::SSE41;
+    bool use_avx2 = target.features & Target::AVX2;
     if (op->type == UInt(8, 16)) {
         value = call_intrin(UInt(8, 16), "sse2.pminu.b", vec(op->a, op->b));
     } else if (use_sse_41 && op->type == Int(8, 16)) {
@@ -493,6 +544,18 @@ void CodeGen_X86::visit(const Min *op) {
         value = call_intrin(Int(32, 4), "sse41.pminsd", vec(op->a, op->b));
     } else if (use_sse_41 && op->type == UInt(32, 4)) {
         value = call_intrin(UInt(32, 4), "sse41.pminud", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == UInt(8, 32)) {
+        value = call_intrin(UInt(8, 32), "avx2.pminu.b", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == Int(8, 32)) {
+        value = call_intrin(Int(8, 32), "avx2.pmins.b", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == Int(16, 16)) {
+        value = call_intrin(Int(16, 16), "avx2.pmins.w", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == UInt(16, 16)) {
+        value = call_intrin(UInt(16, 16), "avx2.pminu.w", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == Int(32, 8)) {
+        value = call_intrin(Int(32, 8), "avx2.pmins.d", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == UInt(32, 8)) {
+        value = call_intrin(UInt(32, 8), "avx2.pminu.d", vec(op->a, op->b));
     } else {
         CodeGen::visit(op);
     }
@@ -500,6 +563,7 @@ void CodeGen_X86::visit(const Min *op) {
 
 void CodeGen_X86::visit(const Max *op) {
     bool use_sse_41 = target.features & Target::SSE41;
+    bool use_avx2 = target.features & Target::AVX2;
     if (op->type == UInt(8, 16)) {
         value = call_intrin(UInt(8, 16), "sse2.pmaxu.b", vec(op->a, op->b));
     } else if (use_sse_41 && op->type == Int(8, 16)) {
@@ -512,11 +576,225 @@ void CodeGen_X86::visit(const Max *op) {
         value = call_intrin(Int(32, 4), "sse41.pmaxsd", vec(op->a, op->b));
     } else if (use_sse_41 && op->type == UInt(32, 4)) {
         value = call_intrin(UInt(32, 4), "sse41.pmaxud", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == UInt(8, 32)) {
+        value = call_intrin(UInt(8, 32), "avx2.pmaxu.b", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == Int(8, 32)) {
+        value = call_intrin(Int(8, 32), "avx2.pmaxs.b", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == Int(16, 16)) {
+        value = call_intrin(Int(16, 16), "avx2.pmaxs.w", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == UInt(16, 16)) {
+        value = call_intrin(UInt(16, 16), "avx2.pmaxu.w", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == Int(32, 8)) {
+        value = call_intrin(Int(32, 8), "avx2.pmaxs.d", vec(op->a, op->b));
+    } else if (use_avx2 && op->type == UInt(32, 8)) {
+        value = call_intrin(UInt(32, 8), "avx2.pmaxu.d", vec(op->a, op->b));
     } else {
         CodeGen::visit(op);
     }
 }
 
+void CodeGen_X86::visit(const Call *op) {
+    if (op->call_type == Call::Intrinsic &&
+        op->name == Call::vector_reduce &&
+        (target.features & Target::SSE41)) {
+        assert(op->args.size() == 2);
+        const StringImm *reduce_op = op->args[0].as<StringImm>();
+        assert(reduce_op && "Malformed vector_reduce node");
+        Type t = op->args[1].type();
+
+        // Combine halves with vertical ops down to 128 bits, then
+        // finish with the horizontal ops sse3, ssse3, and sse4.1
+        // have for some types.
+        string intrin;
+        if (reduce_op->value == "add" && t.element_of() == Float(32)) {
+            intrin = "sse3.hadd.ps";
+        } else if (reduce_op->value == "add" && (t.is_int() || t.is_uint()) && t.bits == 32) {
+            intrin = "ssse3.phadd.d.128";
+        } else if (reduce_op->value == "add" && (t.is_int() || t.is_uint()) && t.bits == 16) {
+            intrin = "ssse3.phadd.w.128";
+        } else if (reduce_op->value == "min" && t.element_of() == UInt(16)) {
+            // phminposuw finds the min of all eight lanes in one go,
+            // and puts it in the bottom lane.
+            intrin = "sse41.phminposuw";
+        }
+
+        int lanes = 128 / t.bits;
+        if (!intrin.empty() && t.width % lanes == 0) {
+            Expr v = lower_vector_reduce(reduce_op->value, op->args[1], lanes);
+            Value *x = codegen(v);
+            if (intrin == "sse41.phminposuw") {
+                x = call_intrin(x->getType(), intrin, vec(x));
+            } else {
+                for (int w = lanes; w > 1; w /= 2) {
+                    x = call_intrin(x->getType(), intrin, vec(x, x));
+                }
+            }
+            value = builder->CreateExtractElement(x, ConstantInt::get(i32, 0));
+            return;
+        }
+    }
+
+    CodeGen_Posix::visit(op);
+}
+
+namespace {
+// The suffix of the avx masked load and store intrinsics for a vector
+// type, or the empty string if there aren't any for that type.
+string avx_maskmov_suffix(Type t) {
+    int bits = t.bits * t.width;
+    if (t.bits == 32 && bits == 128) return "ps";
+    if (t.bits == 32 && bits == 256) return "ps.256";
+    if (t.bits == 64 && bits == 128) return "pd";
+    if (t.bits == 64 && bits == 256) return "pd.256";
+    return "";
+}
+}
+
+Value *CodeGen_X86::codegen_gather(const Load *op) {
+    Type t = op->type;
+    int bytes = t.bytes();
+
+    vector<char> table;
+    if ((target.features & Target::SSE41) && t.bits >= 8 && bytes <= 4 &&
+        get_constant_table(op, 16, &table)) {
+        // The whole table fits in one register. Look up every byte
+        // of the result with ssse3's pshufb.
+        table.resize(16, 0);
+        vector<Constant *> table_bytes(16);
+        for (int i = 0; i < 16; i++) {
+            table_bytes[i] = ConstantInt::get(i8, (uint8_t)table[i]);
+        }
+        Value *lut = ConstantVector::get(table_bytes);
+        Value *index = codegen(op->index);
+
+        int lanes = 16 / bytes;
+        llvm::Type *result_t = VectorType::get(llvm_type_of(t.element_of()), lanes);
+        vector<Value *> results;
+        for (int i = 0; i < t.width; i += lanes) {
+            Value *idx = table_byte_indices(index, i, bytes, 16);
+            Value *result = call_intrin(lut->getType(), "ssse3.pshuf.b.128", vec(lut, idx));
+            results.push_back(builder->CreateBitCast(result, result_t));
+        }
+        return slice_vector(concat_vectors(results), 0, t.width);
+    }
+
+    if ((target.features & Target::AVX2) &&
+        ((bytes == 4 && t.width >= 4) || (bytes == 8 && t.width >= 2))) {
+        // Gather whole registers at a time. A short last gather has
+        // the lanes off the end masked off.
+        int lanes = (bytes == 4 && t.width >= 8) ? 8 : 4;
+        string intrin = "avx2.gather.d.";
+        if (bytes == 4) {
+            intrin += t.is_float() ? "ps" : "d";
+        } else {
+            intrin += t.is_float() ? "pd" : "q";
+        }
+        if (lanes * bytes == 32) {
+            intrin += ".256";
+        }
+
+        Type chunk_t = t;
+        chunk_t.width = lanes;
+        llvm::Type *result_t = llvm_type_of(chunk_t);
+        llvm::Type *index_t = VectorType::get(i32, lanes);
+        llvm::Type *mask_t = llvm_type_of(Int(t.bits));
+
+        Value *base = codegen_buffer_pointer(op->name, t.element_of(), Expr(0));
+        base = builder->CreatePointerCast(base, i8->getPointerTo());
+        Value *scale = ConstantInt::get(i8, bytes);
+
+        vector<llvm::Type *> arg_types;
+        arg_types.push_back(result_t);
+        arg_types.push_back(base->getType());
+        arg_types.push_back(index_t);
+        arg_types.push_back(result_t);
+        arg_types.push_back(i8);
+        FunctionType *func_t = FunctionType::get(result_t, arg_types, false);
+        Constant *fn = module->getOrInsertFunction("llvm.x86." + intrin, func_t);
+
+        // Add a lane holding index zero to use for the lanes off the
+        // end, so that they're valid addresses even though they're
+        // masked off.
+        Value *index = codegen(op->index);
+        index = slice_vector(index, 0, t.width + 1);
+        index = builder->CreateInsertElement(index, ConstantInt::get(i32, 0),
+                                             ConstantInt::get(i32, t.width));
+
+        vector<Value *> results;
+        for (int i = 0; i < t.width; i += lanes) {
+            vector<Constant *> index_lanes(lanes), mask_lanes(lanes);
+            for (int j = 0; j < lanes; j++) {
+                bool active = i + j < t.width;
+                index_lanes[j] = ConstantInt::get(i32, active ? i + j : t.width);
+                mask_lanes[j] = ConstantInt::get(mask_t, active ? -1 : 0, true);
+            }
+            Value *idx = builder->CreateShuffleVector(index, UndefValue::get(index->getType()),
+                                                      ConstantVector::get(index_lanes));
+            Value *mask = builder->CreateBitCast(ConstantVector::get(mask_lanes), result_t);
+
+            vector<Value *> args;
+            args.push_back(UndefValue::get(result_t));
+            args.push_back(base);
+            args.push_back(idx);
+            args.push_back(mask);
+            args.push_back(scale);
+            CallInst *gather = builder->CreateCall(fn, args);
+            gather->setOnlyReadsMemory();
+            results.push_back(gather);
+        }
+        return slice_vector(concat_vectors(results), 0, t.width);
+    }
+
+    return CodeGen_Posix::codegen_gather(op);
+}
+
+Value *CodeGen_X86::codegen_predicated_load(const Load *op) {
+    const Ramp *ramp = op->index.as<Ramp>();
+
+    string suffix = avx_maskmov_suffix(op->type);
+    if (!(target.features & Target::AVX) || suffix.empty() ||
+        !ramp || !is_one(ramp->stride)) {
+        return CodeGen::codegen_predicated_load(op);
+    }
+
+    // vmaskmovps and vmaskmovpd load the lanes for which the top bit
+    // of the mask is set, and don't touch the memory of the
+    // others. The mask and the result are float vectors.
+    llvm::Type *float_t = llvm_type_of(Float(op->type.bits, op->type.width));
+    Value *mask = builder->CreateSExt(predicate, llvm_type_of(Int(op->type.bits, op->type.width)));
+    mask = builder->CreateBitCast(mask, float_t);
+    Value *ptr = codegen_buffer_pointer(op->name, op->type.element_of(), ramp->base);
+    ptr = builder->CreatePointerCast(ptr, i8->getPointerTo());
+
+    FunctionType *func_t = FunctionType::get(float_t, vec(ptr->getType(), float_t), false);
+    Constant *fn = module->getOrInsertFunction("llvm.x86.avx.maskload." + suffix, func_t);
+    Value *result = builder->CreateCall(fn, vec(ptr, mask));
+    return builder->CreateBitCast(result, llvm_type_of(op->type));
+}
+
+void CodeGen_X86::codegen_predicated_store(const Store *op) {
+    Type t = op->value.type();
+    const Ramp *ramp = op->index.as<Ramp>();
+
+    string suffix = avx_maskmov_suffix(t);
+    if (!(target.features & Target::AVX) || suffix.empty() ||
+        !ramp || !is_one(ramp->stride)) {
+        CodeGen::codegen_predicated_store(op);
+        return;
+    }
+
+    llvm::Type *float_t = llvm_type_of(Float(t.bits, t.width));
+    Value *val = builder->CreateBitCast(codegen(op->value), float_t);
+    Value *mask = builder->CreateSExt(predicate, llvm_type_of(Int(t.bits, t.width)));
+    mask = builder->CreateBitCast(mask, float_t);
+    Value *ptr = codegen_buffer_pointer(op->name, t.element_of(), ramp->base);
+    ptr = builder->CreatePointerCast(ptr, i8->getPointerTo());
+
+    FunctionType *func_t = FunctionType::get(void_t, vec(ptr->getType(), float_t, float_t), false);
+    Constant *fn = module->getOrInsertFunction("llvm.x86.avx.maskstore." + suffix, func_t);
+    builder->CreateCall(fn, vec(ptr, mask, val));
+}
+
 static bool extern_function_1_was_called = false;
 extern "C" int extern_function_1(float x) {
     extern_function_1_was_called = true;
@@ -660,6 +938,16 @@ void CodeGen_X86::test() {
 }
 
 string CodeGen_X86::mcpu() const {
+    // Haswell. This also turns on fma, so llvm contracts float
+    // multiplies followed by adds (we allow FPOpFusion::Fast).
+    if (target.features & Target::AVX512) {
+        #if LLVM_VERSION >= 36
+        return "skx";
+        #else
+        assert(false && "avx512 needs llvm 3.6 or later");
+        #endif
+    }
+    if (target.features & Target::AVX2) return "core-avx2";
     if (target.features & Target::AVX) return "corei7-avx";
     // We want SSE4.1 but not SSE4.2, hence "penryn" rather than "corei7"
     if (target.features & Target::SSE41) return "penryn";
@@ -47,8 +47,21 @@ protected:
     void visit(const Div *);
     void visit(const Min *);
     void visit(const Max *);
+    void visit(const Call *);
     // @}
 
+    /** Use vmaskmovps and vmaskmovpd for dense loads and stores of
+     * 32 and 64-bit elements under a predicate on avx. */
+    // @{
+    llvm::Value *codegen_predicated_load(const Load *);
+    void codegen_predicated_store(const Store *);
+    // @}
+
+    /** Use pshufb for lookups into small constant tables, and the
+     * avx2 gathers for other loads of 32 and 64-bit elements at
+     * computed indices. */
+    llvm::Value *codegen_gather(const Load *);
+
     std::string mcpu() const;
     std::string mattrs() const;
     bool use_soft_float_abi() const;
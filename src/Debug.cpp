@@ -1,10 +1,79 @@
 #include "Debug.h"
 
+#include <stdio.h>
+#ifdef _WIN32
+extern "C" bool QueryPerformanceCounter(uint64_t *);
+extern "C" bool QueryPerformanceFrequency(uint64_t *);
+#else
+#include <sys/time.h>
+#endif
+
 namespace Halide {
 namespace Internal {
 
 int debug::debug_level = 0;
 bool debug::initialized = false;
 
+namespace {
+
+// Wall-clock time in milliseconds, from an arbitrary starting point.
+double current_time_ms() {
+    #ifdef _WIN32
+    uint64_t ticks, frequency;
+    QueryPerformanceCounter(&ticks);
+    QueryPerformanceFrequency(&frequency);
+    return (ticks * 1000.0) / frequency;
+    #else
+    timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000.0 + t.tv_usec / 1000.0;
+    #endif
+}
+
+bool timing_passes() {
+    #ifdef _WIN32
+    char buf[32];
+    size_t read = 0;
+    getenv_s(&read, buf, "HL_TIME_PASSES");
+    return read != 0;
+    #else
+    return getenv("HL_TIME_PASSES") != NULL;
+    #endif
+}
+
+}
+
+PassTimer::PassTimer(const std::string &w) : what(w), pass_start(0), enabled(timing_passes()) {
+}
+
+void PassTimer::start(const std::string &pass) {
+    if (!enabled) return;
+    stop();
+    passes.push_back(std::make_pair(pass, 0.0));
+    pass_start = current_time_ms();
+}
+
+void PassTimer::stop() {
+    if (!enabled || passes.empty() || pass_start == 0) return;
+    passes.back().second = current_time_ms() - pass_start;
+    pass_start = 0;
+}
+
+PassTimer::~PassTimer() {
+    if (!enabled) return;
+    stop();
+    double total = 0;
+    for (size_t i = 0; i < passes.size(); i++) {
+        total += passes[i].second;
+    }
+    fprintf(stderr, "Time taken by %s:\n", what.c_str());
+    for (size_t i = 0; i < passes.size(); i++) {
+        fprintf(stderr, "  %10.3f ms %5.1f%%  %s\n", passes[i].second,
+                total > 0 ? 100 * passes[i].second / total : 0.0,
+                passes[i].first.c_str());
+    }
+    fprintf(stderr, "  %10.3f ms         total\n", total);
+}
+
 }
 }
@@ -8,6 +8,7 @@
 #include <iostream>
 #include "IR.h"
 #include <string>
+#include <vector>
 
 namespace Halide {
 namespace Internal {
@@ -59,6 +60,41 @@ struct debug {
     }
 };
 
+/** Measures the wall-clock time taken by a sequence of compiler
+ * passes, for finding out where compile time goes:
+ *
+ \code
+ PassTimer timer("lowering " + f.name());
+ timer.start("bounds inference");
+ s = bounds_inference(s, order, env);
+ timer.start("sliding window");
+ ...
+ \endcode
+ *
+ * Starting a pass ends the one before it, and destroying the timer
+ * ends the last one. If the environment variable HL_TIME_PASSES is
+ * set, the time taken by each pass, and their total, are printed to
+ * stderr when the timer is destroyed. Otherwise the timer does
+ * nothing.
+ */
+class PassTimer {
+    std::string what;
+    std::vector<std::pair<std::string, double> > passes;
+    double pass_start;
+    bool enabled;
+
+public:
+    PassTimer(const std::string &what);
+    ~PassTimer();
+
+    /** End the current pass, if there is one, and start timing the
+     * next. */
+    void start(const std::string &pass);
+
+    /** End the current pass. */
+    void stop();
+};
+
 }
 }
 
@@ -0,0 +1,73 @@
+#include "ExprUsesVar.h"
+#include "IRVisitor.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+
+namespace {
+
+class ExprUsesVar : public IRVisitor {
+    using IRVisitor::visit;
+
+    const string &var;
+
+    void visit(const Variable *op) {
+        if (op->name == var) result = true;
+    }
+public:
+    bool result;
+    ExprUsesVar(const string &v) : var(v), result(false) {}
+};
+
+class ExprUsesVars : public IRVisitor {
+    using IRVisitor::visit;
+
+    const Scope<int> &vars;
+
+    void visit(const Variable *op) {
+        if (vars.contains(op->name)) result = true;
+    }
+public:
+    bool result;
+    ExprUsesVars(const Scope<int> &v) : vars(v), result(false) {}
+};
+
+class ExprReadsMemory : public IRVisitor {
+    using IRVisitor::visit;
+
+    void visit(const Load *) {
+        result = true;
+    }
+
+    void visit(const Call *) {
+        result = true;
+    }
+public:
+    bool result;
+    ExprReadsMemory() : result(false) {}
+};
+
+}
+
+bool expr_uses_var(Expr e, const string &v) {
+    ExprUsesVar uses(v);
+    e.accept(&uses);
+    return uses.result;
+}
+
+bool expr_uses_vars(Expr e, const Scope<int> &vars) {
+    ExprUsesVars uses(vars);
+    e.accept(&uses);
+    return uses.result;
+}
+
+bool expr_reads_memory(Expr e) {
+    ExprReadsMemory reads;
+    e.accept(&reads);
+    return reads.result;
+}
+
+}
+}
@@ -0,0 +1,30 @@
+#ifndef HALIDE_EXPR_USES_VAR_H
+#define HALIDE_EXPR_USES_VAR_H
+
+/** \file
+ * Defines methods for checking what an expression depends on: the
+ * variables it refers to, and whether it reads memory.
+ */
+
+#include "IR.h"
+#include "Scope.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Test if an expression refers to a variable with the given name. */
+bool expr_uses_var(Expr e, const std::string &v);
+
+/** Test if an expression refers to any of the variables in a
+ * scope. */
+bool expr_uses_vars(Expr e, const Scope<int> &vars);
+
+/** Test if an expression loads from memory or calls anything. Such
+ * an expression can't safely be moved somewhere else in the
+ * pipeline. */
+bool expr_reads_memory(Expr e);
+
+}
+}
+
+#endif
@@ -7,11 +7,16 @@
 #include "Argument.h"
 #include "Lower.h"
 #include "StmtCompiler.h"
+#include "JITCache.h"
 #include "CodeGen_C.h"
 #include "Image.h"
 #include "Param.h"
 #include "Debug.h"
 #include "Target.h"
+#include "Simplify.h"
+#include "Substitute.h"
+#include "IREquality.h"
+#include "VectorReduce.h"
 #include <algorithm>
 #include <iostream>
 #include <string.h>
@@ -35,7 +40,10 @@ Func::Func(const string &name) : func(unique_name(name)),
                                  custom_free(NULL),
                                  custom_do_par_for(NULL),
                                  custom_do_task(NULL),
-                                 custom_trace(NULL) {
+                                 thread_pool_max_threads(0),
+                                 thread_pool_priority(0),
+                                 custom_trace(NULL),
+                                 compiled_module_shared(false) {
 }
 
 Func::Func() : func(unique_name('f')),
@@ -44,7 +52,10 @@ Func::Func() : func(unique_name('f')),
                custom_free(NULL),
                custom_do_par_for(NULL),
                custom_do_task(NULL),
-               custom_trace(NULL) {
+               thread_pool_max_threads(0),
+               thread_pool_priority(0),
+               custom_trace(NULL),
+               compiled_module_shared(false) {
 }
 
 Func::Func(Expr e) : func(unique_name('f')),
@@ -53,7 +64,10 @@ Func::Func(Expr e) : func(unique_name('f')),
                      custom_free(NULL),
                      custom_do_par_for(NULL),
                      custom_do_task(NULL),
-                     custom_trace(NULL) {
+                     thread_pool_max_threads(0),
+                     thread_pool_priority(0),
+                     custom_trace(NULL),
+                     compiled_module_shared(false) {
     (*this)(_) = e;
 }
 
@@ -397,7 +411,7 @@ void ScheduleHandle::dump_argument_list() {
     std::cerr << "\n";
 }
 
-ScheduleHandle &ScheduleHandle::split(Var old, Var outer, Var inner, Expr factor) {
+ScheduleHandle &ScheduleHandle::split(Var old, Var outer, Var inner, Expr factor, TailStrategy tail) {
     // Replace the old dimension with the new dimensions in the dims list
     bool found = false;
     string inner_name, outer_name, old_name;
@@ -426,7 +440,7 @@ ScheduleHandle &ScheduleHandle::split(Var old, Var outer, Var inner, Expr factor
     }
 
     // Add the split to the splits list
-    Schedule::Split split = {old_name, outer_name, inner_name, factor, Schedule::Split::SplitVar};
+    Schedule::Split split = {old_name, outer_name, inner_name, factor, Schedule::Split::SplitVar, tail};
     schedule.splits.push_back(split);
     return *this;
 }
@@ -476,7 +490,7 @@ ScheduleHandle &ScheduleHandle::fuse(Var inner, Var outer, Var fused) {
 
 
     // Add the fuse to the splits list
-    Schedule::Split split = {fused_name, outer_name, inner_name, Expr(), Schedule::Split::FuseVars};
+    Schedule::Split split = {fused_name, outer_name, inner_name, Expr(), Schedule::Split::FuseVars, TailAuto};
     schedule.splits.push_back(split);
     return *this;
 }
@@ -506,7 +520,7 @@ ScheduleHandle &ScheduleHandle::rename(Var old_var, Var new_var) {
 
     if (old_name.find('.') == string::npos) {
         // If it's a primitive name, add the rename to the splits list.
-        Schedule::Split split = {old_name, new_name, "", 1, Schedule::Split::RenameVar};
+        Schedule::Split split = {old_name, new_name, "", 1, Schedule::Split::RenameVar, TailAuto};
         schedule.splits.push_back(split);
     } else {
         // It's a derived name, so just rewrite the split or rename that defines it.
@@ -547,30 +561,41 @@ ScheduleHandle &ScheduleHandle::unroll(Var var) {
     return *this;
 }
 
-ScheduleHandle &ScheduleHandle::vectorize(Var var, int factor) {
+ScheduleHandle &ScheduleHandle::vectorize(Var var, int factor, TailStrategy tail) {
     Var tmp;
-    split(var, var, tmp, factor);
+    split(var, var, tmp, factor, tail);
     vectorize(tmp);
     return *this;
 }
 
-ScheduleHandle &ScheduleHandle::unroll(Var var, int factor) {
+ScheduleHandle &ScheduleHandle::vectorize(RVar var) {
+    // Vectorizing a reduction domain is only safe if the update is
+    // associative, or stores to a different site for each lane. That
+    // gets checked when the loop is vectorized.
+    return vectorize(Var(var.name()));
+}
+
+ScheduleHandle &ScheduleHandle::vectorize(RVar var, int factor, TailStrategy tail) {
+    return vectorize(Var(var.name()), factor, tail);
+}
+
+ScheduleHandle &ScheduleHandle::unroll(Var var, int factor, TailStrategy tail) {
     Var tmp;
-    split(var, var, tmp, factor);
+    split(var, var, tmp, factor, tail);
     unroll(tmp);
     return *this;
 }
 
-ScheduleHandle &ScheduleHandle::tile(Var x, Var y, Var xo, Var yo, Var xi, Var yi, Expr xfactor, Expr yfactor) {
-    split(x, xo, xi, xfactor);
-    split(y, yo, yi, yfactor);
+ScheduleHandle &ScheduleHandle::tile(Var x, Var y, Var xo, Var yo, Var xi, Var yi, Expr xfactor, Expr yfactor, TailStrategy tail) {
+    split(x, xo, xi, xfactor, tail);
+    split(y, yo, yi, yfactor, tail);
     reorder(xi, yi, xo, yo);
     return *this;
 }
 
-ScheduleHandle &ScheduleHandle::tile(Var x, Var y, Var xi, Var yi, Expr xfactor, Expr yfactor) {
-    split(x, x, xi, xfactor);
-    split(y, y, yi, yfactor);
+ScheduleHandle &ScheduleHandle::tile(Var x, Var y, Var xi, Var yi, Expr xfactor, Expr yfactor, TailStrategy tail) {
+    split(x, x, xi, xfactor, tail);
+    split(y, y, yi, yfactor, tail);
     reorder(xi, yi, x, y);
     return *this;
 }
@@ -709,6 +734,38 @@ ScheduleHandle &ScheduleHandle::cuda(Var bx, Var by, Var bz,
     return cuda_blocks(bx, by, bz).cuda_threads(tx, ty, tz);
 }
 
+ScheduleHandle &ScheduleHandle::prefetch(Var var, Expr offset) {
+    bool found = false;
+    vector<Schedule::Dim> &dims = schedule.dims;
+    for (size_t i = 0; i < dims.size() && !found; i++) {
+        if (var_name_match(dims[i].var, var.name())) {
+            found = true;
+            Schedule::Prefetch p = {dims[i].var, cast<int>(offset)};
+            schedule.prefetches.push_back(p);
+        }
+    }
+
+    if (!found) {
+        std::cerr << "Could not find dimension "
+                  << var.name()
+                  << " to prefetch across"
+                  << " in argument list for function\n";
+        dump_argument_list();
+        assert(false);
+    }
+    return *this;
+}
+
+ScheduleHandle &ScheduleHandle::specialize(Expr condition) {
+    if (!condition.type().is_bool()) {
+        std::cerr << "Can't specialize on the condition " << condition
+                  << " because it is not a boolean expression\n";
+        assert(false);
+    }
+    schedule.specializations.push_back(condition);
+    return *this;
+}
+
 ScheduleHandle &ScheduleHandle::cuda_tile(Var x, int x_size) {
     Var bx("blockidx"), tx("threadidx");
     split(x, bx, tx, x_size);
@@ -753,8 +810,8 @@ ScheduleHandle &ScheduleHandle::cuda_tile(Var x, Var y, Var z,
     return *this;
 }
 
-Func &Func::split(Var old, Var outer, Var inner, Expr factor) {
-    ScheduleHandle(func.schedule()).split(old, outer, inner, factor);
+Func &Func::split(Var old, Var outer, Var inner, Expr factor, TailStrategy tail) {
+    ScheduleHandle(func.schedule()).split(old, outer, inner, factor, tail);
     return *this;
 }
 
@@ -783,13 +840,13 @@ Func &Func::unroll(Var var) {
     return *this;
 }
 
-Func &Func::vectorize(Var var, int factor) {
-    ScheduleHandle(func.schedule()).vectorize(var, factor);
+Func &Func::vectorize(Var var, int factor, TailStrategy tail) {
+    ScheduleHandle(func.schedule()).vectorize(var, factor, tail);
     return *this;
 }
 
-Func &Func::unroll(Var var, int factor) {
-    ScheduleHandle(func.schedule()).unroll(var, factor);
+Func &Func::unroll(Var var, int factor, TailStrategy tail) {
+    ScheduleHandle(func.schedule()).unroll(var, factor, tail);
     return *this;
 }
 
@@ -813,13 +870,23 @@ Func &Func::bound(Var var, Expr min, Expr extent) {
     return *this;
 }
 
-Func &Func::tile(Var x, Var y, Var xo, Var yo, Var xi, Var yi, Expr xfactor, Expr yfactor) {
-    ScheduleHandle(func.schedule()).tile(x, y, xo, yo, xi, yi, xfactor, yfactor);
+Func &Func::prefetch(Var var, Expr offset) {
+    ScheduleHandle(func.schedule()).prefetch(var, offset);
+    return *this;
+}
+
+Func &Func::specialize(Expr condition) {
+    ScheduleHandle(func.schedule()).specialize(condition);
     return *this;
 }
 
-Func &Func::tile(Var x, Var y, Var xi, Var yi, Expr xfactor, Expr yfactor) {
-    ScheduleHandle(func.schedule()).tile(x, y, xi, yi, xfactor, yfactor);
+Func &Func::tile(Var x, Var y, Var xo, Var yo, Var xi, Var yi, Expr xfactor, Expr yfactor, TailStrategy tail) {
+    ScheduleHandle(func.schedule()).tile(x, y, xo, yo, xi, yi, xfactor, yfactor, tail);
+    return *this;
+}
+
+Func &Func::tile(Var x, Var y, Var xi, Var yi, Expr xfactor, Expr yfactor, TailStrategy tail) {
+    ScheduleHandle(func.schedule()).tile(x, y, xi, yi, xfactor, yfactor, tail);
     return *this;
 }
 
@@ -1038,6 +1105,11 @@ Func &Func::trace_realizations() {
     return *this;
 }
 
+Func &Func::stream_stores() {
+    func.stream_stores();
+    return *this;
+}
+
 void Func::debug_to_file(const string &filename) {
     func.debug_file() = filename;
 }
@@ -1046,6 +1118,185 @@ ScheduleHandle Func::update(int idx) {
     return ScheduleHandle(func.reduction_schedule(idx));
 }
 
+namespace {
+// Does an expression call a given function anywhere?
+class CallsFunction : public IRGraphVisitor {
+    using IRGraphVisitor::visit;
+
+    void visit(const Call *op) {
+        IRGraphVisitor::visit(op);
+        if (op->call_type == Call::Halide && op->name == name) {
+            result = true;
+        }
+    }
+public:
+    const string &name;
+    bool result;
+    CallsFunction(const string &n) : name(n), result(false) {}
+};
+
+bool calls_function(Expr e, const string &name) {
+    CallsFunction c(name);
+    e.accept(&c);
+    return c.result;
+}
+
+// Is an expression a call to the given function at exactly the given site?
+bool is_self_reference(Expr e, const string &name, const vector<Expr> &site) {
+    const Call *c = e.as<Call>();
+    if (!c || c->call_type != Call::Halide || c->name != name ||
+        c->args.size() != site.size() || c->value_index != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < site.size(); i++) {
+        if (!equal(c->args[i], site[i])) return false;
+    }
+    return true;
+}
+}
+
+Func Func::rfactor(RVar r, Var v, Expr chunk_size) {
+    const vector<ReductionDefinition> &reductions = func.reductions();
+
+    // Find the update step that loops over r
+    int idx = -1;
+    size_t dim = 0;
+    for (size_t i = 0; idx < 0 && i < reductions.size(); i++) {
+        const vector<ReductionVariable> &vars = reductions[i].domain.domain();
+        for (size_t j = 0; j < vars.size(); j++) {
+            if (vars[j].var == r.name()) {
+                idx = (int)i;
+                dim = j;
+            }
+        }
+    }
+    if (idx < 0) {
+        std::cerr << "Can't rfactor " << name() << " over " << r.name()
+                  << " because no update step of " << name() << " uses it.\n";
+        assert(false);
+    }
+
+    const vector<string> &pure_args = func.args();
+    for (size_t i = 0; i < pure_args.size(); i++) {
+        if (pure_args[i] == v.name()) {
+            std::cerr << "Can't rfactor " << name() << " using " << v.name()
+                      << " to index the partial results, because " << name()
+                      << " already has a pure var of that name.\n";
+            assert(false);
+        }
+    }
+
+    // Take copies, because we're about to replace this definition
+    const ReductionDefinition update = reductions[idx];
+    const vector<ReductionVariable> vars = update.domain.domain();
+
+    // Match f(site) = f(site) op e
+    string op;
+    Expr a, b;
+    if (update.values.size() == 1) {
+        Expr value = update.values[0];
+        if (const Add *add = value.as<Add>()) {
+            op = "add"; a = add->a; b = add->b;
+        } else if (const Mul *mul = value.as<Mul>()) {
+            op = "mul"; a = mul->a; b = mul->b;
+        } else if (const Min *mn = value.as<Min>()) {
+            op = "min"; a = mn->a; b = mn->b;
+        } else if (const Max *mx = value.as<Max>()) {
+            op = "max"; a = mx->a; b = mx->b;
+        }
+        if (!op.empty() && !is_self_reference(a, name(), update.args)) {
+            std::swap(a, b);
+        }
+    }
+    bool associative = !op.empty() && is_self_reference(a, name(), update.args) &&
+        !calls_function(b, name());
+    for (size_t i = 0; associative && i < update.args.size(); i++) {
+        associative = !calls_function(update.args[i], name());
+    }
+    if (!associative) {
+        std::cerr << "Can't rfactor update step " << idx << " of " << name()
+                  << " because it is not of the form f(args) = f(args) op e, "
+                  << "where op is one of +, *, min, or max, and e does not refer to f.\n";
+        assert(false);
+    }
+
+    Type t = b.type();
+    Expr identity;
+    if (op == "add") {
+        identity = make_zero(t);
+    } else if (op == "mul") {
+        identity = make_one(t);
+    } else if (op == "min") {
+        identity = t.max();
+    } else {
+        identity = t.min();
+    }
+
+    // The intermediate loops over the same reduction domain, except
+    // that r only covers one chunk: r = min + v*chunk_size + r_inner.
+    vector<ReductionVariable> inner_vars = vars;
+    inner_vars[dim].min = 0;
+    inner_vars[dim].extent = chunk_size;
+    ReductionDomain inner_domain(inner_vars);
+
+    const ReductionVariable &rv = vars[dim];
+    Expr r_inner = Variable::make(Int(32), rv.var, inner_domain);
+    Expr r_outer = rv.min + Expr(v) * chunk_size + r_inner;
+
+    // If the chunk size might not divide the extent, the last chunk
+    // runs off the end of the domain. Clamp r so that we only touch
+    // valid sites, and have the extra iterations contribute nothing.
+    Expr in_range;
+    if (!is_zero(simplify(rv.extent % chunk_size))) {
+        in_range = r_outer < rv.min + rv.extent;
+        r_outer = min(r_outer, rv.min + rv.extent - 1);
+    }
+
+    vector<Expr> site = update.args;
+    for (size_t i = 0; i < site.size(); i++) {
+        site[i] = substitute(rv.var, r_outer, site[i]);
+    }
+    b = substitute(rv.var, r_outer, b);
+    for (size_t j = 0; j < vars.size(); j++) {
+        if (j == dim) continue;
+        Expr inner = Variable::make(Int(32), vars[j].var, inner_domain);
+        for (size_t i = 0; i < site.size(); i++) {
+            site[i] = substitute(vars[j].var, inner, site[i]);
+        }
+        b = substitute(vars[j].var, inner, b);
+    }
+    if (in_range.defined() && (op == "add" || op == "mul")) {
+        // Repeating the last element is harmless for min and max.
+        b = select(in_range, b, identity);
+    }
+    site.push_back(v);
+
+    Func intm(name() + "_intm");
+    vector<Var> intm_args;
+    for (size_t i = 0; i < pure_args.size(); i++) {
+        intm_args.push_back(Var(pure_args[i]));
+    }
+    intm_args.push_back(v);
+    intm(intm_args) = identity;
+    intm(site) = vector_reduce_op(op, intm(site), b);
+
+    // Fold the partial results into f
+    RDom chunks(0, simplify((rv.extent + chunk_size - 1) / chunk_size));
+    vector<Expr> args, partial_args;
+    for (size_t i = 0; i < pure_args.size(); i++) {
+        args.push_back(Var(pure_args[i]));
+    }
+    partial_args = args;
+    partial_args.push_back(chunks.x);
+    Expr merged = vector_reduce_op(op, (*this)(args), intm(partial_args));
+    func.redefine_reduction(idx, args, vec(merged));
+
+    intm.compute_root().parallel(v);
+    intm.update().parallel(v);
+
+    return intm;
+}
+
 FuncRefVar::FuncRefVar(Internal::Function f, const vector<Var> &a, int placeholder_pos) : func(f) {
     implicit_placeholder_pos = placeholder_pos;
     args.resize(a.size());
@@ -1475,6 +1726,38 @@ private:
     }
 };
 
+/** Whether two targets generate the same code. */
+bool same_target(const Target &a, const Target &b) {
+    return (a.os == b.os && a.arch == b.arch &&
+            a.bits == b.bits && a.features == b.features);
+}
+
+/** Bind the arguments of a pipeline found in the JIT memo to the
+ * parameters and buffers of this one, which has an equal key. Returns
+ * false if one of them can't be found. */
+bool bind_memoized_arguments(const Internal::PipelineKey &key,
+                             const vector<string> &args,
+                             vector<const void *> &arg_values,
+                             vector<pair<int, Internal::Parameter> > &image_param_args) {
+    for (size_t i = 0; i < args.size(); i++) {
+        Internal::Parameter p;
+        Buffer b;
+        key.find_argument(args[i], &p, &b);
+        if (p.defined() && p.is_buffer()) {
+            image_param_args.push_back(make_pair((int)arg_values.size(), p));
+            Buffer pb = p.get_buffer();
+            arg_values.push_back(pb.defined() ? pb.raw_buffer() : NULL);
+        } else if (p.defined()) {
+            arg_values.push_back(p.get_scalar_address());
+        } else if (b.defined()) {
+            arg_values.push_back(b.raw_buffer());
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
 /** Check that all the necessary arguments are in an args vector. Any
  * images in the source that aren't in the args vector are placed in
  * the images_to_embed list. */
@@ -1535,9 +1818,9 @@ void validate_arguments(const string &output,
                                 const Target &target) {
     assert(defined() && "Can't compile undefined function");
 
-    if (!lowered.defined()) {
-        lowered = Halide::Internal::lower(func);
-    }
+    // Lowering depends on the target, so redo it.
+    lowered = Halide::Internal::lower(func, target);
+    lowered_target = target;
 
     vector<Buffer> images_to_embed;
     validate_arguments(name(), args, lowered, images_to_embed);
@@ -1559,9 +1842,9 @@ void Func::compile_to_bitcode(const string &filename, vector<Argument> args, con
                                const Target &target) {
     assert(defined() && "Can't compile undefined function");
 
-    if (!lowered.defined()) {
-        lowered = Halide::Internal::lower(func);
-    }
+    // Lowering depends on the target, so redo it.
+    lowered = Halide::Internal::lower(func, target);
+    lowered_target = target;
 
     vector<Buffer> images_to_embed;
     validate_arguments(name(), args, lowered, images_to_embed);
@@ -1579,19 +1862,22 @@ void Func::compile_to_object(const string &filename, vector<Argument> args, cons
     compile_to_object(filename, args, "", target);
 }
 
-void Func::compile_to_header(const string &filename, vector<Argument> args, const string &fn_name) {
+void Func::compile_to_header(const string &filename, vector<Argument> args, const string &fn_name,
+                             const Target &target) {
     for (int i = 0; i < outputs(); i++) {
         args.push_back(output_buffers()[i]);
     }
 
     ofstream header(filename.c_str());
     CodeGen_C cg(header);
-    cg.compile_header(fn_name.empty() ? name() : fn_name, args);
+    cg.compile_header(fn_name.empty() ? name() : fn_name, args,
+                      (target.features & Target::Workspace) != 0);
 }
 
 void Func::compile_to_c(const string &filename, vector<Argument> args, const string &fn_name) {
     if (!lowered.defined()) {
-        lowered = Halide::Internal::lower(func);
+        lowered_target = get_target_from_environment();
+        lowered = Halide::Internal::lower(func, lowered_target);
     }
 
     vector<Buffer> images_to_embed;
@@ -1608,7 +1894,8 @@ void Func::compile_to_c(const string &filename, vector<Argument> args, const str
 
 void Func::compile_to_lowered_stmt(const string &filename) {
     if (!lowered.defined()) {
-        lowered = Halide::Internal::lower(func);
+        lowered_target = get_target_from_environment();
+        lowered = Halide::Internal::lower(func, lowered_target);
     }
 
     ofstream stmt_output(filename.c_str());
@@ -1617,7 +1904,7 @@ void Func::compile_to_lowered_stmt(const string &filename) {
 
 void Func::compile_to_file(const string &filename_prefix, vector<Argument> args,
                            const Target &target) {
-    compile_to_header(filename_prefix + ".h", args, filename_prefix);
+    compile_to_header(filename_prefix + ".h", args, filename_prefix, target);
     compile_to_object(filename_prefix + ".o", args, filename_prefix, target);
 }
 
@@ -1654,7 +1941,9 @@ void Func::compile_to_assembly(const string &filename, vector<Argument> args, co
                                const Target &target) {
     assert(defined() && "Can't compile undefined function");
 
-    if (!lowered.defined()) lowered = Halide::Internal::lower(func);
+    // Lowering depends on the target, so redo it.
+    lowered = Halide::Internal::lower(func, target);
+    lowered_target = target;
 
     vector<Buffer> images_to_embed;
     validate_arguments(name(), args, lowered, images_to_embed);
@@ -1672,7 +1961,21 @@ void Func::compile_to_assembly(const string &filename, vector<Argument> args, co
     compile_to_assembly(filename, args, "", target);
 }
 
+bool Func::has_custom_hooks() const {
+    return (error_handler || custom_malloc || custom_free ||
+            custom_do_par_for || custom_do_task || custom_trace ||
+            thread_pool_max_threads || thread_pool_priority);
+}
+
+void Func::unshare_compiled_module() {
+    if (compiled_module_shared) {
+        compiled_module = JITCompiledModule();
+        compiled_module_shared = false;
+    }
+}
+
 void Func::set_error_handler(void (*handler)(void *, const char *)) {
+    unshare_compiled_module();
     error_handler = handler;
     if (compiled_module.set_error_handler) {
         compiled_module.set_error_handler(handler);
@@ -1681,6 +1984,7 @@ void Func::set_error_handler(void (*handler)(void *, const char *)) {
 
 void Func::set_custom_allocator(void *(*cust_malloc)(void *, size_t),
                                 void (*cust_free)(void *, void *)) {
+    unshare_compiled_module();
     custom_malloc = cust_malloc;
     custom_free = cust_free;
     if (compiled_module.set_custom_allocator) {
@@ -1689,6 +1993,7 @@ void Func::set_custom_allocator(void *(*cust_malloc)(void *, size_t),
 }
 
 void Func::set_custom_do_par_for(int (*cust_do_par_for)(void *, int (*)(void *, int, uint8_t *), int, int, uint8_t *)) {
+    unshare_compiled_module();
     custom_do_par_for = cust_do_par_for;
     if (compiled_module.set_custom_do_par_for) {
         compiled_module.set_custom_do_par_for(cust_do_par_for);
@@ -1696,13 +2001,24 @@ void Func::set_custom_do_par_for(int (*cust_do_par_for)(void *, int (*)(void *,
 }
 
 void Func::set_custom_do_task(int (*cust_do_task)(void *, int (*)(void *, int, uint8_t *), int, uint8_t *)) {
+    unshare_compiled_module();
     custom_do_task = cust_do_task;
     if (compiled_module.set_custom_do_task) {
         compiled_module.set_custom_do_task(cust_do_task);
     }
 }
 
+void Func::set_thread_pool_limits(int max_threads, int priority) {
+    unshare_compiled_module();
+    thread_pool_max_threads = max_threads;
+    thread_pool_priority = priority;
+    if (compiled_module.set_thread_pool_limits) {
+        compiled_module.set_thread_pool_limits(max_threads, priority);
+    }
+}
+
 void Func::set_custom_trace(Internal::JITCompiledModule::TraceFn t) {
+    unshare_compiled_module();
     custom_trace = t;
     if (compiled_module.set_custom_trace) {
         compiled_module.set_custom_trace(t);
@@ -1724,12 +2040,17 @@ void Func::set_custom_trace(Internal::JITCompiledModule::TraceFn t) {
         assert(dst[i].type() == func.output_types()[i] && "Buffer and Func have different element types");
     }
 
-    // In case these have changed since the last realization
-    compiled_module.set_error_handler(error_handler);
-    compiled_module.set_custom_allocator(custom_malloc, custom_free);
-    compiled_module.set_custom_do_par_for(custom_do_par_for);
-    compiled_module.set_custom_do_task(custom_do_task);
-    compiled_module.set_custom_trace(custom_trace);
+    // In case these have changed since the last realization. A
+    // shared module only runs with the defaults, and other threads
+    // may be using it.
+    if (!compiled_module_shared) {
+        compiled_module.set_error_handler(error_handler);
+        compiled_module.set_custom_allocator(custom_malloc, custom_free);
+        compiled_module.set_custom_do_par_for(custom_do_par_for);
+        compiled_module.set_custom_do_task(custom_do_task);
+        compiled_module.set_custom_trace(custom_trace);
+        compiled_module.set_thread_pool_limits(thread_pool_max_threads, thread_pool_priority);
+    }
 
     // Update the address of the buffers we're realizing into
     for (size_t i = 0; i < dst.size(); i++) {
@@ -1759,6 +2080,50 @@ void Func::set_custom_trace(Internal::JITCompiledModule::TraceFn t) {
     }
 }
 
+void Func::realize(Buffer dst, const std::vector<Tile> &tiles, const Target &target) {
+    realize(Realization(vec<Buffer>(dst)), tiles, target);
+}
+
+void Func::realize(Realization dst, const std::vector<Tile> &tiles, const Target &target) {
+    for (size_t t = 0; t < tiles.size(); t++) {
+        const Tile &tile = tiles[t];
+        assert((int)tile.min.size() == dimensions() && "Tile and Func have different dimensionalities");
+
+        // Make a view of each buffer that covers just this tile.
+        vector<Buffer> views;
+        for (size_t i = 0; i < dst.size(); i++) {
+            buffer_t b = *dst[i].raw_buffer();
+            assert(b.dev == 0 && "Can't realize tiles of a buffer with a device-side allocation");
+            for (size_t d = 0; d < tile.min.size(); d++) {
+                if (tile.min[d] < b.min[d] ||
+                    tile.min[d] + tile.extent[d] > b.min[d] + b.extent[d]) {
+                    std::cerr << "Tile " << t << " covers [" << tile.min[d] << ", "
+                              << tile.min[d] + tile.extent[d] - 1 << "] in dimension " << d
+                              << ", which is outside of the buffer being realized into, which covers ["
+                              << b.min[d] << ", " << b.min[d] + b.extent[d] - 1 << "]\n";
+                    assert(false);
+                }
+                b.host += (tile.min[d] - b.min[d]) * b.stride[d] * b.elem_size;
+                b.min[d] = tile.min[d];
+                b.extent[d] = tile.extent[d];
+            }
+            views.push_back(Buffer(dst[i].type(), &b));
+        }
+
+        Internal::debug(2) << "Realizing tile " << t << " of " << tiles.size() << "\n";
+        Realization r(views);
+        realize(r, target);
+
+        // The views don't own the memory, so any results left on the
+        // device must come back before they die. Then the device-side
+        // allocation of the view can go.
+        for (size_t i = 0; i < views.size(); i++) {
+            views[i].copy_to_host();
+            views[i].free_dev_buffer();
+        }
+    }
+}
+
 void Func::infer_input_bounds(Buffer dst) {
     infer_input_bounds(Realization(vec<Buffer>(dst)));
 }
@@ -1776,10 +2141,13 @@ void Func::infer_input_bounds(Realization dst) {
     }
 
     // In case these have changed since the last realization
-    compiled_module.set_error_handler(error_handler);
-    compiled_module.set_custom_allocator(custom_malloc, custom_free);
-    compiled_module.set_custom_do_par_for(custom_do_par_for);
-    compiled_module.set_custom_do_task(custom_do_task);
+    if (!compiled_module_shared) {
+        compiled_module.set_error_handler(error_handler);
+        compiled_module.set_custom_allocator(custom_malloc, custom_free);
+        compiled_module.set_custom_do_par_for(custom_do_par_for);
+        compiled_module.set_custom_do_task(custom_do_task);
+        compiled_module.set_thread_pool_limits(thread_pool_max_threads, thread_pool_priority);
+    }
 
     // Update the address of the buffers we're realizing into
     for (size_t i = 0; i < dst.size(); i++) {
@@ -1864,7 +2232,36 @@ void Func::infer_input_bounds(Realization dst) {
 void *Func::compile_jit(const Target &target) {
     assert(defined() && "Can't realize undefined function");
 
-    if (!lowered.defined()) lowered = Halide::Internal::lower(func);
+    Target t = target;
+    t.features |= Target::JIT;
+
+    // If a pipeline built the same way has already been compiled by
+    // this process, use its code. Funcs with runtime hooks set get
+    // code of their own, as the hooks are global to the code.
+    PipelineKey key(func, t);
+    bool shareable = !has_custom_hooks();
+    vector<string> memo_args;
+    compiled_module_shared = false;
+    if (shareable && jit_memo_lookup(key, &compiled_module, &memo_args)) {
+        vector<const void *> values;
+        vector<pair<int, Internal::Parameter> > image_params;
+        if (bind_memoized_arguments(key, memo_args, values, image_params)) {
+            Internal::debug(1) << "Found " << name() << " in the JIT memo\n";
+            // A spot for the address of each output buffer
+            values.resize(values.size() + func.outputs(), NULL);
+            arg_values = values;
+            image_param_args = image_params;
+            compiled_module_shared = true;
+            return compiled_module.function;
+        }
+    }
+
+    // Lowering depends on the target, so redo it if the last lowering
+    // was for something else, e.g. for compile_to_object.
+    if (!lowered.defined() || !same_target(lowered_target, t)) {
+        lowered = Halide::Internal::lower(func, t);
+        lowered_target = t;
+    }
 
     // Infer arguments
     InferArguments infer_args(name());
@@ -1890,10 +2287,18 @@ void *Func::compile_jit(const Target &target) {
                          << infer_args.arg_types[i].is_buffer << "\n";
     }
 
-    Target t = target;
-    t.features |= Target::JIT;
     StmtCompiler cg(t);
-    cg.compile(lowered, name(), infer_args.arg_types, vector<Buffer>());
+
+    // Look for the compiled pipeline in the on-disk cache first.
+    string cache_file = jit_cache_file(lowered, name(), infer_args.arg_types, t);
+    if (!cache_file.empty() && cg.compile_from_bitcode(cache_file, name())) {
+        Internal::debug(1) << "Loaded " << name() << " from the JIT cache\n";
+    } else {
+        cg.compile(lowered, name(), infer_args.arg_types, vector<Buffer>());
+        if (!cache_file.empty()) {
+            jit_cache_store(cg, cache_file);
+        }
+    }
 
     if (debug::debug_level >= 3) {
         cg.compile_to_native(name() + ".s", true);
@@ -1904,6 +2309,17 @@ void *Func::compile_jit(const Target &target) {
 
     compiled_module = cg.compile_to_function_pointers();
 
+    // Remember the pipeline by the canonical names of its arguments.
+    vector<string> canonical_args;
+    for (size_t i = 0; i + func.outputs() < infer_args.arg_types.size(); i++) {
+        string arg = key.canonical_name(infer_args.arg_types[i].name);
+        if (arg.empty()) break;
+        canonical_args.push_back(arg);
+    }
+    if (shareable && canonical_args.size() + func.outputs() == infer_args.arg_types.size()) {
+        compiled_module_shared = jit_memo_insert(key, compiled_module, canonical_args);
+    }
+
     return compiled_module.function;
 }
 
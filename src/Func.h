@@ -45,6 +45,26 @@ struct VarOrRVar {
     const bool is_rvar;
 };
 
+/** A rectangular region of interest of the output of a Func. See
+ * \ref Func::realize */
+struct Tile {
+    /** The coordinates of the first point in the tile in each
+     * dimension, and the size of the tile in each dimension. */
+    std::vector<int> min, extent;
+
+    Tile(const std::vector<int> &m, const std::vector<int> &e) : min(m), extent(e) {
+        assert(min.size() == extent.size() && "Tile min and extent have different dimensionalities");
+    }
+
+    /** Make a one-dimensional or two-dimensional tile. */
+    // @{
+    Tile(int x, int width) :
+        min(Internal::vec<int>(x)), extent(Internal::vec<int>(width)) {}
+    Tile(int x, int y, int width, int height) :
+        min(Internal::vec<int>(x, y)), extent(Internal::vec<int>(width, height)) {}
+    // @}
+};
+
 class FuncRefVar {
     Internal::Function func;
     int implicit_placeholder_pos;
@@ -198,15 +218,15 @@ public:
      * traversed. See the documentation for Func for the meanings. */
     // @{
 
-    EXPORT ScheduleHandle &split(Var old, Var outer, Var inner, Expr factor);
+    EXPORT ScheduleHandle &split(Var old, Var outer, Var inner, Expr factor, TailStrategy tail = TailAuto);
     EXPORT ScheduleHandle &fuse(Var inner, Var outer, Var fused);
     EXPORT ScheduleHandle &parallel(Var var);
     EXPORT ScheduleHandle &vectorize(Var var);
     EXPORT ScheduleHandle &unroll(Var var);
-    EXPORT ScheduleHandle &vectorize(Var var, int factor);
-    EXPORT ScheduleHandle &unroll(Var var, int factor);
-    EXPORT ScheduleHandle &tile(Var x, Var y, Var xo, Var yo, Var xi, Var yi, Expr xfactor, Expr yfactor);
-    EXPORT ScheduleHandle &tile(Var x, Var y, Var xi, Var yi, Expr xfactor, Expr yfactor);
+    EXPORT ScheduleHandle &vectorize(Var var, int factor, TailStrategy tail = TailAuto);
+    EXPORT ScheduleHandle &unroll(Var var, int factor, TailStrategy tail = TailAuto);
+    EXPORT ScheduleHandle &tile(Var x, Var y, Var xo, Var yo, Var xi, Var yi, Expr xfactor, Expr yfactor, TailStrategy tail = TailAuto);
+    EXPORT ScheduleHandle &tile(Var x, Var y, Var xi, Var yi, Expr xfactor, Expr yfactor, TailStrategy tail = TailAuto);
     EXPORT ScheduleHandle &reorder(const std::vector<VarOrRVar> &vars);
     EXPORT ScheduleHandle &reorder(VarOrRVar x, VarOrRVar y);
     EXPORT ScheduleHandle &reorder(VarOrRVar x, VarOrRVar y, VarOrRVar z);
@@ -250,6 +270,26 @@ public:
                                      int x_size, int y_size, int z_size);
     // @}
 
+    /** Vectorize a dimension of the reduction domain of this
+     * update. If every lane would update the same site, the update
+     * must be associative (e.g. a sum, product, min, or max of the
+     * old value and something else). Each lane then keeps its own
+     * partial result across the rest of the loop, and the lanes get
+     * combined with a horizontal reduction at the end. Updates that
+     * aren't associative are done one lane at a time. */
+    // @{
+    EXPORT ScheduleHandle &vectorize(RVar var);
+    EXPORT ScheduleHandle &vectorize(RVar var, int factor, TailStrategy tail = TailAuto);
+    // @}
+
+    /** Prefetch the data loaded by the iteration offset steps ahead
+     * at the top of each iteration of the loop over var. See
+     * \ref Func::prefetch */
+    EXPORT ScheduleHandle &prefetch(Var var, Expr offset = 1);
+
+    /** Compile an extra version of this loop nest that runs when the
+     * condition holds. See \ref Func::specialize */
+    EXPORT ScheduleHandle &specialize(Expr condition);
 };
 
 /** A halide function. This class represents one stage in a Halide
@@ -276,6 +316,9 @@ class Func {
      * re-lowering */
     Internal::Stmt lowered;
 
+    /** The target that the lowered form was lowered for. */
+    Target lowered_target;
+
     /** A JIT-compiled version of this function that we save so that
      * we don't have to rejit every time we want to evaluated it. */
     Internal::JITCompiledModule compiled_module;
@@ -301,6 +344,13 @@ class Func {
                           int, uint8_t *);
     // @}
 
+    /** The limits of the thread pool used when realizing this
+     * function. Zero means use the defaults. Only relevant when
+     * jitting. */
+    // @{
+    int thread_pool_max_threads, thread_pool_priority;
+    // @}
+
     /** The current custom tracing function. May be NULL. */
     // @{
     int32_t (*custom_trace)(void *, const char *, int32_t,
@@ -309,6 +359,20 @@ class Func {
                             int32_t, const int32_t *);
     // @}
 
+    /** Whether the compiled module came from, or went into, the JIT
+     * memo, in which case other Funcs may be using it too. The
+     * runtime hooks above are global to a module, so they must not
+     * be set on a shared one. */
+    bool compiled_module_shared;
+
+    /** Whether any of the runtime hooks above are set. */
+    bool has_custom_hooks() const;
+
+    /** Stop using a shared compiled module, so that setting hooks
+     * doesn't affect other Funcs. The next realization compiles a
+     * module of this Func's own. */
+    void unshare_compiled_module();
+
     /** Pointers to current values of the automatically inferred
      * arguments (buffers and scalars) used to realize this
      * function. Only relevant when jitting. We can hold these things
@@ -391,6 +455,23 @@ public:
     EXPORT void realize(Buffer dst, const Target &target = get_jit_target_from_environment());
     // @}
 
+    /** Evaluate this function over only some regions of an existing
+     * allocated buffer or buffers. The rest of the buffer is left
+     * untouched. Each tile is realized separately, into a view of the
+     * buffer, so the pipeline only computes the producers over the
+     * footprint of each tile. This is useful for sparse outputs,
+     * e.g. the tiles of an image covered by a mask. Footprints that
+     * overlap between tiles get computed once per tile, so merge
+     * adjacent tiles where that's wasteful. The tiles must lie
+     * within the buffer, which must not have a device-side
+     * allocation. */
+    // @{
+    EXPORT void realize(Realization dst, const std::vector<Tile> &tiles,
+                        const Target &target = get_jit_target_from_environment());
+    EXPORT void realize(Buffer dst, const std::vector<Tile> &tiles,
+                        const Target &target = get_jit_target_from_environment());
+    // @}
+
     /** For a given size of output, or a given output buffer,
      * determine the bounds required of all unbound ImageParams
      * referenced. Communicates the result by allocating new buffers
@@ -431,8 +512,11 @@ public:
      * third. The name defaults to the same name as this halide
      * function. You don't actually have to have defined this function
      * yet to call this. You probably don't want to use this directly;
-     * call compile_to_file instead. */
-    EXPORT void compile_to_header(const std::string &filename, std::vector<Argument>, const std::string &fn_name = "");
+     * call compile_to_file instead. If the target has the workspace
+     * feature, the header also declares the function that reports the
+     * size of the workspace (see halide_set_workspace). */
+    EXPORT void compile_to_header(const std::string &filename, std::vector<Argument>, const std::string &fn_name = "",
+                                  const Target &target = get_target_from_environment());
 
     /** Statically compile this function to text assembly equivalent
      * to the object file generated by compile_to_object. This is
@@ -562,6 +646,19 @@ public:
         int (*custom_do_par_for)(void *, int (*)(void *, int, uint8_t *), int,
                                  int, uint8_t *));
 
+    /** Limit the number of threads used to run the parallel loops
+     * of this pipeline, counting the thread that calls realize, and
+     * set their scheduling priority. Positive priorities are more
+     * important, and negative ones less. Each jit-compiled pipeline
+     * has a thread pool of its own, so this doesn't affect other
+     * pipelines. A max_threads of zero means use HL_NUMTHREADS, or
+     * failing that the number of cpus.
+     *
+     * If you are statically compiling, see halide_create_thread_pool
+     * in HalideRuntime.h, which makes a pool that can be bound to a
+     * user context. */
+    EXPORT void set_thread_pool_limits(int max_threads, int priority = 0);
+
     /** Set custom routines to call when tracing is enabled. Call this
      * on the output Func of your pipeline. This then sets custom
      * routines for the entire pipeline, not just calls to this
@@ -714,8 +811,13 @@ public:
      * given names, where the inner dimension iterates from 0 to
      * factor-1. The inner and outer subdimensions can then be dealt
      * with using the other scheduling calls. It's ok to reuse the old
-     * variable name as either the inner or outer variable. */
-    EXPORT Func &split(Var old, Var outer, Var inner, Expr factor);
+     * variable name as either the inner or outer variable.
+     *
+     * If the factor does not provably divide the extent of the old
+     * dimension, the last iteration of the outer dimension would run
+     * off the end of the region being computed. The last argument
+     * says what to do about that. See \ref TailStrategy. */
+    EXPORT Func &split(Var old, Var outer, Var inner, Expr factor, TailStrategy tail = TailAuto);
 
     /** Join two dimensions into a single fused dimenion. The fused
      * dimension covers the product of the extents of the inner and
@@ -744,14 +846,19 @@ public:
      * inner dimension. This is how you vectorize a loop of unknown
      * size. The variable to be vectorized should be the innermost
      * one. After this call, var refers to the outer dimension of the
-     * split. */
-    EXPORT Func &vectorize(Var var, int factor);
+     * split. The last argument says what to do when the factor does
+     * not divide the extent. TailGuardWithIf keeps full-width vectors
+     * for all but the last one, which is done with its lanes beyond
+     * the end masked off. Pass AutoFactor to have the factor picked
+     * for the target at compile time. */
+    EXPORT Func &vectorize(Var var, int factor, TailStrategy tail = TailAuto);
 
     /** Split a dimension by the given factor, then unroll the inner
      * dimension. This is how you unroll a loop of unknown size by
      * some constant factor. After this call, var refers to the outer
-     * dimension of the split. */
-    EXPORT Func &unroll(Var var, int factor);
+     * dimension of the split. Pass AutoFactor to unroll as far as
+     * the copies of the body fit in the target's registers. */
+    EXPORT Func &unroll(Var var, int factor, TailStrategy tail = TailAuto);
 
     /** Statically declare that the range over which a function should
      * be evaluated is given by the second and third arguments. This
@@ -763,14 +870,40 @@ public:
      * runtime error will occur when you try to run your pipeline. */
     EXPORT Func &bound(Var var, Expr min, Expr extent);
 
+    /** At the top of each iteration of the loop over the given
+     * dimension, issue prefetches for everything the iteration
+     * offset steps later will load. For each load that depends on
+     * var, the range of addresses it touches over all the loops
+     * inside var is prefetched one cache line at a time. This helps
+     * stages that walk down the rows of a large image, where the
+     * hardware prefetchers can't see that the next rows are
+     * coming. It is meant for loops whose iterations each touch a row
+     * or a few rows of their inputs (e.g. the y loop of a vertical
+     * blur). The dimension must not be vectorized or unrolled, and
+     * prefetches are not issued inside gpu kernels. */
+    EXPORT Func &prefetch(Var var, Expr offset = 1);
+
+    /** Compile a separate version of the loop nest that computes this
+     * function, to be used when the given boolean condition on
+     * parameters is true at runtime. The check happens once, around
+     * the outermost loop. Within the version, a condition of the
+     * form param == constant, or a boolean param, or a conjunction
+     * of these, is substituted into the loop nest before it is
+     * simplified and vectorized. E.g. if f loads input(x*stride, y),
+     * then f.specialize(stride == 1) gives a version in which the
+     * vectorized loads are dense. Conditions are tested in the order
+     * they were added, and the general version runs if none of them
+     * hold. Each version uses the same schedule. */
+    EXPORT Func &specialize(Expr condition);
+
     /** Split two dimensions at once by the given factors, and then
      * reorder the resulting dimensions to be xi, yi, xo, yo from
      * innermost outwards. This gives a tiled traversal. */
-    EXPORT Func &tile(Var x, Var y, Var xo, Var yo, Var xi, Var yi, Expr xfactor, Expr yfactor);
+    EXPORT Func &tile(Var x, Var y, Var xo, Var yo, Var xi, Var yi, Expr xfactor, Expr yfactor, TailStrategy tail = TailAuto);
 
     /** A shorter form of tile, which reuses the old variable names as
      * the new outer dimensions */
-    EXPORT Func &tile(Var x, Var y, Var xi, Var yi, Expr xfactor, Expr yfactor);
+    EXPORT Func &tile(Var x, Var y, Var xi, Var yi, Expr xfactor, Expr yfactor, TailStrategy tail = TailAuto);
 
     /** Reorder variables to have the given nesting order, from
      * innermost out */
@@ -1095,12 +1228,29 @@ public:
      * Halide has detected that it's possible to use a circular buffer
      * to represent g, and has reduced all accesses to g modulo 2 in
      * the x dimension. This optimization only triggers if the for
-     * loop over x is serial, and if halide can statically determine
-     * some power of two large enough to cover the range needed. For
-     * powers of two, the modulo operator compiles to more efficient
-     * bit-masking. This optimization reduces memory usage, and also
-     * improves locality by reusing recently-accessed memory instead
-     * of pulling new memory into cache.
+     * loop over x is serial, and if halide can bound the range needed
+     * by each iteration. The buffer is folded by exactly that range,
+     * which is usually a constant. It may also be an expression in
+     * things known before the loop starts (e.g. a Param giving the
+     * radius of a stencil), in which case the fold factor is computed
+     * at runtime. Constant fold factors compile to a multiply and
+     * shift, or to bit-masking for powers of two. This optimization
+     * reduces memory usage, and also improves locality by reusing
+     * recently-accessed memory instead of pulling new memory into
+     * cache.
+     *
+     * To keep both the reuse and multicore scaling, split the loop
+     * into parallel strips of serial iterations:
+     *
+     \code
+     f.split(y, yo, yi, 16).parallel(yo);
+     g.store_root().compute_at(f, yi);
+     \endcode
+     *
+     * Each strip then computes the whole footprint of g on its first
+     * iteration, and slides from there. Since nothing else uses g,
+     * each strip also gets its own circular buffer, instead of all
+     * of them sharing one the size of the whole image.
      *
      */
     EXPORT Func &store_at(Func f, Var var);
@@ -1146,6 +1296,33 @@ public:
      * update step can be meaningfully manipulated (see \ref RDom) */
     EXPORT ScheduleHandle update(int idx = 0);
 
+    /** Split an associative update step into an intermediate Func
+     * that computes partial results, and a merge step. The update
+     * that uses the reduction variable r must have the form f(args) =
+     * f(args) op e, where op is one of +, *, min, or max, and e does
+     * not refer to f. The loop over r is cut into chunks of the given
+     * size. The returned Func is indexed by the pure args of f, plus
+     * the new pure Var v which says which chunk the partial result
+     * belongs to, and the update of f is replaced by one that folds
+     * those partial results together. Because v is a pure var, the
+     * chunks can be computed in parallel:
+     *
+     \code
+     Func sum;
+     RDom r(0, 1000000);
+     sum() = 0.0f;
+     sum() += in(r);
+     Var v;
+     Func partial = sum.rfactor(r, v, 10000);
+     // partial is compute_root and parallel over v by default
+     partial.update().vectorize(r, 8);
+     \endcode
+     *
+     * The same works for histograms, where the intermediate holds one
+     * histogram per chunk. Any schedule already placed on the update
+     * step is discarded, so call this before scheduling it. */
+    EXPORT Func rfactor(RVar r, Var v, Expr chunk_size);
+
     /** Trace all loads from this Func by emitting calls to
      * halide_trace. If the Func is inlined, this has no
      * effect. */
@@ -1160,6 +1337,19 @@ public:
      * halide_trace. */
     EXPORT Func &trace_realizations();
 
+    /** Write this Func with non-temporal (streaming) stores, which
+     * go around the cache instead of evicting the data the rest of
+     * the pipeline is working on. This suits outputs and large
+     * compute_root Funcs that are written once and not read again
+     * for a long time. Only dense vector stores of at least 16 bytes
+     * are affected. They must be aligned to the size of the vector,
+     * so where the alignment can't be proven from the index and the
+     * allocation, it is checked at runtime, and the vectors that
+     * aren't aligned (e.g. at the edges of the image) get a regular
+     * store. Vectorize the innermost dimension by a factor that
+     * makes a whole number of vector registers to get any benefit. */
+    EXPORT Func &stream_stores();
+
     /** Get a handle on the internal halide function that this Func
      * represents. Useful if you want to do introspection on Halide
      * functions */
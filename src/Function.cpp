@@ -282,6 +282,33 @@ void Function::define_reduction(const vector<Expr> &_args, vector<Expr> values)
 
 }
 
+void Function::redefine_reduction(int idx, const vector<Expr> &args, vector<Expr> values) {
+    assertf(idx >= 0 && idx < (int)contents.ptr->reductions.size(),
+            "Can't replace a reduction definition that doesn't exist", name());
+
+    // Give back the references to this function that
+    // define_reduction released for the old definition, so that
+    // dropping it doesn't free us.
+    const ReductionDefinition &old = contents.ptr->reductions[idx];
+    CountSelfReferences counter;
+    counter.func = this;
+    for (size_t i = 0; i < old.args.size(); i++) {
+        old.args[i].accept(&counter);
+    }
+    for (size_t i = 0; i < old.values.size(); i++) {
+        old.values[i].accept(&counter);
+    }
+    for (size_t i = 0; i < counter.calls.size(); i++) {
+        contents.ptr->ref_count.increment();
+    }
+
+    vector<ReductionDefinition> later(contents.ptr->reductions.begin() + idx + 1,
+                                      contents.ptr->reductions.end());
+    contents.ptr->reductions.resize(idx);
+    define_reduction(args, values);
+    contents.ptr->reductions.insert(contents.ptr->reductions.end(), later.begin(), later.end());
+}
+
 void Function::define_extern(const std::string &function_name,
                              const std::vector<ExternFuncArgument> &args,
                              const std::vector<Type> &types,
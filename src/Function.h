@@ -72,7 +72,10 @@ struct FunctionContents {
 
     bool trace_loads, trace_stores, trace_realizations;
 
-    FunctionContents() : trace_loads(false), trace_stores(false), trace_realizations(false) {}
+    bool stream_stores;
+
+    FunctionContents() : trace_loads(false), trace_stores(false), trace_realizations(false),
+                         stream_stores(false) {}
 };
 
 /** A reference-counted handle to Halide's internal representation of
@@ -107,6 +110,12 @@ public:
      * definition's argument in the same index. */
     void define_reduction(const std::vector<Expr> &args, std::vector<Expr> values);
 
+    /** Replace an existing reduction definition with a new one,
+     * subject to the same rules as \ref define_reduction. The later
+     * reduction definitions are left in place, and the replaced one
+     * gets a fresh default schedule. */
+    void redefine_reduction(int idx, const std::vector<Expr> &args, std::vector<Expr> values);
+
     /** Construct a new function with the given name */
     Function(const std::string &n) : contents(new FunctionContents) {
         for (size_t i = 0; i < n.size(); i++) {
@@ -255,6 +264,17 @@ public:
     }
     // @}
 
+    /** Mark the stores to this function as non-temporal, and check
+     * whether they are. See \ref Func::stream_stores */
+    // @{
+    void stream_stores() {
+        contents.ptr->stream_stores = true;
+    }
+    bool is_streaming_stores() const {
+        return contents.ptr->stream_stores;
+    }
+    // @}
+
 };
 
 }}
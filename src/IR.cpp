@@ -98,9 +98,12 @@ const string Call::count_leading_zeros = "count_leading_zeros";
 const string Call::count_trailing_zeros = "count_trailing_zeros";
 const string Call::undef = "undef";
 const string Call::address_of = "address_of";
+const string Call::prefetch = "prefetch";
+const string Call::non_temporal = "non_temporal";
 const string Call::null_handle = "null_handle";
 const string Call::trace = "trace";
 const string Call::trace_expr = "trace_expr";
+const string Call::vector_reduce = "vector_reduce";
 
 }
 }
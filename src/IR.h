@@ -953,7 +953,10 @@ struct Call : public ExprNode<Call> {
         undef,
         null_handle,
         address_of,
-        trace, trace_expr;
+        prefetch,
+        non_temporal,
+        trace, trace_expr,
+        vector_reduce;
 
     // If it's a call to another halide function, this call node
     // holds onto a pointer to that function.
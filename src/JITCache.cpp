@@ -0,0 +1,551 @@
+#include "JITCache.h"
+#include "IRMutator.h"
+#include "IREquality.h"
+#include "IRPrinter.h"
+#include "Util.h"
+#include "Debug.h"
+
+#include <sstream>
+#include <list>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+using std::vector;
+using std::map;
+using std::set;
+using std::list;
+using std::ostringstream;
+
+namespace {
+
+// Two independent 64-bit FNV-1a hashes, to make collisions between
+// the pipelines in a cache implausible.
+void hash_string(const string &s, uint64_t *h1, uint64_t *h2) {
+    for (size_t i = 0; i < s.size(); i++) {
+        uint8_t c = (uint8_t)s[i];
+        *h1 = (*h1 ^ c) * 1099511628211ULL;
+        *h2 = (*h2 ^ c) * 1099511628211ULL;
+        *h2 ^= *h2 >> 29;
+    }
+}
+
+// Builds the canonical form of a pipeline. Every Function, parameter,
+// buffer and reduction domain is described once, the first time it
+// is reached. Expressions are rewritten to use canonical names, and
+// collected in the order they are reached.
+class Canonicalize : public IRMutator {
+public:
+    ostringstream text;
+    vector<Expr> exprs;
+    // The canonical form of each component of the names in the
+    // pipeline.
+    map<string, string> names;
+    map<string, Parameter> params;
+    map<string, Buffer> buffers;
+    bool shareable;
+
+    Canonicalize() : shareable(true) {}
+
+    // Describe every Function reachable from the output.
+    void add_pipeline(Function output) {
+        add_function(output);
+        for (size_t i = 0; i < funcs.size(); i++) {
+            add_definition(funcs[i]);
+        }
+    }
+
+private:
+    vector<Function> funcs;
+    set<string> seen_funcs;
+    vector<ReductionDomain> domains;
+
+    using IRMutator::visit;
+
+    // Names are mapped one component at a time, so that the names
+    // made by splitting vars keep the same structure. Names starting
+    // with "__" mean something to Halide, and so do those in angle
+    // brackets, such as the root loop level. They're kept as they
+    // are.
+    string canonical_component(const string &c) {
+        if (c.empty() || starts_with(c, "__") || starts_with(c, "<")) {
+            return c;
+        }
+        map<string, string>::iterator iter = names.find(c);
+        if (iter != names.end()) {
+            return iter->second;
+        }
+        string result = "_" + int_to_string((int)names.size());
+        names[c] = result;
+        return result;
+    }
+
+    string canonical(const string &name) {
+        string result;
+        size_t start = 0;
+        while (true) {
+            size_t end = name.find('.', start);
+            if (end == string::npos) end = name.size();
+            result += canonical_component(name.substr(start, end - start));
+            if (end == name.size()) break;
+            result += '.';
+            start = end + 1;
+        }
+        return result;
+    }
+
+    void add_expr(Expr e) {
+        exprs.push_back(mutate(e));
+    }
+
+    void add_parameter(Parameter p) {
+        string name = canonical(p.name());
+        if (params.count(name)) return;
+        params[name] = p;
+        text << "param " << name << " " << p.type() << " " << p.is_buffer() << "\n";
+        if (p.is_buffer()) {
+            for (int i = 0; i < 4; i++) {
+                add_expr(p.min_constraint(i));
+                add_expr(p.extent_constraint(i));
+                add_expr(p.stride_constraint(i));
+            }
+        } else {
+            add_expr(p.get_min_value());
+            add_expr(p.get_max_value());
+        }
+    }
+
+    void add_buffer(Buffer b) {
+        string name = canonical(b.name());
+        if (buffers.count(name)) return;
+        buffers[name] = b;
+        text << "buffer " << name << " " << b.type() << " " << b.dimensions() << "\n";
+    }
+
+    void add_domain(ReductionDomain d) {
+        for (size_t i = 0; i < domains.size(); i++) {
+            if (domains[i].same_as(d)) return;
+        }
+        domains.push_back(d);
+        const vector<ReductionVariable> &vars = d.domain();
+        text << "rdom";
+        for (size_t i = 0; i < vars.size(); i++) {
+            text << " " << canonical(vars[i].var);
+        }
+        text << "\n";
+        for (size_t i = 0; i < vars.size(); i++) {
+            add_expr(vars[i].min);
+            add_expr(vars[i].extent);
+        }
+    }
+
+    void add_function(Function f) {
+        if (seen_funcs.count(f.name())) return;
+        seen_funcs.insert(f.name());
+        funcs.push_back(f);
+        // Give the Function its name now, so that names are given
+        // out in the order things are reached.
+        canonical(f.name());
+    }
+
+    void add_schedule(const Schedule &s) {
+        text << "store_at " << canonical(s.store_level.func) << " " << canonical(s.store_level.var)
+             << " compute_at " << canonical(s.compute_level.func) << " " << canonical(s.compute_level.var) << "\n";
+        for (size_t i = 0; i < s.splits.size(); i++) {
+            const Schedule::Split &split = s.splits[i];
+            text << "split " << split.split_type << " " << split.tail << " " << canonical(split.old_var)
+                 << " " << canonical(split.outer) << " " << canonical(split.inner) << "\n";
+            add_expr(split.factor);
+        }
+        for (size_t i = 0; i < s.dims.size(); i++) {
+            text << "dim " << canonical(s.dims[i].var) << " " << s.dims[i].for_type << "\n";
+        }
+        text << "storage";
+        for (size_t i = 0; i < s.storage_dims.size(); i++) {
+            text << " " << canonical(s.storage_dims[i]);
+        }
+        text << "\n";
+        for (size_t i = 0; i < s.bounds.size(); i++) {
+            text << "bound " << canonical(s.bounds[i].var) << "\n";
+            add_expr(s.bounds[i].min);
+            add_expr(s.bounds[i].extent);
+        }
+        for (size_t i = 0; i < s.prefetches.size(); i++) {
+            text << "prefetch " << canonical(s.prefetches[i].var) << "\n";
+            add_expr(s.prefetches[i].offset);
+        }
+        for (size_t i = 0; i < s.specializations.size(); i++) {
+            text << "specialize\n";
+            add_expr(s.specializations[i]);
+        }
+    }
+
+    void add_definition(Function f) {
+        if (f.is_tracing_loads() || f.is_tracing_stores() ||
+            f.is_tracing_realizations() || !f.debug_file().empty()) {
+            shareable = false;
+        }
+
+        text << "func " << canonical(f.name()) << "(";
+        for (size_t i = 0; i < f.args().size(); i++) {
+            text << " " << canonical(f.args()[i]);
+        }
+        text << " ) ->";
+        for (size_t i = 0; i < f.output_types().size(); i++) {
+            text << " " << f.output_types()[i];
+        }
+        text << "\n";
+
+        if (f.is_streaming_stores()) {
+            text << "stream_stores\n";
+        }
+
+        text << "values " << f.values().size() << "\n";
+        for (size_t i = 0; i < f.values().size(); i++) {
+            add_expr(f.values()[i]);
+        }
+
+        if (f.has_extern_definition()) {
+            // The name of an extern function is kept as it is.
+            const vector<ExternFuncArgument> &args = f.extern_arguments();
+            text << "extern " << f.extern_function_name() << " " << args.size() << "\n";
+            for (size_t i = 0; i < args.size(); i++) {
+                text << "extern_arg " << args[i].arg_type;
+                if (args[i].is_func()) {
+                    Function g(args[i].func);
+                    add_function(g);
+                    text << " " << canonical(g.name());
+                } else if (args[i].is_buffer()) {
+                    add_buffer(args[i].buffer);
+                    text << " " << canonical(args[i].buffer.name());
+                } else if (args[i].is_image_param()) {
+                    add_parameter(args[i].image_param);
+                    text << " " << canonical(args[i].image_param.name());
+                } else if (args[i].is_expr()) {
+                    add_expr(args[i].expr);
+                }
+                text << "\n";
+            }
+        }
+
+        add_schedule(f.schedule());
+
+        for (size_t i = 0; i < f.reductions().size(); i++) {
+            const ReductionDefinition &r = f.reductions()[i];
+            text << "update " << r.args.size() << " " << r.values.size() << "\n";
+            for (size_t j = 0; j < r.args.size(); j++) {
+                add_expr(r.args[j]);
+            }
+            for (size_t j = 0; j < r.values.size(); j++) {
+                add_expr(r.values[j]);
+            }
+            if (r.domain.defined()) {
+                add_domain(r.domain);
+            }
+            add_schedule(r.schedule);
+        }
+
+        for (size_t i = 0; i < f.output_buffers().size(); i++) {
+            add_parameter(f.output_buffers()[i]);
+        }
+    }
+
+    void visit(const Variable *op) {
+        string name;
+        if (op->param.defined()) {
+            add_parameter(op->param);
+            // The dimensions of a buffer parameter are named after
+            // the parameter. Only the name of the parameter is
+            // replaced.
+            const string &param_name = op->param.name();
+            if (starts_with(op->name, param_name + ".")) {
+                name = canonical(param_name) + op->name.substr(param_name.size());
+            } else {
+                name = canonical(op->name);
+            }
+        } else {
+            if (op->reduction_domain.defined()) {
+                add_domain(op->reduction_domain);
+            }
+            name = canonical(op->name);
+        }
+        expr = Variable::make(op->type, name);
+    }
+
+    void visit(const Call *op) {
+        vector<Expr> args(op->args.size());
+        for (size_t i = 0; i < args.size(); i++) {
+            args[i] = mutate(op->args[i]);
+        }
+
+        // Calls to Funcs and images become calls to extern functions
+        // with names that no real one could have, so that they don't
+        // need to refer to the Function or the image.
+        string name = op->name;
+        if (op->call_type == Call::Halide) {
+            add_function(op->func);
+            name = "halide " + canonical(name);
+        } else {
+            if (op->image.defined()) {
+                add_buffer(op->image);
+            }
+            if (op->param.defined()) {
+                add_parameter(op->param);
+            }
+            if (op->call_type == Call::Image) {
+                name = "image " + canonical(name);
+            }
+        }
+
+        Call::CallType call_type = op->call_type;
+        if (call_type == Call::Halide || call_type == Call::Image) {
+            call_type = Call::Extern;
+        }
+        expr = Call::make(op->type, name, args, call_type, Function(), op->value_index);
+    }
+};
+
+struct MemoizedPipeline {
+    PipelineKey key;
+    JITCompiledModule module;
+    vector<string> args;
+};
+
+// The pipelines in the memo, most recently used first. This is never
+// freed, so that the compiled modules in it outlive anything they
+// might use at exit.
+list<MemoizedPipeline> *jit_memo = NULL;
+
+// Guards the memo, which Funcs on different threads may look things
+// up in, reorder, and add to at the same time.
+#ifdef _WIN32
+SRWLOCK jit_memo_lock = SRWLOCK_INIT;
+struct ScopedMemoLock {
+    ScopedMemoLock() { AcquireSRWLockExclusive(&jit_memo_lock); }
+    ~ScopedMemoLock() { ReleaseSRWLockExclusive(&jit_memo_lock); }
+};
+#else
+pthread_mutex_t jit_memo_lock = PTHREAD_MUTEX_INITIALIZER;
+struct ScopedMemoLock {
+    ScopedMemoLock() { pthread_mutex_lock(&jit_memo_lock); }
+    ~ScopedMemoLock() { pthread_mutex_unlock(&jit_memo_lock); }
+};
+#endif
+
+size_t jit_memo_size() {
+    char *size = getenv("HL_JIT_MEMO");
+    return size ? (size_t)atoi(size) : 32;
+}
+
+}
+
+PipelineKey::PipelineKey(Function output, const Target &target) {
+    Canonicalize c;
+    c.text << "target " << target.os << " " << target.arch << " "
+           << target.bits << " " << target.features << "\n";
+    c.add_pipeline(output);
+
+    text = c.text.str();
+    exprs.swap(c.exprs);
+    names.swap(c.names);
+    params.swap(c.params);
+    buffers.swap(c.buffers);
+
+    // Tracing and profiling put the names of the Funcs into the
+    // compiled code.
+    is_shareable = c.shareable;
+    char *trace = getenv("HL_TRACE");
+    char *profile = getenv("HL_PROFILE");
+    if ((trace && atoi(trace) > 0) ||
+        (profile && atoi(profile) > 0) ||
+        (target.features & Target::Profile)) {
+        is_shareable = false;
+    }
+
+    ostringstream printed;
+    printed << text;
+    for (size_t i = 0; i < exprs.size(); i++) {
+        if (exprs[i].defined()) {
+            printed << exprs[i] << "\n";
+        } else {
+            printed << "undefined\n";
+        }
+    }
+    uint64_t h1 = 14695981039346656037ULL, h2 = 0;
+    hash_string(printed.str(), &h1, &h2);
+    hash_value = h1;
+}
+
+int PipelineKey::compare(const PipelineKey &other) const {
+    if (hash_value < other.hash_value) return -1;
+    if (hash_value > other.hash_value) return 1;
+    int result = text.compare(other.text);
+    if (result < 0) return -1;
+    if (result > 0) return 1;
+    if (exprs.size() < other.exprs.size()) return -1;
+    if (exprs.size() > other.exprs.size()) return 1;
+    for (size_t i = 0; i < exprs.size(); i++) {
+        result = deep_compare(exprs[i], other.exprs[i]);
+        if (result) return result;
+    }
+    return 0;
+}
+
+string PipelineKey::canonical_name(const string &name) const {
+    string result;
+    size_t start = 0;
+    while (true) {
+        size_t end = name.find('.', start);
+        if (end == string::npos) end = name.size();
+        string c = name.substr(start, end - start);
+        if (!starts_with(c, "__")) {
+            map<string, string>::const_iterator iter = names.find(c);
+            if (iter == names.end()) return "";
+            c = iter->second;
+        }
+        result += c;
+        if (end == name.size()) break;
+        result += '.';
+        start = end + 1;
+    }
+    if (!params.count(result) && !buffers.count(result)) {
+        return "";
+    }
+    return result;
+}
+
+void PipelineKey::find_argument(const string &canonical_name, Parameter *param, Buffer *buf) const {
+    map<string, Parameter>::const_iterator p = params.find(canonical_name);
+    if (p != params.end()) {
+        *param = p->second;
+    }
+    map<string, Buffer>::const_iterator b = buffers.find(canonical_name);
+    if (b != buffers.end()) {
+        *buf = b->second;
+    }
+}
+
+PipelineKey PipelineKey::without_arguments() const {
+    PipelineKey key;
+    key.text = text;
+    key.exprs = exprs;
+    key.hash_value = hash_value;
+    key.is_shareable = is_shareable;
+    return key;
+}
+
+bool jit_memo_lookup(const PipelineKey &key, JITCompiledModule *module,
+                     vector<string> *args) {
+    if (!key.shareable() || jit_memo_size() == 0) return false;
+
+    ScopedMemoLock lock;
+    if (!jit_memo) return false;
+    for (list<MemoizedPipeline>::iterator iter = jit_memo->begin();
+         iter != jit_memo->end(); ++iter) {
+        if (iter->key.hash() != key.hash() || iter->key.compare(key)) continue;
+        // Move it to the front.
+        jit_memo->splice(jit_memo->begin(), *jit_memo, iter);
+        *module = iter->module;
+        *args = iter->args;
+        return true;
+    }
+    return false;
+}
+
+bool jit_memo_insert(const PipelineKey &key, const JITCompiledModule &module,
+                     const vector<string> &args) {
+    size_t size = jit_memo_size();
+    if (!key.shareable() || size == 0) return false;
+
+    MemoizedPipeline p;
+    p.key = key.without_arguments();
+    p.module = module;
+    p.args = args;
+
+    ScopedMemoLock lock;
+    if (!jit_memo) {
+        jit_memo = new list<MemoizedPipeline>;
+    }
+    jit_memo->push_front(p);
+    while (jit_memo->size() > size) {
+        jit_memo->pop_back();
+    }
+    return true;
+}
+
+string jit_cache_directory() {
+    char *dir = getenv("HL_JIT_CACHE");
+    return dir ? string(dir) : string();
+}
+
+string jit_cache_file(Stmt s, const string &name,
+                      const vector<Argument> &args,
+                      const Target &target) {
+    string dir = jit_cache_directory();
+    if (dir.empty()) return "";
+
+    ostringstream key;
+    // Compiled code depends on the version of Halide and llvm, so
+    // every build of Halide gets its own entries. The makefile
+    // defines a hash of all the sources of the library. Otherwise,
+    // this file gets rebuilt whenever any of them change, so the time
+    // it was built identifies the build.
+    #ifdef HALIDE_BUILD_HASH
+    key << "halide " << HALIDE_BUILD_HASH << "\n";
+    #else
+    key << "halide " << __DATE__ << " " << __TIME__ << "\n";
+    #endif
+    #ifdef LLVM_VERSION
+    key << "llvm " << LLVM_VERSION << "\n";
+    #endif
+    key << "target " << target.os << " " << target.arch << " "
+        << target.bits << " " << target.features << "\n";
+    key << "name " << name << "\n";
+    for (size_t i = 0; i < args.size(); i++) {
+        key << "arg " << args[i].name << " " << args[i].is_buffer
+            << " " << args[i].type << "\n";
+    }
+    // Print floats with enough digits that different constants
+    // give different text.
+    key.precision(9);
+    key << s;
+
+    uint64_t h1 = 14695981039346656037ULL, h2 = 0x9e3779b97f4a7c15ULL;
+    hash_string(key.str(), &h1, &h2);
+
+    char hash[33];
+    snprintf(hash, sizeof(hash), "%016llx%016llx",
+             (unsigned long long)h1, (unsigned long long)h2);
+
+    string file = dir + "/" + hash + ".bc";
+    debug(2) << "JIT cache file for " << name << ": " << file << "\n";
+    return file;
+}
+
+void jit_cache_store(StmtCompiler &cg, const string &file) {
+    string tmp = file + ".tmp" + int_to_string(getpid());
+    cg.compile_to_bitcode(tmp);
+    if (rename(tmp.c_str(), file.c_str()) != 0) {
+        // Another process may have got there first.
+        debug(1) << "Could not add " << file << " to the JIT cache\n";
+        remove(tmp.c_str());
+    }
+}
+
+}
+}
@@ -0,0 +1,109 @@
+#ifndef HALIDE_JIT_CACHE_H
+#define HALIDE_JIT_CACHE_H
+
+/** \file
+ * Defines the caches of jit-compiled pipelines: one in memory, shared
+ * by every Func in the process, and one on disk.
+ */
+
+#include "IR.h"
+#include "Argument.h"
+#include "Function.h"
+#include "Target.h"
+#include "StmtCompiler.h"
+
+#include <string>
+#include <vector>
+#include <map>
+
+namespace Halide {
+namespace Internal {
+
+/** A canonical description of a pipeline: every Function reachable
+ * from the output, their definitions and schedules, the parameters
+ * and buffers they use, and the target. The names of Funcs, Vars,
+ * RDoms, Params and Buffers are replaced by names given out in the
+ * order they are first reached, so two pipelines built the same way
+ * get equal keys even though their Funcs have different names. The
+ * definitions are kept as expressions, and compared with
+ * deep_compare. */
+class PipelineKey {
+public:
+    PipelineKey() : hash_value(0), is_shareable(false) {}
+    PipelineKey(Function output, const Target &target);
+
+    /** Can code compiled for this pipeline be used for another
+     * pipeline with an equal key? This is false if the compiled code
+     * depends on the names in the pipeline, which is the case when
+     * it's traced, profiled, or writes out debug files. */
+    bool shareable() const {return is_shareable;}
+
+    /** A hash of the key. Equal keys have equal hashes. */
+    uint64_t hash() const {return hash_value;}
+
+    /** Order two keys. Returns zero if they are equal. */
+    int compare(const PipelineKey &other) const;
+
+    /** Get the canonical form of the name of a parameter or buffer in
+     * this pipeline. Returns an empty string if it isn't one. */
+    std::string canonical_name(const std::string &name) const;
+
+    /** Find the parameter or buffer of this pipeline that has the
+     * given canonical name. At most one of the two is defined. */
+    void find_argument(const std::string &canonical_name, Parameter *param, Buffer *buf) const;
+
+    /** Make a copy of the key that doesn't refer to the parameters and
+     * buffers of the pipeline, so that it can be kept without keeping
+     * them alive. */
+    PipelineKey without_arguments() const;
+
+private:
+    std::string text;
+    std::vector<Expr> exprs;
+    uint64_t hash_value;
+    bool is_shareable;
+    std::map<std::string, std::string> names;
+    std::map<std::string, Parameter> params;
+    std::map<std::string, Buffer> buffers;
+};
+
+/** Look up a pipeline in the memo of pipelines jit-compiled by this
+ * process. If there's one with an equal key, this sets module to its
+ * compiled code, and args to the canonical names of its arguments in
+ * order, not counting the outputs, and returns true. The memo holds
+ * the most recently used pipelines. It holds 32 of them, or as many
+ * as the environment variable HL_JIT_MEMO says. Setting HL_JIT_MEMO
+ * to zero turns it off. */
+bool jit_memo_lookup(const PipelineKey &key, JITCompiledModule *module,
+                     std::vector<std::string> *args);
+
+/** Add a jit-compiled pipeline to the memo. Returns whether it was
+ * added, in which case other Funcs may share the module. The memo
+ * may be used from several threads at once. */
+bool jit_memo_insert(const PipelineKey &key, const JITCompiledModule &module,
+                     const std::vector<std::string> &args);
+
+/** The directory that holds the cache of jit-compiled pipelines. This
+ * is the value of the environment variable HL_JIT_CACHE. If it isn't
+ * set, the cache is off, and this returns an empty string. */
+std::string jit_cache_directory();
+
+/** Return the path of the file that holds the compiled form of a
+ * pipeline in the jit cache. The name of the file is a hash of the
+ * lowered statement, the name and arguments of the pipeline, the
+ * target, and the build of %Halide in use, so a change to any of
+ * those gives a different file. Returns an empty string if the cache
+ * is off. */
+std::string jit_cache_file(Stmt s, const std::string &name,
+                           const std::vector<Argument> &args,
+                           const Target &target);
+
+/** Write the module held by a statement compiler to the given file in
+ * the jit cache. The file is written under a temporary name and then
+ * renamed, so that other processes never see it half-written. */
+void jit_cache_store(StmtCompiler &cg, const std::string &file);
+
+}
+}
+
+#endif
@@ -166,6 +166,8 @@ void JITCompiledModule::compile_module(CodeGen *cg, llvm::Module *m, const strin
     // Retrieve function pointers from the compiled module (which also
     // triggers compilation)
     debug(1) << "JIT compiling...\n";
+    PassTimer timer("JIT compilation of " + function_name);
+    timer.start("Generating machine code");
 
     hook_up_function_pointer(ee, m, function_name, true, &function);
 
@@ -182,9 +184,14 @@ void JITCompiledModule::compile_module(CodeGen *cg, llvm::Module *m, const strin
     hook_up_function_pointer(ee, m, "halide_set_custom_do_task", true, &set_custom_do_task);
     hook_up_function_pointer(ee, m, "halide_set_custom_trace", true, &set_custom_trace);
     hook_up_function_pointer(ee, m, "halide_shutdown_thread_pool", true, &shutdown_thread_pool);
+    hook_up_function_pointer(ee, m, "halide_set_thread_pool_limits", true, &set_thread_pool_limits);
+
+    void (*shutdown_profiler)();
+    hook_up_function_pointer(ee, m, "halide_profiler_shutdown", true, &shutdown_profiler);
 
     debug(2) << "Finalizing object\n";
     ee->finalizeObject();
+    timer.stop();
 
     // Stash the various objects that need to stay alive behind a reference-counted pointer.
     module = new JITModuleHolder(ee, m, shutdown_thread_pool);
@@ -192,6 +199,10 @@ void JITCompiledModule::compile_module(CodeGen *cg, llvm::Module *m, const strin
     // Do any target-specific post-compilation module meddling
     cg->jit_finalize(ee, m, &module.ptr->cleanup_routines);
 
+    // Now that the module is set up, make sure the sampling profiler
+    // (if it was ever started) stops before the module goes away.
+    module.ptr->cleanup_routines.push_back(shutdown_profiler);
+
     #ifdef __arm__
     // Flush each function from the dcache so that it gets pulled into
     // the icache correctly.
@@ -73,6 +73,11 @@ struct JITCompiledModule {
      * module is destroyed. */
     void (*shutdown_thread_pool)();
 
+    /** Set the maximum number of threads and the priority of the
+     * thread pool maintained by this JIT module. See \ref
+     * Func::set_thread_pool_limits. */
+    void (*set_thread_pool_limits)(int max_threads, int priority);
+
     // The JIT Module Allocator holds onto the memory storing the functions above.
     IntrusivePtr<JITModuleHolder> module;
 
@@ -87,7 +92,8 @@ struct JITCompiledModule {
         set_custom_do_par_for(NULL),
         set_custom_do_task(NULL),
         set_custom_trace(NULL),
-        shutdown_thread_pool(NULL) {}
+        shutdown_thread_pool(NULL),
+        set_thread_pool_limits(NULL) {}
 
     /** Take an llvm module and compile it. Populates the function
      * pointer members above with the result. */
@@ -8,6 +8,7 @@
 #include "Substitute.h"
 #include "Function.h"
 #include "Scope.h"
+#include "ExprUsesVar.h"
 #include "Bounds.h"
 #include "Simplify.h"
 #include "IRPrinter.h"
@@ -26,6 +27,8 @@
 #include "EarlyFree.h"
 #include "UniquifyVariableNames.h"
 #include "SkipStages.h"
+#include "Prefetch.h"
+#include "PartitionLoops.h"
 #include "CSE.h"
 #include "SpecializeClampedRamps.h"
 #include "RemoveUndef.h"
@@ -33,6 +36,7 @@
 #include "Inline.h"
 #include "Qualify.h"
 #include "UnifyDuplicateLets.h"
+#include "ChooseFactors.h"
 
 namespace Halide {
 namespace Internal {
@@ -62,35 +66,95 @@ void lower_test() {
     g.store_at(f, y).compute_at(f, x);
     h.store_at(f, y).compute_at(f, y);
 
-    Stmt result = lower(f.function());
+    Stmt result = lower(f.function(), get_host_target());
 
     assert(result.defined() && "Lowering returned trivial function");
 
     std::cout << "Lowering test passed" << std::endl;
 }
 
-class ExprUsesVar : public IRVisitor {
-    using IRVisitor::visit;
+namespace {
+// Substitute what a specialization condition says about the params
+// it tests into one version of a loop nest. Only equalities with
+// constants and boolean params say anything useful to the
+// simplifier. Other conditions just select the version.
+Stmt specialize_loop_nest(Stmt s, Expr condition) {
+    if (const And *a = condition.as<And>()) {
+        return specialize_loop_nest(specialize_loop_nest(s, a->a), a->b);
+    } else if (const Variable *var = condition.as<Variable>()) {
+        return substitute(var->name, const_true(), s);
+    } else if (const Not *n = condition.as<Not>()) {
+        if (const Variable *var = n->a.as<Variable>()) {
+            return substitute(var->name, const_false(), s);
+        }
+    } else if (const EQ *eq = condition.as<EQ>()) {
+        const Variable *var = eq->a.as<Variable>();
+        Expr value = eq->b;
+        if (!var) {
+            var = eq->b.as<Variable>();
+            value = eq->a;
+        }
+        if (var && is_const(value)) {
+            return substitute(var->name, value, s);
+        }
+    }
+    return s;
+}
 
-    string var;
+// Wrap the versions of a loop nest specialized for each condition in
+// a schedule around the general version. The specialized versions
+// are made from a loop nest that refers to the params directly
+// wherever the general one refers to bounds computed from them. The
+// first condition added wins.
+Stmt build_specializations(Stmt general, Stmt exact, const Schedule &s, const string &prefix) {
+    Stmt stmt = general;
+    for (size_t i = s.specializations.size(); i > 0; i--) {
+        Expr condition = s.specializations[i-1];
+        debug(2) << "Specializing " << prefix << " on " << condition << "\n";
+        Stmt version = specialize_loop_nest(exact, condition);
+        stmt = IfThenElse::make(condition, version, stmt);
+    }
+    return stmt;
+}
 
-    void visit(const Variable *v) {
-        if (v->name == var) {
-            result = true;
+// The pure vars of a function, and the vars split from them. Any
+// other var in a schedule comes from a reduction domain.
+set<string> pure_loop_vars(Function f, const vector<Schedule::Split> &splits) {
+    set<string> pure_vars(f.args().begin(), f.args().end());
+    for (size_t i = 0; i < splits.size(); i++) {
+        const Schedule::Split &split = splits[i];
+        if (split.is_fuse()) {
+            if (pure_vars.count(split.inner) && pure_vars.count(split.outer)) {
+                pure_vars.insert(split.old_var);
+            }
+        } else if (pure_vars.count(split.old_var)) {
+            pure_vars.insert(split.outer);
+            pure_vars.insert(split.inner);
         }
     }
-public:
-    ExprUsesVar(const string &v) : var(v), result(false) {}
-    bool result;
-};
-bool expr_uses_var(Expr e, const string &v) {
-    ExprUsesVar uses(v);
-    e.accept(&uses);
-    return uses.result;
+    return pure_vars;
 }
 
+// The names of the vectorized loops over a reduction domain. The
+// lanes of these may store to the same site.
+set<string> vectorized_reduction_loops(const map<string, Function> &env) {
+    set<string> loops;
+    for (map<string, Function>::const_iterator iter = env.begin(); iter != env.end(); ++iter) {
+        Function f = iter->second;
+        for (size_t i = 0; i < f.reductions().size(); i++) {
+            const Schedule &s = f.reductions()[i].schedule;
+            set<string> pure_vars = pure_loop_vars(f, s.splits);
+            string prefix = f.name() + ".s" + int_to_string(i+1) + ".";
+            for (size_t j = 0; j < s.dims.size(); j++) {
+                if (s.dims[j].for_type == For::Vectorized && !pure_vars.count(s.dims[j].var)) {
+                    loops.insert(prefix + s.dims[j].var);
+                }
+            }
+        }
+    }
+    return loops;
+}
 
-namespace {
 // A structure representing a containing LetStmt or For loop. Used in
 // build_provide_loop_nest below.
 struct Container {
@@ -106,7 +170,8 @@ Stmt build_provide_loop_nest(Function f,
                              const vector<Expr> &site,
                              const vector<Expr> &values,
                              const Schedule &s,
-                             bool is_update) {
+                             bool is_update,
+                             const Target &target) {
 
     // We'll build it from inside out, starting from a store node,
     // then wrapping it in for loops.
@@ -121,9 +186,63 @@ Stmt build_provide_loop_nest(Function f,
     for (size_t i = 0; i < s.bounds.size(); i++) {
         known_size_dims[s.bounds[i].var] = s.bounds[i].extent;
     }
+    // Then through the reduction domains.
+    if (is_update) {
+        for (size_t i = 0; i < f.reductions().size(); i++) {
+            ReductionDomain dom = f.reductions()[i].domain;
+            if (!dom.defined()) continue;
+            for (size_t j = 0; j < dom.domain().size(); j++) {
+                known_size_dims[dom.domain()[j].var] = dom.domain()[j].extent;
+            }
+        }
+    }
 
     vector<Schedule::Split> splits = s.splits;
 
+    // Pick the factors of splits scheduled with AutoFactor for the
+    // target. The vectorized ones go first, because the unroll
+    // factor depends on the vector width.
+    ostringstream chosen_factors;
+    int vector_factor = 1;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < splits.size(); i++) {
+            Schedule::Split &split = splits[i];
+            if (!split.is_split()) continue;
+
+            For::ForType for_type = For::Serial;
+            for (size_t j = 0; j < s.dims.size(); j++) {
+                if (s.dims[j].var == split.inner) {
+                    for_type = s.dims[j].for_type;
+                }
+            }
+            if ((for_type == For::Vectorized) != (pass == 0)) continue;
+
+            const IntImm *factor = split.factor.as<IntImm>();
+            if (factor && factor->value == AutoFactor) {
+                if (!chosen_factors.str().empty()) chosen_factors << ",";
+                int chosen;
+                if (for_type == For::Vectorized) {
+                    chosen = choose_vector_factor(values, target);
+                    chosen_factors << " vectorize " << split.old_var << " by " << chosen;
+                } else if (for_type == For::Unrolled) {
+                    chosen = choose_unroll_factor(values, vector_factor, target);
+                    chosen_factors << " unroll " << split.old_var << " by " << chosen;
+                } else {
+                    std::cerr << "The split of " << split.old_var << " in " << prefix
+                              << " has an automatic factor, but its inner dimension"
+                              << " is neither vectorized nor unrolled.\n";
+                    assert(false);
+                    chosen = 1;
+                }
+                split.factor = chosen;
+                factor = split.factor.as<IntImm>();
+            }
+            if (for_type == For::Vectorized && factor) {
+                vector_factor *= factor->value;
+            }
+        }
+    }
+
     // Rebalance the split tree to make the outermost split first.
     for (size_t i = 0; i < splits.size(); i++) {
         for (size_t j = i+1; j < splits.size(); j++) {
@@ -161,6 +280,12 @@ Stmt build_provide_loop_nest(Function f,
         }
     }
 
+    // Conditions that must hold for the provide to run, from splits
+    // that guard their tails with an if.
+    vector<Expr> guards;
+
+    set<string> pure_vars = pure_loop_vars(f, splits);
+
     // Define the function args in terms of the loop variables using the splits
     map<string, pair<string, Expr> > base_values;
     for (size_t i = 0; i < splits.size(); i++) {
@@ -175,6 +300,19 @@ Stmt build_provide_loop_nest(Function f,
 
             Expr base = outer * split.factor + old_min;
 
+            TailStrategy tail = split.tail;
+            if (tail == TailAuto) {
+                if (!is_update) {
+                    tail = TailShiftInwards;
+                } else if (pure_vars.count(split.old_var)) {
+                    tail = TailRoundUp;
+                } else {
+                    // Rounding up a reduction domain would add
+                    // extra terms to the reduction.
+                    tail = TailGuardWithIf;
+                }
+            }
+
             map<string, Expr>::iterator iter = known_size_dims.find(split.old_var);
             if ((iter != known_size_dims.end()) &&
                 is_zero(simplify(iter->second % split.factor))) {
@@ -182,7 +320,14 @@ Stmt build_provide_loop_nest(Function f,
                 // We have proved that the split factor divides the
                 // old extent. No need to adjust the base.
                 known_size_dims[split.outer] = iter->second / split.factor;
-            } else if (!is_update) {
+                tail = TailRoundUp;
+            } else if (tail == TailShiftInwards) {
+                if (is_update) {
+                    std::cerr << "Can't shift the tail of the split of " << split.old_var
+                              << " in an update of " << f.name() << " inwards, because"
+                              << " that would compute some points of the update twice.\n";
+                    assert(false);
+                }
                 // Adjust the base downwards to not compute off the
                 // end of the realization.
 
@@ -192,8 +337,19 @@ Stmt build_provide_loop_nest(Function f,
 
             string base_name = prefix + split.inner + ".base";
             Expr base_var = Variable::make(Int(32), base_name);
-            //stmt = LetStmt::make(prefix + split.old_var, base_var + inner, stmt);
-            stmt = substitute(prefix + split.old_var, base_var + inner, stmt);
+            if (tail == TailGuardWithIf) {
+                // Skip the points past the end of the
+                // realization. Keep the old var as a let so that
+                // bounds inference can see the condition bounding
+                // it. The condition gets wrapped around the provide
+                // once all the lets have been pulled out.
+                Expr old_var = Variable::make(Int(32), prefix + split.old_var);
+                guards.push_back(old_var <= old_max);
+                stmt = LetStmt::make(prefix + split.old_var, base_var + inner, stmt);
+            } else {
+                //stmt = LetStmt::make(prefix + split.old_var, base_var + inner, stmt);
+                stmt = substitute(prefix + split.old_var, base_var + inner, stmt);
+            }
 
             // Don't put the let here, put it just inside the loop over outer
             stmt = LetStmt::make(base_name, base, stmt);
@@ -236,6 +392,12 @@ Stmt build_provide_loop_nest(Function f,
         stmt = let->body;
     }
 
+    // Guard the provide with the conditions from the splits. These
+    // go inside all the lets, so that the vars they test are defined.
+    for (size_t i = 0; i < guards.size(); i++) {
+        stmt = IfThenElse::make(guards[i], stmt);
+    }
+
     // Resort the containers vector so that lets are as far outwards
     // as possible. Use reverse insertion sort. Start at the first letstmt.
     for (int i = (int)s.dims.size(); i < (int)nest.size(); i++) {
@@ -307,6 +469,11 @@ Stmt build_provide_loop_nest(Function f,
         }
     }
 
+    if (!chosen_factors.str().empty()) {
+        debug(1) << "Chose factors for " << prefix.substr(0, prefix.size() - 1)
+                 << ":" << chosen_factors.str() << "\n";
+    }
+
     // Define the loop mins and extents in terms of the mins and maxs produced by bounds inference
     for (size_t i = 0; i < f.args().size(); i++) {
         string var = prefix + f.args()[i];
@@ -328,7 +495,7 @@ Stmt build_provide_loop_nest(Function f,
 // which it should be realized. It will compute at least those
 // bounds (depending on splits, it may compute more). This loop
 // won't do any allocation.
-Stmt build_produce(Function f) {
+Stmt build_produce(Function f, const Target &target) {
 
     if (f.has_extern_definition()) {
         // Call the external function
@@ -463,12 +630,13 @@ Stmt build_produce(Function f) {
             site.push_back(Variable::make(Int(32), prefix + f.args()[i]));
         }
 
-        return build_provide_loop_nest(f, prefix, site, values, f.schedule(), false);
+        Stmt loop = build_provide_loop_nest(f, prefix, site, values, f.schedule(), false, target);
+        return build_specializations(loop, loop, f.schedule(), prefix);
     }
 }
 
 // Build the loop nests that update a function (assuming it's a reduction).
-vector<Stmt> build_update(Function f) {
+vector<Stmt> build_update(Function f, const Target &target) {
 
     vector<Stmt> updates;
 
@@ -492,9 +660,12 @@ vector<Stmt> build_update(Function f) {
             debug(2) << "Reduction site " << i << " = " << s << "\n";
         }
 
-        Stmt loop = build_provide_loop_nest(f, prefix, site, values, r.schedule, true);
+        Stmt loop = build_provide_loop_nest(f, prefix, site, values, r.schedule, true, target);
 
-        // Now define the bounds on the reduction domain
+        // Now define the bounds on the reduction domain. The
+        // specialized versions use the bounds as written, so that
+        // they see the values of the params they are specialized on.
+        Stmt exact = loop;
         if (r.domain.defined()) {
             const vector<ReductionVariable> &dom = r.domain.domain();
             for (size_t i = 0; i < dom.size(); i++) {
@@ -504,18 +675,21 @@ vector<Stmt> build_update(Function f) {
                 loop = LetStmt::make(p + ".loop_min", rmin, loop);
                 loop = LetStmt::make(p + ".loop_max", rmax, loop);
                 loop = LetStmt::make(p + ".loop_extent", rmax - rmin + 1, loop);
+                exact = LetStmt::make(p + ".loop_min", dom[i].min, exact);
+                exact = LetStmt::make(p + ".loop_max", dom[i].min + dom[i].extent - 1, exact);
+                exact = LetStmt::make(p + ".loop_extent", dom[i].extent, exact);
             }
         }
 
-        updates.push_back(loop);
+        updates.push_back(build_specializations(loop, exact, r.schedule, prefix));
     }
 
     return updates;
 }
 
-pair<Stmt, Stmt> build_production(Function func) {
-    Stmt produce = build_produce(func);
-    vector<Stmt> updates = build_update(func);
+pair<Stmt, Stmt> build_production(Function func, const Target &target) {
+    Stmt produce = build_produce(func, target);
+    vector<Stmt> updates = build_update(func, target);
 
     // Build it from the last stage backwards.
     Stmt merged_updates;
@@ -584,16 +758,17 @@ bool function_is_called_in_stmt(Function f, Stmt s) {
 class InjectRealization : public IRMutator {
 public:
     const Function &func;
+    const Target &target;
     bool found_store_level, found_compute_level;
 
-    InjectRealization(const Function &f) :
-        func(f), found_store_level(false), found_compute_level(false) {}
+    InjectRealization(const Function &f, const Target &t) :
+        func(f), target(t), found_store_level(false), found_compute_level(false) {}
 private:
 
     string producing;
 
     Stmt build_pipeline(Stmt s) {
-        pair<Stmt, Stmt> realization = build_production(func);
+        pair<Stmt, Stmt> realization = build_production(func, target);
         return Pipeline::make(func.name(), realization.first, realization.second, s);
     }
 
@@ -898,9 +1073,9 @@ vector<string> realization_order(string output, const map<string, Function> &env
 
 }
 
-Stmt create_initial_loop_nest(Function f) {
+Stmt create_initial_loop_nest(Function f, const Target &t) {
     // Generate initial loop nest
-    pair<Stmt, Stmt> r = build_production(f);
+    pair<Stmt, Stmt> r = build_production(f, t);
     Stmt s = r.first;
     // This must be in a pipeline so that bounds inference understands the update step
     s = Pipeline::make(f.name(), r.first, r.second, AssertStmt::make(const_true(), "Dummy consume step"));
@@ -1008,10 +1183,12 @@ void validate_schedule(Function f, Stmt s, bool is_output) {
         const vector<ReductionVariable> &rvars = r.domain.domain();
         const vector<Schedule::Dim> &dims = r.schedule.dims;
 
-        // Look for the rvars in order
+        // Look for the rvars in order. A split rvar is found by the
+        // first of the dims split from it.
         size_t next = 0;
         for (size_t j = 0; j < dims.size() && next < rvars.size(); j++) {
-            if (rvars[next].var == dims[j].var) {
+            if (rvars[next].var == dims[j].var ||
+                starts_with(dims[j].var, rvars[next].var + ".")) {
                 next++;
             }
         }
@@ -1080,7 +1257,8 @@ void validate_schedule(Function f, Stmt s, bool is_output) {
 
 Stmt schedule_functions(Stmt s, const vector<string> &order,
                         const map<string, Function> &env,
-                        const map<string, set<string> > &graph) {
+                        const map<string, set<string> > &graph,
+                        const Target &t) {
 
     // Inject a loop over root to give us a scheduling point
     string root_var = Schedule::LoopLevel::root().func + "." + Schedule::LoopLevel::root().var;
@@ -1101,7 +1279,7 @@ Stmt schedule_functions(Stmt s, const vector<string> &order,
             s = inline_function(s, f);
         } else {
             debug(1) << "Injecting realization of " << order[i-1] << '\n';
-            InjectRealization injector(f);
+            InjectRealization injector(f, t);
             s = injector.mutate(s);
             assert(injector.found_store_level && injector.found_compute_level);
         }
@@ -1518,7 +1696,9 @@ Stmt add_image_checks(Stmt s, Function f) {
     return s;
 }
 
-Stmt lower(Function f) {
+Stmt lower(Function f, const Target &t) {
+    PassTimer timer("lowering " + f.name());
+    timer.start("Computing the realization order");
 
     // Compute an environment
     map<string, Function> env;
@@ -1527,26 +1707,31 @@ Stmt lower(Function f) {
     // Compute a realization order
     map<string, set<string> > graph;
     vector<string> order = realization_order(f.name(), env, graph);
-    Stmt s = create_initial_loop_nest(f);
+    Stmt s = create_initial_loop_nest(f, t);
 
     debug(2) << "Initial statement: " << '\n' << s << '\n';
-    s = schedule_functions(s, order, env, graph);
+    timer.start("Injecting realizations");
+    s = schedule_functions(s, order, env, graph, t);
     debug(2) << "All realizations injected:\n" << s << '\n';
 
+    timer.start("Injecting tracing");
     debug(1) << "Injecting tracing...\n";
     s = inject_tracing(s, env, f);
     debug(2) << "Tracing injected:\n" << s << '\n';
 
+    timer.start("Injecting profiling");
     debug(1) << "Injecting profiling...\n";
     s = inject_profiling(s, f.name());
     debug(2) << "Profiling injected:\n" << s << '\n';
 
+    timer.start("Adding checks for parameters");
     debug(1) << "Adding checks for parameters\n";
     s = add_parameter_checks(s);
     debug(2) << "Parameter checks injected:\n" << s << '\n';
 
     // The checks will be in terms of the symbols defined by bounds
     // inference.
+    timer.start("Adding checks for images");
     debug(1) << "Adding checks for images\n";
     s = add_image_checks(s, f);
     debug(2) << "Image checks injected:\n" << s << '\n';
@@ -1554,14 +1739,17 @@ Stmt lower(Function f) {
     // This pass injects nested definitions of variable names, so we
     // can't simplify statements from here until we fix them up. (We
     // can still simplify Exprs).
+    timer.start("Performing computation bounds inference");
     debug(1) << "Performing computation bounds inference...\n";
     s = bounds_inference(s, order, env);
     debug(2) << "Computation bounds inference:\n" << s << '\n';
 
+    timer.start("Performing sliding window optimization");
     debug(1) << "Performing sliding window optimization...\n";
     s = sliding_window(s, env);
     debug(2) << "Sliding window:\n" << s << '\n';
 
+    timer.start("Performing allocation bounds inference");
     debug(1) << "Performing allocation bounds inference...\n";
     s = allocation_bounds_inference(s, env);
     debug(2) << "Allocation bounds inference:\n" << s << '\n';
@@ -1569,72 +1757,99 @@ Stmt lower(Function f) {
     // This uniquifies the variable names, so we're good to simplify
     // after this point. This lets later passes assume syntactic
     // equivalence means semantic equivalence.
+    timer.start("Uniquifying variable names");
     debug(1) << "Uniquifying variable names...\n";
     s = uniquify_variable_names(s);
     debug(2) << "Uniquified variable names: \n" << s << "\n\n";
 
+    timer.start("Performing storage folding optimization");
     debug(1) << "Performing storage folding optimization...\n";
     s = storage_folding(s);
     debug(2) << "Storage folding:\n" << s << '\n';
 
+    timer.start("Injecting debug_to_file calls");
     debug(1) << "Injecting debug_to_file calls...\n";
     s = debug_to_file(s, order[order.size()-1], env);
     debug(2) << "Injected debug_to_file calls:\n" << s << '\n';
 
+    timer.start("Simplifying");
     debug(1) << "Simplifying...\n"; // without removing dead lets, because storage flattening needs the strides
     s = simplify(s, false);
     debug(2) << "Simplified: \n" << s << "\n\n";
 
+    timer.start("Dynamically skipping stages");
     debug(1) << "Dynamically skipping stages...\n";
     s = skip_stages(s, order);
     debug(2) << "Dynamically skipped stages: \n" << s << "\n\n";
 
+    timer.start("Performing storage flattening");
     debug(1) << "Performing storage flattening...\n";
     s = storage_flattening(s, env);
     debug(2) << "Storage flattening: \n" << s << "\n\n";
 
+    timer.start("Injecting prefetches");
+    debug(1) << "Injecting prefetches...\n";
+    s = inject_prefetch(s, env);
+    debug(2) << "Injected prefetches: \n" << s << "\n\n";
+
+    timer.start("Removing code that depends on undef values");
     debug(1) << "Removing code that depends on undef values...\n";
     s = remove_undef(s);
     debug(2) << "Removed code that depends on undef values: \n" << s << "\n\n;";
 
+    timer.start("Simplifying");
     debug(1) << "Simplifying...\n";
     s = simplify(s);
     s = unify_duplicate_lets(s);
     s = remove_trivial_for_loops(s);
     debug(2) << "Simplified: \n" << s << "\n\n";
 
+    timer.start("Unrolling");
     debug(1) << "Unrolling...\n";
     s = unroll_loops(s);
     debug(2) << "Unrolled: \n" << s << "\n\n";
 
+    timer.start("Simplifying");
     debug(1) << "Simplifying...\n";
     s = simplify(s);
     debug(2) << "Simplified: \n" << s << "\n\n";
 
+    timer.start("Partitioning loops");
+    debug(1) << "Partitioning loops...\n";
+    s = partition_loops(s);
+    debug(2) << "Partitioned loops: \n" << s << "\n\n";
+
+    timer.start("Vectorizing");
     debug(1) << "Vectorizing...\n";
-    s = vectorize_loops(s);
+    s = vectorize_loops(s, vectorized_reduction_loops(env));
     debug(2) << "Vectorized: \n" << s << "\n\n";
 
+    timer.start("Simplifying");
     debug(1) << "Simplifying...\n";
     s = simplify(s);
     debug(2) << "Simplified: \n" << s << "\n\n";
 
+    timer.start("Specializing clamped ramps");
     debug(1) << "Specializing clamped ramps...\n";
     s = specialize_clamped_ramps(s);
     s = simplify(s);
     debug(2) << "Specialized clamped ramps: \n" << s << "\n\n";
 
+    timer.start("Detecting vector interleavings");
     debug(1) << "Detecting vector interleavings...\n";
     s = rewrite_interleavings(s);
     debug(2) << "Rewrote vector interleavings: \n" << s << "\n\n";
 
+    timer.start("Injecting early frees");
     debug(1) << "Injecting early frees...\n";
     s = inject_early_frees(s);
     debug(2) << "Injected early frees: \n" << s << "\n\n";
 
+    timer.start("Simplifying");
     debug(1) << "Simplifying...\n";
     s = common_subexpression_elimination(s);
     s = simplify(s);
+    timer.stop();
     debug(1) << "Simplified: \n" << s << "\n\n";
 
     return s;
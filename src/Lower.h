@@ -9,14 +9,16 @@
 
 #include "IR.h"
 #include "Func.h"
+#include "Target.h"
 
 namespace Halide {
 namespace Internal {
 
 /** Given a halide function with a schedule, create a statement that
  * evaluates it. Automatically pulls in all the functions f depends
- * on */
-Stmt lower(Function f);
+ * on. The target is used to pick the factors of splits scheduled with
+ * AutoFactor. */
+Stmt lower(Function f, const Target &t);
 
 void lower_test();
 
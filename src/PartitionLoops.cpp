@@ -0,0 +1,428 @@
+#include "PartitionLoops.h"
+#include "IRMutator.h"
+#include "IRVisitor.h"
+#include "IROperator.h"
+#include "Bounds.h"
+#include "Scope.h"
+#include "ExprUsesVar.h"
+#include "Simplify.h"
+#include "Substitute.h"
+#include "IRPrinter.h"
+#include "Debug.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+bool is_gpu_loop(const string &name) {
+    string n = base_name(name);
+    return starts_with(n, "threadid") || starts_with(n, "blockid");
+}
+
+// Write e as coeff*var + rest, if it is linear in var.
+bool linear_in_var(Expr e, const string &var, int *coeff, Expr *rest) {
+    int ca, cb;
+    Expr ra, rb;
+    if (const Variable *v = e.as<Variable>()) {
+        if (v->name == var) {
+            *coeff = 1;
+            *rest = make_zero(e.type());
+            return true;
+        }
+    } else if (const Add *add = e.as<Add>()) {
+        if (linear_in_var(add->a, var, &ca, &ra) &&
+            linear_in_var(add->b, var, &cb, &rb)) {
+            *coeff = ca + cb;
+            *rest = ra + rb;
+            return true;
+        }
+        return false;
+    } else if (const Sub *sub = e.as<Sub>()) {
+        if (linear_in_var(sub->a, var, &ca, &ra) &&
+            linear_in_var(sub->b, var, &cb, &rb)) {
+            *coeff = ca - cb;
+            *rest = ra - rb;
+            return true;
+        }
+        return false;
+    } else if (const Mul *mul = e.as<Mul>()) {
+        const int *k = as_const_int(mul->b);
+        if (k && linear_in_var(mul->a, var, &ca, &ra)) {
+            *coeff = ca * (*k);
+            *rest = ra * (*k);
+            return true;
+        }
+    }
+
+    Scope<int> scope;
+    scope.push(var, 0);
+    if (expr_uses_vars(e, scope)) return false;
+    *coeff = 0;
+    *rest = e;
+    return true;
+}
+
+// Find the range of var over which e <= 0, if e is linear in
+// var. One end of the range is unbounded, so only one of lo and hi
+// gets set.
+bool solve_le_zero(Expr e, const string &var, Expr *lo, Expr *hi) {
+    int c;
+    Expr rest;
+    if (!linear_in_var(e, var, &c, &rest) || c == 0) return false;
+
+    // c*var + rest <= 0. Division rounds down.
+    if (c > 0) {
+        *hi = simplify((0 - rest) / c);
+    } else {
+        *lo = simplify((rest + (-c - 1)) / (-c));
+    }
+    return true;
+}
+
+// Make the version of a loop body for the steady state, and find
+// the range of the loop variable it is valid for. The mins and maxes
+// of something that moves with the loop and something that doesn't
+// get replaced with the moving side, and selects and ifs with
+// conditions that move with the loop get replaced with the moving
+// or non-constant side. Each replacement is only made if the range
+// over which it is valid can be found.
+class FindSteadyState : public IRMutator {
+    const string &loop_var;
+
+    // Bounds on the inner loop variables and lets, in terms of the
+    // loop variable and things defined outside the loop.
+    Scope<Interval> scope;
+
+    // The loop variable, and the inner loop variables and lets that
+    // change with it.
+    Scope<int> varying;
+
+    using IRMutator::visit;
+
+    bool varies(Expr e) {
+        return expr_uses_vars(e, varying);
+    }
+
+    // If each of the exprs is at most zero over a range of the loop
+    // variable, for all values of the inner variables, restrict the
+    // steady state to that range.
+    bool holds_when_le_zero(const vector<Expr> &exprs) {
+        vector<Expr> new_lows, new_highs;
+        for (size_t i = 0; i < exprs.size(); i++) {
+            Interval b = bounds_of_expr_in_scope(exprs[i], scope);
+            if (!b.max.defined()) return false;
+            Expr lo, hi;
+            if (!solve_le_zero(simplify(b.max), loop_var, &lo, &hi)) return false;
+            // The range gets computed before the loop, so it can't
+            // depend on anything the loop might write.
+            if ((lo.defined() && expr_reads_memory(lo)) ||
+                (hi.defined() && expr_reads_memory(hi))) {
+                return false;
+            }
+            if (lo.defined()) new_lows.push_back(lo);
+            if (hi.defined()) new_highs.push_back(hi);
+        }
+        lows.insert(lows.end(), new_lows.begin(), new_lows.end());
+        highs.insert(highs.end(), new_highs.begin(), new_highs.end());
+        return true;
+    }
+
+    // Express a condition taking the given value as a list of
+    // expressions that must all be at most zero.
+    bool condition_as_le_zero(Expr cond, bool value, vector<Expr> &exprs) {
+        if (const Not *n = cond.as<Not>()) {
+            return condition_as_le_zero(n->a, !value, exprs);
+        } else if (const And *a = cond.as<And>()) {
+            return value &&
+                condition_as_le_zero(a->a, true, exprs) &&
+                condition_as_le_zero(a->b, true, exprs);
+        } else if (const Or *o = cond.as<Or>()) {
+            return !value &&
+                condition_as_le_zero(o->a, false, exprs) &&
+                condition_as_le_zero(o->b, false, exprs);
+        }
+
+        // Normalize to a < b or a <= b.
+        Expr a, b;
+        bool strict;
+        if (const LT *lt = cond.as<LT>()) {
+            a = lt->a; b = lt->b; strict = true;
+        } else if (const LE *le = cond.as<LE>()) {
+            a = le->a; b = le->b; strict = false;
+        } else if (const GT *gt = cond.as<GT>()) {
+            a = gt->b; b = gt->a; strict = true;
+        } else if (const GE *ge = cond.as<GE>()) {
+            a = ge->b; b = ge->a; strict = false;
+        } else {
+            return false;
+        }
+        if (a.type() != Int(32)) return false;
+
+        if (value) {
+            exprs.push_back(strict ? (a - b) + 1 : a - b);
+        } else {
+            // The negation of a < b is b <= a.
+            exprs.push_back(strict ? b - a : (b - a) + 1);
+        }
+        return true;
+    }
+
+    // Which side of a select or if to keep in the steady state: the
+    // one that moves with the loop, or else the one that isn't a
+    // constant. Returns -1 for neither.
+    int side_to_keep(Expr true_value, Expr false_value) {
+        bool vt = varies(true_value), vf = varies(false_value);
+        bool ct = is_const(true_value), cf = is_const(false_value);
+        if (vt != vf) return vt ? 1 : 0;
+        if (ct != cf) return cf ? 1 : 0;
+        return -1;
+    }
+
+    void visit(const Min *op) {
+        Expr a = mutate(op->a);
+        Expr b = mutate(op->b);
+        bool va = varies(a), vb = varies(b);
+        if (op->type == Int(32) && va && !vb && holds_when_le_zero(vec(a - b))) {
+            expr = a;
+        } else if (op->type == Int(32) && vb && !va && holds_when_le_zero(vec(b - a))) {
+            expr = b;
+        } else if (a.same_as(op->a) && b.same_as(op->b)) {
+            expr = op;
+        } else {
+            expr = Min::make(a, b);
+        }
+    }
+
+    void visit(const Max *op) {
+        Expr a = mutate(op->a);
+        Expr b = mutate(op->b);
+        bool va = varies(a), vb = varies(b);
+        if (op->type == Int(32) && va && !vb && holds_when_le_zero(vec(b - a))) {
+            expr = a;
+        } else if (op->type == Int(32) && vb && !va && holds_when_le_zero(vec(a - b))) {
+            expr = b;
+        } else if (a.same_as(op->a) && b.same_as(op->b)) {
+            expr = op;
+        } else {
+            expr = Max::make(a, b);
+        }
+    }
+
+    void visit(const Select *op) {
+        Expr cond = mutate(op->condition);
+        Expr t = mutate(op->true_value);
+        Expr f = mutate(op->false_value);
+        int keep = -1;
+        vector<Expr> exprs;
+        if (cond.type().is_scalar() && varies(cond)) {
+            keep = side_to_keep(t, f);
+            if (keep >= 0 &&
+                !(condition_as_le_zero(cond, keep == 1, exprs) &&
+                  holds_when_le_zero(exprs))) {
+                keep = -1;
+            }
+        }
+        if (keep == 1) {
+            expr = t;
+        } else if (keep == 0) {
+            expr = f;
+        } else if (cond.same_as(op->condition) &&
+                   t.same_as(op->true_value) &&
+                   f.same_as(op->false_value)) {
+            expr = op;
+        } else {
+            expr = Select::make(cond, t, f);
+        }
+    }
+
+    void visit(const IfThenElse *op) {
+        Expr cond = mutate(op->condition);
+        Stmt then_case = mutate(op->then_case);
+        Stmt else_case = mutate(op->else_case);
+        vector<Expr> exprs;
+        if (varies(cond) &&
+            condition_as_le_zero(cond, true, exprs) &&
+            holds_when_le_zero(exprs)) {
+            stmt = then_case;
+        } else if (cond.same_as(op->condition) &&
+                   then_case.same_as(op->then_case) &&
+                   else_case.same_as(op->else_case)) {
+            stmt = op;
+        } else {
+            stmt = IfThenElse::make(cond, then_case, else_case);
+        }
+    }
+
+    void visit(const Let *op) {
+        Expr value = mutate(op->value);
+        scope.push(op->name, bounds_of_expr_in_scope(value, scope));
+        bool v = varies(value);
+        if (v) varying.push(op->name, 0);
+        Expr body = mutate(op->body);
+        if (v) varying.pop(op->name);
+        scope.pop(op->name);
+        if (value.same_as(op->value) && body.same_as(op->body)) {
+            expr = op;
+        } else {
+            expr = Let::make(op->name, value, body);
+        }
+    }
+
+    void visit(const LetStmt *op) {
+        Expr value = mutate(op->value);
+        scope.push(op->name, bounds_of_expr_in_scope(value, scope));
+        bool v = varies(value);
+        if (v) varying.push(op->name, 0);
+        Stmt body = mutate(op->body);
+        if (v) varying.pop(op->name);
+        scope.pop(op->name);
+        if (value.same_as(op->value) && body.same_as(op->body)) {
+            stmt = op;
+        } else {
+            stmt = LetStmt::make(op->name, value, body);
+        }
+    }
+
+    void visit(const For *op) {
+        Expr min = mutate(op->min);
+        Expr extent = mutate(op->extent);
+        Interval min_bounds = bounds_of_expr_in_scope(min, scope);
+        Interval extent_bounds = bounds_of_expr_in_scope(extent, scope);
+        Interval i;
+        if (min_bounds.min.defined() && min_bounds.max.defined() && extent_bounds.max.defined()) {
+            i = Interval(min_bounds.min, min_bounds.max + extent_bounds.max - 1);
+        }
+        scope.push(op->name, i);
+        bool v = varies(min) || varies(extent);
+        if (v) varying.push(op->name, 0);
+        Stmt body = mutate(op->body);
+        if (v) varying.pop(op->name);
+        scope.pop(op->name);
+        if (min.same_as(op->min) && extent.same_as(op->extent) && body.same_as(op->body)) {
+            stmt = op;
+        } else {
+            stmt = For::make(op->name, min, extent, op->for_type, body);
+        }
+    }
+
+public:
+    // The steady state is where the loop variable is at least each
+    // of the lows and at most each of the highs.
+    vector<Expr> lows, highs;
+
+    FindSteadyState(const string &v) : loop_var(v) {
+        varying.push(v, 0);
+    }
+};
+
+class PartitionLoops : public IRMutator {
+    using IRMutator::visit;
+
+    void visit(const For *op) {
+        if (is_gpu_loop(op->name)) {
+            stmt = op;
+            return;
+        }
+
+        // Work from the outside in, so that the inner loops only get
+        // partitioned within the steady state of the outer ones.
+        FindSteadyState finder(op->name);
+        Stmt steady = op->body;
+        if (op->for_type == For::Serial) {
+            steady = finder.mutate(op->body);
+        }
+        steady = mutate(steady);
+
+        if (finder.lows.empty() && finder.highs.empty()) {
+            Stmt body = steady;
+            if (body.same_as(op->body)) {
+                stmt = op;
+            } else {
+                stmt = For::make(op->name, op->min, op->extent, op->for_type, body);
+            }
+            return;
+        }
+
+        // Clamp the steady state to the loop, and the epilogue to
+        // after the prologue.
+        Expr loop_end = op->min + op->extent;
+        string prologue_end_name = op->name + ".prologue_end";
+        string epilogue_start_name = op->name + ".epilogue_start";
+        Expr prologue_end = Variable::make(Int(32), prologue_end_name);
+        Expr epilogue_start = Variable::make(Int(32), epilogue_start_name);
+
+        Expr prologue_end_value = op->min;
+        for (size_t i = 0; i < finder.lows.size(); i++) {
+            prologue_end_value = Max::make(prologue_end_value, finder.lows[i]);
+        }
+        prologue_end_value = simplify(Min::make(prologue_end_value, loop_end));
+
+        Expr epilogue_start_value = loop_end;
+        for (size_t i = 0; i < finder.highs.size(); i++) {
+            epilogue_start_value = Min::make(epilogue_start_value, finder.highs[i] + 1);
+        }
+        epilogue_start_value = simplify(Max::make(epilogue_start_value, prologue_end));
+
+        debug(3) << "Partitioning loop over " << op->name
+                 << " with steady state [" << prologue_end_value << ", "
+                 << epilogue_start_value << ")\n";
+
+        // The prologue and epilogue are usually a few iterations at
+        // the edges, so they get the original body, with the inner
+        // loops left whole. Partitioning those too would multiply the
+        // code size for each level of nesting.
+        Stmt s = For::make(op->name, prologue_end, epilogue_start - prologue_end, op->for_type, steady);
+        if (!finder.lows.empty()) {
+            Stmt prologue = For::make(op->name, op->min, prologue_end - op->min, op->for_type, op->body);
+            s = Block::make(prologue, s);
+        }
+        if (!finder.highs.empty()) {
+            Stmt epilogue = For::make(op->name, epilogue_start, loop_end - epilogue_start, op->for_type, op->body);
+            s = Block::make(s, epilogue);
+        }
+        s = LetStmt::make(epilogue_start_name, epilogue_start_value, s);
+        stmt = LetStmt::make(prologue_end_name, prologue_end_value, s);
+    }
+};
+
+// Remove the pieces of partitioned loops that are empty.
+class RemoveEmptyLoops : public IRMutator {
+    using IRMutator::visit;
+
+    bool is_empty_loop(Stmt s) {
+        const For *loop = s.as<For>();
+        return loop && is_zero(loop->extent);
+    }
+
+    void visit(const Block *op) {
+        Stmt first = mutate(op->first);
+        Stmt rest = op->rest.defined() ? mutate(op->rest) : op->rest;
+        if (rest.defined() && is_empty_loop(first)) {
+            stmt = rest;
+        } else if (rest.defined() && is_empty_loop(rest)) {
+            stmt = first;
+        } else if (first.same_as(op->first) && rest.same_as(op->rest)) {
+            stmt = op;
+        } else {
+            stmt = Block::make(first, rest);
+        }
+    }
+};
+
+}
+
+Stmt partition_loops(Stmt s) {
+    s = PartitionLoops().mutate(s);
+    // The simplifier can often show that some of the pieces are
+    // empty, e.g. when a loop over a few rows is entirely in the
+    // interior.
+    s = simplify(s);
+    return RemoveEmptyLoops().mutate(s);
+}
+
+}
+}
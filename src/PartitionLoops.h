@@ -0,0 +1,27 @@
+#ifndef HALIDE_PARTITION_LOOPS_H
+#define HALIDE_PARTITION_LOOPS_H
+
+/** \file
+ * Defines a lowering pass that partitions loop bodies into the
+ * boundary cases and a steady state free of boundary conditions.
+ */
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Split each serial loop into a prologue, a steady state, and an
+ * epilogue. The steady state covers the range of the loop variable
+ * over which the mins, maxes, selects, and ifs in the body that
+ * clamp or guard something moving with the loop are known to go one
+ * particular way, and has them replaced with that way. E.g. the
+ * clamp in a boundary condition, or the if guarding the tail of a
+ * split. The prologue and epilogue run the original body over the
+ * rest of the range. */
+Stmt partition_loops(Stmt s);
+
+}
+}
+
+#endif
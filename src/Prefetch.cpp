@@ -0,0 +1,246 @@
+#include <algorithm>
+
+#include "Prefetch.h"
+#include "IRMutator.h"
+#include "IRVisitor.h"
+#include "IROperator.h"
+#include "IREquality.h"
+#include "Bounds.h"
+#include "Scope.h"
+#include "ExprUsesVar.h"
+#include "Simplify.h"
+#include "Substitute.h"
+#include "Function.h"
+#include "IRPrinter.h"
+#include "Debug.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace {
+
+// The prefetches of a range of memory are spaced out by this many
+// bytes.
+const int cache_line_bytes = 64;
+
+bool is_gpu_loop(const string &name) {
+    string n = base_name(name);
+    return starts_with(n, "threadid") || starts_with(n, "blockid");
+}
+
+class ReadsMemory : public IRVisitor {
+    using IRVisitor::visit;
+
+    void visit(const Load *) {
+        result = true;
+    }
+public:
+    bool result;
+    ReadsMemory() : result(false) {}
+};
+
+bool reads_memory(Expr e) {
+    ReadsMemory r;
+    e.accept(&r);
+    return r.result;
+}
+
+// The range of flat indices of a buffer touched by a single load
+// over one iteration of a loop.
+struct Footprint {
+    const Load *load;
+    Expr min, max;
+};
+
+// Find the footprint of each load in a loop body, in terms of the
+// variables defined outside of it. Loads from buffers allocated
+// inside the body are skipped, as are loads at indices computed from
+// other loads, which can't usefully be bounded.
+class FindFootprints : public IRVisitor {
+    Scope<Interval> scope;
+    Scope<int> inner_allocations;
+
+    using IRVisitor::visit;
+
+    void visit(const For *op) {
+        op->min.accept(this);
+        op->extent.accept(this);
+        Interval min = bounds_of_expr_in_scope(op->min, scope);
+        Interval extent = bounds_of_expr_in_scope(op->extent, scope);
+        Interval i;
+        if (min.min.defined() && min.max.defined() && extent.max.defined()) {
+            i = Interval(min.min, min.max + extent.max - 1);
+        }
+        scope.push(op->name, i);
+        op->body.accept(this);
+        scope.pop(op->name);
+    }
+
+    void visit(const LetStmt *op) {
+        op->value.accept(this);
+        scope.push(op->name, bounds_of_expr_in_scope(op->value, scope));
+        op->body.accept(this);
+        scope.pop(op->name);
+    }
+
+    void visit(const Let *op) {
+        op->value.accept(this);
+        scope.push(op->name, bounds_of_expr_in_scope(op->value, scope));
+        op->body.accept(this);
+        scope.pop(op->name);
+    }
+
+    void visit(const Allocate *op) {
+        op->size.accept(this);
+        inner_allocations.push(op->name, 0);
+        op->body.accept(this);
+        inner_allocations.pop(op->name);
+    }
+
+    void visit(const Load *op) {
+        IRVisitor::visit(op);
+        if (inner_allocations.contains(op->name) || reads_memory(op->index)) {
+            return;
+        }
+        Interval i = bounds_of_expr_in_scope(op->index, scope);
+        if (i.min.defined() && i.max.defined()) {
+            Footprint f = {op, i.min, i.max};
+            footprints.push_back(f);
+        }
+    }
+
+public:
+    vector<Footprint> footprints;
+};
+
+class InjectPrefetch : public IRMutator {
+    // The prefetch distance for each loop marked with prefetch.
+    map<string, Expr> offsets;
+    int gpu_depth;
+
+    using IRMutator::visit;
+
+    void visit(const For *op) {
+        bool gpu = is_gpu_loop(op->name);
+        if (gpu) gpu_depth++;
+        IRMutator::visit(op);
+        if (gpu) gpu_depth--;
+
+        map<string, Expr>::iterator iter = offsets.find(op->name);
+        if (iter == offsets.end() || gpu_depth > 0 || gpu) {
+            return;
+        }
+
+        const For *loop = stmt.as<For>();
+        assert(loop);
+        if (loop->for_type == For::Vectorized ||
+            loop->for_type == For::Unrolled) {
+            std::cerr << "Can't prefetch across the loop " << op->name
+                      << " because it is vectorized or unrolled\n";
+            assert(false);
+        }
+
+        FindFootprints finder;
+        loop->body.accept(&finder);
+
+        // Ranges loaded by the iterations between this one and the
+        // one we prefetch for are in cache already, or will have
+        // been prefetched by an earlier iteration. If the distance
+        // isn't a constant, only this iteration's ranges are known to
+        // be covered.
+        Expr offset = iter->second;
+        const int *const_offset = as_const_int(offset);
+        int covered = const_offset ? std::min(*const_offset, 16) : 1;
+        vector<Footprint> done;
+        for (int k = 0; k < covered; k++) {
+            Expr shifted = Variable::make(Int(32), op->name) + k;
+            for (size_t i = 0; i < finder.footprints.size(); i++) {
+                Footprint f = finder.footprints[i];
+                f.min = simplify(substitute(op->name, shifted, f.min));
+                f.max = simplify(substitute(op->name, shifted, f.max));
+                done.push_back(f);
+            }
+        }
+
+        Expr next = Variable::make(Int(32), op->name) + offset;
+        Stmt prefetches;
+        int count = 0;
+        for (size_t i = 0; i < finder.footprints.size(); i++) {
+            Footprint f = finder.footprints[i];
+            if (!expr_uses_var(f.min, op->name) && !expr_uses_var(f.max, op->name)) {
+                // Loads that don't move with the loop are already
+                // in cache.
+                continue;
+            }
+            f.min = simplify(substitute(op->name, next, f.min));
+            f.max = simplify(substitute(op->name, next, f.max));
+
+            bool duplicate = false;
+            for (size_t j = 0; j < done.size() && !duplicate; j++) {
+                duplicate = (done[j].load->name == f.load->name &&
+                             equal(done[j].min, f.min) &&
+                             equal(done[j].max, f.max));
+            }
+            if (duplicate) continue;
+            done.push_back(f);
+            count++;
+
+            // Touch one element per cache line from min up, and then
+            // max, which may be on a line of its own if min isn't at
+            // the start of one.
+            int step = std::max(1, cache_line_bytes / f.load->type.bytes());
+            string line_name = op->name + ".prefetch." + int_to_string(count);
+            Expr line = Variable::make(Int(32), line_name);
+            Expr span = simplify(f.max - f.min);
+            Expr lines = is_zero(span) ? 1 : simplify(span / step + 2);
+            Expr index = Min::make(f.min + line * step, f.max);
+            Expr addr = Load::make(f.load->type, f.load->name, index,
+                                   f.load->image, f.load->param);
+            Stmt p = Evaluate::make(Call::make(Int(32), Call::prefetch,
+                                               vec(addr), Call::Intrinsic));
+            p = For::make(line_name, 0, lines, For::Serial, p);
+
+            debug(3) << "Prefetching " << f.load->name << "[" << f.min << ", " << f.max
+                     << "] at the top of " << op->name << "\n";
+
+            if (prefetches.defined()) {
+                prefetches = Block::make(prefetches, p);
+            } else {
+                prefetches = p;
+            }
+        }
+
+        if (prefetches.defined()) {
+            Stmt body = Block::make(prefetches, loop->body);
+            stmt = For::make(loop->name, loop->min, loop->extent, loop->for_type, body);
+        }
+    }
+
+public:
+    InjectPrefetch(const map<string, Function> &env) : gpu_depth(0) {
+        for (map<string, Function>::const_iterator iter = env.begin();
+             iter != env.end(); ++iter) {
+            Function f = iter->second;
+            for (size_t stage = 0; stage <= f.reductions().size(); stage++) {
+                const Schedule &s = (stage == 0) ? f.schedule() : f.reduction_schedule(stage - 1);
+                for (size_t i = 0; i < s.prefetches.size(); i++) {
+                    string loop = f.name() + ".s" + int_to_string((int)stage) + "." + s.prefetches[i].var;
+                    offsets[loop] = s.prefetches[i].offset;
+                }
+            }
+        }
+    }
+};
+
+}
+
+Stmt inject_prefetch(Stmt s, const map<string, Function> &env) {
+    return InjectPrefetch(env).mutate(s);
+}
+
+}
+}
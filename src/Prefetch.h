@@ -0,0 +1,27 @@
+#ifndef HALIDE_PREFETCH_H
+#define HALIDE_PREFETCH_H
+
+/** \file
+ * Defines the lowering pass that injects software prefetches.
+ */
+
+#include <map>
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Take a statement with flattened storage, and at the top of the
+ * body of each loop that has been marked with Func::prefetch, inject
+ * prefetches of the data loaded by the iteration some number of
+ * steps later. Each load in the body that depends on the loop
+ * variable gets its flat range of addresses over all the inner loops
+ * prefetched one cache line at a time, unless an iteration in
+ * between loads the same range. */
+Stmt inject_prefetch(Stmt s, const std::map<std::string, Function> &env);
+
+}
+}
+
+#endif
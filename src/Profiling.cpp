@@ -9,12 +9,23 @@
 namespace Halide {
 namespace Internal {
 
+using std::map;
+using std::string;
+using std::vector;
+
 namespace {
     const char kBufName[] = "ProfilerBuffer";
     const char kToplevel[] = "$total$";
     const char kOverhead[] = "$overhead$";
     const char kIgnore[] = "$ignore$";
     const char kIgnoreBuf[] = "$ignore_buf$";
+
+    // replace all spaces with '_'
+    string sanitize(const string& s) {
+      string san = s;
+      std::replace(san.begin(), san.end(), ' ', '_');
+      return san;
+    }
 }
 
 int profiling_level() {
@@ -22,10 +33,6 @@ int profiling_level() {
     return trace ? atoi(trace) : 0;
 }
 
-using std::map;
-using std::string;
-using std::vector;
-
 class InjectProfiling : public IRMutator {
 public:
     InjectProfiling(string func_name)
@@ -124,13 +131,6 @@ private:
         }
     };
 
-    // replace all spaces with '_'
-    static string sanitize(const string& s) {
-      string san = s;
-      std::replace(san.begin(), san.end(), ' ', '_');
-      return san;
-    }
-
     Expr get_index(const string& s) {
         if (indices.find(s) == indices.end()) {
             int idx = indices.size();
@@ -237,5 +237,91 @@ Stmt inject_profiling(Stmt s, string name) {
     return s;
 }
 
+class InjectSamplingProfiler : public IRMutator {
+public:
+    // The names of the stages, indexed by their id relative to the
+    // first stage of the pipeline. Stage zero is the time spent in
+    // the pipeline outside of any Func.
+    vector<string> stages;
+
+    InjectSamplingProfiler() : current(first_stage()) {
+        stages.push_back(kOverhead);
+    }
+
+    // The id of stage zero, as handed out by the runtime when the
+    // pipeline starts.
+    static Expr first_stage() {
+        return Variable::make(Int(32), "profiler.first_stage");
+    }
+
+    // Mark the calling thread as working on the given stage while it
+    // runs s, and then put back the stage it was working on before.
+    static Stmt set_stage(const string &name, Expr id, Stmt s) {
+        string prev_name = name + ".profiler_prev";
+        Expr prev = Variable::make(Int(32), prev_name);
+        Expr enter = Call::make(Int(32), "halide_profiler_set_stage", vec(id), Call::Extern);
+        Expr leave = Call::make(Int(32), "halide_profiler_set_stage", vec(prev), Call::Extern);
+        s = Block::make(s, Evaluate::make(leave));
+        return LetStmt::make(prev_name, enter, s);
+    }
+
+private:
+    using IRMutator::visit;
+
+    map<string, int> indices;
+
+    // The id of the stage that encloses the statement being mutated.
+    Expr current;
+
+    void visit(const Pipeline *op) {
+        if (indices.find(op->name) == indices.end()) {
+            indices[op->name] = stages.size();
+            stages.push_back(sanitize(op->name));
+        }
+        Expr id = first_stage() + indices[op->name];
+
+        Expr outer = current;
+        current = id;
+        Stmt produce = set_stage(op->name + ".produce", id, mutate(op->produce));
+        Stmt update;
+        if (op->update.defined()) {
+            update = set_stage(op->name + ".update", id, mutate(op->update));
+        }
+        current = outer;
+        Stmt consume = mutate(op->consume);
+
+        stmt = Pipeline::make(op->name, produce, update, consume);
+    }
+
+    void visit(const For *op) {
+        IRMutator::visit(op);
+        // The body of a parallel loop may run on another thread, so
+        // it has to say which stage it belongs to again.
+        if (op->for_type == For::Parallel) {
+            const For *loop = stmt.as<For>();
+            Stmt body = set_stage(op->name, current, loop->body);
+            stmt = For::make(loop->name, loop->min, loop->extent, loop->for_type, body);
+        }
+    }
+};
+
+Stmt inject_sampling_profiler(Stmt s, string name) {
+    InjectSamplingProfiler profiler;
+    s = profiler.mutate(s);
+    s = InjectSamplingProfiler::set_stage(name, InjectSamplingProfiler::first_stage(), s);
+
+    string stage_names;
+    for (size_t i = 0; i < profiler.stages.size(); i++) {
+        if (i > 0) stage_names += " ";
+        stage_names += profiler.stages[i];
+    }
+    debug(2) << "Profiling stages of " << name << ": " << stage_names << "\n";
+
+    Expr start = Call::make(Int(32), "halide_profiler_pipeline_start",
+                            vec<Expr>(sanitize(name), (int)profiler.stages.size(), stage_names),
+                            Call::Extern);
+    return LetStmt::make("profiler.first_stage", start, s);
+}
+
 }
 }
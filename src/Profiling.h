@@ -26,6 +26,13 @@ namespace Internal {
  */
 Stmt inject_profiling(Stmt, std::string);
 
+/** Take a fully lowered statement, and make each thread that runs
+ * it record which Func it is working on, for the sampling profiler
+ * in the runtime (see halide_profiler_get_stats). Used for targets
+ * with the profile feature. Unlike inject_profiling, this leaves the
+ * inner loops alone, and works with parallel schedules. */
+Stmt inject_sampling_profiler(Stmt, std::string);
+
 /** Gets the current profiling level (by reading HL_PROFILE) */
 int profiling_level();
 
@@ -10,6 +10,45 @@
 #include <vector>
 
 namespace Halide {
+
+/** Different ways to handle a split whose factor might not divide
+ * the extent of the dimension being split. See \ref Func::split */
+enum TailStrategy {
+    /** Use TailShiftInwards for pure definitions, and TailRoundUp
+     * for update definitions. */
+    TailAuto = 0,
+
+    /** Round the extent up to the next multiple of the split
+     * factor. The last iteration computes points beyond the end of
+     * the region, so the function must be realized over a region
+     * large enough to hold them. Fails for output buffers that are
+     * not a multiple of the split factor in size. */
+    TailRoundUp,
+
+    /** Shift the last iteration inwards so that it ends at the end
+     * of the region, recomputing some points that an earlier
+     * iteration already did. Keeps full vectors for all iterations,
+     * but needs the region to be at least as large as the split
+     * factor, and can't be used for update definitions, which
+     * aren't safe to compute twice. */
+    TailShiftInwards,
+
+    /** Guard the body of the loop with an if statement that skips the
+     * points beyond the end of the region. When the inner dimension
+     * is vectorized, the last vector is done with masked loads and
+     * stores where the target has them, and lane-by-lane otherwise;
+     * all the other vectors are done at full width. Safe for update
+     * definitions and odd-sized outputs. */
+    TailGuardWithIf
+};
+
+/** Pass this as the factor to \ref Func::vectorize or \ref
+ * Func::unroll to have the factor chosen when the pipeline is
+ * compiled, from the target's vector width, the types in the
+ * definition, and an estimate of how many registers it needs. The
+ * chosen factors are reported in the lowered statement. */
+const int AutoFactor = -1;
+
 namespace Internal {
 
 /** A schedule for a halide function, which defines where, when, and
@@ -85,6 +124,10 @@ struct Schedule {
         // split, it joins the outer and inner into the old_var.
         SplitType split_type;
 
+        // How to handle the case where the factor does not divide
+        // the extent of the old_var. Only meaningful for splits.
+        TailStrategy tail;
+
         bool is_rename() const {return split_type == RenameVar;}
         bool is_split() const {return split_type == SplitVar;}
         bool is_fuse() const {return split_type == FuseVars;}
@@ -120,6 +163,18 @@ struct Schedule {
     /** You may explicitly bound some of the dimensions of a
      * function. See \ref ScheduleHandle::bound */
     std::vector<Bound> bounds;
+
+    struct Prefetch {
+        std::string var;
+        Expr offset;
+    };
+    /** Loops at the top of which to prefetch the data loaded by a
+     * later iteration. See \ref ScheduleHandle::prefetch */
+    std::vector<Prefetch> prefetches;
+
+    /** Conditions on parameters under which to compile separate
+     * versions of the loop nest. See \ref ScheduleHandle::specialize */
+    std::vector<Expr> specializations;
 };
 
 }
@@ -33,6 +33,10 @@ void StmtCompiler::compile(Stmt stmt, string name,
     contents.ptr->compile(stmt, name, args, images_to_embed);
 }
 
+bool StmtCompiler::compile_from_bitcode(const string &filename, const string &name) {
+    return contents.ptr->compile_from_bitcode(filename, name);
+}
+
 void StmtCompiler::compile_to_bitcode(const string &filename) {
     contents.ptr->compile_to_bitcode(filename);
 }
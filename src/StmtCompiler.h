@@ -36,6 +36,10 @@ public:
                  const std::vector<Argument> &args,
                  const std::vector<Buffer> &images_to_embed);
 
+    /** Load a module written by compile_to_bitcode in place of
+     * calling compile. Returns false if it couldn't be loaded. */
+    bool compile_from_bitcode(const std::string &filename, const std::string &name);
+
     /** Write the module to an llvm bitcode file */
     void compile_to_bitcode(const std::string &filename);
 
@@ -186,9 +186,19 @@ private:
             }
         }
 
+        // Mark the values to be stored non-temporally for
+        // CodeGen. This goes on the value of the store, so that it
+        // survives vectorization.
+        map<string, Function>::const_iterator iter = env.find(provide->name);
+        bool stream = (iter != env.end() && iter->second.is_streaming_stores());
+
         if (values.size() == 1) {
             Expr idx = mutate(flatten_args(provide->name, provide->args));
-            stmt = Store::make(provide->name, values[0], idx);
+            Expr value = values[0];
+            if (stream) {
+                value = Call::make(value.type(), Call::non_temporal, vec(value), Call::Intrinsic);
+            }
+            stmt = Store::make(provide->name, value, idx);
         } else {
 
             vector<string> names(provide->values.size());
@@ -200,6 +210,9 @@ private:
                 Expr idx = mutate(flatten_args(name, provide->args));
                 names[i] = name + ".value";
                 Expr var = Variable::make(values[i].type(), names[i]);
+                if (stream) {
+                    var = Call::make(var.type(), Call::non_temporal, vec(var), Call::Intrinsic);
+                }
                 Stmt store = Store::make(name, var, idx);
                 if (result.defined()) {
                     result = Block::make(result, store);
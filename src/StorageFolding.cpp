@@ -1,11 +1,11 @@
 #include "StorageFolding.h"
 #include "Bounds.h"
+#include "ExprUsesVar.h"
 #include "IROperator.h"
 #include "IREquality.h"
 #include "IRMutator.h"
 #include "Substitute.h"
 #include "Simplify.h"
-#include "Bounds.h"
 #include "IRPrinter.h"
 #include "Debug.h"
 #include "Derivative.h"
@@ -54,12 +54,47 @@ public:
         func(f), dim(d), factor(e) {}
 };
 
+// Rewrite a - min(b, c) as max(a - b, a - c), and similarly for max,
+// so that the simplifier can cancel the loop variable out of the
+// extent of a footprint whose min comes from a select (e.g. after
+// sliding window).
+class DistributeSubtraction : public IRMutator {
+    using IRMutator::visit;
+
+    void visit(const Sub *op) {
+        Expr a = mutate(op->a), b = mutate(op->b);
+        if (const Min *m = b.as<Min>()) {
+            expr = mutate(Max::make(a - m->a, a - m->b));
+        } else if (const Max *m = b.as<Max>()) {
+            expr = mutate(Min::make(a - m->a, a - m->b));
+        } else if (const Min *m = a.as<Min>()) {
+            expr = mutate(Min::make(m->a - b, m->b - b));
+        } else if (const Max *m = a.as<Max>()) {
+            expr = mutate(Max::make(m->a - b, m->b - b));
+        } else if (a.same_as(op->a) && b.same_as(op->b)) {
+            expr = op;
+        } else {
+            expr = Sub::make(a, b);
+        }
+    }
+};
+
 // Attempt to fold the storage of a particular function in a statement
 class AttemptStorageFoldingOfFunction : public IRMutator {
     string func;
 
+    // Variables defined inside the realization, which a fold factor
+    // computed at runtime can't depend on.
+    Scope<int> defined;
+
     using IRMutator::visit;
 
+    void visit(const LetStmt *op) {
+        defined.push(op->name, 0);
+        IRMutator::visit(op);
+        defined.pop(op->name);
+    }
+
     void visit(const Pipeline *op) {
         if (op->name == func) {
             // Can't proceed into the pipeline for this func
@@ -100,7 +135,7 @@ class AttemptStorageFoldingOfFunction : public IRMutator {
                 is_monotonic(max, op->name) == MonotonicDecreasing) {
 
                 // The max of the extent over all values of the loop variable must be a constant
-                Expr extent = simplify(max - min);
+                Expr extent = simplify(DistributeSubtraction().mutate(simplify(max - min)));
                 Scope<Interval> scope;
                 scope.push(op->name, Interval(Variable::make(Int(32), op->name + ".loop_min"),
                                               Variable::make(Int(32), op->name + ".loop_max")));
@@ -109,20 +144,36 @@ class AttemptStorageFoldingOfFunction : public IRMutator {
 
                 max_extent = simplify(max_extent);
 
+                // Fold by exactly the number of sites touched. If
+                // that isn't a constant, it can still be computed
+                // before the realization, so long as it doesn't
+                // depend on anything defined inside it.
+                Expr factor;
                 const IntImm *max_extent_int = max_extent.as<IntImm>();
                 if (max_extent_int) {
-                    int extent = max_extent_int->value;
-                    debug(3) << "Proceeding...\n";
+                    factor = max_extent_int->value + 1;
+                } else if (max_extent.defined()) {
+                    defined.push(op->name + ".loop_min", 0);
+                    defined.push(op->name + ".loop_max", 0);
+                    if (!expr_uses_vars(max_extent, defined)) {
+                        // Compute it once, just outside the realization.
+                        dynamic_fold_factor = simplify(Max::make(max_extent + 1, 1));
+                        factor = Variable::make(Int(32), func + ".fold_factor");
+                    }
+                    defined.pop(op->name + ".loop_min");
+                    defined.pop(op->name + ".loop_max");
+                }
 
-                    int factor = 1;
-                    while (factor <= extent) factor *= 2;
+                if (factor.defined()) {
+                    debug(3) << "Proceeding with fold factor " << factor << "\n";
 
                     dim_folded = (int)i - 1;
                     fold_factor = factor;
                     stmt = FoldStorageOfFunction(func, (int)i - 1, factor).mutate(result);
                     return;
                 } else {
-                    debug(3) << "Not folding because extent not bounded by a constant\n"
+                    debug(3) << "Not folding because extent not bounded by an expression "
+                             << "that can be computed outside the realization\n"
                              << "extent = " << extent << "\n"
                              << "max extent = " << max_extent << "\n";
                 }
@@ -140,9 +191,122 @@ class AttemptStorageFoldingOfFunction : public IRMutator {
 public:
     int dim_folded;
     Expr fold_factor;
+    // If the fold factor is only known at runtime, fold_factor is a
+    // variable of this value, to be defined outside the realization.
+    Expr dynamic_fold_factor;
     AttemptStorageFoldingOfFunction(string f) : func(f), dim_folded(-1) {}
 };
 
+// Does a statement refer to a function?
+class UsesFunction : public IRVisitor {
+    const string &func;
+
+    using IRVisitor::visit;
+
+    void visit(const Call *op) {
+        IRVisitor::visit(op);
+        if (op->name == func) result = true;
+    }
+
+    void visit(const Provide *op) {
+        IRVisitor::visit(op);
+        if (op->name == func) result = true;
+    }
+public:
+    bool result;
+    UsesFunction(const string &f) : func(f), result(false) {}
+};
+
+bool uses_function(Stmt s, const string &func) {
+    if (!s.defined()) return false;
+    UsesFunction uses(func);
+    s.accept(&uses);
+    return uses.result;
+}
+
+// If all uses of a realization are within a parallel loop (perhaps
+// inside some lets, or the production of another function), each
+// iteration of that loop can have storage of its own. The sliding
+// window optimization only slides over serial loops, so no iteration
+// reads values computed by another one, and the storage of each can
+// then be folded over the serial loops inside it. Each task computes
+// the full footprint on its first iteration and slides from there.
+// Returns an undefined Stmt if this doesn't let us fold the storage.
+Stmt fold_storage_within_parallel_loop(const Realize *realize, Stmt s) {
+    if (const LetStmt *let = s.as<LetStmt>()) {
+        Stmt body = fold_storage_within_parallel_loop(realize, let->body);
+        if (!body.defined()) return Stmt();
+        return LetStmt::make(let->name, let->value, body);
+    }
+
+    if (const Pipeline *pipeline = s.as<Pipeline>()) {
+        if (uses_function(pipeline->update, realize->name) ||
+            uses_function(pipeline->consume, realize->name)) {
+            return Stmt();
+        }
+        Stmt produce = fold_storage_within_parallel_loop(realize, pipeline->produce);
+        if (!produce.defined()) return Stmt();
+        return Pipeline::make(pipeline->name, produce, pipeline->update, pipeline->consume);
+    }
+
+    if (const Block *block = s.as<Block>()) {
+        if (!uses_function(block->rest, realize->name)) {
+            Stmt first = fold_storage_within_parallel_loop(realize, block->first);
+            if (!first.defined()) return Stmt();
+            return Block::make(first, block->rest);
+        } else if (!uses_function(block->first, realize->name)) {
+            Stmt rest = fold_storage_within_parallel_loop(realize, block->rest);
+            if (!rest.defined()) return Stmt();
+            return Block::make(block->first, rest);
+        }
+        return Stmt();
+    }
+
+    const For *loop = s.as<For>();
+    if (!loop || loop->for_type != For::Parallel) {
+        return Stmt();
+    }
+
+    // Put the realization inside the lets at the top of the loop
+    // body, so that the footprint can refer to them.
+    vector<const LetStmt *> lets;
+    Stmt body = loop->body;
+    while (const LetStmt *let = body.as<LetStmt>()) {
+        lets.push_back(let);
+        body = let->body;
+    }
+
+    Box box = box_touched(body, realize->name);
+    for (size_t i = 0; i < box.size(); i++) {
+        if (!box[i].min.defined() || !box[i].max.defined()) {
+            return Stmt();
+        }
+    }
+
+    AttemptStorageFoldingOfFunction folder(realize->name);
+    body = folder.mutate(body);
+    if (folder.dim_folded < 0) {
+        return Stmt();
+    }
+
+    debug(3) << "Folding " << realize->name << " within each iteration of " << loop->name << "\n";
+
+    Region bounds(box.size());
+    for (size_t i = 0; i < box.size(); i++) {
+        bounds[i] = Range(box[i].min, simplify(box[i].max - box[i].min + 1));
+    }
+    bounds[folder.dim_folded] = Range(0, folder.fold_factor);
+
+    body = Realize::make(realize->name, realize->types, bounds, body);
+    if (folder.dynamic_fold_factor.defined()) {
+        body = LetStmt::make(realize->name + ".fold_factor", folder.dynamic_fold_factor, body);
+    }
+    for (size_t i = lets.size(); i > 0; i--) {
+        body = LetStmt::make(lets[i-1]->name, lets[i-1]->value, body);
+    }
+    return For::make(loop->name, loop->min, loop->extent, loop->for_type, body);
+}
+
 /** Check if a buffer's allocated is referred to directly via an
  * intrinsic. If so we should leave it alone. (e.g. it may be used
  * extern). */
@@ -186,7 +350,14 @@ class StorageFolding : public IRMutator {
             debug(3) << "Attempting to fold " << op->name << "\n";
             Stmt new_body = folder.mutate(body);
 
-            if (new_body.same_as(op->body)) {
+            Stmt per_task;
+            if (new_body.same_as(body)) {
+                per_task = fold_storage_within_parallel_loop(op, body);
+            }
+
+            if (per_task.defined()) {
+                stmt = per_task;
+            } else if (new_body.same_as(op->body)) {
                 stmt = op;
             } else if (new_body.same_as(body)) {
                 stmt = Realize::make(op->name, op->types, op->bounds, body);
@@ -199,6 +370,9 @@ class StorageFolding : public IRMutator {
                 bounds[folder.dim_folded] = Range(0, folder.fold_factor);
 
                 stmt = Realize::make(op->name, op->types, bounds, new_body);
+                if (folder.dynamic_fold_factor.defined()) {
+                    stmt = LetStmt::make(op->name + ".fold_factor", folder.dynamic_fold_factor, stmt);
+                }
             }
         }
     }
@@ -22,7 +22,9 @@ namespace Internal {
  \endcode
  *
  * We can store f as a circular buffer of size two, instead of
- * allocating space for all of it.
+ * allocating space for all of it. If the storage of f is outside a
+ * parallel loop that contains all uses of it, each iteration of the
+ * parallel loop instead gets a circular buffer of its own.
  */
 Stmt storage_folding(Stmt s);
 
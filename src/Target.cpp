@@ -1,5 +1,6 @@
 #include <iostream>
 #include <string>
+#include <algorithm>
 
 #include "Target.h"
 #include "LLVM_Headers.h"
@@ -74,6 +75,7 @@ Target get_host_target() {
     bool have_avx = info[2] & (1 << 28);
     bool have_f16 = info[2] & (1 << 29);
     bool have_rdrand = info[2] & (1 << 30);
+    bool have_fma = info[2] & (1 << 12);
 
     assert(have_sse2 && "The x86 backend assumes at least sse2 support");
 
@@ -81,12 +83,14 @@ Target get_host_target() {
     if (have_sse41) features |= Target::SSE41;
     if (have_avx)   features |= Target::AVX;
 
-    if (use_64_bits && have_avx && have_f16 && have_rdrand) {
+    // The avx2 target also uses fma instructions (see
+    // CodeGen_X86::mcpu), so require both.
+    if (use_64_bits && have_avx && have_f16 && have_rdrand && have_fma) {
         // So far, so good.  AVX2?
         // Call cpuid with eax=7, ecx=0
         int info2[4];
         cpuid(info2, 7, 0);
-        bool have_avx2 = info[1] & (1 << 5);
+        bool have_avx2 = info2[1] & (1 << 5);
         if (have_avx2) {
             features |= Target::AVX2;
         }
@@ -96,6 +100,38 @@ Target get_host_target() {
 #endif
 }
 
+namespace {
+// Check that this build of Halide can generate code for a set of
+// target features. Returns the features it can use.
+uint64_t check_features(uint64_t features) {
+    #if LLVM_VERSION < 36
+    if (features & Target::AVX512) {
+        std::cerr << "The avx512 target feature needs Halide to be built against llvm 3.6 or later\n";
+        assert(false);
+        features &= ~(uint64_t)Target::AVX512;
+    }
+    #endif
+    return features;
+}
+}
+
+Target::Target(OS o, Arch a, int b, uint64_t f) : os(o), arch(a), bits(b), features(check_features(f)) {}
+
+int Target::natural_vector_size(Type t) const {
+    int vector_bytes = 16;
+    if (arch == X86 && (features & AVX512)) {
+        vector_bytes = 64;
+    } else if (arch == X86 && (features & AVX2)) {
+        vector_bytes = 32;
+    } else if (arch == X86 && (features & AVX) && t.is_float()) {
+        // Avx has 256-bit float ops, but no 256-bit integer ops.
+        vector_bytes = 32;
+    }
+    // Bools are stored as bytes
+    int element_bytes = std::max(t.bytes(), 1);
+    return std::max(vector_bytes / element_bytes, 1);
+}
+
 namespace {
 string get_env(const char *name) {
 #ifdef _WIN32
@@ -209,6 +245,8 @@ Target parse_target_string(const std::string &target) {
             t.features |= (Target::SSE41 | Target::AVX);
         } else if (tok == "avx2") {
             t.features |= (Target::SSE41 | Target::AVX | Target::AVX2);
+        } else if (tok == "avx512") {
+            t.features |= check_features(Target::SSE41 | Target::AVX | Target::AVX2 | Target::AVX512);
         } else if (tok == "cuda" || tok == "ptx") {
             t.features |= Target::CUDA;
         } else if (tok == "opencl") {
@@ -219,13 +257,17 @@ Target parse_target_string(const std::string &target) {
             t.features |= Target::OpenCL | Target::SPIR64;
         } else if (tok == "gpu_debug") {
             t.features |= Target::GPUDebug;
+        } else if (tok == "workspace") {
+            t.features |= Target::Workspace;
+        } else if (tok == "profile") {
+            t.features |= Target::Profile;
         } else {
             std::cerr << "Did not understand HL_TARGET=" << target << "\n"
                       << "Expected format is arch-os-feature1-feature2-... "
                       << "Where arch is x86-32, x86-64, arm-32, arm-64, "
                       << "and os is linux, windows, osx, nacl, ios, or android. "
                       << "If arch or os are omitted, they default to the host. "
-                      << "Features include sse41, avx, avx2, cuda, opencl, and gpu_debug.\n"
+                      << "Features include sse41, avx, avx2, avx512, cuda, opencl, gpu_debug, workspace, and profile.\n"
                       << "HL_TARGET can also include \"host\", which sets the "
                       << "host's architecture, os, and feature set, with the "
                       << "exception of the GPU runtimes, which default to off\n";
@@ -309,10 +351,13 @@ DECLARE_CPP_INITMOD(android_io)
 DECLARE_CPP_INITMOD(ios_io)
 DECLARE_CPP_INITMOD(cuda)
 DECLARE_CPP_INITMOD(cuda_debug)
+DECLARE_CPP_INITMOD(fake_profiler)
+DECLARE_CPP_INITMOD(fake_thread_affinity)
 DECLARE_CPP_INITMOD(fake_thread_pool)
 DECLARE_CPP_INITMOD(gcd_thread_pool)
 DECLARE_CPP_INITMOD(linux_clock)
 DECLARE_CPP_INITMOD(linux_host_cpu_count)
+DECLARE_CPP_INITMOD(linux_thread_affinity)
 DECLARE_CPP_INITMOD(nogpu)
 DECLARE_CPP_INITMOD(opencl)
 DECLARE_CPP_INITMOD(opencl_debug)
@@ -327,7 +372,10 @@ DECLARE_CPP_INITMOD(posix_io)
 DECLARE_CPP_INITMOD(nacl_io)
 DECLARE_CPP_INITMOD(windows_io)
 DECLARE_CPP_INITMOD(posix_math)
+DECLARE_CPP_INITMOD(posix_profiler)
 DECLARE_CPP_INITMOD(posix_thread_pool)
+DECLARE_CPP_INITMOD(posix_thread_id)
+DECLARE_CPP_INITMOD(windows_thread_id)
 DECLARE_CPP_INITMOD(tracing)
 DECLARE_CPP_INITMOD(write_debug_image)
 
@@ -343,6 +391,7 @@ DECLARE_LL_INITMOD(spir_dev)
 DECLARE_LL_INITMOD(spir64_dev)
 DECLARE_LL_INITMOD(spir_common_dev)
 DECLARE_LL_INITMOD(x86_avx)
+DECLARE_LL_INITMOD(x86_avx2)
 DECLARE_LL_INITMOD(x86)
 DECLARE_LL_INITMOD(x86_sse41)
 
@@ -374,11 +423,25 @@ void link_modules(std::vector<llvm::Module *> &modules) {
                        "halide_dev_free",
                        "halide_set_error_handler",
                        "halide_set_custom_allocator",
+                       "halide_set_malloc_cache_size",
+                       "halide_malloc_cache_trim",
+                       "halide_get_malloc_cache_stats",
+                       "halide_set_workspace",
                        "halide_set_custom_trace",
                        "halide_set_custom_do_par_for",
                        "halide_set_custom_do_task",
                        "halide_shutdown_thread_pool",
+                       "halide_set_thread_affinity",
+                       "halide_set_thread_pool_limits",
+                       "halide_create_thread_pool",
+                       "halide_destroy_thread_pool",
+                       "halide_set_thread_pool",
+                       "halide_get_thread_pool",
                        "halide_shutdown_trace",
+                       "halide_profiler_get_stats",
+                       "halide_profiler_report",
+                       "halide_profiler_reset",
+                       "halide_profiler_shutdown",
                        "halide_set_cuda_context",
                        "halide_set_cl_context",
                        "halide_dev_sync",
@@ -437,29 +500,44 @@ llvm::Module *get_initial_module_for_target(Target t, llvm::LLVMContext *c) {
         modules.push_back(get_initmod_linux_clock(c, bits_64));
         modules.push_back(get_initmod_posix_io(c, bits_64));
         modules.push_back(get_initmod_linux_host_cpu_count(c, bits_64));
+        modules.push_back(get_initmod_linux_thread_affinity(c, bits_64));
         modules.push_back(get_initmod_posix_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_posix_thread_id(c, bits_64));
+        modules.push_back(get_initmod_posix_profiler(c, bits_64));
     } else if (t.os == Target::OSX) {
         modules.push_back(get_initmod_osx_clock(c, bits_64));
         modules.push_back(get_initmod_osx_io(c, bits_64));
         modules.push_back(get_initmod_gcd_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_posix_thread_id(c, bits_64));
+        modules.push_back(get_initmod_posix_profiler(c, bits_64));
     } else if (t.os == Target::Android) {
         modules.push_back(get_initmod_android_clock(c, bits_64));
         modules.push_back(get_initmod_android_io(c, bits_64));
         modules.push_back(get_initmod_android_host_cpu_count(c, bits_64));
+        modules.push_back(get_initmod_linux_thread_affinity(c, bits_64));
         modules.push_back(get_initmod_posix_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_posix_thread_id(c, bits_64));
+        modules.push_back(get_initmod_posix_profiler(c, bits_64));
     } else if (t.os == Target::Windows) {
         modules.push_back(get_initmod_windows_clock(c, bits_64));
         modules.push_back(get_initmod_windows_io(c, bits_64));
         modules.push_back(get_initmod_fake_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_windows_thread_id(c, bits_64));
+        modules.push_back(get_initmod_fake_profiler(c, bits_64));
     } else if (t.os == Target::IOS) {
         modules.push_back(get_initmod_posix_clock(c, bits_64));
         modules.push_back(get_initmod_ios_io(c, bits_64));
         modules.push_back(get_initmod_gcd_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_posix_thread_id(c, bits_64));
+        modules.push_back(get_initmod_posix_profiler(c, bits_64));
     } else if (t.os == Target::NaCl) {
         modules.push_back(get_initmod_posix_clock(c, bits_64));
         modules.push_back(get_initmod_nacl_io(c, bits_64));
         modules.push_back(get_initmod_linux_host_cpu_count(c, bits_64));
+        modules.push_back(get_initmod_fake_thread_affinity(c, bits_64));
         modules.push_back(get_initmod_posix_thread_pool(c, bits_64));
+        modules.push_back(get_initmod_posix_thread_id(c, bits_64));
+        modules.push_back(get_initmod_posix_profiler(c, bits_64));
     }
 
     // These modules are always used
@@ -483,6 +561,9 @@ llvm::Module *get_initial_module_for_target(Target t, llvm::LLVMContext *c) {
     if (t.features & Target::AVX) {
         modules.push_back(get_initmod_x86_avx_ll(c));
     }
+    if (t.features & Target::AVX2) {
+        modules.push_back(get_initmod_x86_avx2_ll(c));
+    }
     if (t.features & Target::CUDA) {
         if (t.features & Target::GPUDebug) {
             modules.push_back(get_initmod_cuda_debug(c, bits_64));
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <string>
 #include "Util.h"
+#include "Type.h"
 
 namespace llvm {
 class Module;
@@ -16,11 +17,21 @@ struct Target {
     enum OS {OSUnknown = 0, Linux, Windows, OSX, Android, IOS, NaCl} os;
     enum Arch {ArchUnknown = 0, X86, ARM} arch;
     int bits; // Must be 0 for unknown, or 32 or 64
-    enum Features {JIT = 1, SSE41 = 2, AVX = 4, AVX2 = 8, CUDA = 16, OpenCL = 32, GPUDebug = 64, SPIR = 128, SPIR64 = 256};
+    enum Features {JIT = 1, SSE41 = 2, AVX = 4, AVX2 = 8, CUDA = 16, OpenCL = 32, GPUDebug = 64, SPIR = 128, SPIR64 = 256, Workspace = 512, Profile = 1024, AVX512 = 2048};
     uint64_t features;
 
     Target() : os(OSUnknown), arch(ArchUnknown), bits(0), features(0) {}
-    Target(OS o, Arch a, int b, uint64_t f) : os(o), arch(a), bits(b), features(f) {}
+
+    /** Make a target. It's an error to ask for avx512 if Halide was
+     * built against an llvm older than 3.6. */
+    EXPORT Target(OS o, Arch a, int b, uint64_t f);
+
+    /** The number of elements of the given type that fit in one of
+     * the target's vector registers, counting only the registers that
+     * the target has arithmetic on that type for. E.g. on avx without
+     * avx2, floats fill 256 bits, but integers only 128. A good
+     * choice of factor for Func::vectorize. */
+    EXPORT int natural_vector_size(Type t) const;
 };
 
 /** Return the target corresponding to the host machine. */
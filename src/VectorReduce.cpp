@@ -0,0 +1,65 @@
+#include "VectorReduce.h"
+#include "IROperator.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+using std::vector;
+
+Expr vector_reduce_op(const string &op, Expr a, Expr b) {
+    if (op == "add") {
+        return Add::make(a, b);
+    } else if (op == "mul") {
+        return Mul::make(a, b);
+    } else if (op == "min") {
+        return Min::make(a, b);
+    } else if (op == "max") {
+        return Max::make(a, b);
+    } else if (op == "and") {
+        return And::make(a, b);
+    } else if (op == "or") {
+        return Or::make(a, b);
+    } else {
+        std::cerr << "Unknown vector reduction: " << op << "\n";
+        assert(false);
+        return Expr();
+    }
+}
+
+namespace {
+// Grab some contiguous lanes of a vector.
+Expr slice_vector(Expr v, int begin, int size) {
+    vector<Expr> args(size + 1);
+    args[0] = v;
+    for (int i = 0; i < size; i++) {
+        args[i+1] = begin + i;
+    }
+    return Call::make(v.type().element_of().vector_of(size),
+                      Call::shuffle_vector, args, Call::Intrinsic);
+}
+}
+
+Expr lower_vector_reduce(const string &op, Expr v, int lanes) {
+    assert(lanes >= 1);
+    int width = v.type().width;
+
+    // Combine the two halves until we're down to the desired
+    // number of lanes, or the vector can't be split evenly.
+    while (width > lanes && width % 2 == 0) {
+        width /= 2;
+        v = vector_reduce_op(op, slice_vector(v, 0, width), slice_vector(v, width, width));
+    }
+
+    if (width == lanes || lanes > 1) {
+        return v;
+    }
+
+    // We want a scalar, and there are an odd number of lanes
+    // left. Reduce all but the last, then fold that one in.
+    Expr rest = lower_vector_reduce(op, slice_vector(v, 0, width - 1), 1);
+    return vector_reduce_op(op, rest, slice_vector(v, width - 1, 1));
+}
+
+}
+}
@@ -0,0 +1,27 @@
+#ifndef HALIDE_VECTOR_REDUCE_H
+#define HALIDE_VECTOR_REDUCE_H
+
+#include "IR.h"
+
+/** \file
+ * Defines methods for converting a vector_reduce intrinsic into Halide IR.
+ */
+
+namespace Halide {
+namespace Internal {
+
+/** Combine two values with one of the associative and commutative
+ * operators that the vector_reduce intrinsic understands: "add",
+ * "mul", "min", "max", "and", or "or". */
+Expr EXPORT vector_reduce_op(const std::string &op, Expr a, Expr b);
+
+/** Build Halide IR that reduces a vector across its lanes by
+ * repeatedly combining its upper and lower halves, until it has no
+ * more than the given number of lanes. Used by codegen targets to do
+ * the parts of a vector_reduce they have no horizontal ops for. */
+Expr EXPORT lower_vector_reduce(const std::string &op, Expr v, int lanes = 1);
+
+}
+}
+
+#endif
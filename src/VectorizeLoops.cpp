@@ -5,17 +5,250 @@
 #include "Deinterleave.h"
 #include "Substitute.h"
 #include "IROperator.h"
+#include "IRVisitor.h"
+#include "IREquality.h"
+#include "VectorReduce.h"
+#include "Simplify.h"
 
 namespace Halide {
 namespace Internal {
 
 using std::string;
 using std::vector;
+using std::pair;
+using std::make_pair;
+
+namespace {
+// Can the body of an if statement with a vector condition be run once
+// for the whole vector, with the loads and stores of the lanes for
+// which the condition is false masked off? Not if it calls anything
+// for its side effects, or contains loops or allocations. Once the
+// body is vectorized, every store in it must also be a vector store,
+// so that each lane stores separately.
+class CanPredicate : public IRVisitor {
+    int width;
+
+    using IRVisitor::visit;
+
+    void visit(const Evaluate *) {result = false;}
+    void visit(const AssertStmt *) {result = false;}
+    void visit(const Pipeline *) {result = false;}
+    void visit(const For *) {result = false;}
+    void visit(const Provide *) {result = false;}
+    void visit(const Allocate *) {result = false;}
+    void visit(const Free *) {result = false;}
+    void visit(const Realize *) {result = false;}
+
+    void visit(const Store *op) {
+        if (width && op->value.type().width != width) {
+            result = false;
+        }
+        IRVisitor::visit(op);
+    }
+
+public:
+    bool result;
+    CanPredicate(int w) : width(w), result(true) {}
+};
+
+bool can_predicate(Stmt s, int width = 0) {
+    if (!s.defined()) return true;
+    CanPredicate c(width);
+    s.accept(&c);
+    return c.result;
+}
+
+// Does an expression refer to any of the given variables, or load
+// from the given buffer?
+class ExprUses : public IRVisitor {
+    const Scope<int> &vars;
+    const string &buffer;
+
+    using IRVisitor::visit;
+
+    void visit(const Variable *op) {
+        if (vars.contains(op->name)) result = true;
+    }
+
+    void visit(const Load *op) {
+        if (op->name == buffer) result = true;
+        IRVisitor::visit(op);
+    }
+
+public:
+    bool result;
+    ExprUses(const Scope<int> &v, const string &b) : vars(v), buffer(b), result(false) {}
+};
+
+bool expr_uses(Expr e, const Scope<int> &vars, const string &buffer) {
+    ExprUses u(vars, buffer);
+    e.accept(&u);
+    return u.result;
+}
+
+// Is a store an update of the value already at that site using an
+// associative and commutative operator, e.g. f[i] = f[i] + g[j]? If
+// so, get the name of the operator, the load of the old value, and
+// the value it's combined with. Only updates of this form can be
+// reordered across the lanes of a vector. Lets wrapped around the
+// whole value (e.g. from CSE) stay wrapped around the rest.
+bool match_associative_update(const Store *op, string *reduce_op, Expr *old, Expr *rest) {
+    Expr value = op->value;
+    vector<const Let *> lets;
+    Scope<int> let_vars;
+    while (const Let *let = value.as<Let>()) {
+        lets.push_back(let);
+        let_vars.push(let->name, 0);
+        value = let->body;
+    }
+
+    Expr a, b;
+    if (const Add *add = value.as<Add>()) {
+        *reduce_op = "add"; a = add->a; b = add->b;
+    } else if (const Mul *mul = value.as<Mul>()) {
+        *reduce_op = "mul"; a = mul->a; b = mul->b;
+    } else if (const Min *min = value.as<Min>()) {
+        *reduce_op = "min"; a = min->a; b = min->b;
+    } else if (const Max *max = value.as<Max>()) {
+        *reduce_op = "max"; a = max->a; b = max->b;
+    } else if (const And *and_op = value.as<And>()) {
+        *reduce_op = "and"; a = and_op->a; b = and_op->b;
+    } else if (const Or *or_op = value.as<Or>()) {
+        *reduce_op = "or"; a = or_op->a; b = or_op->b;
+    } else {
+        return false;
+    }
+
+    const Scope<int> no_vars;
+    for (size_t i = 0; i < lets.size(); i++) {
+        if (expr_uses(lets[i]->value, no_vars, op->name)) return false;
+    }
+
+    // The old value may be on either side.
+    for (int i = 0; i < 2; i++) {
+        const Load *load = a.as<Load>();
+        if (load && load->name == op->name && equal(load->index, op->index) &&
+            !expr_uses(a, let_vars, "") &&
+            !expr_uses(b, no_vars, op->name)) {
+            *old = a;
+            *rest = b;
+            for (size_t j = lets.size(); j > 0; j--) {
+                *rest = Let::make(lets[j-1]->name, lets[j-1]->value, *rest);
+            }
+            return true;
+        }
+        std::swap(a, b);
+    }
+    return false;
+}
+
+// The value to start a vector of partial results of an associative
+// update at. Min, max, and, and or are idempotent, so those can start
+// at the old value.
+Expr partial_result_identity(const string &reduce_op, Expr old) {
+    if (reduce_op == "add") {
+        return make_zero(old.type());
+    } else if (reduce_op == "mul") {
+        return make_one(old.type());
+    } else {
+        return old;
+    }
+}
+
+// Given a serial loop around a vectorized loop that does an
+// associative update of a single site, e.g.
+//   for (ro) { vectorized for (ri) { f[0] = f[0] + g[ro*8 + ri] } }
+// accumulate a vector of partial results across the serial loop, and
+// only reduce across the lanes once at the end:
+//   allocate f.partial[8]
+//   vectorized for (ri) { f.partial[ri] = 0 }
+//   for (ro) { vectorized for (ri) { f.partial[ri] = f.partial[ri] + g[ro*8 + ri] } }
+//   vectorized for (ri) { f[0] = f[0] + f.partial[ri] }
+// If the update is guarded by an if, so is the update of the partial
+// results. Returns an undefined Stmt if the loop isn't of that form.
+Stmt accumulate_partial_results(const For *outer) {
+    Scope<int> loop_vars;
+    loop_vars.push(outer->name, 0);
+
+    vector<pair<string, Expr> > outer_lets, inner_lets;
+    Stmt s = outer->body;
+    while (const LetStmt *let = s.as<LetStmt>()) {
+        outer_lets.push_back(make_pair(let->name, let->value));
+        loop_vars.push(let->name, 0);
+        s = let->body;
+    }
+
+    const For *inner = s.as<For>();
+    if (!inner || inner->for_type != For::Vectorized) return Stmt();
+    const IntImm *width = inner->extent.as<IntImm>();
+    if (!width) return Stmt();
+
+    loop_vars.push(inner->name, 0);
+    s = inner->body;
+    while (const LetStmt *let = s.as<LetStmt>()) {
+        inner_lets.push_back(make_pair(let->name, let->value));
+        loop_vars.push(let->name, 0);
+        s = let->body;
+    }
+
+    // The update may be guarded by the tail of a split.
+    vector<Expr> conditions;
+    while (const IfThenElse *if_stmt = s.as<IfThenElse>()) {
+        if (if_stmt->else_case.defined()) return Stmt();
+        conditions.push_back(if_stmt->condition);
+        s = if_stmt->then_case;
+    }
+
+    const Store *store = s.as<Store>();
+    string reduce_op;
+    Expr old, rest;
+    if (!store ||
+        !match_associative_update(store, &reduce_op, &old, &rest) ||
+        expr_uses(store->index, loop_vars, "")) {
+        return Stmt();
+    }
+
+    debug(3) << "Accumulating partial results of " << store->name
+             << " across " << outer->name << "\n";
+
+    string partial = unique_name(store->name + ".partial", false);
+    Type t = old.type();
+    Expr lane = Variable::make(Int(32), inner->name + ".lane");
+    Expr partial_value = Load::make(t, partial, lane, Buffer(), Parameter());
+
+    Stmt init = Store::make(partial, partial_result_identity(reduce_op, old), lane);
+    init = For::make(inner->name + ".lane", 0, width, For::Vectorized, init);
+
+    Expr inner_lane = Variable::make(Int(32), inner->name) - inner->min;
+    Stmt update = Store::make(partial,
+                              vector_reduce_op(reduce_op, Load::make(t, partial, inner_lane, Buffer(), Parameter()), rest),
+                              inner_lane);
+    for (size_t i = conditions.size(); i > 0; i--) {
+        update = IfThenElse::make(conditions[i-1], update);
+    }
+    for (size_t i = inner_lets.size(); i > 0; i--) {
+        update = LetStmt::make(inner_lets[i-1].first, inner_lets[i-1].second, update);
+    }
+    update = For::make(inner->name, inner->min, inner->extent, inner->for_type, update);
+    for (size_t i = outer_lets.size(); i > 0; i--) {
+        update = LetStmt::make(outer_lets[i-1].first, outer_lets[i-1].second, update);
+    }
+    update = For::make(outer->name, outer->min, outer->extent, outer->for_type, update);
+
+    Stmt reduce = Store::make(store->name, vector_reduce_op(reduce_op, old, partial_value), store->index);
+    reduce = For::make(inner->name + ".lane", 0, width, For::Vectorized, reduce);
+
+    return Allocate::make(partial, t, width, Block::make(init, Block::make(update, reduce)));
+}
+}
 
 class VectorizeLoops : public IRMutator {
+    const std::set<string> &reduction_loops;
+
     class VectorSubs : public IRMutator {
         string var;
         Expr replacement;
+        bool reduction;
         Scope<Expr> scope;
         Scope<int> internal_allocations;
 
@@ -226,6 +459,42 @@ class VectorizeLoops : public IRMutator {
             Expr value = mutate(op->value);
             Expr index = mutate(op->index);
 
+            if (index.type().is_scalar() && value.type().is_vector() &&
+                !internal_allocations.contains(op->name)) {
+                // Every lane stores to the same site. If it's an
+                // associative update of the value already there, we
+                // can reduce across the lanes first and do one
+                // scalar update. Otherwise the lanes must be done in
+                // order.
+                string reduce_op;
+                Expr old, rest;
+                if (match_associative_update(op, &reduce_op, &old, &rest)) {
+                    debug(3) << "Reducing across the lanes of a store to " << op->name << "\n";
+                    rest = mutate(rest);
+                    Expr reduced = Call::make(rest.type().element_of(), Call::vector_reduce,
+                                              vec<Expr>(reduce_op, rest), Call::Intrinsic);
+                    stmt = Store::make(op->name, vector_reduce_op(reduce_op, old, reduced), index);
+                } else {
+                    debug(3) << "Scalarizing a store to " << op->name
+                             << " that every lane writes to\n";
+                    stmt = scalarize(op);
+                }
+                return;
+            }
+
+            // In a loop over a reduction domain, a vector of indices
+            // may hit the same site more than once, e.g. in a
+            // histogram. Unless the lanes provably store to different
+            // sites, they must be done in order.
+            if (reduction && index.type().is_vector() &&
+                !internal_allocations.contains(op->name) &&
+                !lanes_are_distinct(index)) {
+                debug(3) << "Scalarizing a store to " << op->name
+                         << " whose lanes may collide\n";
+                stmt = scalarize(op);
+                return;
+            }
+
             // Internal allocations always get vectorized.
             if (internal_allocations.contains(op->name)) {
                 int width = replacement.type().width;
@@ -251,7 +520,24 @@ class VectorizeLoops : public IRMutator {
             debug(3) << "Vectorizing over " << var << "\n"
                      << "Old: " << op->condition << "\n"
                      << "New: " << cond << "\n";
-            if (width > 1) {
+            if (width > 1 &&
+                can_predicate(op->then_case) &&
+                can_predicate(op->else_case)) {
+                // It's an if statement on a vector of conditions,
+                // but we may be able to keep the body vectorized, and
+                // mask off the lanes for which the condition is false
+                // when generating code.
+                Stmt then_case = mutate(op->then_case);
+                Stmt else_case = mutate(op->else_case);
+                if (can_predicate(then_case, width) &&
+                    can_predicate(else_case, width)) {
+                    debug(3) << "Predicating if then else\n";
+                    stmt = IfThenElse::make(cond, then_case, else_case);
+                } else {
+                    debug(3) << "Scalarizing if then else\n";
+                    stmt = scalarize(op);
+                }
+            } else if (width > 1) {
                 // It's an if statement on a vector of
                 // conditions. We'll have to scalarize and make
                 // multiple copies of the if statement.
@@ -320,6 +606,25 @@ class VectorizeLoops : public IRMutator {
 
         }
 
+        // Is a vectorized index a ramp with a non-zero constant
+        // stride, once the vector lets it refers to are substituted in?
+        bool lanes_are_distinct(Expr index) {
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (Scope<Expr>::iterator iter = scope.begin(); iter != scope.end(); ++iter) {
+                    Expr new_index = substitute(iter.name(), iter.value(), index);
+                    if (!new_index.same_as(index)) {
+                        index = new_index;
+                        changed = true;
+                    }
+                }
+            }
+            const Ramp *ramp = simplify(index).as<Ramp>();
+            const IntImm *stride = ramp ? ramp->stride.as<IntImm>() : NULL;
+            return stride && stride->value != 0;
+        }
+
         Stmt scalarize(Stmt s) {
             Stmt result;
             int width = replacement.type().width;
@@ -346,7 +651,7 @@ class VectorizeLoops : public IRMutator {
         }
 
     public:
-        VectorSubs(string v, Expr r) : var(v), replacement(r) {
+        VectorSubs(string v, Expr r, bool red) : var(v), replacement(r), reduction(red) {
         }
     };
 
@@ -366,22 +671,32 @@ class VectorizeLoops : public IRMutator {
             // Replace the var with a ramp within the body
             Expr for_var = Variable::make(Int(32), for_loop->name);
             Expr replacement = Ramp::make(for_var, 1, extent->value);
-            Stmt body = VectorSubs(for_loop->name, replacement).mutate(for_loop->body);
+            bool reduction = reduction_loops.count(for_loop->name) > 0;
+            Stmt body = VectorSubs(for_loop->name, replacement, reduction).mutate(for_loop->body);
 
             // The for loop becomes a simple let statement
             stmt = LetStmt::make(for_loop->name, for_loop->min, body);
 
+        } else if (for_loop->for_type == For::Serial) {
+            Stmt s = accumulate_partial_results(for_loop);
+            if (s.defined()) {
+                stmt = mutate(s);
+            } else {
+                IRMutator::visit(for_loop);
+            }
         } else {
             IRMutator::visit(for_loop);
         }
     }
 
+public:
+    VectorizeLoops(const std::set<string> &r) : reduction_loops(r) {}
 };
 
 
 
-Stmt vectorize_loops(Stmt s) {
-    return VectorizeLoops().mutate(s);
+Stmt vectorize_loops(Stmt s, const std::set<string> &reduction_loops) {
+    return VectorizeLoops(reduction_loops).mutate(s);
 }
 
 }
@@ -6,15 +6,18 @@
  */
 
 #include "IR.h"
+#include <set>
 
 namespace Halide {
 namespace Internal {
 
 /** Take a statement with for loops marked for vectorization, and turn
  * them into single statements that operate on vectors. The loops in
- * question must have constant extent.
+ * question must have constant extent. The lanes of the named loops
+ * over a reduction domain may store to the same site, so stores in
+ * those are only vectorized if the lanes provably don't collide.
  */
-Stmt vectorize_loops(Stmt);
+Stmt vectorize_loops(Stmt, const std::set<std::string> &reduction_loops);
 
 }
 }
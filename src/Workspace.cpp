@@ -0,0 +1,286 @@
+#include "Workspace.h"
+#include "IRMutator.h"
+#include "IRVisitor.h"
+#include "IROperator.h"
+#include "Bounds.h"
+#include "Simplify.h"
+#include "Scope.h"
+#include "ExprUsesVar.h"
+#include "IRPrinter.h"
+#include "Debug.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// Allocations of a constant size this small go on the stack anyway
+// (see CodeGen_Posix::create_allocation).
+const int max_stack_bytes = 8*1024;
+
+// Replace variables with the values of the lets that define them.
+class ExpandLets : public IRMutator {
+    const Scope<Expr> &scope;
+
+    using IRMutator::visit;
+
+    void visit(const Variable *op) {
+        if (scope.contains(op->name)) {
+            expr = mutate(scope.get(op->name));
+        } else {
+            expr = op;
+        }
+    }
+public:
+    ExpandLets(const Scope<Expr> &s) : scope(s) {}
+};
+
+}
+
+class InjectWorkspace : public IRMutator {
+public:
+    // The size in bytes of the regions handed out so far. The
+    // workspace is allocated with this size, and total_64 is the same
+    // thing computed with 64-bit ints, which can't overflow, to report
+    // to callers and to check this against.
+    Expr total, total_64;
+
+private:
+    // The values of the lets inside the workspace, and the bounds of
+    // the loop variables inside it. Sizes are bounded by expanding
+    // the lets first and then bounding the result over the loops, so
+    // that the extent of a region like [base, base + 7] comes out as
+    // 8 rather than a bound on the whole range of base.
+    Scope<Expr> lets;
+    Scope<Interval> loops;
+
+    // Every variable defined inside the workspace. The bound on a
+    // size can't depend on any of these.
+    Scope<int> inner;
+
+    struct ParallelLoop {
+        string name;
+        // An upper bound on the extent of the loop, in terms of the
+        // arguments to the pipeline.
+        Expr max_extent;
+        // Whether an allocation inside the loop was placed in the
+        // workspace, and so depends on the loop min.
+        bool used;
+    };
+
+    // The parallel loops surrounding the current statement, outermost
+    // first.
+    vector<ParallelLoop> parallel_loops;
+
+    // Expand the lets in an expression, and find its bounds over the
+    // enclosing loops. Returns undefined bounds if the expression
+    // depends on anything other than the arguments to the pipeline.
+    Interval bounds_of(Expr e) {
+        if (expr_reads_memory(e)) {
+            return Interval();
+        }
+        ExpandLets expand(lets);
+        e = simplify(expand.mutate(e));
+        Interval result = bounds_of_expr_in_scope(e, loops);
+        if (result.min.defined() &&
+            (expr_reads_memory(result.min) || expr_uses_vars(result.min, inner))) {
+            result.min = Expr();
+        }
+        if (result.max.defined() &&
+            (expr_reads_memory(result.max) || expr_uses_vars(result.max, inner))) {
+            result.max = Expr();
+        }
+        return result;
+    }
+
+    using IRMutator::visit;
+
+    void visit(const LetStmt *op) {
+        inner.push(op->name, 0);
+        bool pure = !expr_reads_memory(op->value);
+        if (pure) {
+            lets.push(op->name, op->value);
+        }
+        Stmt body = mutate(op->body);
+        if (pure) {
+            lets.pop(op->name);
+        }
+        inner.pop(op->name);
+
+        if (body.same_as(op->body)) {
+            stmt = op;
+        } else {
+            stmt = LetStmt::make(op->name, op->value, body);
+        }
+    }
+
+    void visit(const For *op) {
+        Interval min_bounds = bounds_of(op->min);
+        Interval max_bounds = bounds_of(op->min + op->extent - 1);
+
+        if (op->for_type == For::Parallel) {
+            ParallelLoop loop;
+            loop.name = op->name;
+            loop.max_extent = bounds_of(op->extent).max;
+            loop.used = false;
+            parallel_loops.push_back(loop);
+        }
+
+        inner.push(op->name, 0);
+        loops.push(op->name, Interval(min_bounds.min, max_bounds.max));
+        Stmt body = mutate(op->body);
+        loops.pop(op->name);
+        inner.pop(op->name);
+
+        if (op->for_type == For::Parallel) {
+            bool used = parallel_loops.back().used;
+            parallel_loops.pop_back();
+            if (used) {
+                // The regions inside the loop are indexed by the loop
+                // variable relative to the loop min.
+                string min_name = op->name + ".workspace_min";
+                Expr min_var = Variable::make(Int(32), min_name);
+                stmt = For::make(op->name, min_var, op->extent, op->for_type, body);
+                stmt = LetStmt::make(min_name, op->min, stmt);
+                return;
+            }
+        }
+
+        if (body.same_as(op->body)) {
+            stmt = op;
+        } else {
+            stmt = For::make(op->name, op->min, op->extent, op->for_type, body);
+        }
+    }
+
+    void visit(const Allocate *op) {
+        Stmt body = mutate(op->body);
+
+        const IntImm *const_size = op->size.as<IntImm>();
+        Expr max_size;
+        if (const_size && const_size->value * op->type.bytes() <= max_stack_bytes) {
+            // It's going on the stack.
+        } else {
+            max_size = bounds_of(op->size).max;
+        }
+
+        // Find which region belongs to this iteration of each
+        // surrounding parallel loop.
+        Expr slots = 1, slot = 0;
+        Expr slots_64 = make_one(Int(64));
+        for (size_t i = parallel_loops.size(); max_size.defined() && i > 0; i--) {
+            const ParallelLoop &loop = parallel_loops[i-1];
+            if (!loop.max_extent.defined()) {
+                max_size = Expr();
+                break;
+            }
+            Expr loop_var = Variable::make(Int(32), loop.name);
+            Expr loop_min = Variable::make(Int(32), loop.name + ".workspace_min");
+            slot += (loop_var - loop_min) * slots;
+            slots *= loop.max_extent;
+            slots_64 *= Cast::make(Int(64), loop.max_extent);
+        }
+
+        if (!max_size.defined()) {
+            debug(3) << "Leaving " << op->name << " out of the workspace\n";
+            if (body.same_as(op->body)) {
+                stmt = op;
+            } else {
+                stmt = Allocate::make(op->name, op->type, op->size, body);
+            }
+            return;
+        }
+
+        for (size_t i = 0; i < parallel_loops.size(); i++) {
+            parallel_loops[i].used = true;
+        }
+
+        // Keep every region 32-byte aligned, like halide_malloc.
+        Expr region = simplify(((max_size * op->type.bytes() + 31) / 32) * 32);
+        Expr offset = total.defined() ? total : Expr(0);
+        Expr region_64 = ((Cast::make(Int(64), max_size) * op->type.bytes() + 31) / 32) * 32;
+        Expr offset_64 = total_64.defined() ? total_64 : make_zero(Int(64));
+        debug(3) << "Placing " << op->name << " in the workspace at "
+                 << offset << " with " << slots << " regions of size " << region << "\n";
+
+        total = simplify(offset + slots * region);
+        total_64 = simplify(offset_64 + slots_64 * region_64);
+        offset = simplify(offset + slot * region);
+
+        Expr ptr = Load::make(UInt(8), "__workspace", offset, Buffer(), Parameter());
+        ptr = Call::make(Handle(), Call::address_of, vec(ptr), Call::Intrinsic);
+
+        stmt = Allocate::make(op->name, op->type, op->size, body);
+        stmt = LetStmt::make(op->name + ".workspace", ptr, stmt);
+    }
+};
+
+Stmt inject_workspace(Stmt s) {
+    // Walk down to the point at which the pipeline starts doing real
+    // work. Everything above it only checks and unpacks the
+    // arguments, and the workspace size may depend on the lets there.
+    if (const LetStmt *let = s.as<LetStmt>()) {
+        return LetStmt::make(let->name, let->value, inject_workspace(let->body));
+    } else if (const Block *block = s.as<Block>()) {
+        if (block->rest.defined()) {
+            return Block::make(block->first, inject_workspace(block->rest));
+        }
+    } else if (const IfThenElse *if_stmt = s.as<IfThenElse>()) {
+        if (!if_stmt->else_case.defined()) {
+            return IfThenElse::make(if_stmt->condition, inject_workspace(if_stmt->then_case));
+        }
+    }
+
+    InjectWorkspace inject;
+    Stmt body = inject.mutate(s);
+    if (!inject.total.defined()) {
+        return inject_empty_workspace(s);
+    }
+
+    debug(2) << "Workspace size: " << inject.total << "\n";
+    body = Block::make(body, Free::make("__workspace"));
+    Stmt stmt = Allocate::make("__workspace", UInt(8), inject.total, body);
+
+    // The allocation takes a 32-bit size, so make sure the size
+    // didn't overflow.
+    Expr bytes = Variable::make(Int(64), "__workspace.bytes");
+    Expr max_bytes = Cast::make(Int(64), 0x7fffffff);
+    Stmt check = AssertStmt::make(bytes <= max_bytes,
+                                  "Workspace size is larger than 2^31 - 1 bytes");
+    stmt = Block::make(check, stmt);
+    return LetStmt::make("__workspace.bytes", inject.total_64, stmt);
+}
+
+Stmt inject_empty_workspace(Stmt s) {
+    return LetStmt::make("__workspace.bytes", make_zero(Int(64)), s);
+}
+
+Expr workspace_size(Stmt s) {
+    // Follow the same path as inject_workspace, wrapping the size in
+    // the lets it passes.
+    if (const LetStmt *let = s.as<LetStmt>()) {
+        if (let->name == "__workspace.bytes") {
+            return let->value;
+        }
+        Expr size = workspace_size(let->body);
+        if (size.defined()) {
+            size = Let::make(let->name, let->value, size);
+        }
+        return size;
+    } else if (const Block *block = s.as<Block>()) {
+        if (block->rest.defined()) {
+            return workspace_size(block->rest);
+        }
+    } else if (const IfThenElse *if_stmt = s.as<IfThenElse>()) {
+        if (!if_stmt->else_case.defined()) {
+            return workspace_size(if_stmt->then_case);
+        }
+    }
+    return Expr();
+}
+
+}
+}
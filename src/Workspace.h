@@ -0,0 +1,38 @@
+#ifndef HALIDE_WORKSPACE_H
+#define HALIDE_WORKSPACE_H
+
+/** \file
+ * Defines the pass that carves the heap allocations of a pipeline out
+ * of a single workspace block.
+ */
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Take a fully lowered statement, and for each allocation that
+ * would otherwise go on the heap, work out an upper bound on its
+ * size in terms of the arguments to the pipeline. Those allocations
+ * are then placed at fixed offsets within a single allocation called
+ * "__workspace", made once per invocation of the pipeline. An
+ * allocation inside a parallel loop gets a separate region per
+ * iteration of the loop. Allocations that can't be bounded are left
+ * alone. If nothing goes in the workspace, its size is zero. */
+Stmt inject_workspace(Stmt s);
+
+/** Mark a statement as using a workspace of size zero, so that a
+ * size query still gets made for a pipeline that doesn't gather its
+ * allocations into a workspace. */
+Stmt inject_empty_workspace(Stmt s);
+
+/** Given a statement produced by inject_workspace, return a 64-bit
+ * expression in the arguments to the pipeline that gives the size of
+ * the workspace in bytes. Returns an undefined Expr if the statement
+ * wasn't given a workspace. */
+Expr workspace_size(Stmt s);
+
+}
+}
+
+#endif
@@ -72,6 +72,65 @@ extern int halide_do_par_for(void *user_context,
 extern void halide_shutdown_thread_pool();
 //@}
 
+/** Policies for placing the worker threads of the default thread
+ * pool on linux and android. halide_thread_affinity_cores pins each
+ * worker thread to its own cpu. halide_thread_affinity_numa does the
+ * same, and also keeps each range of a parallel loop on the same NUMA
+ * node from one run to the next, so that the pages of the output it
+ * first touched stay local. */
+enum halide_thread_affinity_t {halide_thread_affinity_none = 0,
+                               halide_thread_affinity_cores = 1,
+                               halide_thread_affinity_numa = 2};
+
+/** Set the placement policy used the next time the default thread
+ * pool starts. If this is never called, the policy is taken from the
+ * HL_THREAD_AFFINITY environment variable, which may be "cores" or
+ * "numa". To change the policy of a running pool, call
+ * halide_shutdown_thread_pool first. The number of threads is taken
+ * from HL_NUMTHREADS, and otherwise defaults to the number of cpus.
+ */
+extern void halide_set_thread_affinity(halide_thread_affinity_t policy);
+
+/** By default all pipelines share one thread pool. A pipeline can
+ * instead run its parallel loops on a pool of its own, so that it
+ * doesn't queue behind the jobs of other pipelines.
+ *
+ * halide_create_thread_pool makes a pool that runs at most
+ * max_threads threads at once, counting the thread that calls into
+ * the pipeline. A max_threads of zero means the same number as the
+ * default pool. Positive priorities are more important, and
+ * negative ones less. On linux the priority becomes the nice value of
+ * the worker threads, and an unprivileged process can only use zero or
+ * negative priorities. The threads start when the pool is first used.
+ *
+ * halide_set_thread_pool binds a user context to a pool. Parallel
+ * loops run by pipelines called with that user context use the pool
+ * from then on. Pass NULL to remove the binding. In AOT code you can
+ * instead define halide_get_thread_pool to find the pool from your
+ * own user context. It should return NULL to use the default pool.
+ *
+ * halide_destroy_thread_pool stops the threads of a pool and frees
+ * it. It does not affect other pools. Make sure no pipeline is still
+ * using the pool when you call it.
+ *
+ * halide_set_thread_pool_limits sets the limits of the default
+ * pool. If they have changed, the pool is shut down and restarts with
+ * the new limits the next time it's used. See
+ * Func::set_thread_pool_limits.
+ *
+ * Only the default pthreads-based thread pool supports this. On other
+ * platforms halide_create_thread_pool returns NULL, and the other
+ * calls do nothing.
+ */
+//@{
+struct halide_thread_pool;
+extern struct halide_thread_pool *halide_create_thread_pool(int max_threads, int priority);
+extern void halide_destroy_thread_pool(struct halide_thread_pool *pool);
+extern void halide_set_thread_pool(void *user_context, struct halide_thread_pool *pool);
+extern struct halide_thread_pool *halide_get_thread_pool(void *user_context);
+extern void halide_set_thread_pool_limits(int max_threads, int priority);
+//@}
+
 /** Define halide_malloc and halide_free to replace the default memory
  * allocator.  See Func::set_custom_allocator. (Specifically note that
  * halide_malloc must return a 32-byte aligned pointer.)
@@ -81,6 +140,96 @@ extern void *halide_malloc(void *user_context, size_t x);
 extern void halide_free(void *user_context, void *ptr);
 //@}
 
+/** The default halide_malloc can keep the blocks passed to
+ * halide_free in a cache, and hand them out again to later
+ * allocations of a similar size. This helps pipelines that are run
+ * over and over, and allocate the same sizes of buffers every
+ * time. Blocks are rounded up to one of four size classes per power
+ * of two, so up to 25% of each block may go unused.
+ *
+ * The cache is off unless the HL_MALLOC_CACHE environment variable
+ * gives its size in megabytes, or halide_set_malloc_cache_size is
+ * called with a size in bytes. Once the cache holds that many bytes,
+ * further frees go straight back to the system. Setting the size to
+ * zero turns the cache off and releases everything in it.
+ *
+ * halide_malloc_cache_trim releases every block held by the cache
+ * back to the system. halide_get_malloc_cache_stats reports how many
+ * allocations were satisfied from the cache (hits), how many had to
+ * go to the system (misses), and how much memory the cache holds.
+ *
+ * None of this applies if a custom allocator is in use.
+ */
+//@{
+struct halide_malloc_cache_stats_t {
+    uint64_t hits, misses;
+    uint64_t cached_bytes;
+};
+extern void halide_set_malloc_cache_size(size_t bytes);
+extern void halide_malloc_cache_trim();
+extern void halide_get_malloc_cache_stats(struct halide_malloc_cache_stats_t *stats);
+//@}
+
+/** Pipelines compiled for a target with the "workspace" feature carve
+ * their internal buffers out of one block of memory per call,
+ * instead of allocating each one separately. Such a pipeline comes
+ * with a second function, named after the pipeline with
+ * "_workspace_size" appended, that takes the same arguments and
+ * returns how many bytes that block needs to be, as an int64_t. The
+ * pipeline fails with an error if that is more than 2^31 - 1.
+ *
+ * The block is allocated with halide_workspace_malloc, and released
+ * with halide_workspace_free. By default these call halide_malloc and
+ * halide_free, unless a workspace at least as large as the request
+ * has been bound to the user context with halide_set_workspace, in
+ * which case that is used instead and nothing is allocated. The
+ * workspace must be 32-byte aligned, and must not be used by two
+ * calls at once. Pass a NULL pointer to remove the binding.
+ */
+//@{
+extern void halide_set_workspace(void *user_context, void *ptr, size_t size);
+extern void *halide_workspace_malloc(void *user_context, size_t x);
+extern void halide_workspace_free(void *user_context, void *ptr);
+//@}
+
+/** Pipelines compiled for a target with the "profile" feature record
+ * which Func each thread is working on, and a sampler thread counts
+ * how often it finds each Func running. This is much cheaper than the
+ * instrumentation done by HL_PROFILE, so it can be left on, and it
+ * works with parallel schedules. The sampler starts the first time
+ * such a pipeline runs. It wakes up every millisecond, or every
+ * HL_PROFILER_INTERVAL microseconds if that is set. Samples taken
+ * while a thread is in a pipeline but not in any of its Funcs are
+ * counted against the name "$overhead$".
+ *
+ * halide_profiler_get_stats fills in up to max_funcs entries with the
+ * number of samples taken in each Func of the named pipeline, and
+ * the fraction of the pipeline's samples that is. It returns the
+ * number of Funcs in the pipeline, or -1 if the pipeline hasn't run.
+ *
+ * halide_profiler_report prints the samples of every pipeline with
+ * halide_printf, in a form that util/HalideProf.cpp can read.
+ * halide_profiler_reset sets all the counts back to zero.
+ * halide_profiler_shutdown stops the sampler, prints the report, and
+ * releases everything the profiler holds. In JIT-compiled code it is
+ * called when the module is freed.
+ *
+ * The sampler is only available on platforms with pthreads. On
+ * windows no samples are taken.
+ */
+//@{
+struct halide_profiler_func_stats_t {
+    const char *name;
+    uint64_t samples;
+    double fraction;
+};
+extern int halide_profiler_get_stats(const char *pipeline_name,
+                                     struct halide_profiler_func_stats_t *stats, int max_funcs);
+extern void halide_profiler_report(void *user_context);
+extern void halide_profiler_reset();
+extern void halide_profiler_shutdown();
+//@}
+
 /** Called when debug_to_file is used inside %Halide code.  See
  * Func::debug_to_file for how this is called
  *
@@ -104,11 +253,14 @@ enum halide_trace_event_t {halide_trace_load = 0,
 /** Called when Funcs are marked as trace_load, trace_store, or
  * trace_realization. See Func::set_custom_trace. The default
  * implementation either prints events via halide_printf, or if
- * HL_TRACE_FILE is defined, dumps the trace to that file in a
- * yet-to-be-documented binary format (see src/runtime/tracing.cpp to
- * reverse engineer the format). If the trace is going to be large,
- * you may want to make the file a named pipe, and then read from that
- * pipe into gzip.
+ * HL_TRACE_FILE is defined, dumps the trace to that file in a compact
+ * binary format described in src/runtime/tracing.cpp, and read by
+ * util/HalideTrace.cpp. Events are buffered per thread and written in
+ * large blocks, so loads and stores from different threads may
+ * appear out of order with respect to each other, but never out of
+ * order with respect to the other events. If the trace is going to be
+ * large, you may want to make the file a named pipe, and then read
+ * from that pipe into gzip.
  *
  * halide_trace returns a unique ID which will be passed to future
  * events that "belong" to the earlier event as the parent id. The
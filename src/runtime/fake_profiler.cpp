@@ -0,0 +1,29 @@
+#include "mini_stdint.h"
+#include "HalideRuntime.h"
+
+extern "C" {
+
+WEAK int halide_profiler_pipeline_start(void *user_context, const char *pipeline_name,
+                                        int num_stages, const char *stage_names) {
+    return 0;
+}
+
+WEAK int halide_profiler_set_stage(void *user_context, int stage) {
+    return -1;
+}
+
+WEAK int halide_profiler_get_stats(const char *pipeline_name,
+                                   halide_profiler_func_stats_t *stats, int max_funcs) {
+    return -1;
+}
+
+WEAK void halide_profiler_reset() {
+}
+
+WEAK void halide_profiler_report(void *user_context) {
+}
+
+WEAK void halide_profiler_shutdown() {
+}
+
+}
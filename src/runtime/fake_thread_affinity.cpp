@@ -0,0 +1,17 @@
+#include "mini_stdint.h"
+
+extern "C" {
+
+WEAK int halide_pin_thread_to_cpu(int cpu) {
+    return -1;
+}
+
+WEAK int halide_numa_node_of_cpu(int cpu) {
+    return 0;
+}
+
+WEAK int halide_set_thread_priority(int priority) {
+    return -1;
+}
+
+}
@@ -7,6 +7,27 @@ extern "C" {
 WEAK void halide_shutdown_thread_pool() {
 }
 
+// Pools of our own aren't supported by this thread pool. Everything
+// runs on the default one.
+struct halide_thread_pool;
+
+WEAK halide_thread_pool *halide_create_thread_pool(int max_threads, int priority) {
+    return NULL;
+}
+
+WEAK void halide_destroy_thread_pool(halide_thread_pool *pool) {
+}
+
+WEAK void halide_set_thread_pool(void *user_context, halide_thread_pool *pool) {
+}
+
+WEAK halide_thread_pool *halide_get_thread_pool(void *user_context) {
+    return NULL;
+}
+
+WEAK void halide_set_thread_pool_limits(int max_threads, int priority) {
+}
+
 WEAK int (*halide_custom_do_task)(void *, int (*)(void *, int, uint8_t *),
                                   int, uint8_t *);
 
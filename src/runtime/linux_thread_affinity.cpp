@@ -0,0 +1,48 @@
+#include "mini_stdint.h"
+
+extern "C" {
+
+extern int sched_setaffinity(int pid, size_t cpusetsize, const void *mask);
+extern int access(const char *pathname, int mode);
+extern int snprintf(char *str, size_t size, const char *format, ...);
+extern int setpriority(int which, int who, int prio);
+
+// Pin the calling thread to a single cpu. Returns zero on success.
+WEAK int halide_pin_thread_to_cpu(int cpu) {
+    // Big enough for the 1024 cpus that a glibc cpu_set_t can describe.
+    uint64_t mask[16];
+    if (cpu < 0 || cpu >= 1024) return -1;
+    for (int i = 0; i < 16; i++) {
+        mask[i] = 0;
+    }
+    mask[cpu / 64] = (uint64_t)1 << (cpu % 64);
+    return sched_setaffinity(0, sizeof(mask), mask);
+}
+
+// Return the NUMA node that a cpu belongs to, or zero if it can't be
+// determined.
+WEAK int halide_numa_node_of_cpu(int cpu) {
+    char path[64];
+    for (int node = 0; ; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", node);
+        if (access(path, 0) != 0) break;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if (access(path, 0) == 0) return node;
+    }
+    return 0;
+}
+
+// Adjust the scheduling priority of the calling thread. Positive
+// values are more important. On linux the nice value is a per-thread
+// attribute, so this doesn't affect the rest of the process. An
+// unprivileged process can only lower its priority, so a call with a
+// positive value may fail, which is harmless.
+WEAK int halide_set_thread_priority(int priority) {
+    int nice = -priority;
+    if (nice < -20) nice = -20;
+    if (nice > 19) nice = 19;
+    // 0 is PRIO_PROCESS, and a who of 0 means the calling thread.
+    return setpriority(0, 0, nice);
+}
+
+}
@@ -1,4 +1,5 @@
 #include "mini_stdint.h"
+#include "HalideRuntime.h"
 
 #define WEAK __attribute__((weak))
 #ifndef NULL
@@ -9,6 +10,9 @@ extern "C" {
 
 extern void *malloc(size_t);
 extern void free(void *);
+extern char *getenv(const char *);
+extern int atoi(const char *);
+extern size_t halide_current_thread_id();
 
 WEAK void *(*halide_custom_malloc)(void *, size_t) = NULL;
 WEAK void (*halide_custom_free)(void *, void *) = NULL;
@@ -19,27 +23,276 @@ WEAK void halide_set_custom_allocator(void *(*cust_malloc)(void *, size_t),
     halide_custom_free = cust_free;
 }
 
+// The cache keeps freed blocks in size classes. There are four size
+// classes per power of two from 40 bytes up to 2GB. A block holds its
+// size class just below the pointer to the original allocation, so
+// that halide_free knows where to put it back. Larger allocations go
+// straight to malloc and free.
+#define HALIDE_MALLOC_NUM_CLASSES (4 * (31 - 5))
+
+// The cache is split into shards to keep threads from contending with
+// each other. A thread picks its shard by hashing its thread id, so it
+// always gets the same shard, and different threads usually get
+// different shards.
+#define HALIDE_MALLOC_NUM_SHARDS 16
+
+struct malloc_cache_shard {
+    // Protects everything in this shard.
+    int lock;
+    // Singly linked lists of free blocks, threaded through the first
+    // word of each block.
+    void *free_lists[HALIDE_MALLOC_NUM_CLASSES];
+    uint64_t hits, misses;
+    // Keep the shards on separate cache lines.
+    uint8_t padding[64];
+};
+
+WEAK malloc_cache_shard halide_malloc_cache_shards[HALIDE_MALLOC_NUM_SHARDS];
+
+// The most bytes the cache may hold onto. Zero means the cache is off.
+WEAK size_t halide_malloc_cache_limit = 0;
+WEAK size_t halide_malloc_cache_bytes = 0;
+WEAK bool halide_malloc_cache_initialized = false;
+
+WEAK void halide_set_malloc_cache_size(size_t bytes) {
+    halide_malloc_cache_initialized = true;
+    halide_malloc_cache_limit = bytes;
+    if (bytes == 0) {
+        halide_malloc_cache_trim();
+    }
+}
+
+// Returns the size class to use for an allocation of the given size,
+// or -1 if it's too large to cache. Sets *class_bytes to the size of
+// blocks in that class.
+WEAK int halide_malloc_size_class(size_t size, size_t *class_bytes) {
+    // The smallest class holds 40 bytes.
+    if (size < 40) size = 40;
+    // Find the power of two k such that 2^k < size <= 2^(k+1)
+    int k = 5;
+    while (k < 31 && ((size_t)1 << (k + 1)) < size) {
+        k++;
+    }
+    if (k >= 31) return -1;
+    // Divide that range into quarters.
+    size_t step = (size_t)1 << (k - 2);
+    size_t quarters = (size - ((size_t)1 << k) + step - 1) / step;
+    *class_bytes = ((size_t)1 << k) + quarters * step;
+    return (k - 5) * 4 + (int)quarters - 1;
+}
+
+// Map the calling thread to one of n shards. Thread ids are often
+// pointers or small counters, so mix all of their bits in with a
+// multiplicative hash before reducing. Also used by tracing.cpp.
+WEAK int halide_thread_shard(int n) {
+    uint64_t h = (uint64_t)halide_current_thread_id() * UINT64_C(0x9E3779B97F4A7C15);
+    return (int)((h >> 32) % (uint64_t)n);
+}
+
+WEAK malloc_cache_shard *halide_malloc_cache_shard() {
+    return halide_malloc_cache_shards + halide_thread_shard(HALIDE_MALLOC_NUM_SHARDS);
+}
+
+WEAK void halide_malloc_cache_lock(malloc_cache_shard *shard) {
+    while (__sync_lock_test_and_set(&shard->lock, 1)) {
+        while (*((volatile int *)(&shard->lock))) {}
+    }
+}
+
+WEAK void halide_malloc_cache_unlock(malloc_cache_shard *shard) {
+    __sync_lock_release(&shard->lock);
+}
+
+// Allocate a 32-byte aligned block with the size class stored below
+// it. -1 marks a block that bypasses the cache.
+WEAK void *halide_aligned_malloc(size_t x, int size_class) {
+    // The two words below the returned pointer hold the original
+    // pointer and the size class, so leave room for them before
+    // rounding up to the next multiple of 32.
+    const size_t header = 2 * sizeof(void *);
+    void *orig = malloc(x + header + 31);
+    if (orig == NULL) {
+        // Will result in a failed assertion and a call to halide_error
+        return NULL;
+    }
+    void *ptr = (void *)(((size_t)orig + header + 31) & ~(size_t)31);
+    ((void **)ptr)[-1] = orig;
+    ((intptr_t *)ptr)[-2] = size_class;
+    return ptr;
+}
+
 WEAK void *halide_malloc(void *user_context, size_t x) {
     if (halide_custom_malloc) {
         return halide_custom_malloc(user_context, x);
-    } else {
-        void *orig = malloc(x+32);
-        if (orig == NULL) {
-            // Will result in a failed assertion and a call to halide_error
-            return NULL;
+    }
+
+    if (!halide_malloc_cache_initialized) {
+        // HL_MALLOC_CACHE gives the size of the cache in megabytes.
+        char *cache_str = getenv("HL_MALLOC_CACHE");
+        if (cache_str) {
+            halide_malloc_cache_limit = (size_t)atoi(cache_str) << 20;
         }
-        // Round up to next multiple of 32. Should add at least 8 bytes so we can fit the original pointer.
-        void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
-        ((void **)ptr)[-1] = orig;
+        halide_malloc_cache_initialized = true;
+    }
+
+    if (halide_malloc_cache_limit == 0) {
+        return halide_aligned_malloc(x, -1);
+    }
+
+    size_t class_bytes;
+    int size_class = halide_malloc_size_class(x, &class_bytes);
+    if (size_class < 0) {
+        return halide_aligned_malloc(x, -1);
+    }
+
+    malloc_cache_shard *shard = halide_malloc_cache_shard();
+    halide_malloc_cache_lock(shard);
+    void *ptr = shard->free_lists[size_class];
+    if (ptr) {
+        shard->free_lists[size_class] = *((void **)ptr);
+        shard->hits++;
+    } else {
+        shard->misses++;
+    }
+    halide_malloc_cache_unlock(shard);
+
+    if (ptr) {
+        __sync_fetch_and_sub(&halide_malloc_cache_bytes, class_bytes);
         return ptr;
+    } else {
+        return halide_aligned_malloc(class_bytes, size_class);
     }
 }
 
 WEAK void halide_free(void *user_context, void *ptr) {
     if (halide_custom_free) {
         halide_custom_free(user_context, ptr);
+        return;
+    }
+
+    int size_class = (int)(((intptr_t *)ptr)[-2]);
+    if (size_class >= 0 && halide_malloc_cache_limit) {
+        // Blocks in a size class were allocated at exactly that size.
+        size_t class_bytes = (size_t)(((size_class % 4) + 5)) << (size_class / 4 + 3);
+        size_t cached = __sync_add_and_fetch(&halide_malloc_cache_bytes, class_bytes);
+        if (cached <= halide_malloc_cache_limit) {
+            malloc_cache_shard *shard = halide_malloc_cache_shard();
+            halide_malloc_cache_lock(shard);
+            *((void **)ptr) = shard->free_lists[size_class];
+            shard->free_lists[size_class] = ptr;
+            halide_malloc_cache_unlock(shard);
+            return;
+        }
+        // The cache is full.
+        __sync_fetch_and_sub(&halide_malloc_cache_bytes, class_bytes);
+    }
+
+    free(((void**)ptr)[-1]);
+}
+
+WEAK void halide_malloc_cache_trim() {
+    for (int i = 0; i < HALIDE_MALLOC_NUM_SHARDS; i++) {
+        malloc_cache_shard *shard = halide_malloc_cache_shards + i;
+        for (int c = 0; c < HALIDE_MALLOC_NUM_CLASSES; c++) {
+            halide_malloc_cache_lock(shard);
+            void *ptr = shard->free_lists[c];
+            shard->free_lists[c] = NULL;
+            halide_malloc_cache_unlock(shard);
+
+            size_t class_bytes = (size_t)(((c % 4) + 5)) << (c / 4 + 3);
+            while (ptr) {
+                void *next = *((void **)ptr);
+                __sync_fetch_and_sub(&halide_malloc_cache_bytes, class_bytes);
+                free(((void**)ptr)[-1]);
+                ptr = next;
+            }
+        }
+    }
+}
+
+WEAK void halide_get_malloc_cache_stats(halide_malloc_cache_stats_t *stats) {
+    stats->hits = 0;
+    stats->misses = 0;
+    for (int i = 0; i < HALIDE_MALLOC_NUM_SHARDS; i++) {
+        malloc_cache_shard *shard = halide_malloc_cache_shards + i;
+        halide_malloc_cache_lock(shard);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        halide_malloc_cache_unlock(shard);
+    }
+    stats->cached_bytes = halide_malloc_cache_bytes;
+}
+
+
+// Workspaces supplied by callers with halide_set_workspace, keyed by
+// user context.
+struct workspace_binding {
+    void *user_context;
+    void *ptr;
+    size_t size;
+    workspace_binding *next;
+};
+
+WEAK workspace_binding *halide_workspace_bindings = NULL;
+WEAK int halide_workspace_bindings_lock = 0;
+
+WEAK void halide_set_workspace(void *user_context, void *ptr, size_t size) {
+    while (__sync_lock_test_and_set(&halide_workspace_bindings_lock, 1)) {}
+    workspace_binding **b = &halide_workspace_bindings;
+    while (*b && (*b)->user_context != user_context) {
+        b = &((*b)->next);
+    }
+    if (ptr == NULL) {
+        if (*b) {
+            workspace_binding *dead = *b;
+            *b = dead->next;
+            free(dead);
+        }
     } else {
-        free(((void**)ptr)[-1]);
+        if (*b == NULL) {
+            *b = (workspace_binding *)malloc(sizeof(workspace_binding));
+            (*b)->user_context = user_context;
+            (*b)->next = NULL;
+        }
+        (*b)->ptr = ptr;
+        (*b)->size = size;
+    }
+    __sync_lock_release(&halide_workspace_bindings_lock);
+}
+
+// Returns the workspace bound to a user context, or NULL.
+WEAK void *halide_get_workspace(void *user_context, size_t *size) {
+    // Most callers never bind a workspace, so check that without
+    // taking the lock.
+    if (halide_workspace_bindings == NULL) {
+        return NULL;
+    }
+    void *ptr = NULL;
+    while (__sync_lock_test_and_set(&halide_workspace_bindings_lock, 1)) {}
+    for (workspace_binding *b = halide_workspace_bindings; b; b = b->next) {
+        if (b->user_context == user_context) {
+            ptr = b->ptr;
+            *size = b->size;
+            break;
+        }
+    }
+    __sync_lock_release(&halide_workspace_bindings_lock);
+    return ptr;
+}
+
+WEAK void *halide_workspace_malloc(void *user_context, size_t x) {
+    size_t size = 0;
+    void *ptr = halide_get_workspace(user_context, &size);
+    if (ptr && x <= size) {
+        return ptr;
+    }
+    return halide_malloc(user_context, x);
+}
+
+WEAK void halide_workspace_free(void *user_context, void *ptr) {
+    size_t size = 0;
+    if (ptr != halide_get_workspace(user_context, &size)) {
+        halide_free(user_context, ptr);
     }
 }
 
@@ -0,0 +1,307 @@
+#include "mini_stdint.h"
+#include "HalideRuntime.h"
+
+#define WEAK __attribute__((weak))
+
+extern "C" {
+
+typedef long pthread_t;
+extern int pthread_create(pthread_t *thread, const void *attr,
+                          void *(*start_routine)(void *), void *arg);
+extern int pthread_join(pthread_t thread, void **retval);
+extern int usleep(unsigned int usec);
+
+extern char *getenv(const char *);
+extern int atoi(const char *);
+extern int strcmp(const char *, const char *);
+extern size_t strlen(const char *);
+extern void *memcpy(void *, const void *, size_t);
+extern void *malloc(size_t);
+extern void free(void *);
+
+extern int halide_printf(void *user_context, const char *, ...);
+extern size_t halide_current_thread_id();
+extern int halide_thread_shard(int n);
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+// Pipelines compiled with the profile feature call
+// halide_profiler_set_stage whenever a thread starts or finishes
+// work on a Func. That writes the id of the Func into a slot that
+// belongs to the thread, and does nothing else. A sampler thread
+// wakes up at a fixed rate, and counts one sample against whatever
+// stage each slot holds. The fraction of the samples a Func gets is
+// an estimate of the fraction of the time spent computing it.
+
+// A stage id is the index of the pipeline in the table below,
+// shifted up by 16 bits, plus the index of the Func within the
+// pipeline. -1 means the thread isn't running a pipeline.
+#define HALIDE_PROFILER_MAX_PIPELINES 256
+#define HALIDE_PROFILER_MAX_STAGES 65536
+
+// A thread finds its slot by hashing its id into a table of
+// lists. Slots are only added to the lists while the profiler runs,
+// so threads can search them without taking the lock. The slot of a
+// thread that exits stays idle until a new thread with the same id
+// takes it over.
+#define HALIDE_PROFILER_NUM_BUCKETS 64
+
+struct profiler_thread_slot {
+    volatile int stage;
+    size_t thread;
+    // The next slot in the list of all slots, and in the list of the
+    // bucket this slot is in.
+    profiler_thread_slot *next;
+    profiler_thread_slot *volatile next_in_bucket;
+};
+
+struct profiler_pipeline {
+    const char *name;
+    // The names of the stages, as passed to
+    // halide_profiler_pipeline_start, and a copy that is split up
+    // into the names of the individual stages.
+    const char *stage_names;
+    char *stage_names_copy;
+    const char **stages;
+    int num_stages;
+    uint64_t *samples;
+    uint64_t runs;
+};
+
+WEAK profiler_pipeline halide_profiler_pipelines[HALIDE_PROFILER_MAX_PIPELINES];
+WEAK int halide_profiler_num_pipelines = 0;
+
+// Protects the pipeline table and the list of thread slots. The
+// threads running pipelines never take it, except when they see a
+// pipeline or a thread for the first time.
+WEAK int halide_profiler_lock = 0;
+
+WEAK profiler_thread_slot *halide_profiler_thread_slots = NULL;
+WEAK profiler_thread_slot *volatile halide_profiler_slot_buckets[HALIDE_PROFILER_NUM_BUCKETS];
+
+WEAK bool halide_profiler_started = false;
+WEAK volatile bool halide_profiler_stopping = false;
+WEAK pthread_t halide_profiler_sampler;
+WEAK int halide_profiler_interval_us = 1000;
+
+WEAK void halide_profiler_lock_acquire() {
+    while (__sync_lock_test_and_set(&halide_profiler_lock, 1)) {
+        while (*((volatile int *)(&halide_profiler_lock))) {}
+    }
+}
+
+WEAK void halide_profiler_lock_release() {
+    __sync_lock_release(&halide_profiler_lock);
+}
+
+WEAK void *halide_profiler_sampler_thread(void *) {
+    while (!halide_profiler_stopping) {
+        usleep(halide_profiler_interval_us);
+        halide_profiler_lock_acquire();
+        for (profiler_thread_slot *s = halide_profiler_thread_slots; s; s = s->next) {
+            int stage = s->stage;
+            if (stage < 0) continue;
+            int p = stage / HALIDE_PROFILER_MAX_STAGES;
+            int i = stage % HALIDE_PROFILER_MAX_STAGES;
+            if (p < halide_profiler_num_pipelines &&
+                i < halide_profiler_pipelines[p].num_stages) {
+                halide_profiler_pipelines[p].samples[i]++;
+            }
+        }
+        halide_profiler_lock_release();
+    }
+    return NULL;
+}
+
+// Returns the slot of the calling thread, making one if need be.
+WEAK profiler_thread_slot *halide_profiler_get_slot() {
+    size_t thread = halide_current_thread_id();
+    int bucket = halide_thread_shard(HALIDE_PROFILER_NUM_BUCKETS);
+    profiler_thread_slot *slot = halide_profiler_slot_buckets[bucket];
+    for (; slot; slot = slot->next_in_bucket) {
+        if (slot->thread == thread) return slot;
+    }
+
+    // Only this thread adds slots with its id, so there's no need to
+    // search again once we hold the lock.
+    halide_profiler_lock_acquire();
+    slot = (profiler_thread_slot *)malloc(sizeof(profiler_thread_slot));
+    slot->stage = -1;
+    slot->thread = thread;
+    slot->next = halide_profiler_thread_slots;
+    halide_profiler_thread_slots = slot;
+    slot->next_in_bucket = halide_profiler_slot_buckets[bucket];
+    // Finish writing the slot before other threads can see it.
+    __sync_synchronize();
+    halide_profiler_slot_buckets[bucket] = slot;
+    halide_profiler_lock_release();
+
+    return slot;
+}
+
+// Called at the start of each run of a pipeline. The names of its
+// stages are separated by spaces. Returns the id of the first stage
+// of the pipeline. If there is no room for the pipeline, the ids
+// returned are past the end of the table, and the sampler ignores
+// them.
+WEAK int halide_profiler_pipeline_start(void *user_context, const char *pipeline_name,
+                                        int num_stages, const char *stage_names) {
+    halide_profiler_lock_acquire();
+
+    if (!halide_profiler_started) {
+        char *interval = getenv("HL_PROFILER_INTERVAL");
+        if (interval && atoi(interval) > 0) {
+            halide_profiler_interval_us = atoi(interval);
+        }
+        halide_profiler_stopping = false;
+        pthread_create(&halide_profiler_sampler, NULL, halide_profiler_sampler_thread, NULL);
+        halide_profiler_started = true;
+    }
+
+    // Pipelines are identified by their name and their stages, so
+    // that the samples of a pipeline that is compiled more than once
+    // add up.
+    int p = 0;
+    for (; p < halide_profiler_num_pipelines; p++) {
+        profiler_pipeline *pipe = halide_profiler_pipelines + p;
+        if (!strcmp(pipe->name, pipeline_name) &&
+            !strcmp(pipe->stage_names, stage_names)) {
+            break;
+        }
+    }
+
+    if (p == halide_profiler_num_pipelines) {
+        if (p == HALIDE_PROFILER_MAX_PIPELINES || num_stages > HALIDE_PROFILER_MAX_STAGES) {
+            halide_profiler_lock_release();
+            return HALIDE_PROFILER_MAX_PIPELINES * HALIDE_PROFILER_MAX_STAGES;
+        }
+        profiler_pipeline *pipe = halide_profiler_pipelines + p;
+        // Copy the names, in case they belong to code that is
+        // unloaded before the report is printed.
+        size_t name_len = strlen(pipeline_name) + 1;
+        size_t stages_len = strlen(stage_names) + 1;
+        char *names = (char *)malloc(name_len + 2 * stages_len);
+        memcpy(names, pipeline_name, name_len);
+        memcpy(names + name_len, stage_names, stages_len);
+        memcpy(names + name_len + stages_len, stage_names, stages_len);
+        pipe->name = names;
+        pipe->stage_names = names + name_len;
+        pipe->stage_names_copy = names + name_len + stages_len;
+
+        pipe->num_stages = num_stages;
+        pipe->stages = (const char **)malloc(num_stages * sizeof(const char *));
+        pipe->samples = (uint64_t *)malloc(num_stages * sizeof(uint64_t));
+        char *c = pipe->stage_names_copy;
+        for (int i = 0; i < num_stages; i++) {
+            pipe->stages[i] = c;
+            pipe->samples[i] = 0;
+            while (*c && *c != ' ') c++;
+            if (*c) *c++ = 0;
+        }
+        pipe->runs = 0;
+        halide_profiler_num_pipelines++;
+    }
+    halide_profiler_pipelines[p].runs++;
+
+    halide_profiler_lock_release();
+
+    return p * HALIDE_PROFILER_MAX_STAGES;
+}
+
+// Marks the calling thread as working on the given stage. Returns the
+// stage it was working on before.
+WEAK int halide_profiler_set_stage(void *user_context, int stage) {
+    profiler_thread_slot *slot = halide_profiler_get_slot();
+    int old = slot->stage;
+    slot->stage = stage;
+    return old;
+}
+
+WEAK int halide_profiler_get_stats(const char *pipeline_name,
+                                   halide_profiler_func_stats_t *stats, int max_funcs) {
+    int result = -1;
+    halide_profiler_lock_acquire();
+    for (int p = 0; p < halide_profiler_num_pipelines; p++) {
+        profiler_pipeline *pipe = halide_profiler_pipelines + p;
+        if (strcmp(pipe->name, pipeline_name)) continue;
+        uint64_t total = 0;
+        for (int i = 0; i < pipe->num_stages; i++) {
+            total += pipe->samples[i];
+        }
+        for (int i = 0; i < pipe->num_stages && i < max_funcs; i++) {
+            stats[i].name = pipe->stages[i];
+            stats[i].samples = pipe->samples[i];
+            stats[i].fraction = total ? (double)pipe->samples[i] / (double)total : 0.0;
+        }
+        result = pipe->num_stages;
+        break;
+    }
+    halide_profiler_lock_release();
+    return result;
+}
+
+WEAK void halide_profiler_reset() {
+    halide_profiler_lock_acquire();
+    for (int p = 0; p < halide_profiler_num_pipelines; p++) {
+        profiler_pipeline *pipe = halide_profiler_pipelines + p;
+        for (int i = 0; i < pipe->num_stages; i++) {
+            pipe->samples[i] = 0;
+        }
+        pipe->runs = 0;
+    }
+    halide_profiler_lock_release();
+}
+
+WEAK void halide_profiler_report(void *user_context) {
+    halide_profiler_lock_acquire();
+    for (int p = 0; p < halide_profiler_num_pipelines; p++) {
+        profiler_pipeline *pipe = halide_profiler_pipelines + p;
+        uint64_t total = 0;
+        for (int i = 0; i < pipe->num_stages; i++) {
+            total += pipe->samples[i];
+        }
+        for (int i = 0; i < pipe->num_stages; i++) {
+            // Read by util/HalideProf.cpp
+            halide_printf(user_context, "halide_profiler samples %s %s %llu %llu %d %llu\n",
+                          pipe->name, pipe->stages[i],
+                          (unsigned long long)pipe->samples[i],
+                          (unsigned long long)total,
+                          halide_profiler_interval_us,
+                          (unsigned long long)pipe->runs);
+        }
+    }
+    halide_profiler_lock_release();
+}
+
+WEAK void halide_profiler_shutdown() {
+    if (!halide_profiler_started) return;
+
+    halide_profiler_stopping = true;
+    pthread_join(halide_profiler_sampler, NULL);
+    halide_profiler_started = false;
+
+    halide_profiler_report(NULL);
+
+    for (int p = 0; p < halide_profiler_num_pipelines; p++) {
+        profiler_pipeline *pipe = halide_profiler_pipelines + p;
+        free((void *)pipe->name);
+        free(pipe->stages);
+        free(pipe->samples);
+    }
+    halide_profiler_num_pipelines = 0;
+
+    // The slots can go too, as long as no pipeline is running. Threads
+    // get new ones if the profiler starts again.
+    for (int i = 0; i < HALIDE_PROFILER_NUM_BUCKETS; i++) {
+        halide_profiler_slot_buckets[i] = NULL;
+    }
+    while (halide_profiler_thread_slots) {
+        profiler_thread_slot *next = halide_profiler_thread_slots->next;
+        free(halide_profiler_thread_slots);
+        halide_profiler_thread_slots = next;
+    }
+}
+
+}
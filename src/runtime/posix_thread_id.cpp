@@ -0,0 +1,12 @@
+#include "mini_stdint.h"
+
+extern "C" {
+
+typedef long pthread_t;
+extern pthread_t pthread_self();
+
+WEAK size_t halide_current_thread_id() {
+    return (size_t)pthread_self();
+}
+
+}
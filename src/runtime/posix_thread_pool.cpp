@@ -1,4 +1,5 @@
 #include "mini_stdint.h"
+#include "HalideRuntime.h"
 
 #define WEAK __attribute__((weak))
 
@@ -39,6 +40,13 @@ extern int pthread_mutex_destroy(pthread_mutex_t *mutex);
 
 extern char *getenv(const char *);
 extern int atoi(const char *);
+extern int strcmp(const char *, const char *);
+extern void *malloc(size_t);
+extern void free(void *);
+
+extern int halide_pin_thread_to_cpu(int cpu);
+extern int halide_numa_node_of_cpu(int cpu);
+extern int halide_set_thread_priority(int priority);
 
 extern int halide_printf(void *user_context, const char *, ...);
 
@@ -46,68 +54,239 @@ extern int halide_printf(void *user_context, const char *, ...);
 #define NULL 0
 #endif
 
+// Each thread that joins a job is handed one of these slots. A slot
+// holds a contiguous range of the job's task indices. Tasks are
+// claimed from the front of a range in chunks with an atomic add, so
+// no lock is taken to claim work. A thread drains its own slot first,
+// and then steals chunks from the other slots of the same job.
+struct work_slot {
+    int next, end;
+    // The NUMA node this range of tasks belongs to. Threads drain the
+    // slots on their own node before stealing from other nodes.
+    int node;
+    // Number of threads that have started on this slot. Protected by
+    // the pool mutex.
+    int joined;
+    // Keep each slot on its own cache line, so that threads claiming
+    // from their own slots don't contend with each other.
+    uint8_t padding[48];
+};
+
 struct work {
     work *next_job;
     int (*f)(void *, int, uint8_t *);
     void *user_context;
-    int next, max;
     uint8_t *closure;
+    work_slot *slots;
+    int num_slots;
+    // Number of tasks that have not yet completed. Updated atomically
+    // outside of the lock.
+    int remaining;
     int active_workers;
     int exit_status;
-    bool running() { return next < max || active_workers > 0; }
+    bool running() { return remaining > 0 || active_workers > 0; }
 };
 
-// The work queue and thread pool is weak, so one big work queue is shared by all halide functions
-#define MAX_THREADS 64
-WEAK struct {
-    // all fields are protected by this mutex.
+struct worker {
+    pthread_t thread;
+    // The pool this thread belongs to.
+    halide_thread_pool *pool;
+    // The cpu this thread is pinned to, or -1 if it isn't pinned.
+    int cpu;
+    // The NUMA node the thread runs on. Zero unless the affinity
+    // policy is halide_thread_affinity_numa.
+    int node;
+};
+
+struct halide_thread_pool {
+    // All fields are protected by this mutex. The task ranges inside
+    // the jobs are not.
     pthread_mutex_t mutex;
 
-    // Singly linked list for job stack
+    // Singly linked list for job stack. Jobs are removed once all of
+    // their tasks have been claimed, though some may still be in
+    // flight.
     work *jobs;
 
     // Broadcast whenever items are added to the queue or a job completes.
     pthread_cond_t state_change;
     // Keep track of threads so they can be joined at shutdown
-    pthread_t threads[MAX_THREADS];
+    worker *workers;
+
+    // The most threads that may work on this pool's jobs at once,
+    // counting the thread that called do_par_for. Zero means use
+    // HL_NUMTHREADS, or failing that the number of cpus.
+    int max_threads;
+
+    // The number of threads the pool was started with.
+    int num_threads;
 
-    // Global flag indicating
+    // Passed to halide_set_thread_priority by each worker thread.
+    int priority;
+
+    // The number of NUMA nodes the worker threads are spread over.
+    int num_nodes;
+
+    bool initialized;
+
+    // Flag indicating the worker threads should exit
     bool shutdown;
 
     bool running() {
         return !shutdown;
     }
+};
 
-} halide_work_queue;
+// The default thread pool is weak, so one big work queue is shared by
+// all halide functions that don't ask for a pool of their own.
+WEAK halide_thread_pool halide_work_queue;
 
-WEAK int halide_threads;
-WEAK bool halide_thread_pool_initialized = false;
+// Negative until set by halide_set_thread_affinity, in which case
+// HL_THREAD_AFFINITY is consulted when a pool starts.
+WEAK int halide_thread_affinity_policy = -1;
 
-WEAK void halide_shutdown_thread_pool() {
-    if (!halide_thread_pool_initialized) return;
+WEAK void halide_set_thread_affinity(halide_thread_affinity_t policy) {
+    halide_thread_affinity_policy = policy;
+}
+
+// Stop the worker threads of a pool. The pool restarts on its next use.
+WEAK void halide_shutdown_pool(halide_thread_pool *pool) {
+    // The pool may be starting up on another thread, so check
+    // whether it's running with the lock held.
+    pthread_mutex_lock(&pool->mutex);
+    if (!pool->initialized) {
+        pthread_mutex_unlock(&pool->mutex);
+        return;
+    }
 
     // Wake everyone up and tell them the party's over and it's time
     // to go home
-    pthread_mutex_lock(&halide_work_queue.mutex);
-    halide_work_queue.shutdown = true;
-    pthread_cond_broadcast(&halide_work_queue.state_change);
-    pthread_mutex_unlock(&halide_work_queue.mutex);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->state_change);
+    pthread_mutex_unlock(&pool->mutex);
 
     // Wait until they leave
-    for (int i = 0; i < halide_threads-1; i++) {
+    for (int i = 0; i < pool->num_threads-1; i++) {
         //fprintf(stderr, "Waiting for thread %d to exit\n", i);
         void *retval;
-        pthread_join(halide_work_queue.threads[i], &retval);
+        pthread_join(pool->workers[i].thread, &retval);
     }
+    free(pool->workers);
+    pool->workers = NULL;
 
     //fprintf(stderr, "All threads have quit. Destroying mutex and condition variable.\n");
     // Tidy up
-    pthread_mutex_destroy(&halide_work_queue.mutex);
+    pthread_mutex_destroy(&pool->mutex);
     // Reset it to zero in case we call another do_par_for
     pthread_mutex_t uninitialized_mutex = {0};
-    halide_work_queue.mutex = uninitialized_mutex;
-    pthread_cond_destroy(&halide_work_queue.state_change);
-    halide_thread_pool_initialized = false;
+    pool->mutex = uninitialized_mutex;
+    pthread_cond_destroy(&pool->state_change);
+    pool->initialized = false;
+}
+
+WEAK void halide_shutdown_thread_pool() {
+    halide_shutdown_pool(&halide_work_queue);
+}
+
+WEAK void halide_set_thread_pool_limits(int max_threads, int priority) {
+    pthread_mutex_lock(&halide_work_queue.mutex);
+    bool changed = (halide_work_queue.max_threads != max_threads ||
+                    halide_work_queue.priority != priority);
+    halide_work_queue.max_threads = max_threads;
+    halide_work_queue.priority = priority;
+    pthread_mutex_unlock(&halide_work_queue.mutex);
+
+    // Restart the default pool with the new limits when it's next used.
+    if (changed) {
+        halide_shutdown_pool(&halide_work_queue);
+    }
+}
+
+WEAK halide_thread_pool *halide_create_thread_pool(int max_threads, int priority) {
+    halide_thread_pool *pool = (halide_thread_pool *)malloc(sizeof(halide_thread_pool));
+    if (pool == NULL) return NULL;
+    // A zeroed-out mutex is an unlocked one (see PTHREAD_MUTEX_INITIALIZER).
+    uint8_t *bytes = (uint8_t *)pool;
+    for (size_t i = 0; i < sizeof(halide_thread_pool); i++) {
+        bytes[i] = 0;
+    }
+    pool->max_threads = max_threads;
+    pool->priority = priority;
+    return pool;
+}
+
+// Bindings from user contexts to thread pools, made by halide_set_thread_pool.
+struct thread_pool_binding {
+    void *user_context;
+    halide_thread_pool *pool;
+    thread_pool_binding *next;
+};
+
+WEAK thread_pool_binding *halide_thread_pool_bindings = NULL;
+WEAK pthread_mutex_t halide_thread_pool_bindings_mutex;
+
+WEAK void halide_set_thread_pool(void *user_context, halide_thread_pool *pool) {
+    pthread_mutex_lock(&halide_thread_pool_bindings_mutex);
+    thread_pool_binding **b = &halide_thread_pool_bindings;
+    while (*b && (*b)->user_context != user_context) {
+        b = &((*b)->next);
+    }
+    if (*b && pool) {
+        (*b)->pool = pool;
+    } else if (*b) {
+        thread_pool_binding *dead = *b;
+        *b = dead->next;
+        free(dead);
+    } else if (pool) {
+        thread_pool_binding *binding = (thread_pool_binding *)malloc(sizeof(thread_pool_binding));
+        if (binding) {
+            binding->user_context = user_context;
+            binding->pool = pool;
+            binding->next = halide_thread_pool_bindings;
+            halide_thread_pool_bindings = binding;
+        }
+    }
+    pthread_mutex_unlock(&halide_thread_pool_bindings_mutex);
+}
+
+WEAK halide_thread_pool *halide_get_thread_pool(void *user_context) {
+    // Don't bother with the lock in the common case where nobody has
+    // made a pool of their own.
+    if (halide_thread_pool_bindings == NULL) return NULL;
+
+    halide_thread_pool *pool = NULL;
+    pthread_mutex_lock(&halide_thread_pool_bindings_mutex);
+    for (thread_pool_binding *b = halide_thread_pool_bindings; b; b = b->next) {
+        if (b->user_context == user_context) {
+            pool = b->pool;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&halide_thread_pool_bindings_mutex);
+    return pool;
+}
+
+WEAK void halide_destroy_thread_pool(halide_thread_pool *pool) {
+    if (pool == NULL) return;
+
+    // Forget any user contexts bound to this pool.
+    pthread_mutex_lock(&halide_thread_pool_bindings_mutex);
+    thread_pool_binding **b = &halide_thread_pool_bindings;
+    while (*b) {
+        if ((*b)->pool == pool) {
+            thread_pool_binding *dead = *b;
+            *b = dead->next;
+            free(dead);
+        } else {
+            b = &((*b)->next);
+        }
+    }
+    pthread_mutex_unlock(&halide_thread_pool_bindings_mutex);
+
+    halide_shutdown_pool(pool);
+    if (pool != &halide_work_queue) {
+        free(pool);
+    }
 }
 
 typedef int (*halide_task)(void *user_context, int, uint8_t *);
@@ -133,50 +312,112 @@ WEAK int halide_do_task(void *user_context, halide_task f, int idx,
     }
 }
 
-WEAK void *halide_worker_thread(void *void_arg) {
-    work *owned_job = (work *)void_arg;
+// Claim a chunk of tasks from a slot. Returns the number of tasks
+// claimed, and sets *first to the first one.
+WEAK int halide_claim_tasks(work_slot *slot, int *first) {
+    int end = slot->end;
+    int available = end - *((volatile int *)(&slot->next));
+    if (available <= 0) return 0;
+
+    // Take an eighth of what's left, so that chunks get smaller as
+    // the range drains and the tail of the job balances well.
+    int chunk = available / 8;
+    if (chunk < 1) chunk = 1;
+
+    // Other threads may have raced us to the end of the range, in
+    // which case we get less than we asked for, or nothing at all.
+    int start = __sync_fetch_and_add(&slot->next, chunk);
+    if (start >= end) return 0;
+    if (chunk > end - start) chunk = end - start;
+    *first = start;
+    return chunk;
+}
+
+// Pick the slot that a thread on the given node should start
+// on. Prefers a slot on the same node that nobody has started on
+// yet. Must be called with the lock held.
+WEAK int halide_pick_slot(work *job, int node) {
+    int unjoined = -1;
+    for (int i = 0; i < job->num_slots; i++) {
+        if (job->slots[i].joined) continue;
+        if (node < 0 || job->slots[i].node == node) {
+            return i;
+        }
+        if (unjoined < 0) unjoined = i;
+    }
+    if (unjoined >= 0) return unjoined;
+
+    // Everything has been started on. Pile onto the slot with the
+    // fewest threads on it.
+    int best = 0;
+    for (int i = 1; i < job->num_slots; i++) {
+        if (job->slots[i].joined < job->slots[best].joined) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Run tasks from a job until none are left to claim, starting with
+// the given slot. Slots on the given node are drained before slots
+// on any other node. A negative node means any node is
+// fine. Returns zero, or the exit status of a failing task.
+WEAK int halide_work_on_job(work *job, int slot_idx, int node) {
+    int exit_status = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < job->num_slots; i++) {
+            work_slot *slot = job->slots + (slot_idx + i) % job->num_slots;
+            bool local = node < 0 || slot->node == node;
+            if (local != (pass == 0)) continue;
+            int first, count;
+            while ((count = halide_claim_tasks(slot, &first)) > 0) {
+                for (int idx = first; idx < first + count; idx++) {
+                    int result = halide_do_task(job->user_context, job->f, idx, job->closure);
+                    if (result) {
+                        exit_status = result;
+                    }
+                }
+                __sync_fetch_and_sub(&job->remaining, count);
+            }
+        }
+    }
+    return exit_status;
+}
 
+WEAK void halide_worker_thread(halide_thread_pool *pool, work *owned_job, int node) {
     // Grab the lock
-    pthread_mutex_lock(&halide_work_queue.mutex);
+    pthread_mutex_lock(&pool->mutex);
 
     // If I'm a job owner, then I was the thread that called
     // do_par_for, and I should only stay in this function until my
     // job is complete. If I'm a lowly worker thread, I should stay in
-    // this function as long as the work queue is running.
+    // this function as long as the pool is running.
     while (owned_job != NULL ? owned_job->running()
-           : halide_work_queue.running()) {
+           : pool->running()) {
 
-        if (halide_work_queue.jobs == NULL) {
+        if (pool->jobs == NULL) {
             // There are no jobs pending, though some tasks may still
             // be in flight from the last job. Release the lock and
             // wait for something new to happen.
-            pthread_cond_wait(&halide_work_queue.state_change, &halide_work_queue.mutex);
+            pthread_cond_wait(&pool->state_change, &pool->mutex);
         } else {
-            // There are jobs still to do. Grab the next one.
-            work *job = halide_work_queue.jobs;
-
-            // Claim a task from it.
-            work myjob = *job;
-            job->next++;
-
-            // If there were no more tasks pending for this job, or if
-            // it has failed, remove it from the stack.
-            if (job->next == job->max) {
-                halide_work_queue.jobs = job->next_job;
-            }
+            // There are jobs still to do. Join the most recent one.
+            work *job = pool->jobs;
+            int slot_idx = halide_pick_slot(job, node);
+            job->slots[slot_idx].joined++;
 
             // Increment the active_worker count so that other threads
             // are aware that this job is still in progress even
-            // though there are no outstanding tasks for it.
+            // though there may be no outstanding tasks for it.
             job->active_workers++;
 
-            // Release the lock and do the task.
-            pthread_mutex_unlock(&halide_work_queue.mutex);
-            int result = halide_do_task(myjob.user_context, myjob.f, myjob.next,
-                                        myjob.closure);
-            pthread_mutex_lock(&halide_work_queue.mutex);
+            // Release the lock and work on the job until all of its
+            // tasks have been claimed.
+            pthread_mutex_unlock(&pool->mutex);
+            int result = halide_work_on_job(job, slot_idx, node);
+            pthread_mutex_lock(&pool->mutex);
 
-            // If this task failed, set the exit status on the job.
+            // If a task failed, set the exit status on the job.
             if (result) {
                 job->exit_status = result;
             }
@@ -184,76 +425,168 @@ WEAK void *halide_worker_thread(void *void_arg) {
             // We are no longer active on this job
             job->active_workers--;
 
+            // There's nothing left to claim in this job, so remove it
+            // from the stack if nobody else has already.
+            for (work **j = &pool->jobs; *j; j = &((*j)->next_job)) {
+                if (*j == job) {
+                    *j = job->next_job;
+                    break;
+                }
+            }
+
             // If the job is done and I'm not the owner of it, wake up
             // the owner.
             if (!job->running() && job != owned_job) {
-                pthread_cond_broadcast(&halide_work_queue.state_change);
+                pthread_cond_broadcast(&pool->state_change);
             }
         }
     }
-    pthread_mutex_unlock(&halide_work_queue.mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+WEAK void *halide_worker_thread_main(void *void_arg) {
+    worker *w = (worker *)void_arg;
+    if (w->cpu >= 0) {
+        halide_pin_thread_to_cpu(w->cpu);
+    }
+    if (w->pool->priority) {
+        halide_set_thread_priority(w->pool->priority);
+    }
+    halide_worker_thread(w->pool, NULL, w->node);
     return NULL;
 }
 
 extern int halide_host_cpu_count();
 
+// Start the worker threads of a pool. Must be called with the lock held.
+WEAK void halide_start_pool(halide_thread_pool *pool) {
+    pool->shutdown = false;
+    pthread_cond_init(&pool->state_change, NULL);
+    pool->jobs = NULL;
+
+    int threads = pool->max_threads;
+    if (threads <= 0) {
+        char *threadStr = getenv("HL_NUMTHREADS");
+        if (threadStr) {
+            threads = atoi(threadStr);
+        } else {
+            threads = halide_host_cpu_count();
+            // halide_printf(user_context, "HL_NUMTHREADS not defined. Defaulting to %d threads.\n", threads);
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    pool->num_threads = threads;
+
+    if (halide_thread_affinity_policy < 0) {
+        char *affinityStr = getenv("HL_THREAD_AFFINITY");
+        if (affinityStr && strcmp(affinityStr, "numa") == 0) {
+            halide_thread_affinity_policy = halide_thread_affinity_numa;
+        } else if (affinityStr && strcmp(affinityStr, "cores") == 0) {
+            halide_thread_affinity_policy = halide_thread_affinity_cores;
+        } else {
+            halide_thread_affinity_policy = halide_thread_affinity_none;
+        }
+    }
+
+    int cpus = halide_host_cpu_count();
+    if (cpus < 1) cpus = 1;
+    pool->num_nodes = 1;
+    pool->workers = (worker *)malloc(sizeof(worker) * threads);
+    if (pool->workers == NULL) {
+        // Run everything on the calling thread.
+        pool->num_threads = threads = 1;
+    }
+    for (int i = 0; i < threads-1; i++) {
+        worker *w = pool->workers + i;
+        w->pool = pool;
+        // Leave the first cpu for the thread that calls do_par_for,
+        // which we don't pin.
+        w->cpu = -1;
+        w->node = 0;
+        if (halide_thread_affinity_policy != halide_thread_affinity_none) {
+            w->cpu = (i + 1) % cpus;
+        }
+        if (halide_thread_affinity_policy == halide_thread_affinity_numa) {
+            w->node = halide_numa_node_of_cpu(w->cpu);
+            if (w->node >= pool->num_nodes) {
+                pool->num_nodes = w->node + 1;
+            }
+        }
+    }
+    for (int i = 0; i < threads-1; i++) {
+        //fprintf(stderr, "Creating thread %d\n", i);
+        pthread_create(&(pool->workers[i].thread), NULL,
+                       halide_worker_thread_main, pool->workers + i);
+    }
+
+    pool->initialized = true;
+}
+
 WEAK int halide_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
                            int min, int size, uint8_t *closure) {
     if (halide_custom_do_par_for) {
         return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
     }
 
+    halide_thread_pool *pool = halide_get_thread_pool(user_context);
+    if (pool == NULL) {
+        pool = &halide_work_queue;
+    }
+
     // Grab the lock. If it hasn't been initialized yet, then the
     // field will be zero-initialized because it's a static
-    // global. pthreads helpfully interprets zero-valued mutex objects
-    // as uninitialized and initializes them for you (see PTHREAD_MUTEX_INITIALIZER).
-    pthread_mutex_lock(&halide_work_queue.mutex);
+    // global or was zeroed by halide_create_thread_pool. pthreads
+    // helpfully interprets zero-valued mutex objects as uninitialized
+    // and initializes them for you (see PTHREAD_MUTEX_INITIALIZER).
+    pthread_mutex_lock(&pool->mutex);
 
-    if (!halide_thread_pool_initialized) {
-        halide_work_queue.shutdown = false;
-        pthread_cond_init(&halide_work_queue.state_change, NULL);
-        halide_work_queue.jobs = NULL;
+    if (!pool->initialized) {
+        halide_start_pool(pool);
+    }
 
-        char *threadStr = getenv("HL_NUMTHREADS");
-        if (threadStr) {
-            halide_threads = atoi(threadStr);
-        } else {
-            halide_threads = halide_host_cpu_count();
-            // halide_printf(user_context, "HL_NUMTHREADS not defined. Defaulting to %d threads.\n", halide_threads);
-        }
-        if (halide_threads > MAX_THREADS) {
-            halide_threads = MAX_THREADS;
-        } else if (halide_threads < 1) {
-            halide_threads = 1;
-        }
-        for (int i = 0; i < halide_threads-1; i++) {
-            //fprintf(stderr, "Creating thread %d\n", i);
-            pthread_create(halide_work_queue.threads + i, NULL, halide_worker_thread, NULL);
-        }
+    if (size <= 0) {
+        pthread_mutex_unlock(&pool->mutex);
+        return 0;
+    }
 
-        halide_thread_pool_initialized = true;
+    // Deal the tasks out evenly across one slot per thread. Under
+    // the numa policy, consecutive slots are assigned to the same
+    // node, so a given range of a parallel loop always runs on the
+    // same node. Its output pages are first touched there, and
+    // subsequent runs keep them local.
+    int num_slots = size < pool->num_threads ? size : pool->num_threads;
+    work_slot *slots = (work_slot *)__builtin_alloca(sizeof(work_slot) * num_slots);
+    int num_nodes = pool->num_nodes;
+    for (int i = 0; i < num_slots; i++) {
+        slots[i].next = min + (int)(((int64_t)size * i) / num_slots);
+        slots[i].end  = min + (int)(((int64_t)size * (i + 1)) / num_slots);
+        slots[i].node = (int)(((int64_t)num_nodes * i) / num_slots);
+        slots[i].joined = 0;
     }
 
     // Make the job.
     work job;
     job.f = f;               // The job should call this function. It takes an index and a closure.
     job.user_context = user_context;
-    job.next = min;          // Start at this index.
-    job.max  = min + size;   // Keep going until one less than this index.
     job.closure = closure;   // Use this closure.
+    job.slots = slots;       // Claim task indices from these ranges.
+    job.num_slots = num_slots;
+    job.remaining = size;    // None of the tasks have completed
     job.exit_status = 0;     // The job hasn't failed yet
     job.active_workers = 0;  // Nobody is working on this yet
 
     // Push the job onto the stack.
-    job.next_job = halide_work_queue.jobs;
-    halide_work_queue.jobs = &job;
-    pthread_mutex_unlock(&halide_work_queue.mutex);
+    job.next_job = pool->jobs;
+    pool->jobs = &job;
+    pthread_mutex_unlock(&pool->mutex);
 
     // Wake up any idle worker threads.
-    pthread_cond_broadcast(&halide_work_queue.state_change);
+    pthread_cond_broadcast(&pool->state_change);
 
     // Do some work myself.
-    halide_worker_thread((void *)(&job));
+    halide_worker_thread(pool, &job, -1);
 
     // Return zero if the job succeeded, otherwise return the exit
     // status of one of the failing jobs (whichever one failed last).
@@ -8,6 +8,9 @@ extern void *fopen(const char *path, const char *mode);
 extern size_t fwrite(const void *ptr, size_t size, size_t n, void *file);
 extern int snprintf(char *str, size_t size, const char *format, ...);
 extern int fclose(void *f);
+extern void *malloc(size_t);
+extern void free(void *);
+extern int halide_thread_shard(int n);
 
 typedef int32_t (*trace_fn)(void *, const char *, halide_trace_event_t, int32_t,
                             int32_t, int32_t, int32_t, int32_t,
@@ -19,84 +22,246 @@ WEAK void halide_set_custom_trace(trace_fn t) {
     halide_custom_trace = t;
 }
 
+// The binary trace format, used when HL_TRACE_FILE is set. Each time
+// the file is opened we write a four byte header: 'H', 'L', 'T' and
+// the version number. The rest of the file is a sequence of blocks,
+// each of which is the byte 'B', a little-endian uint32 giving the
+// size of the block, and then that many bytes of packets. Blocks are
+// written whole, so they don't interleave with each other, and each
+// can be decoded by itself. A packet is:
+//
+// - The event, type code, and bits, in one byte each.
+// - The id, the parent id, the vector width, the value index, and the
+//   number of int args, as LEB128 varints.
+// - The function name. The first time a block mentions a function,
+//   this is the varint (2*n + 1), where n is the number of distinct
+//   names in the block so far, followed by the length of the name as
+//   a varint and then the name. After that it is the varint 2*n.
+// - The value, as width elements of bits rounded up to a power of two.
+// - The int args, as zig-zag encoded varints.
+#define HALIDE_TRACE_VERSION 1
+
+// The most bytes a packet can take. The name is truncated to 255
+// bytes, the width and int args to 255 elements, and a varint takes
+// at most 5 bytes.
+#define HALIDE_TRACE_MAX_PACKET (3 + 5*5 + 5*2 + 255 + 255*8 + 255*5)
+
+// Size of the block buffered by each slot.
+#define HALIDE_TRACE_BLOCK_SIZE (64*1024)
+
+// The most distinct function names in a block. After this many, the
+// block is flushed.
+#define HALIDE_TRACE_MAX_NAMES 16
+
+#define HALIDE_TRACE_NUM_SLOTS 32
+
+// Threads write their packets to one of a number of slots, picked by
+// hashing their thread id, so that they rarely wait for each other
+// and each thread's packets stay in order. Each slot also hands out
+// ids from a range it reserves from a shared counter, so that threads
+// don't all contend on the counter.
+struct trace_slot {
+    int lock;
+    int32_t next_id, end_id;
+    uint8_t *buffer;
+    size_t size;
+    const char *names[HALIDE_TRACE_MAX_NAMES];
+    int num_names;
+    // Keep the slots on separate cache lines.
+    uint8_t padding[64];
+};
+
+WEAK trace_slot halide_trace_slots[HALIDE_TRACE_NUM_SLOTS];
+WEAK int32_t halide_trace_next_id_range = 1;
+
 WEAK void *halide_trace_file = NULL;
 WEAK bool halide_trace_initialized = false;
+WEAK int halide_trace_init_lock = 0;
+
+WEAK trace_slot *halide_trace_slot() {
+    return halide_trace_slots + halide_thread_shard(HALIDE_TRACE_NUM_SLOTS);
+}
+
+WEAK void halide_trace_lock(int *lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        while (*((volatile int *)lock)) {}
+    }
+}
+
+WEAK void halide_trace_unlock(int *lock) {
+    __sync_lock_release(lock);
+}
+
+// Write out the block held by a slot. Call with the slot locked.
+WEAK bool halide_trace_flush_slot(trace_slot *slot) {
+    bool ok = true;
+    if (slot->size > 5) {
+        uint32_t block_bytes = (uint32_t)(slot->size - 5);
+        slot->buffer[0] = 'B';
+        for (int i = 0; i < 4; i++) {
+            slot->buffer[1 + i] = (uint8_t)(block_bytes >> (i*8));
+        }
+        // stdio locks the file, so blocks from different slots don't
+        // interleave.
+        ok = fwrite(slot->buffer, 1, slot->size, halide_trace_file) == slot->size;
+    }
+    // Leave room for the block header.
+    slot->size = 5;
+    slot->num_names = 0;
+    return ok;
+}
+
+WEAK bool halide_trace_flush_all() {
+    bool ok = true;
+    for (int i = 0; i < HALIDE_TRACE_NUM_SLOTS; i++) {
+        trace_slot *slot = halide_trace_slots + i;
+        halide_trace_lock(&slot->lock);
+        if (slot->buffer) {
+            ok = halide_trace_flush_slot(slot) && ok;
+        }
+        halide_trace_unlock(&slot->lock);
+    }
+    return ok;
+}
+
+WEAK bool halide_trace_same_name(const char *a, const char *b) {
+    if (a == b) return true;
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+WEAK uint8_t *halide_trace_put_varint(uint8_t *dst, uint32_t x) {
+    while (x >= 0x80) {
+        *dst++ = (uint8_t)(x | 0x80);
+        x >>= 7;
+    }
+    *dst++ = (uint8_t)x;
+    return dst;
+}
 
 WEAK int32_t halide_trace(void *user_context, const char *func, halide_trace_event_t event, int32_t parent_id,
                           int32_t type_code, int32_t bits, int32_t width, int32_t value_idx, void *value,
                           int32_t num_int_args, const int32_t *int_args) {
-    static int32_t ids = 1;
-
     if (halide_custom_trace) {
         return (*halide_custom_trace)(user_context, func, event, parent_id, type_code,
                                       bits, width, value_idx, value, num_int_args, int_args);
     } else {
 
-        int32_t my_id = __sync_fetch_and_add(&ids, 1);
-
         if (!halide_trace_initialized) {
-            const char *trace_file_name = getenv("HL_TRACE_FILE");
-            halide_trace_initialized = true;
-            if (trace_file_name) {
-                halide_trace_file = fopen(trace_file_name, "ab");
-                halide_assert(user_context, halide_trace_file && "Failed to open trace file\n");
+            halide_trace_lock(&halide_trace_init_lock);
+            if (!halide_trace_initialized) {
+                const char *trace_file_name = getenv("HL_TRACE_FILE");
+                if (trace_file_name) {
+                    halide_trace_file = fopen(trace_file_name, "ab");
+                    halide_assert(user_context, halide_trace_file && "Failed to open trace file\n");
+                    uint8_t header[4] = {'H', 'L', 'T', HALIDE_TRACE_VERSION};
+                    fwrite(header, 1, 4, halide_trace_file);
+                }
+                __sync_synchronize();
+                halide_trace_initialized = true;
             }
+            halide_trace_unlock(&halide_trace_init_lock);
+        }
+
+        // Everything other than loads and stores marks a change in
+        // the state of a realization or production. Loads and stores
+        // that happened before it may be sitting in any of the slots,
+        // and the ones that come after it may refer to its id, so
+        // write out everything before it, and then it.
+        bool ok = true;
+        bool flush = (event != halide_trace_load && event != halide_trace_store);
+        if (halide_trace_file && flush) {
+            ok = halide_trace_flush_all();
+        }
+
+        trace_slot *slot = halide_trace_slot();
+        halide_trace_lock(&slot->lock);
+
+        if (slot->next_id == slot->end_id) {
+            slot->next_id = __sync_fetch_and_add(&halide_trace_next_id_range, 1024);
+            slot->end_id = slot->next_id + 1024;
         }
+        int32_t my_id = slot->next_id++;
 
         // If we're dumping to a file, use a binary format
         if (halide_trace_file) {
-            // A 32-byte header. The first 6 bytes are metadata, then the rest is a zero-terminated string.
-            uint8_t clamped_width = width < 256 ? width : 255;
-            uint8_t clamped_num_int_args = num_int_args < 256 ? num_int_args : 255;
+            if (slot->buffer == NULL) {
+                slot->buffer = (uint8_t *)malloc(HALIDE_TRACE_BLOCK_SIZE);
+                halide_assert(user_context, slot->buffer && "Failed to allocate trace buffer\n");
+                slot->size = 5;
+                slot->num_names = 0;
+            }
+
+            uint32_t clamped_width = width < 256 ? width : 255;
+            uint32_t clamped_num_int_args = num_int_args < 256 ? num_int_args : 255;
 
             // Upgrade the bit count to a power of two, because that's
             // how it will be stored on the stack.
             int bytes = 1;
             while (bytes*8 < bits) bytes <<= 1;
-
-            // Compute the size of each portion of the tracing packet
-            size_t header_bytes = 32;
             size_t value_bytes = clamped_width * bytes;
-            size_t int_arg_bytes = clamped_num_int_args * sizeof(int32_t);
-            size_t total_bytes = header_bytes + value_bytes + int_arg_bytes;
-            uint8_t buffer[4096];
-            halide_assert(user_context, total_bytes <= 4096 && "Tracing packet too large");
-
-            ((int32_t *)buffer)[0] = my_id;
-            ((int32_t *)buffer)[1] = parent_id;
-            buffer[8] = event;
-            buffer[9] = type_code;
-            buffer[10] = bits;
-            buffer[11] = clamped_width;
-            buffer[12] = value_idx;
-            buffer[13] = clamped_num_int_args;
-
-            // Use up to 17 bytes for the function name
-            int i = 14;
-            for (; i < header_bytes-1; i++) {
-                buffer[i] = func[i-14];
-                if (buffer[i] == 0) break;
+
+            // Find the function name among the ones already in this
+            // block. The names are string constants, so usually
+            // comparing the pointers is enough.
+            int name_idx = 0;
+            while (name_idx < slot->num_names &&
+                   !halide_trace_same_name(slot->names[name_idx], func)) {
+                name_idx++;
+            }
+
+            if (slot->size + HALIDE_TRACE_MAX_PACKET > HALIDE_TRACE_BLOCK_SIZE ||
+                name_idx == HALIDE_TRACE_MAX_NAMES) {
+                ok = halide_trace_flush_slot(slot) && ok;
+                name_idx = 0;
             }
-            // Fill the rest with zeros
-            for (; i < header_bytes; i++) {
-                buffer[i] = 0;
+
+            uint8_t *dst = slot->buffer + slot->size;
+            *dst++ = (uint8_t)event;
+            *dst++ = (uint8_t)type_code;
+            *dst++ = (uint8_t)bits;
+            dst = halide_trace_put_varint(dst, (uint32_t)my_id);
+            dst = halide_trace_put_varint(dst, (uint32_t)parent_id);
+            dst = halide_trace_put_varint(dst, clamped_width);
+            dst = halide_trace_put_varint(dst, (uint32_t)value_idx);
+            dst = halide_trace_put_varint(dst, clamped_num_int_args);
+
+            if (name_idx < slot->num_names) {
+                dst = halide_trace_put_varint(dst, name_idx * 2);
+            } else {
+                slot->names[slot->num_names++] = func;
+                dst = halide_trace_put_varint(dst, name_idx * 2 + 1);
+                uint32_t len = 0;
+                while (len < 255 && func[len]) len++;
+                dst = halide_trace_put_varint(dst, len);
+                for (uint32_t i = 0; i < len; i++) {
+                    *dst++ = func[i];
+                }
             }
 
-            // Next comes the value
             for (size_t i = 0; i < value_bytes; i++) {
-                buffer[header_bytes + i] = ((uint8_t *)value)[i];
+                *dst++ = ((uint8_t *)value)[i];
             }
 
-            // Then the int args
-            for (size_t i = 0; i < int_arg_bytes; i++) {
-                buffer[header_bytes + value_bytes + i] = ((uint8_t *)int_args)[i];
+            for (uint32_t i = 0; i < clamped_num_int_args; i++) {
+                int32_t x = int_args[i];
+                dst = halide_trace_put_varint(dst, ((uint32_t)x << 1) ^ (uint32_t)(x >> 31));
             }
 
+            slot->size = dst - slot->buffer;
+            if (flush) {
+                ok = halide_trace_flush_slot(slot) && ok;
+            }
+            halide_trace_unlock(&slot->lock);
 
-            size_t written = fwrite(&buffer[0], 1, total_bytes, halide_trace_file);
-            halide_assert(user_context, written == total_bytes && "Can't write to trace file");
+            halide_assert(user_context, ok && "Can't write to trace file");
 
         } else {
+            halide_trace_unlock(&slot->lock);
+
             char buf[256];
             char *buf_ptr = &buf[0];
             char *buf_end = &buf[255];
@@ -202,7 +367,13 @@ WEAK int32_t halide_trace(void *user_context, const char *func, halide_trace_eve
 
 WEAK int halide_shutdown_trace() {
     if (halide_trace_file) {
+        bool ok = halide_trace_flush_all();
+        for (int i = 0; i < HALIDE_TRACE_NUM_SLOTS; i++) {
+            free(halide_trace_slots[i].buffer);
+            halide_trace_slots[i].buffer = NULL;
+        }
         int ret = fclose(halide_trace_file);
+        if (!ok && ret == 0) ret = -1;
         halide_trace_file = NULL;
         halide_trace_initialized = false;
         return ret;
@@ -0,0 +1,15 @@
+#include "mini_stdint.h"
+
+extern "C" {
+
+#ifdef BITS_64
+extern uint32_t GetCurrentThreadId();
+#else
+extern __stdcall uint32_t GetCurrentThreadId();
+#endif
+
+WEAK size_t halide_current_thread_id() {
+    return (size_t)GetCurrentThreadId();
+}
+
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <Halide.h>
+#include <fstream>
+#include <string>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    Image<uint8_t> in(101, 67);
+    for (int y = 0; y < in.height(); y++) {
+        for (int x = 0; x < in.width(); x++) {
+            in(x, y) = rand() & 0xff;
+        }
+    }
+
+    Func blur, scaled;
+    Var x, y;
+    blur(x, y) = cast<uint8_t>((cast<uint16_t>(in(x, y)) + in(x+1, y) + in(x, y+1)) / 3);
+    scaled(x, y) = cast<float>(blur(x, y)) * 0.5f;
+    scaled(x, y) += cast<float>(in(x, y));
+
+    // Let the compiler pick the factors for the target.
+    blur.compute_root().vectorize(x, AutoFactor).unroll(y, AutoFactor);
+    scaled.vectorize(x, AutoFactor, TailGuardWithIf);
+    scaled.update().vectorize(x, AutoFactor, TailGuardWithIf).unroll(y, AutoFactor, TailGuardWithIf);
+
+    Image<float> result = scaled.realize(97, 63);
+    for (int y = 0; y < result.height(); y++) {
+        for (int x = 0; x < result.width(); x++) {
+            int b = (in(x, y) + in(x+1, y) + in(x, y+1)) / 3;
+            float correct = b * 0.5f + in(x, y);
+            if (result(x, y) != correct) {
+                printf("scaled(%d, %d) = %f instead of %f\n", x, y, result(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    // The chosen vector factor shows up as ramps in the lowered
+    // statement. The factors themselves are reported at HL_DEBUG_CODEGEN=1.
+    const char *tmp = getenv("TMPDIR");
+    if (!tmp) tmp = getenv("TEMP");
+    std::string stmt_file = std::string(tmp ? tmp : "/tmp") + "/auto_factors.stmt";
+    scaled.compile_to_lowered_stmt(stmt_file);
+    std::string contents;
+    {
+        std::ifstream stmt(stmt_file.c_str());
+        contents.assign((std::istreambuf_iterator<char>(stmt)),
+                        std::istreambuf_iterator<char>());
+    }
+    remove(stmt_file.c_str());
+    if (contents.find("ramp(") == std::string::npos) {
+        printf("The lowered statement wasn't vectorized\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -25,6 +25,47 @@ int main(int argc, char **argv) {
         }
     }
 
+    // Updates can't shift their last vector inwards, so guard the
+    // tail with an if instead. The last vector of each row is done
+    // with the lanes past the end masked off.
+    Func g;
+    g(x, y) = input(x, y);
+    g(x, y) += input(x, y)*3;
+
+    g.vectorize(x, 8, TailGuardWithIf);
+    g.update().vectorize(x, 8, TailGuardWithIf).unroll(x, 2, TailGuardWithIf);
+    g.update().split(y, y, yi, 16, TailGuardWithIf).parallel(y);
+
+    out = g.realize(87, 93);
+
+    for (int y = 0; y < out.height(); y++) {
+        for (int x = 0; x < out.width(); x++) {
+            if (out(x, y) != input(x, y)*4) {
+                printf("out(%d, %d) = %d instead of %d\n",
+                       x, y, out(x, y), input(x, y)*4);
+                return -1;
+            }
+        }
+    }
+
+    // 8-bit elements have no masked stores, so the last vector is
+    // done one lane at a time.
+    Func h;
+    h(x, y) = cast<uint8_t>(input(x, y));
+    h.vectorize(x, 16, TailGuardWithIf);
+
+    Image<uint8_t> out8 = h.realize(87, 93);
+
+    for (int y = 0; y < out8.height(); y++) {
+        for (int x = 0; x < out8.width(); x++) {
+            if (out8(x, y) != (uint8_t)input(x, y)) {
+                printf("out8(%d, %d) = %d instead of %d\n",
+                       x, y, out8(x, y), (uint8_t)input(x, y));
+                return -1;
+            }
+        }
+    }
+
     printf("Success!\n");
     return 0;
 }
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+// Override Halide's malloc and free, remembering the largest
+// allocation. The parallel tasks may allocate at the same time, but
+// they all allocate the same size.
+
+size_t custom_malloc_size = 0;
+
+void *my_malloc(void *user_context, size_t x) {
+    if (x > custom_malloc_size) custom_malloc_size = x;
+    void *orig = malloc(x+32);
+    void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    return ptr;
+}
+
+void my_free(void *user_context, void *ptr) {
+    free(((void**)ptr)[-1]);
+}
+
+int main(int argc, char **argv) {
+    Func f, g;
+    Var x, y, yo, yi;
+
+    f(x, y) = x * 3 + y;
+    g(x, y) = f(x, y) + f(x, y+1) + f(x, y+2);
+
+    // Strips of 16 rows in parallel, sliding f down each strip.
+    g.split(y, yo, yi, 16).parallel(yo);
+    f.store_root().compute_at(g, yi);
+
+    g.set_custom_allocator(my_malloc, my_free);
+
+    Image<int> im = g.realize(1000, 1000);
+
+    for (int y = 0; y < im.height(); y++) {
+        for (int x = 0; x < im.width(); x++) {
+            int correct = 9 * x + 3 * y + 3;
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    // Each strip should have its own circular buffer of four rows,
+    // instead of sharing storage for all of f.
+    if (custom_malloc_size == 0 || custom_malloc_size > 1000*4*sizeof(int)) {
+        printf("Scratch space allocated was %d instead of %d\n",
+               (int)custom_malloc_size, (int)(1000*4*sizeof(int)));
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
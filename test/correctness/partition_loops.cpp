@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <Halide.h>
+#include <algorithm>
+
+using namespace Halide;
+
+// Stencils with clamped and select-based boundary conditions, at
+// sizes where the steady state of each loop is empty, short, or most
+// of the loop.
+int clamp_coord(int x, int size) {
+    return std::min(std::max(x, 0), size - 1);
+}
+
+bool test(int w, int h, bool vectorize) {
+    Image<int> input(w, h);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            input(x, y) = rand() & 0xfff;
+        }
+    }
+
+    Func clamped, blur_x, blur_y, out;
+    Var x, y, xi;
+    clamped(x, y) = input(clamp(x, 0, w-1), clamp(y, 0, h-1));
+    blur_x(x, y) = clamped(x-1, y) + 2*clamped(x, y) + clamped(x+2, y);
+    blur_y(x, y) = blur_x(x, y-2) + blur_x(x, y) + blur_x(x, y+1);
+    out(x, y) = select(x < 3 || x >= w - 3, 0, blur_y(x, y));
+
+    blur_x.compute_at(out, y);
+    blur_y.compute_at(out, y);
+    if (vectorize) {
+        blur_x.vectorize(x, 4);
+        out.vectorize(x, 4);
+    } else {
+        out.split(x, x, xi, 5, TailGuardWithIf);
+    }
+
+    Image<int> result = out.realize(w, h);
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int correct = 0;
+            if (x >= 3 && x < w - 3) {
+                int dy[] = {-2, 0, 1};
+                for (int i = 0; i < 3; i++) {
+                    int yy = clamp_coord(y + dy[i], h);
+                    correct += (input(clamp_coord(x - 1, w), yy) +
+                                2 * input(clamp_coord(x, w), yy) +
+                                input(clamp_coord(x + 2, w), yy));
+                }
+            }
+            if (result(x, y) != correct) {
+                printf("result(%d, %d) = %d instead of %d (size %dx%d)\n",
+                       x, y, result(x, y), correct, w, h);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// A select whose condition depends on values computed inside the
+// loop nest. The steady state can't be computed before the loop from
+// something the loop writes.
+bool test_data_dependent(int w, int h) {
+    Image<int> input(w, h);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            input(x, y) = rand() & 0xfff;
+        }
+    }
+
+    Func thresh, out;
+    Var x, y;
+    thresh(y) = input(0, y) % w;
+    out(x, y) = select(x < thresh(y), input(x, y), 0);
+    thresh.compute_at(out, y);
+
+    Image<int> result = out.realize(w, h);
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int correct = x < input(0, y) % w ? input(x, y) : 0;
+            if (result(x, y) != correct) {
+                printf("result(%d, %d) = %d instead of %d (size %dx%d)\n",
+                       x, y, result(x, y), correct, w, h);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int sizes[][2] = {{1, 1}, {2, 3}, {5, 5}, {7, 2}, {13, 11}, {64, 40}, {101, 3}};
+    for (int i = 0; i < 7; i++) {
+        if (!test(sizes[i][0], sizes[i][1], false)) return -1;
+        if (sizes[i][0] >= 4 && !test(sizes[i][0], sizes[i][1], true)) return -1;
+        if (!test_data_dependent(sizes[i][0], sizes[i][1])) return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <Halide.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    Image<float> in(203, 150);
+    for (int y = 0; y < in.height(); y++) {
+        for (int x = 0; x < in.width(); x++) {
+            in(x, y) = (float)(rand() & 0xff);
+        }
+    }
+
+    {
+        // A vertical blur, prefetching two rows ahead inside parallel
+        // strips. Prefetches of the rows past the bottom of the input
+        // are harmless.
+        Func blur;
+        Var x, y, yi;
+        blur(x, y) = (in(x, y) + in(x, y+1) + in(x, y+2)) / 3;
+        blur.split(y, y, yi, 8).parallel(y).vectorize(x, 8).prefetch(yi, 2);
+
+        Image<float> result = blur.realize(200, 144);
+        for (int y = 0; y < result.height(); y++) {
+            for (int x = 0; x < result.width(); x++) {
+                float correct = (in(x, y) + in(x, y+1) + in(x, y+2)) / 3;
+                if (result(x, y) != correct) {
+                    printf("blur(%d, %d) = %f instead of %f\n", x, y, result(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    {
+        // An update that sums along the rows of the input, with
+        // the prefetch distance given at runtime.
+        Func sums;
+        Var y;
+        RDom r(0, in.width());
+        Param<int> distance;
+        sums(y) = 0.0f;
+        sums(y) += in(r, y);
+        sums.update().prefetch(y, distance);
+
+        distance.set(4);
+        Image<float> result = sums.realize(in.height());
+        for (int y = 0; y < in.height(); y++) {
+            float correct = 0.0f;
+            for (int x = 0; x < in.width(); x++) {
+                correct += in(x, y);
+            }
+            if (result(y) != correct) {
+                printf("sums(%d) = %f instead of %f\n", y, result(y), correct);
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
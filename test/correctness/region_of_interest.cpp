@@ -0,0 +1,145 @@
+#include <Halide.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+#ifdef _MSC_VER
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#endif
+
+int call_count[4];
+extern "C" DLLEXPORT int call_counter(int x, int idx) {
+    call_count[idx]++;
+    return x;
+}
+HalideExtern_2(int, call_counter, int, int);
+
+void reset_counts() {
+    for (int i = 0; i < 4; i++) {
+        call_count[i] = 0;
+    }
+}
+
+// Custom error handler. If we don't define this, it'll just print out
+// an error message and quit
+bool error_occurred = false;
+void halide_error(void *, const char *msg) {
+    printf("%s\n", msg);
+    error_occurred = true;
+}
+
+void check_counts(int a = 0, int b = 0, int c = 0, int d = 0) {
+    int correct[] = {a, b, c, d};
+    for (int i = 0; i < 4; i++) {
+        if (correct[i] != call_count[i]) {
+            printf("call_count[%d] was supposed to be %d but instead is %d\n", i, correct[i], call_count[i]);
+            exit(-1);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+
+    {
+        // Both sides of a select get evaluated, so each producer is
+        // needed over the whole region, whatever the condition.
+        Func f1, f2, f3;
+        f1(x) = call_counter(x, 0);
+        f2(x) = call_counter(x*2, 1);
+        f3(x) = select(x < 30, f1(x), f2(x));
+
+        f1.compute_root();
+        f2.compute_root();
+
+        reset_counts();
+        Image<int> im = f3.realize(100);
+        check_counts(100, 100);
+
+        for (int i = 0; i < 100; i++) {
+            int correct = i < 30 ? i : i*2;
+            if (im(i) != correct) {
+                printf("im(%d) = %d instead of %d\n", i, im(i), correct);
+                return -1;
+            }
+        }
+
+        // The same goes for a select on a param.
+        Param<bool> toggle;
+        Func g1, g2;
+        g1(x) = call_counter(x, 2);
+        g2(x) = select(toggle, g1(x), g1(2*x));
+        g1.compute_root();
+
+        reset_counts();
+        toggle.set(true);
+        g2.realize(10);
+        check_counts(0, 0, 19);
+
+        reset_counts();
+        toggle.set(false);
+        g2.realize(10);
+        check_counts(0, 0, 19);
+    }
+
+    {
+        // A select doesn't guard the other side against reading out
+        // of bounds.
+        Image<int> input(10);
+        Func f;
+        f(x) = select(x < 10, input(x), 0);
+        f.set_error_handler(&halide_error);
+
+        error_occurred = false;
+        f.realize(20);
+        if (!error_occurred) {
+            printf("There should have been an out-of-bounds error\n");
+            return -1;
+        }
+    }
+
+    {
+        // Realize a blur over just a few tiles of an image, and check
+        // the producer is only computed around those tiles.
+        Func f, g;
+        f(x, y) = call_counter(x + y, 2);
+        g(x, y) = f(x-1, y) + f(x+1, y);
+        f.compute_root();
+
+        Image<int> im(100, 100);
+        for (int y = 0; y < 100; y++) {
+            for (int x = 0; x < 100; x++) {
+                im(x, y) = -1;
+            }
+        }
+
+        std::vector<Tile> tiles;
+        tiles.push_back(Tile(0, 0, 10, 10));
+        tiles.push_back(Tile(50, 60, 20, 5));
+
+        reset_counts();
+        g.realize(im, tiles);
+        check_counts(0, 0, 12*10 + 22*5);
+
+        for (int y = 0; y < 100; y++) {
+            for (int x = 0; x < 100; x++) {
+                bool in_tile = false;
+                for (size_t i = 0; i < tiles.size(); i++) {
+                    in_tile = in_tile ||
+                        (x >= tiles[i].min[0] && x < tiles[i].min[0] + tiles[i].extent[0] &&
+                         y >= tiles[i].min[1] && y < tiles[i].min[1] + tiles[i].extent[1]);
+                }
+                int correct = in_tile ? 2*(x + y) : -1;
+                if (im(x, y) != correct) {
+                    printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    Image<uint8_t> in(301, 257);
+    for (int y = 0; y < in.height(); y++) {
+        for (int x = 0; x < in.width(); x++) {
+            in(x, y) = rand() & 0xff;
+        }
+    }
+
+    {
+        // A global sum, split into chunks of rows that are summed in
+        // parallel. The chunk size doesn't divide the height, so the
+        // last chunk is short.
+        Func total;
+        RDom r(0, in.width(), 0, in.height());
+        total() = 0;
+        total() += cast<int>(in(r.x, r.y));
+
+        Var v;
+        Func partial = total.rfactor(r.y, v, 16);
+        partial.update().vectorize(r.x, 8);
+
+        Image<int> result = total.realize();
+
+        int correct = 0;
+        for (int y = 0; y < in.height(); y++) {
+            for (int x = 0; x < in.width(); x++) {
+                correct += in(x, y);
+            }
+        }
+        if (result(0) != correct) {
+            printf("total() = %d instead of %d\n", result(0), correct);
+            return -1;
+        }
+    }
+
+    {
+        // A histogram, with one partial histogram per chunk of rows.
+        Func hist;
+        Var x;
+        RDom r(0, in.width(), 0, in.height());
+        hist(x) = 0;
+        hist(cast<int>(in(r.x, r.y))) += 1;
+
+        Var v;
+        hist.rfactor(r.y, v, 32);
+        hist.update().vectorize(x, 8);
+
+        Image<int> result = hist.realize(256);
+
+        int correct[256] = {0};
+        for (int y = 0; y < in.height(); y++) {
+            for (int x = 0; x < in.width(); x++) {
+                correct[in(x, y)]++;
+            }
+        }
+        for (int i = 0; i < 256; i++) {
+            if (result(i) != correct[i]) {
+                printf("hist(%d) = %d instead of %d\n", i, result(i), correct[i]);
+                return -1;
+            }
+        }
+    }
+
+    {
+        // The maximum of each column, computed over chunks of
+        // rows. The update has a pure var, which the partial results
+        // keep.
+        Func col_max;
+        Var x;
+        RDom r(0, in.height());
+        col_max(x) = cast<uint8_t>(0);
+        col_max(x) = max(col_max(x), in(x, r));
+
+        Var v;
+        Func partial = col_max.rfactor(r, v, 100);
+        partial.update().vectorize(x, 16, TailGuardWithIf);
+
+        Image<uint8_t> result = col_max.realize(in.width());
+
+        for (int x = 0; x < in.width(); x++) {
+            uint8_t correct = 0;
+            for (int y = 0; y < in.height(); y++) {
+                if (in(x, y) > correct) correct = in(x, y);
+            }
+            if (result(x) != correct) {
+                printf("col_max(%d) = %d instead of %d\n", x, result(x), correct);
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -12,7 +12,7 @@ using std::vector;
 bool failed = false;
 Var x, y;
 
-bool use_ssse3, use_sse41, use_sse42, use_avx, use_avx2;
+bool use_ssse3, use_sse41, use_sse42, use_avx, use_avx2, use_avx512;
 
 char *filter = NULL;
 
@@ -212,6 +212,12 @@ void check_sse_all() {
     Expr u64_1 = in_u64(x), u64_2 = in_u64(x+16), u64_3 = in_u64(x+32);
     Expr bool_1 = (f32_1 > 0.3f), bool_2 = (f32_1 < -0.3f), bool_3 = (f32_1 != -0.34f);
 
+    // A constant table small enough to live in one register
+    Image<uint8_t> lut_u8(16);
+    for (int i = 0; i < 16; i++) {
+        lut_u8(i) = (uint8_t)(i * 17);
+    }
+
     const int min_i8 = -128, max_i8 = 127;
     const int min_i16 = -32768, max_i16 = 32767;
     //const int min_i32 = 0x80000000, max_i32 = 0x7fffffff;
@@ -283,6 +289,11 @@ void check_sse_all() {
     check("shufps", 4, in_f32(2*x));
     if (!use_avx) check("pshufd", 4, in_f32(100-x));
 
+    // A store that depends on a vector condition happens once for the
+    // whole vector, with the lanes for which the condition is false
+    // masked off, so the math shouldn't get scalarized.
+    check("sqrtps", 4, select(f32_1 > 0.3f, sqrt(f32_1), undef<float>()));
+
     // SSE 2
 
     check("addpd", 2, f64_1 + f64_2);
@@ -323,6 +334,9 @@ void check_sse_all() {
         check("pabsb", 16, abs(i8_1));
         check("pabsw", 8, abs(i16_1));
         check("pabsd", 4, abs(i32_1));
+
+        // Lookups into a small constant table
+        check("pshufb", 16, lut_u8(i32(u8_1) % 16));
     }
 
     // SSE 4.1
@@ -405,6 +419,9 @@ void check_sse_all() {
 	check("vblendvps", 8, select(f32_1 > 0.7f, f32_1, f32_2));
 	check("vblendvpd", 4, select(f64_1 > cast<double>(0.7f), f64_1, f64_2));
 
+	check("vmaskmovps", 8, select(f32_1 > 0.3f, f32_1 * f32_2, undef<float>()));
+	check("vmaskmovpd", 4, select(f64_1 > cast<double>(0.3f), f64_1 * f64_2, undef<double>()));
+
 	check("vcvttps2dq", 8, i32(f32_1));
 	check("vcvtdq2ps", 8, f32(i32_1));
 	check("vcvttpd2dq", 8, i32(f64_1));
@@ -463,6 +480,9 @@ void check_sse_all() {
 	check("vpabsw", 16, abs(i16_1));
 	check("vpabsd", 8, abs(i32_1));
 
+	// Loads at computed indices
+	check("vpgatherdd", 8, in_i32(clamp(i32_1, 0, 63)));
+
         // llvm doesn't distinguish between signed and unsigned multiplies
         // check("vpmuldq", 8, i64(i32_1) * i64(i32_2));
         check("vpmuludq", 8, u64(u32_1) * u64(u32_2));
@@ -482,6 +502,35 @@ void check_sse_all() {
 	check("vpcmpeqq", 4, select(i64_1 == i64_2, i64(1), i64(2)));
 	check("vpackusdw", 16, u16(clamp(i32_1, 0, max_u16)));
 	check("vpcmpgtq", 4, select(i64_1 > i64_2, i64(1), i64(2)));
+
+	// Widening multiplies
+	check("vpmovzxbw", 16, u16(u8_1) * u16(u8_2));
+	check("vpmullw", 16, u16(u8_1) * u16(u8_2));
+	check("vpmovsxwd", 8, i32(i16_1) * i32(i16_2));
+	check("vpmulld", 8, i32(i16_1) * i32(i16_2));
+
+	// Fused multiply-add
+	check("vfmadd", 8, f32_1 * f32_2 + f32_3);
+	check("vfmadd", 4, f64_1 * f64_2 + f64_3);
+	check("vfmsub", 8, f32_1 * f32_2 - f32_3);
+	check("vfnmadd", 8, f32_3 - f32_1 * f32_2);
+    }
+
+    // AVX 512
+
+    if (use_avx512) {
+	check("vaddps", 16, f32_1 + f32_2);
+	check("vfmadd", 16, f32_1 * f32_2 + f32_3);
+	check("vpaddd", 16, i32_1 + i32_2);
+	check("vpmulld", 16, i32_1 * i32_2);
+	check("vpabsq", 8, abs(i64_1));
+	check("vpmaxsq", 8, max(i64_1, i64_2));
+	check("vpminuq", 8, min(u64_1, u64_2));
+	check("vpmullq", 8, i64_1 * i64_2);
+	check("vcvtudq2ps", 16, f32(u32_1));
+	check("vcvttps2udq", 16, u32(f32_1));
+	check("vpmovdb", 16, i8(i32_1));
+	check("vpmovqd", 8, i32(i64_1));
     }
 }
 
@@ -1361,7 +1410,18 @@ void check_neon_all() {
 
     // VTBL	X	-	Table Lookup
     // Arm's version of shufps. Allows for arbitrary permutations of a
-    // 64-bit vector. We typically use vrev variants instead.
+    // 64-bit vector. We typically use vrev variants instead, but
+    // lookups into small constant tables use it.
+    if (target.bits == 32) {
+        // One and four registers of table.
+        Image<uint8_t> lut_8(8), lut_32(32);
+        for (int i = 0; i < 32; i++) {
+            if (i < 8) lut_8(i) = (uint8_t)(i * 29);
+            lut_32(i) = (uint8_t)(i * 7);
+        }
+        check("vtbl.8", 8, lut_8(i32(u8_1) % 8));
+        check("vtbl.8", 16, lut_32(i32(u8_1) % 32));
+    }
 
     // VTBX	X	-	Table Extension
     // Like vtbl, but doesn't change any elements where the index was
@@ -1391,7 +1451,8 @@ int main(int argc, char **argv) {
 
     target = get_target_from_environment();
 
-    use_avx2 = target.features & Target::AVX2;
+    use_avx512 = target.features & Target::AVX512;
+    use_avx2 = use_avx512 | (target.features & Target::AVX2);
     use_avx = use_avx2 | (target.features & Target::AVX);
     use_sse41 = use_avx | (target.features & Target::SSE41);
 
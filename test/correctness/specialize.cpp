@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <Halide.h>
+#include <algorithm>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    Image<float> input(1024, 16);
+    for (int y = 0; y < input.height(); y++) {
+        for (int x = 0; x < input.width(); x++) {
+            input(x, y) = (float)(x * 3 + y);
+        }
+    }
+
+    Param<int> stride;
+    Param<bool> flip;
+    Func f, g;
+    Var x, y;
+    Expr v = input(x * stride, y);
+    f(x, y) = select(flip, -v, v);
+    g(x, y) = f(x, y) + f(x, y + 1);
+
+    // A version for unit stride without the flip, one for stride
+    // two, and the general one for everything else.
+    f.compute_at(g, y).vectorize(x, 8);
+    f.specialize(stride == 1 && !flip).specialize(stride == 2);
+    g.vectorize(x, 8);
+
+    for (int s = 1; s <= 3; s++) {
+        for (int fl = 0; fl < 2; fl++) {
+            stride.set(s);
+            flip.set(fl == 1);
+            int w = 1024 / s - 7;
+            Image<float> out = g.realize(w, 15);
+            for (int yy = 0; yy < out.height(); yy++) {
+                for (int xx = 0; xx < out.width(); xx++) {
+                    float a = input(xx * s, yy), b = input(xx * s, yy + 1);
+                    float correct = fl ? -a - b : a + b;
+                    if (out(xx, yy) != correct) {
+                        printf("out(%d, %d) = %f instead of %f (stride %d, flip %d)\n",
+                               xx, yy, out(xx, yy), correct, s, fl);
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+
+    // Specializing an update on the size of its reduction domain.
+    Param<int> radius;
+    RDom r(-radius, 2*radius + 1);
+    Func h;
+    h(x) = 0.0f;
+    h(x) += input(clamp(x + r, 0, 1023), 0);
+    h.update().specialize(radius == 1);
+
+    for (int rad = 0; rad < 3; rad++) {
+        radius.set(rad);
+        Image<float> out = h.realize(1024);
+        for (int xx = 0; xx < 1024; xx++) {
+            float correct = 0;
+            for (int i = -rad; i <= rad; i++) {
+                int xi = std::min(std::max(xx + i, 0), 1023);
+                correct += input(xi, 0);
+            }
+            if (out(xx) != correct) {
+                printf("h(%d) = %f instead of %f (radius %d)\n", xx, out(xx), correct, rad);
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -20,21 +20,81 @@ void my_free(void *user_context, void *ptr) {
 }
 
 int main(int argc, char **argv) {
-    Func f, g;
     Var x, y;
 
-    f(x, y) = x;
-    g(x, y) = f(x-1, y) + f(x, y-1);
-    f.store_root().compute_at(g, x);
+    {
+        Func f, g;
+        f(x, y) = x;
+        g(x, y) = f(x-1, y) + f(x, y-1);
+        f.store_root().compute_at(g, x);
 
-    g.set_custom_allocator(my_malloc, my_free);
+        g.set_custom_allocator(my_malloc, my_free);
 
-    Image<int> im = g.realize(1000, 1000);
+        Image<int> im = g.realize(1000, 1000);
 
-    // Should fold by a factor of two, but sliding window analysis makes it round up to 4.
-    if (custom_malloc_size == 0 || custom_malloc_size > 1002*4*sizeof(int)) {
-        printf("Scratch space allocated was %d instead of %d\n", (int)custom_malloc_size, (int)(1002*4*sizeof(int)));
-        return -1;
+        // Should fold by a factor of two.
+        if (custom_malloc_size == 0 || custom_malloc_size > 1002*2*sizeof(int)) {
+            printf("Scratch space allocated was %d instead of %d\n", (int)custom_malloc_size, (int)(1002*2*sizeof(int)));
+            return -1;
+        }
+    }
+
+    {
+        // A stencil three rows tall should fold by exactly three.
+        custom_malloc_size = 0;
+        Func f, g;
+        f(x, y) = x + y;
+        g(x, y) = f(x, y-1) + f(x, y) + f(x, y+1);
+        f.store_root().compute_at(g, y);
+
+        g.set_custom_allocator(my_malloc, my_free);
+
+        Image<int> im = g.realize(1000, 1000);
+
+        if (custom_malloc_size == 0 || custom_malloc_size > 1000*3*sizeof(int)) {
+            printf("Scratch space allocated was %d instead of %d\n", (int)custom_malloc_size, (int)(1000*3*sizeof(int)));
+            return -1;
+        }
+
+        for (int y = 0; y < 1000; y++) {
+            for (int x = 0; x < 1000; x++) {
+                if (im(x, y) != 3 * (x + y)) {
+                    printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), 3 * (x + y));
+                    return -1;
+                }
+            }
+        }
+    }
+
+    {
+        // A stencil whose height is only known at runtime should
+        // fold by a factor computed at runtime.
+        custom_malloc_size = 0;
+        Func f, g;
+        Param<int> radius;
+        RDom r(0, 2*radius + 1);
+        f(x, y) = x + y;
+        g(x, y) = sum(f(x, y + r - radius));
+        f.store_root().compute_at(g, y);
+
+        g.set_custom_allocator(my_malloc, my_free);
+
+        radius.set(2);
+        Image<int> im = g.realize(1000, 1000);
+
+        if (custom_malloc_size == 0 || custom_malloc_size > 1000*5*sizeof(int)) {
+            printf("Scratch space allocated was %d instead of %d\n", (int)custom_malloc_size, (int)(1000*5*sizeof(int)));
+            return -1;
+        }
+
+        for (int y = 0; y < 1000; y++) {
+            for (int x = 0; x < 1000; x++) {
+                if (im(x, y) != 5 * (x + y)) {
+                    printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), 5 * (x + y));
+                    return -1;
+                }
+            }
+        }
     }
 
     printf("Success!\n");
@@ -0,0 +1,39 @@
+#include <Halide.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    // The rows are an odd number of elements wide, so most vectors
+    // aren't aligned and must fall back to regular stores.
+    Image<float> in(1001, 67);
+    for (int y = 0; y < in.height(); y++) {
+        for (int x = 0; x < in.width(); x++) {
+            in(x, y) = (float)(rand() & 0xfff);
+        }
+    }
+
+    Func f, g;
+    Var x, y;
+    f(x, y) = in(x, y) * 2 + 1;
+    g(x, y) = Tuple(f(x, y) - 3, cast<uint8_t>(f(x, y)));
+    f.compute_root().vectorize(x, 8).parallel(y).stream_stores();
+    g.vectorize(x, 16, TailGuardWithIf).stream_stores();
+
+    Realization r = g.realize(in.width(), in.height());
+    Image<float> a = r[0];
+    Image<uint8_t> b = r[1];
+    for (int y = 0; y < in.height(); y++) {
+        for (int x = 0; x < in.width(); x++) {
+            float correct_f = in(x, y) * 2 + 1;
+            if (a(x, y) != correct_f - 3 || b(x, y) != (uint8_t)correct_f) {
+                printf("g(%d, %d) = {%f, %d} instead of {%f, %d}\n",
+                       x, y, a(x, y), b(x, y), correct_f - 3, (uint8_t)correct_f);
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
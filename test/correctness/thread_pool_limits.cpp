@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <Halide.h>
+
+using namespace Halide;
+
+int active_tasks = 0;
+int max_active_tasks = 0;
+
+// When set, each task spins for a while until this many tasks are
+// running at once, so that the count doesn't depend on how the tasks
+// happen to get scheduled.
+int wait_for_tasks = 0;
+
+// Count how many tasks are running at once.
+int my_do_task(void *user_context, int (*f)(void *, int, uint8_t *),
+               int idx, uint8_t *closure) {
+    int active = __sync_add_and_fetch(&active_tasks, 1);
+    int old_max;
+    while ((old_max = max_active_tasks) < active) {
+        __sync_bool_compare_and_swap(&max_active_tasks, old_max, active);
+    }
+    for (int i = 0; i < (1 << 24); i++) {
+        if (__sync_fetch_and_add(&max_active_tasks, 0) >= wait_for_tasks) break;
+    }
+    int result = f(user_context, idx, closure);
+    __sync_sub_and_fetch(&active_tasks, 1);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+    Func f;
+
+    Expr math = cast<float>(x+y);
+    for (int i = 0; i < 20; i++) math = sqrt(cos(sin(math)));
+    f(x, y) = math;
+    f.parallel(y);
+
+    f.set_custom_do_task(my_do_task);
+    f.set_thread_pool_limits(2);
+
+    Image<float> im = f.realize(1024, 256);
+
+    if (max_active_tasks > 2) {
+        printf("%d tasks ran at once, but the pool was limited to 2 threads\n",
+               max_active_tasks);
+        return -1;
+    }
+
+    // Raising the limit restarts the pool with more threads.
+    f.set_thread_pool_limits(8);
+    max_active_tasks = 0;
+    wait_for_tasks = 3;
+    f.realize(im);
+
+    if (max_active_tasks <= 2) {
+        printf("Only %d tasks ran at once after raising the limit to 8 threads\n",
+               max_active_tasks);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
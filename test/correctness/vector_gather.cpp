@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <Halide.h>
+#include <algorithm>
+
+using namespace Halide;
+
+// Vectorized loads at computed indices, of each element size, and at
+// widths that don't fill a whole number of gathers.
+template<typename T>
+bool test(int vector_width) {
+    const int size = 37;
+    Image<T> table(size);
+    for (int i = 0; i < size; i++) {
+        table(i) = (T)(i * 3 + 1);
+    }
+
+    Image<int> indices(100);
+    for (int i = 0; i < 100; i++) {
+        indices(i) = (i * 7 + i / 3) % size;
+    }
+
+    Func f;
+    Var x;
+    f(x) = table(indices(x)) + table(clamp(indices(x) * 2, 0, size - 1));
+    f.vectorize(x, vector_width);
+
+    Image<T> result = f.realize(96);
+    for (int i = 0; i < 96; i++) {
+        int a = indices(i);
+        int b = std::min(indices(i) * 2, size - 1);
+        T correct = (T)(table(a) + table(b));
+        if (result(i) != correct) {
+            printf("f(%d) = %f instead of %f (vector width %d)\n",
+                   i, (double)result(i), (double)correct, vector_width);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (!test<float>(4)) return -1;
+    if (!test<float>(8)) return -1;
+    if (!test<float>(12)) return -1;
+    if (!test<int32_t>(8)) return -1;
+    if (!test<uint32_t>(16)) return -1;
+    if (!test<double>(2)) return -1;
+    if (!test<double>(4)) return -1;
+    if (!test<int64_t>(6)) return -1;
+    if (!test<uint8_t>(16)) return -1;
+    if (!test<int16_t>(8)) return -1;
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <Halide.h>
+#include <stdio.h>
+#include <math.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    // Stores that depend on undef become stores guarded by the rest of
+    // the condition. When that condition varies across the vector,
+    // the store is done once for the whole vector with some of the
+    // lanes masked off. Check that the masked lanes are left alone.
+
+    Image<float> in(100);
+    for (int i = 0; i < 100; i++) {
+        in(i) = (i % 3 == 0) ? -1.0f : (float)i;
+    }
+
+    {
+        Func f;
+        Var x;
+        f(x) = -2.0f;
+        f(x) = select(in(x) > 0, sqrt(in(x)), undef<float>());
+        f.vectorize(x, 4);
+        f.update().vectorize(x, 8);
+
+        Image<float> result = f.realize(96);
+        for (int i = 0; i < 96; i++) {
+            float correct = (i % 3 == 0) ? -2.0f : sqrtf((float)i);
+            if (fabs(result(i) - correct) > 0.0001f) {
+                printf("f(%d) = %f instead of %f\n", i, result(i), correct);
+                return -1;
+            }
+        }
+    }
+
+    {
+        // 16-bit elements, which have no masked stores on x86.
+        Func g;
+        Var x;
+        g(x) = cast<uint16_t>(x);
+        g(x) = select(x % 5 == 1 || x % 7 == 2, g(x) * 3, undef<uint16_t>());
+        g.update().vectorize(x, 16);
+
+        Image<uint16_t> result = g.realize(128);
+        for (int i = 0; i < 128; i++) {
+            uint16_t correct = (i % 5 == 1 || i % 7 == 2) ? i * 3 : i;
+            if (result(i) != correct) {
+                printf("g(%d) = %d instead of %d\n", i, result(i), correct);
+                return -1;
+            }
+        }
+    }
+
+    {
+        // A division by a loaded value, with the tail guarded by an
+        // if. The masked lanes must not divide by whatever they hold.
+        const int N = 101;
+        Image<int> num(N), den(N);
+        for (int i = 0; i < N; i++) {
+            num(i) = (i % 2) ? -2147483647 - 1 : i * 37 - 1000;
+            den(i) = (i % 3) + 1;
+        }
+
+        Func q;
+        Var x;
+        q(x) = num(x) / den(x) + num(x) % den(x);
+        q.vectorize(x, 8, TailGuardWithIf);
+
+        Image<int> result = q.realize(N);
+        for (int i = 0; i < N; i++) {
+            int64_t a = num(i), b = den(i);
+            // Halide rounds division down.
+            int64_t quo = a / b - ((a % b != 0) && (a < 0) ? 1 : 0);
+            int correct = (int)(quo + (a - quo * b));
+            if (result(i) != correct) {
+                printf("q(%d) = %d instead of %d\n", i, result(i), correct);
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
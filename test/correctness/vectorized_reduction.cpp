@@ -0,0 +1,132 @@
+#include <Halide.h>
+#include <stdio.h>
+#include <math.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    // Vectorizing an update across a reduction domain, where every
+    // lane updates the same site. Each lane accumulates a partial
+    // result, and the lanes get combined at the end.
+
+    const int N = 1001;
+    Image<float> a(N), b(N);
+    Image<uint16_t> c(N);
+    for (int i = 0; i < N; i++) {
+        a(i) = (float)(i % 17) - 8.0f;
+        b(i) = (float)(i % 13) * 0.25f;
+        c(i) = (uint16_t)((i * 7919) % 65521);
+    }
+
+    {
+        // A dot product. N isn't a multiple of the vector width, so
+        // the last vector has its extra lanes masked off.
+        Func dot;
+        RDom r(0, N);
+        dot() = 0.0f;
+        dot() += a(r) * b(r);
+        dot.update().vectorize(r.x, 8);
+
+        float correct = 0.0f;
+        for (int i = 0; i < N; i++) {
+            correct += a(i) * b(i);
+        }
+
+        Image<float> result = dot.realize();
+        if (fabs(result(0) - correct) > 0.01f) {
+            printf("dot product = %f instead of %f\n", result(0), correct);
+            return -1;
+        }
+    }
+
+    {
+        // Integer row sums, min, and max, vectorized across the rows.
+        Func sum_rows, min_rows, max_rows;
+        Var y;
+        RDom r(0, 96);
+        sum_rows(y) = 0;
+        sum_rows(y) += cast<int>(c(r + y));
+        min_rows(y) = cast<uint16_t>(65535);
+        min_rows(y) = min(min_rows(y), c(r + y));
+        max_rows(y) = cast<uint16_t>(0);
+        max_rows(y) = max(c(r + y), max_rows(y));
+
+        sum_rows.update().vectorize(r.x, 8);
+        min_rows.update().vectorize(r.x, 16);
+        max_rows.update().vectorize(r.x, 16);
+
+        Image<int> sums = sum_rows.realize(N - 96);
+        Image<uint16_t> mins = min_rows.realize(N - 96);
+        Image<uint16_t> maxs = max_rows.realize(N - 96);
+
+        for (int y = 0; y < N - 96; y++) {
+            int correct_sum = 0;
+            uint16_t correct_min = 65535, correct_max = 0;
+            for (int x = 0; x < 96; x++) {
+                correct_sum += c(x + y);
+                if (c(x + y) < correct_min) correct_min = c(x + y);
+                if (c(x + y) > correct_max) correct_max = c(x + y);
+            }
+            if (sums(y) != correct_sum) {
+                printf("sum_rows(%d) = %d instead of %d\n", y, sums(y), correct_sum);
+                return -1;
+            }
+            if (mins(y) != correct_min) {
+                printf("min_rows(%d) = %d instead of %d\n", y, mins(y), correct_min);
+                return -1;
+            }
+            if (maxs(y) != correct_max) {
+                printf("max_rows(%d) = %d instead of %d\n", y, maxs(y), correct_max);
+                return -1;
+            }
+        }
+    }
+
+    {
+        // An update that isn't associative. The lanes have to be done
+        // in order.
+        Func f;
+        RDom r(0, 20);
+        f() = 0;
+        f() = f() * 3 + cast<int>(c(r)) % 5;
+        f.update().vectorize(r.x, 4);
+
+        int correct = 0;
+        for (int i = 0; i < 20; i++) {
+            correct = correct * 3 + c(i) % 5;
+        }
+
+        Image<int> result = f.realize();
+        if (result(0) != correct) {
+            printf("f() = %d instead of %d\n", result(0), correct);
+            return -1;
+        }
+    }
+
+    {
+        // A histogram. The lanes store through a vector of indices
+        // that may collide, so they have to be done in order.
+        Func hist;
+        Var x;
+        RDom r(0, N);
+        hist(x) = 0;
+        hist(cast<int>(c(r) % 16)) += 1;
+        hist.update().vectorize(r.x, 8);
+
+        int correct[16] = {0};
+        for (int i = 0; i < N; i++) {
+            correct[c(i) % 16]++;
+        }
+
+        Image<int> result = hist.realize(16);
+        for (int i = 0; i < 16; i++) {
+            if (result(i) != correct[i]) {
+                printf("hist(%d) = %d instead of %d\n", i, result(i), correct[i]);
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -10,6 +10,7 @@
 #include "Deinterleave.h"
 #include "ModulusRemainder.h"
 #include "OneToOne.h"
+#include "CSE.h"
 
 using namespace Halide;
 using namespace Halide::Internal;
@@ -30,5 +31,6 @@ int main(int argc, const char **argv) {
     deinterleave_vector_test();
     modulus_remainder_test();
     is_one_to_one_test();
+    cse_test();
     return 0;
 }
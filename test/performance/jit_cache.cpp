@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <math.h>
+#include <Halide.h>
+#include "clock.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Halide;
+
+Func make_pipeline(ImageParam input) {
+    Var x("x"), y("y");
+
+    Func blur_x("blur_x");
+    blur_x(x, y) = (input(x, y) + input(x+1, y) + input(x+2, y)) / 3;
+
+    Func blur_y("blur_y");
+    blur_y(x, y) = (blur_x(x, y) + blur_x(x, y+1) + blur_x(x, y+2)) / 3;
+
+    Var yi("yi");
+    blur_y.split(y, y, yi, 8).parallel(y).vectorize(x, 8);
+    blur_x.store_at(blur_y, y).compute_at(blur_y, yi).vectorize(x, 8);
+
+    return blur_y;
+}
+
+// Delete a cache directory and the files in it.
+void remove_cache(const char *dir) {
+    char path[512];
+    #ifdef _WIN32
+    sprintf(path, "%s/*", dir);
+    struct _finddata_t entry;
+    intptr_t handle = _findfirst(path, &entry);
+    if (handle != -1) {
+        do {
+            sprintf(path, "%s/%s", dir, entry.name);
+            remove(path);
+        } while (_findnext(handle, &entry) == 0);
+        _findclose(handle);
+    }
+    _rmdir(dir);
+    #else
+    DIR *d = opendir(dir);
+    if (d) {
+        while (struct dirent *entry = readdir(d)) {
+            sprintf(path, "%s/%s", dir, entry->d_name);
+            remove(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+    #endif
+}
+
+int run_test() {
+    ImageParam input(Float(32), 2, "input");
+    Image<float> in(1026, 1026);
+    for (int y = 0; y < in.height(); y++) {
+        for (int x = 0; x < in.width(); x++) {
+            in(x, y) = (float)(x * y % 17);
+        }
+    }
+    input.set(in);
+
+    // The second compilation of the same pipeline finds it in the
+    // cache. A new process that builds the same pipeline would too.
+    Func blur = make_pipeline(input);
+    double t1 = currentTime();
+    blur.compile_jit();
+    double t2 = currentTime();
+    blur.compile_jit();
+    double t3 = currentTime();
+
+    printf("Cold compile: %f ms\n", t2 - t1);
+    printf("Warm compile: %f ms\n", t3 - t2);
+
+    Image<float> out = blur.realize(1024, 1024);
+    for (int y = 0; y < 1024; y++) {
+        for (int x = 0; x < 1024; x++) {
+            float blur_x[3];
+            for (int i = 0; i < 3; i++) {
+                blur_x[i] = (in(x, y+i) + in(x+1, y+i) + in(x+2, y+i)) / 3;
+            }
+            float correct = (blur_x[0] + blur_x[1] + blur_x[2]) / 3;
+            if (fabs(out(x, y) - correct) > 0.001f) {
+                printf("out(%d, %d) = %f instead of %f\n",
+                       x, y, out(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    if (t3 - t2 > t2 - t1) {
+        printf("Loading from the cache should be faster than compiling\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    // Use a fresh cache directory, and turn off the in-memory memo of
+    // compiled pipelines, so that the second compilation goes to disk.
+    char dir[256];
+    sprintf(dir, "jit_cache_%d", (int)getpid());
+    #ifdef _WIN32
+    _mkdir(dir);
+    char env[300];
+    sprintf(env, "HL_JIT_CACHE=%s", dir);
+    _putenv(env);
+    _putenv("HL_JIT_MEMO=0");
+    #else
+    mkdir(dir, 0755);
+    setenv("HL_JIT_CACHE", dir, 1);
+    setenv("HL_JIT_MEMO", "0", 1);
+    #endif
+
+    int result = run_test();
+    remove_cache(dir);
+    if (result != 0) return result;
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include <Halide.h>
+#include <stdio.h>
+#include <math.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// Build a new pipeline. Every call makes new Funcs, with new names.
+Func make_pipeline(ImageParam input, Param<float> scale, int offset) {
+    Var x, y, xi;
+    Func blur_x, blur_y;
+    blur_x(x, y) = (input(x, y) + input(x+1, y) + input(x+2, y)) * scale;
+    blur_y(x, y) = blur_x(x, y) + blur_x(x, y+1) + blur_x(x, y+2) + offset;
+    blur_x.compute_at(blur_y, y).vectorize(x, 4);
+    blur_y.split(x, x, xi, 8).vectorize(xi, 4).parallel(y);
+    return blur_y;
+}
+
+bool check(Image<float> in, Image<float> out, float scale, int offset) {
+    for (int y = 0; y < out.height(); y++) {
+        for (int x = 0; x < out.width(); x++) {
+            float correct = offset;
+            for (int dy = 0; dy < 3; dy++) {
+                correct += (in(x, y+dy) + in(x+1, y+dy) + in(x+2, y+dy)) * scale;
+            }
+            if (fabs(out(x, y) - correct) > 0.001f) {
+                printf("out(%d, %d) = %f instead of %f\n", x, y, out(x, y), correct);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// A serial parallel-for that counts how often it's called.
+int par_for_calls = 0;
+int my_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
+                  int min, int extent, uint8_t *closure) {
+    par_for_calls++;
+    for (int i = min; i < min + extent; i++) {
+        int result = f(user_context, i, closure);
+        if (result) return result;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    Image<float> in(66, 66);
+    for (int y = 0; y < in.height(); y++) {
+        for (int x = 0; x < in.width(); x++) {
+            in(x, y) = (float)(x * y % 17);
+        }
+    }
+    Image<float> out(64, 64);
+
+    double t1 = currentTime();
+    {
+        ImageParam input(Float(32), 2);
+        Param<float> scale;
+        input.set(in);
+        scale.set(1.0f);
+        make_pipeline(input, scale, 0).realize(out);
+        if (!check(in, out, 1.0f, 0)) return -1;
+    }
+    double t2 = currentTime();
+
+    // Building the same pipeline again, with new parameters, should
+    // reuse the code compiled for the first one.
+    const int iterations = 20;
+    for (int i = 0; i < iterations; i++) {
+        ImageParam input(Float(32), 2);
+        Param<float> scale;
+        input.set(in);
+        scale.set((float)i);
+        make_pipeline(input, scale, 0).realize(out);
+        if (!check(in, out, (float)i, 0)) return -1;
+    }
+    double t3 = currentTime();
+
+    // A pipeline that differs only in a constant must not.
+    {
+        ImageParam input(Float(32), 2);
+        Param<float> scale;
+        input.set(in);
+        scale.set(1.0f);
+        make_pipeline(input, scale, 5).realize(out);
+        if (!check(in, out, 1.0f, 5)) return -1;
+    }
+
+    // Setting a runtime hook on one Func mustn't affect another that
+    // shares its code.
+    {
+        ImageParam input(Float(32), 2);
+        Param<float> scale;
+        input.set(in);
+        scale.set(1.0f);
+        Func a = make_pipeline(input, scale, 0);
+        Func b = make_pipeline(input, scale, 0);
+        a.realize(out);
+        b.realize(out);
+        b.set_custom_do_par_for(my_do_par_for);
+
+        a.realize(out);
+        if (par_for_calls != 0) {
+            printf("Setting a hook on one Func changed another\n");
+            return -1;
+        }
+        b.realize(out);
+        if (par_for_calls == 0) {
+            printf("The custom parallel-for wasn't called\n");
+            return -1;
+        }
+        if (!check(in, out, 1.0f, 0)) return -1;
+    }
+
+    double cold = t2 - t1, warm = (t3 - t2) / iterations;
+    printf("First build: %f ms. Later builds: %f ms\n", cold, warm);
+
+    if (warm * 10 > cold) {
+        printf("Rebuilding the pipeline should be much faster than building it the first time\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
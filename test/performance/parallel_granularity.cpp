@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <Halide.h>
+#include "clock.h"
+
+using namespace Halide;
+
+#define W 2048
+#define H 2048
+
+// Measure how the thread pool copes as the individual tasks of a
+// parallel loop get smaller. With one row per task there are H
+// tasks each doing very little work, so the cost of claiming a task
+// dominates.
+int main(int argc, char **argv) {
+    Var x, y, yo, yi;
+
+    Func serial;
+    serial(x, y) = sqrt(cast<float>(x*y + 1));
+    Image<float> reference = serial.realize(W, H);
+
+    double t1, t2;
+    t1 = currentTime();
+    for (int i = 0; i < 10; i++) {
+        serial.realize(reference);
+    }
+    t2 = currentTime();
+    double serial_time = (t2 - t1) / 10;
+    printf("Serial: %f ms\n", serial_time);
+
+    for (int rows_per_task = 64; rows_per_task >= 1; rows_per_task /= 4) {
+        Func f;
+        f(x, y) = sqrt(cast<float>(x*y + 1));
+        f.split(y, yo, yi, rows_per_task).parallel(yo);
+
+        Image<float> im = f.realize(W, H);
+
+        t1 = currentTime();
+        for (int i = 0; i < 10; i++) {
+            f.realize(im);
+        }
+        t2 = currentTime();
+        double parallel_time = (t2 - t1) / 10;
+
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                if (im(x, y) != reference(x, y)) {
+                    printf("im(%d, %d) = %f instead of %f\n",
+                           x, y, im(x, y), reference(x, y));
+                    return -1;
+                }
+            }
+        }
+
+        printf("%4d tasks of %2d rows: %f ms, speedup %f\n",
+               H / rows_per_task, rows_per_task,
+               parallel_time, serial_time / parallel_time);
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <Halide.h>
+#include <stdio.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// A vertical blur over an image much larger than the cache, with
+// each parallel task walking down a strip of rows. Returns the time
+// taken in milliseconds.
+double test(ImageParam in, Image<float> output, int distance) {
+    Func blur;
+    Var x, y, yi;
+    blur(x, y) = (in(x, y) + in(x, y+2) + in(x, y+4) + in(x, y+6)) / 4;
+    blur.split(y, y, yi, 64).parallel(y).vectorize(x, 8);
+    if (distance > 0) {
+        blur.prefetch(yi, distance);
+    }
+    blur.compile_jit();
+    blur.realize(output);
+
+    double t1 = currentTime();
+    for (int i = 0; i < 10; i++) {
+        blur.realize(output);
+    }
+    return currentTime() - t1;
+}
+
+int main(int argc, char **argv) {
+    ImageParam in(Float(32), 2);
+    Image<float> input(4096, 4096 + 6);
+    for (int y = 0; y < input.height(); y++) {
+        for (int x = 0; x < input.width(); x++) {
+            input(x, y) = (float)(rand() & 0xff);
+        }
+    }
+    in.set(input);
+
+    Image<float> output(4096, 4096);
+
+    double t_ref = test(in, output, 0);
+    double t_near = test(in, output, 1);
+    double t_far = test(in, output, 4);
+
+    printf("No prefetching: %f ms\n"
+           "Prefetching one row ahead: %f ms\n"
+           "Prefetching four rows ahead: %f ms\n",
+           t_ref, t_near, t_far);
+
+    // The prefetches are cheap, so they shouldn't cost much even
+    // where the hardware prefetchers already keep up.
+    if (t_near > t_ref * 1.5 || t_far > t_ref * 1.5) {
+        printf("Prefetching made things much slower\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include <Halide.h>
+#include <stdio.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// Scale a buffer much larger than the cache, with regular and with
+// non-temporal stores, and report the bandwidth of each.
+double test(ImageParam src, Image<float> output, bool stream) {
+    Func dst;
+    Var x, xo;
+    dst(x) = src(x) * 2.0f;
+    dst.split(x, xo, x, 8*4096);
+    dst.vectorize(x, 16);
+    if (stream) {
+        dst.stream_stores();
+    }
+    dst.compile_jit();
+    dst.realize(output);
+
+    double t1 = currentTime();
+    for (int i = 0; i < 20; i++) {
+        dst.realize(output);
+    }
+    return currentTime() - t1;
+}
+
+int main(int argc, char **argv) {
+    ImageParam src(Float(32), 1);
+
+    const int32_t buffer_size = 16*1024*1024;
+
+    Image<float> input(buffer_size);
+    Image<float> output(buffer_size);
+    for (int i = 0; i < buffer_size; i++) {
+        input(i) = (float)i;
+    }
+    src.set(input);
+
+    double regular = test(src, output, false);
+    double streaming = test(src, output, true);
+
+    // Bytes read plus bytes written.
+    double bytes = 20.0 * buffer_size * sizeof(float) * 2;
+    printf("regular stores: %.3e byte/s\n", bytes / regular * 1000);
+    printf("non-temporal stores: %.3e byte/s\n", bytes / streaming * 1000);
+
+    for (int i = 0; i < buffer_size; i++) {
+        if (output(i) != input(i) * 2.0f) {
+            printf("output(%d) = %f instead of %f\n", i, output(i), input(i) * 2.0f);
+            return -1;
+        }
+    }
+
+    // Skipping the read for ownership of the output should make
+    // things faster, but how much depends on the machine.
+    if (streaming > regular * 1.5) {
+        printf("Non-temporal stores are slower than they should be.\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
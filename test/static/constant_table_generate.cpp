@@ -0,0 +1,34 @@
+#include <Halide.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    ImageParam input(UInt(8), 1);
+
+    // Tables small enough to be looked up in registers (with pshufb
+    // on x86, and vtbl on arm). They're embedded in the object file,
+    // so their contents are known at compile time.
+    Image<uint8_t> lut_u8(16);
+    Image<int16_t> lut_i16(8);
+    Image<int32_t> lut_i32(4);
+    Image<uint8_t> lut_wide(32);
+    for (int i = 0; i < 32; i++) {
+        if (i < 16) lut_u8(i) = (uint8_t)(i * 17 + 3);
+        if (i < 8) lut_i16(i) = (int16_t)(i * 1000 - 4000);
+        if (i < 4) lut_i32(i) = i * 100000 + 7;
+        lut_wide(i) = (uint8_t)(255 - i * 5);
+    }
+
+    Var x;
+    Expr i = cast<int>(input(x));
+    Func f;
+    f(x) = (cast<int>(lut_u8(i % 16)) +
+            cast<int>(lut_i16(i % 8)) +
+            lut_i32(i % 4) +
+            cast<int>(lut_wide(i % 32)));
+    f.vectorize(x, 16);
+
+    f.compile_to_file("constant_table", input);
+    return 0;
+}
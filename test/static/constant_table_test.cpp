@@ -0,0 +1,29 @@
+#include <constant_table.h>
+#include <static_image.h>
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+    Image<uint8_t> input(1000);
+    for (int x = 0; x < 1000; x++) {
+        input(x) = (uint8_t)(x * 37 + x / 11);
+    }
+    Image<int> output(1000);
+
+    constant_table(input, output);
+
+    // The same tables as constant_table_generate.cpp
+    for (int x = 0; x < 1000; x++) {
+        int i = input(x);
+        int correct = ((i % 16) * 17 + 3) & 0xff;
+        correct += (i % 8) * 1000 - 4000;
+        correct += (i % 4) * 100000 + 7;
+        correct += (255 - (i % 32) * 5) & 0xff;
+        if (output(x) != correct) {
+            printf("output(%d) = %d instead of %d\n", x, output(x), correct);
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
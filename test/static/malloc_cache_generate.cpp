@@ -0,0 +1,21 @@
+#include <Halide.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    ImageParam input(Float(32), 2);
+
+    Var x, y;
+
+    // g is too big for the stack, so it gets allocated with halide_malloc
+    Func g;
+    g(x, y) = input(x, y) * 2;
+    g.compute_root();
+
+    Func f;
+    f(x, y) = g(x, y) + 1;
+
+    f.compile_to_file("malloc_cache", input);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include <malloc_cache.h>
+#include <../../include/HalideRuntime.h>
+#include <static_image.h>
+#include <stdio.h>
+#include <assert.h>
+
+int main(int argc, char **argv) {
+    Image<float> input(1024, 1024);
+    for (int y = 0; y < 1024; y++) {
+        for (int x = 0; x < 1024; x++) {
+            input(x, y) = x + y;
+        }
+    }
+    Image<float> output(1024, 1024);
+
+    halide_set_malloc_cache_size(64 << 20);
+
+    for (int i = 0; i < 10; i++) {
+        malloc_cache(input, output);
+    }
+
+    for (int y = 0; y < 1024; y++) {
+        for (int x = 0; x < 1024; x++) {
+            if (output(x, y) != (x + y) * 2 + 1) {
+                printf("output(%d, %d) = %f instead of %f\n",
+                       x, y, output(x, y), (x + y) * 2.0f + 1);
+                return -1;
+            }
+        }
+    }
+
+    // The first run misses, and the rest should reuse its buffer.
+    halide_malloc_cache_stats_t stats;
+    halide_get_malloc_cache_stats(&stats);
+    if (stats.misses != 1 || stats.hits != 9) {
+        printf("Expected 9 hits and 1 miss, got %d hits and %d misses\n",
+               (int)stats.hits, (int)stats.misses);
+        return -1;
+    }
+    if (stats.cached_bytes == 0) {
+        printf("The cache should be holding onto the buffer\n");
+        return -1;
+    }
+
+    halide_malloc_cache_trim();
+    halide_get_malloc_cache_stats(&stats);
+    if (stats.cached_bytes != 0) {
+        printf("Trimming should have emptied the cache\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
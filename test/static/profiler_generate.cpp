@@ -0,0 +1,29 @@
+#include <Halide.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    ImageParam input(Float(32), 2);
+
+    Var x, y;
+
+    // expensive does about fifty times as much work as cheap.
+    Func cheap("cheap");
+    cheap(x, y) = input(x, y) + 1;
+    cheap.compute_root().parallel(y);
+
+    RDom r(0, 50);
+    Func expensive("expensive");
+    expensive(x, y) = sum(sqrt(cheap(x, y) + r));
+    expensive.compute_root().parallel(y);
+
+    Func out("out");
+    out(x, y) = expensive(x, y) * 2;
+    out.parallel(y);
+
+    Target target = get_target_from_environment();
+    target.features |= Target::Profile;
+    out.compile_to_file("profiler", input, target);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <profiler.h>
+#include <../../include/HalideRuntime.h>
+#include <static_image.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+int main(int argc, char **argv) {
+    Image<float> input(512, 512);
+    for (int y = 0; y < 512; y++) {
+        for (int x = 0; x < 512; x++) {
+            input(x, y) = x + y;
+        }
+    }
+    Image<float> output(512, 512);
+
+    // Run the pipeline until the sampler has had a good look at it.
+    halide_profiler_func_stats_t stats[16];
+    int num_funcs = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < 10000 && total < 500; i++) {
+        profiler(input, output);
+        num_funcs = halide_profiler_get_stats("profiler", stats, 16);
+        total = 0;
+        for (int j = 0; j < num_funcs; j++) {
+            total += stats[j].samples;
+        }
+    }
+
+    if (total < 500) {
+        printf("Only %d samples were taken\n", (int)total);
+        return -1;
+    }
+
+    double cheap = -1, expensive = -1, sum = 0;
+    for (int i = 0; i < num_funcs; i++) {
+        printf("%s: %llu samples (%f)\n", stats[i].name,
+               (unsigned long long)stats[i].samples, stats[i].fraction);
+        if (strcmp(stats[i].name, "cheap") == 0) {
+            cheap = stats[i].fraction;
+        } else if (strcmp(stats[i].name, "expensive") == 0) {
+            expensive = stats[i].fraction;
+        }
+        sum += stats[i].fraction;
+    }
+
+    if (cheap < 0 || expensive < 0) {
+        printf("Missing stats for cheap or expensive\n");
+        return -1;
+    }
+
+    if (sum < 0.99 || sum > 1.01) {
+        printf("Fractions add up to %f\n", sum);
+        return -1;
+    }
+
+    if (expensive < 0.5 || expensive < cheap * 4) {
+        printf("expensive should have taken most of the time\n");
+        return -1;
+    }
+
+    halide_profiler_reset();
+    num_funcs = halide_profiler_get_stats("profiler", stats, 16);
+    for (int i = 0; i < num_funcs; i++) {
+        assert(stats[i].samples == 0);
+    }
+
+    halide_profiler_shutdown();
+
+    printf("Success!\n");
+    return 0;
+}
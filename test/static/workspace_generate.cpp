@@ -0,0 +1,31 @@
+#include <Halide.h>
+#include <stdio.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    ImageParam input(Float(32), 2);
+
+    Var x, y, yo, yi;
+
+    // h is computed per task of g's parallel loop, and f per row of
+    // g. Their sizes depend on the size of the output, so they would
+    // otherwise be allocated with halide_malloc over and over.
+    Func h;
+    h(x, y) = input(x, y) * 2;
+
+    Func f;
+    f(x, y) = h(x, y) + h(x+1, y);
+
+    Func g;
+    g(x, y) = f(x, y) + 1;
+
+    g.split(y, yo, yi, 8).parallel(yo);
+    f.compute_at(g, yi);
+    h.compute_at(g, yo);
+
+    Target target = get_target_from_environment();
+    target.features |= Target::Workspace;
+    g.compile_to_file("workspace", input, target);
+    return 0;
+}
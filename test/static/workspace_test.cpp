@@ -0,0 +1,82 @@
+#include <workspace.h>
+#include <../../include/HalideRuntime.h>
+#include <static_image.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+static int mallocs = 0;
+
+extern "C" void *halide_malloc(void *context, size_t sz) {
+    __sync_fetch_and_add(&mallocs, 1);
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, 32, sz)) return NULL;
+    return ptr;
+}
+
+extern "C" void halide_free(void *context, void *ptr) {
+    free(ptr);
+}
+
+int check(const Image<float> &output) {
+    for (int y = 0; y < output.height(); y++) {
+        for (int x = 0; x < output.width(); x++) {
+            float correct = (x + y) * 2 + (x + 1 + y) * 2 + 1;
+            if (output(x, y) != correct) {
+                printf("output(%d, %d) = %f instead of %f\n",
+                       x, y, output(x, y), correct);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    Image<float> input(1025, 1024);
+    for (int y = 0; y < 1024; y++) {
+        for (int x = 0; x < 1025; x++) {
+            input(x, y) = x + y;
+        }
+    }
+    Image<float> output(1024, 1024);
+
+    int64_t size = workspace_workspace_size(input, output);
+    // There's at least one row of f and eight rows of h per task.
+    if (size < 1024 * 9 * (int64_t)sizeof(float)) {
+        printf("Workspace size %lld is too small\n", (long long)size);
+        return -1;
+    }
+
+    // Without a workspace supplied, each call allocates it once.
+    for (int i = 0; i < 10; i++) {
+        workspace(input, output);
+    }
+    if (check(output)) return -1;
+    if (mallocs != 10) {
+        printf("Expected 10 calls to halide_malloc, got %d\n", mallocs);
+        return -1;
+    }
+
+    // With one supplied, nothing is allocated.
+    void *block = halide_malloc(NULL, size);
+    if (block == NULL) {
+        printf("Couldn't allocate a workspace of %lld bytes\n", (long long)size);
+        return -1;
+    }
+    mallocs = 0;
+    halide_set_workspace(NULL, block, size);
+    for (int i = 0; i < 10; i++) {
+        workspace(input, output);
+    }
+    halide_set_workspace(NULL, NULL, 0);
+    halide_free(NULL, block);
+    if (check(output)) return -1;
+    if (mallocs != 0) {
+        printf("Expected no calls to halide_malloc, got %d\n", mallocs);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
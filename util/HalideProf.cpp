@@ -49,6 +49,28 @@ namespace {
   typedef std::map<std::string, OpInfo> OpInfoMap;
   typedef std::map<std::string, OpInfoMap> FuncInfoMap;
 
+  // Output of the sampling profiler (see halide_profiler_report)
+  struct SampleInfo {
+    std::string func_name;
+    // number of samples taken while in this func
+    int64_t samples;
+    // number of samples taken in the whole pipeline
+    int64_t total;
+    // microseconds between samples
+    int64_t interval_us;
+    // number of times the pipeline ran
+    int64_t runs;
+
+    SampleInfo()
+      : samples(0),
+        total(0),
+        interval_us(0),
+        runs(0) {}
+  };
+
+  // Keyed by pipeline name, then by func name
+  typedef std::map<std::string, std::map<std::string, SampleInfo> > PipelineSampleMap;
+
   std::string qualified_name(const std::string& op_type, const std::string& op_name) {
     // Arbitrary, just join type + name
     return op_type + ":" + op_name;
@@ -80,7 +102,7 @@ namespace {
     return std::string();
   }
 
-  void ProcessLine(const std::string& s, FuncInfoMap& info) {
+  void ProcessLine(const std::string& s, FuncInfoMap& info, PipelineSampleMap& samples) {
     std::vector<std::string> v = Split(s, ' ');
     if (v.size() < 8) {
       return;
@@ -98,6 +120,18 @@ namespace {
     if (first < 0) {
       return;
     }
+    if (v[first + 1] == "samples") {
+      if ((int)v.size() < first + 8) {
+        return;
+      }
+      SampleInfo& sample_info = samples[v[first + 2]][v[first + 3]];
+      sample_info.func_name = v[first + 3];
+      std::istringstream(v[first + 4]) >> sample_info.samples;
+      std::istringstream(v[first + 5]) >> sample_info.total;
+      std::istringstream(v[first + 6]) >> sample_info.interval_us;
+      std::istringstream(v[first + 7]) >> sample_info.runs;
+      return;
+    }
     const std::string& metric = v[first + 1];
     const std::string& func_name = v[first + 2];
     const std::string& op_type = v[first + 3];
@@ -205,6 +239,8 @@ namespace {
     return v;
   }
 
+  bool by_samples(const SampleInfo& a, const SampleInfo& b) { return a.samples < b.samples; }
+
   bool by_count(const OpInfo& a, const OpInfo& b) { return a.count < b.count; }
   bool by_ticks(const OpInfo& a, const OpInfo& b) { return a.ticks < b.ticks; }
   bool by_ticks_only(const OpInfo& a, const OpInfo& b) { return a.ticks_only < b.ticks_only; }
@@ -215,6 +251,8 @@ int main(int argc, char** argv) {
 
   if (HasOpt(argv, argv + argc, "-h")) {
     printf("HalideProf [-f funcname] [-sort c|t|to] [-top N] [-overhead=0|1] < profiledata\n");
+    printf("Also reads the output of the sampling profiler, in which case -f\n"
+           "filters by pipeline name and -sort is ignored.\n");
     return 0;
   }
 
@@ -249,9 +287,48 @@ int main(int argc, char** argv) {
   }
 
   FuncInfoMap func_info_map;
+  PipelineSampleMap pipeline_sample_map;
   std::string line;
   while (std::getline(std::cin, line)) {
-    ProcessLine(line, func_info_map);
+    ProcessLine(line, func_info_map, pipeline_sample_map);
+  }
+
+  for (PipelineSampleMap::iterator p = pipeline_sample_map.begin(); p != pipeline_sample_map.end(); ++p) {
+    const std::string& pipeline_name = p->first;
+    if (!func_name_filter.empty() && func_name_filter != pipeline_name) {
+      continue;
+    }
+    std::vector<SampleInfo> sample_info;
+    for (std::map<std::string, SampleInfo>::const_iterator s = p->second.begin(); s != p->second.end(); ++s) {
+      sample_info.push_back(s->second);
+    }
+    std::sort(sample_info.rbegin(), sample_info.rend(), by_samples);
+    const SampleInfo& first = sample_info[0];
+    std::cout << "Pipeline: " << pipeline_name << " (sampled, "
+              << first.runs << " runs, "
+              << first.total << " samples every " << first.interval_us << " usec)\n";
+    std::cout << "--------------------------\n";
+    std::cout
+      << std::setw(40) << std::left << "func_name"
+      << std::setw(16) << std::right << "samples"
+      << std::setw(12) << "msec"
+      << std::setw(8) << std::fixed << "%"
+      << "\n";
+    int32_t n = top_n;
+    for (std::vector<SampleInfo>::const_iterator s = sample_info.begin(); s != sample_info.end(); ++s) {
+      // Each sample stands for one interval of time on one thread.
+      double msec = s->samples * s->interval_us / 1000.0;
+      double percent = s->total ? (100.0 * s->samples) / s->total : 0.0;
+      std::cout
+        << std::setw(40) << std::left << s->func_name
+        << std::setw(16) << std::right << s->samples
+        << std::setw(12) << std::setprecision(2) << std::fixed << msec
+        << std::setw(8) << std::setprecision(2) << std::fixed << percent
+        << "\n";
+      if (--n <= 0) {
+        break;
+      }
+    }
   }
 
   for (FuncInfoMap::iterator f = func_info_map.begin(); f != func_info_map.end(); ++f) {
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <map>
 #include <vector>
 #include <string>
@@ -14,37 +15,132 @@ using std::vector;
 
 typedef uint32_t Id;
 
+// The version of the trace format written by src/runtime/tracing.cpp
+// that we understand. See there for a description of the format.
+const int trace_version = 1;
+
 struct Packet {
     Id id, parent;
     uint8_t event, type, bits, width, value_idx, num_int_args;
-    char name[17];
-    uint8_t payload[4096-32]; // Not all of this will be used, but this is the max possible size.
+    string name;
+    vector<uint8_t> value;
+    vector<int> int_args;
 
     size_t value_bytes() const {
         size_t bytes_per_elem = 1;
         while (bytes_per_elem*8 < bits) bytes_per_elem <<= 1;
         return bytes_per_elem * width;
     }
+};
+
+// Reads packets from the blocks of a trace on stdin.
+class TraceReader {
+    vector<uint8_t> block;
+    size_t pos;
+    // The function names seen so far in the current block.
+    vector<string> names;
+
+public:
+    TraceReader() : pos(0) {}
+
+    // Grab a packet from stdin. Returns false when stdin closes.
+    bool next(Packet &p) {
+        while (pos == block.size()) {
+            if (!next_block()) return false;
+        }
+
+        p.event = byte();
+        p.type = byte();
+        p.bits = byte();
+        p.id = varint();
+        p.parent = varint();
+        p.width = varint();
+        p.value_idx = varint();
+        p.num_int_args = varint();
+
+        uint32_t name_code = varint();
+        if (name_code & 1) {
+            uint32_t len = varint();
+            assert(pos + len <= block.size() && "Unexpected end of block");
+            names.push_back(string((const char *)&block[pos], len));
+            pos += len;
+        }
+        assert((name_code >> 1) < names.size() && "Bad function name in packet");
+        p.name = names[name_code >> 1];
+
+        size_t value_bytes = p.value_bytes();
+        assert(pos + value_bytes <= block.size() && "Unexpected end of block");
+        p.value.assign(block.begin() + pos, block.begin() + pos + value_bytes);
+        pos += value_bytes;
+
+        p.int_args.resize(p.num_int_args);
+        for (int i = 0; i < p.num_int_args; i++) {
+            uint32_t x = varint();
+            p.int_args[i] = (int)((x >> 1) ^ (-(int32_t)(x & 1)));
+        }
+        return true;
+    }
 
-    size_t int_args_bytes() const {
-        return sizeof(int) * num_int_args;
+private:
+    uint8_t byte() {
+        assert(pos < block.size() && "Unexpected end of block");
+        return block[pos++];
     }
 
-    size_t payload_bytes() const {
-        return value_bytes() + int_args_bytes();
+    uint32_t varint() {
+        uint32_t result = 0;
+        for (int shift = 0; ; shift += 7) {
+            uint8_t b = byte();
+            result |= (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) break;
+        }
+        return result;
     }
 
-    // Grab a packet from stdin. Returns false when stdin closes.
-    bool read_from_stdin() {
-        if (!read_stdin(this, 32)) {
+    // Read the next block, skipping over any headers. Returns false
+    // at the end of the trace.
+    bool next_block() {
+        uint8_t tag;
+        if (!read_stdin(&tag, 1)) {
             return false;
         }
-        assert(read_stdin(payload, payload_bytes()) &&
-               "Unexpected EOF mid-packet");
+        if (tag == 'H') {
+            // Every time the runtime opens the trace file, it writes
+            // a header, so these can appear between any two blocks.
+            uint8_t header[3];
+            if (!read_stdin(header, 3)) {
+                fprintf(stderr, "Unexpected EOF mid-header\n");
+                exit(-1);
+            }
+            assert(header[0] == 'L' && header[1] == 'T' && "Not a Halide trace");
+            if (header[2] != trace_version) {
+                fprintf(stderr, "Trace has version %d. Expected version %d\n",
+                        header[2], trace_version);
+                exit(-1);
+            }
+            block.clear();
+        } else {
+            assert(tag == 'B' && "Corrupt trace");
+            uint8_t size_bytes[4];
+            if (!read_stdin(size_bytes, 4)) {
+                fprintf(stderr, "Unexpected EOF mid-block\n");
+                exit(-1);
+            }
+            uint32_t size = 0;
+            for (int i = 0; i < 4; i++) {
+                size |= (uint32_t)size_bytes[i] << (i*8);
+            }
+            block.resize(size);
+            if (!read_stdin(&block[0], size)) {
+                fprintf(stderr, "Unexpected EOF mid-block\n");
+                exit(-1);
+            }
+        }
+        pos = 0;
+        names.clear();
         return true;
     }
 
-private:
     bool read_stdin(void *d, ssize_t size) {
         uint8_t *dst = (uint8_t *)d;
         if (!size) return true;
@@ -317,19 +413,14 @@ struct FuncStats {
 
 
 int main(int argc, char **argv) {
-    assert(sizeof(Packet) == 4096);
-
     map<string, FuncStats> funcs;
 
     Count clock;
 
-    while (1) {
-        Packet p;
-        if (!p.read_from_stdin()) {
-            break;
-        }
-
-        //printf("Packet header: %u %u %d %d %d %d %d %d %s\n", p.id, p.parent, p.event, p.type, p.bits, p.width, p.value_idx, p.num_int_args, p.name);
+    TraceReader reader;
+    Packet p;
+    while (reader.next(p)) {
+        //printf("Packet header: %u %u %d %d %d %d %d %d %s\n", p.id, p.parent, p.event, p.type, p.bits, p.width, p.value_idx, p.num_int_args, p.name.c_str());
 
         FuncStats &f = funcs[p.name];
 